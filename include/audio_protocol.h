@@ -0,0 +1,64 @@
+#ifndef AUDIO_PROTOCOL_H
+#define AUDIO_PROTOCOL_H
+
+#include "config.h"
+
+// ============================================================================
+// AUDIO STREAM
+// ============================================================================
+//
+// With audio input enabled the master broadcasts one AUDIO packet per
+// analysis block (~60 Hz, src/master/audio.h). Nothing is acknowledged or
+// repeated: a lost packet is replaced 16 ms later. beatCount increases by
+// one per detected beat, so a panel that missed the packet carrying the
+// beat still sees it on the next one.
+
+#define AUDIO_BANDS 4          // bass, low mid, high mid, treble
+#define AUDIO_STALE_MS 200     // panels stop modulating after this silence
+#define AUDIO_BEAT_HOLD_MS 60  // full brightness kick after a beat
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_AUDIO
+  uint8_t seq;
+  uint8_t intensity; // envelope, 0-255
+  uint8_t depth;     // how far panels dim on silence, 0 = not at all
+  uint8_t beatCount;
+  uint8_t bands[AUDIO_BANDS];
+} AudioPacket;
+
+// Panel side. The receive callback stores the latest packet; loop() asks
+// for a gain to scale the rendered frame by.
+class AudioFollower {
+public:
+  void onPacket(const AudioPacket &pkt, uint32_t now) {
+    intensity = pkt.intensity;
+    depth = pkt.depth;
+    if (pkt.beatCount != beatCount) {
+      beatCount = pkt.beatCount;
+      beatAt = now;
+    }
+    receivedAt = now;
+    seen = true;
+  }
+
+  bool active(uint32_t now) const {
+    return seen && now - receivedAt < AUDIO_STALE_MS;
+  }
+
+  // 255 = leave the frame alone
+  uint8_t gain(uint32_t now) const {
+    if (!active(now) || now - beatAt < AUDIO_BEAT_HOLD_MS)
+      return 255;
+    return 255 - depth + depth * intensity / 255;
+  }
+
+private:
+  volatile uint8_t intensity = 0;
+  volatile uint8_t depth = 0;
+  volatile uint8_t beatCount = 0;
+  volatile uint32_t beatAt = 0;
+  volatile uint32_t receivedAt = 0;
+  volatile bool seen = false;
+};
+
+#endif
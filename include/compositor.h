@@ -0,0 +1,236 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include "config.h"
+#include "effects.h"
+
+// ============================================================================
+// LAYER COMPOSITOR
+// ============================================================================
+//
+// Stacks up to MAX_LAYERS effect engines on one panel. Layer 0 is the base
+// look and behaves exactly like a lone EffectEngine: every command without a
+// layer lands there. Layers 1.. are overlays, each with its own effect,
+// regions, parameters, blend mode and mix, drawn over the layers below in
+// index order. An overlay only touches the regions it was given.
+//
+//   blend      result where the overlay covers a region
+//   max        the brighter of the two
+//   add        sum, clamped to 255
+//   multiply   below * overlay / 255 (the overlay acts as a mask)
+//   crossfade  the overlay's level
+//
+// mix then fades between the level below (0) and that result (255).
+//
+// A command to a layer with blend = BLEND_REMOVE drops that overlay;
+// sent to layer 0 it drops every overlay and leaves the base alone.
+//
+// Transitions: a command that changes the look - a new base effect type,
+// or an overlay added or removed - crossfades from the last rendered frame
+// to the new output over its transitionMs, eased by its curve. Without it,
+// effects that start from zero (a breath, a wave) would drop every region
+// to black first. A command that keeps the effect type but changes what a
+// layer draws (brightness, speed, beats, regions, blend, mix) crossfades
+// too when it carries a transitionMs; with 0 it cuts, and a repeat of the
+// same command changes nothing. A transition interrupted by another starts
+// from wherever the first had got to.
+//
+// render() is one pass over the regions with each active layer's clock
+// advanced once, so a frame costs O(regions x active layers) with no
+// allocation; `render --bench` prints the figures. apply() only records
+// where the transition starts, so nothing stalls when a command lands.
+
+#define MAX_LAYERS 4
+
+class Compositor {
+public:
+  void begin(const RegionInfo *layout, uint8_t count) {
+    for (uint8_t l = 0; l < MAX_LAYERS; l++) {
+      layers[l].begin(layout, count);
+      covers[l] = 0;
+      blend[l] = BLEND_MAX;
+      mix[l] = 255;
+    }
+    overlays = 0;
+    transitionMs = 0;
+    memset(shown, 0, sizeof(shown));
+  }
+
+  const EffectEngine &base() const { return layers[0]; }
+
+  // Including the base
+  uint8_t activeLayers() const {
+    return 1 + __builtin_popcount(overlays);
+  }
+
+  bool transitioning() const { return transitionMs != 0; }
+
+  uint32_t programFaults() const {
+    uint32_t total = 0;
+    for (uint8_t l = 0; l < MAX_LAYERS; l++) {
+      total += layers[l].programFaults();
+    }
+    return total;
+  }
+
+  // Returns true if the base layer's effect type changed
+  bool apply(const LightCommand &cmd, uint32_t now) {
+    uint8_t l = cmd.layer;
+    if (l >= MAX_LAYERS) {
+      return false;
+    }
+    if (cmd.blend == BLEND_REMOVE) {
+      uint8_t remaining = overlays & (l == 0 ? 0 : ~(1U << l));
+      if (remaining != overlays) {
+        startTransition(cmd, now);
+      }
+      overlays = remaining;
+      return false;
+    }
+    if (l == 0) {
+      LightCommand was = layers[0].state;
+      bool changed = layers[0].apply(cmd, now);
+      if (changed ||
+          (cmd.transitionMs && changesLook(was, layers[0].state))) {
+        startTransition(cmd, now);
+      }
+      return changed;
+    }
+
+    // A new overlay fades in from dark, not from whatever it last showed
+    bool added = !(overlays & (1U << l));
+    if (added) {
+      layers[l].clear();
+      overlays |= 1U << l;
+      startTransition(cmd, now);
+    }
+    LightCommand was = layers[l].state;
+    bool restyled = blend[l] != cmd.blend || mix[l] != cmd.mix;
+    layers[l].apply(cmd, now);
+    if (!added && cmd.transitionMs &&
+        (restyled || changesLook(was, layers[l].state))) {
+      startTransition(cmd, now);
+    }
+    blend[l] = cmd.blend;
+    mix[l] = cmd.mix;
+    covers[l] = 0;
+    for (uint8_t r = 0; r < layers[l].regions(); r++) {
+      if (layers[l].regionActive(r)) {
+        covers[l] |= 1U << r;
+      }
+    }
+    return false;
+  }
+
+  void render(uint32_t now, Framebuffer &fb) {
+    // Active overlays in stacking order, flattened out of the bitmask once
+    uint8_t stack[MAX_LAYERS];
+    uint8_t depth = 0;
+    layers[0].prepare(now);
+    for (uint8_t l = 1; l < MAX_LAYERS; l++) {
+      if (overlays & (1U << l)) {
+        layers[l].prepare(now);
+        stack[depth++] = l;
+      }
+    }
+
+    // Share of the new look in this frame, 255 = done
+    uint8_t toward = 255;
+    if (transitionMs) {
+      uint32_t elapsed = now - transitionStart;
+      if (elapsed >= transitionMs) {
+        transitionMs = 0;
+      } else {
+        toward = ease(transitionCurve, elapsed * 255 / transitionMs);
+      }
+    }
+
+    for (uint8_t r = 0; r < layers[0].regions(); r++) {
+      uint8_t v = layers[0].level(r);
+      for (uint8_t i = 0; i < depth; i++) {
+        uint8_t l = stack[i];
+        if (covers[l] & (1U << r)) {
+          v = blendLevel(blend[l], mix[l], v, layers[l].level(r));
+        }
+      }
+      if (toward != 255) {
+        v = from[r] + ((int16_t)v - from[r]) * toward / 255;
+      }
+      shown[r] = v;
+      fb.set(r, v);
+    }
+  }
+
+  // 0-255 in, 0-255 out; curves meet the line at both ends
+  static uint8_t ease(uint8_t curve, uint8_t t) {
+    uint16_t u = 255 - t;
+    switch (curve) {
+    case CURVE_EASE: // smoothstep, 3t^2 - 2t^3
+      return (uint32_t)t * t * (765 - 2 * t) / 65025;
+    case CURVE_EASE_IN:
+      return t * t / 255;
+    case CURVE_EASE_OUT:
+      return 255 - u * u / 255;
+    default: // CURVE_LINEAR
+      return t;
+    }
+  }
+
+  static uint8_t blendLevel(uint8_t mode, uint8_t amount, uint8_t below,
+                            uint8_t top) {
+    uint8_t mixed;
+    switch (mode) {
+    case BLEND_ADD:
+      mixed = below + top > 255 ? 255 : below + top;
+      break;
+    case BLEND_MULTIPLY:
+      mixed = below * top / 255;
+      break;
+    case BLEND_CROSSFADE:
+      mixed = top;
+      break;
+    default: // BLEND_MAX
+      mixed = below > top ? below : top;
+      break;
+    }
+    return below + ((int16_t)mixed - below) * amount / 255;
+  }
+
+private:
+  // Compares the layer's state before and after apply(), so regions are
+  // the ones left after group resolution
+  static bool changesLook(const LightCommand &was, const LightCommand &now) {
+    return was.effect != now.effect || was.brightness != now.brightness ||
+           was.speed != now.speed || was.beatLength != now.beatLength ||
+           was.regions != now.regions;
+  }
+
+  // The frame the transition starts from is whatever render() last wrote,
+  // so shown[] is kept up to date on every frame.
+  void startTransition(const LightCommand &cmd, uint32_t now) {
+    transitionStart = now;
+    transitionMs = cmd.transitionMs;
+    transitionCurve = cmd.curve;
+    if (transitionMs) {
+      memcpy(from, shown, sizeof(from));
+    }
+  }
+
+  EffectEngine layers[MAX_LAYERS];
+  uint16_t covers[MAX_LAYERS]; // panel regions each overlay touches
+  uint8_t blend[MAX_LAYERS];
+  uint8_t mix[MAX_LAYERS];
+  uint8_t overlays = 0; // bit per active overlay (bit 0 unused)
+
+  // Crossfade in progress (transitionMs 0 = none)
+  uint32_t transitionStart = 0;
+  uint16_t transitionMs = 0;
+  uint8_t transitionCurve = CURVE_LINEAR;
+  uint8_t from[MAX_PANEL_REGIONS];  // last frame before the change
+  uint8_t shown[MAX_PANEL_REGIONS]; // last frame written
+};
+
+static_assert(MAX_LAYERS <= 8, "overlays is a uint8_t bitmask");
+static_assert(MAX_PANEL_REGIONS <= 16, "covers is a uint16_t bitmask");
+
+#endif
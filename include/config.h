@@ -1,6 +1,7 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "region_set.h"
 #include <Arduino.h>
 
 // ============================================================================
@@ -49,28 +50,39 @@
 #define GROUP_VEENA (1 << 6)
 #define GROUP_DANCER (1 << 7)
 #define GROUP_VALLUVAR (1 << 8)
+#define NUM_GROUPS 9
+
+// Names for commands (bit i is GROUP_NAMES[i])
+static const char *const GROUP_NAMES[NUM_GROUPS] = {
+    "SYMBOL", "RAAVANA_HEAD", "RAAVANA", "CONTINENT", "BULL",
+    "BHARATHI", "VEENA", "DANCER", "VALLUVAR"};
 
 // ============================================================================
 // NETWORK CONFIGURATION
 // ============================================================================
 
-// #define ESPNOW_WIFI_CHANNEL 6
+// Channel a panel tries first when it has never heard the master. After
+// that it starts on the last channel it found the master on and scans for
+// it when beacons stop (src/panel/rendezvous.h), so this does not have to
+// match the router.
 #define ESPNOW_WIFI_CHANNEL 1
 
-uint8_t panel1_mac[] = {0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0x01};
-uint8_t panel2_mac[] = {0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0x02};
-uint8_t panel3_mac[] = {0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0x03};
-uint8_t panel4_mac[] = {0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0x04};
+// Panels set AA:AA:AA:AA:AA:<panel ID> so they are easy to spot in sniffer
+// traces; a panel with no ID yet keeps its factory MAC. The master learns
+// them at runtime from ANNOUNCE packets.
 uint8_t broadcast_mac[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
 // ============================================================================
 // PROTOCOL DEFINITIONS
 // ============================================================================
 
-#define MAX_REGIONS 20
+// Addressable global regions. Commands carry a bitset of this capacity;
+// only the bytes up to the highest set bit go over the air.
+#define MAX_REGIONS 512
 
 #define DEFAULT_BRIGHTNESS 128
 #define DEFAULT_SPEED 50
+#define DEFAULT_TRANSITION_MS 300
 
 enum EffectType {
   EFFECT_STATIC = 0,
@@ -78,17 +90,94 @@ enum EffectType {
   EFFECT_WAVE = 2,
   EFFECT_PULSE = 3,
   EFFECT_FADE_IN = 4,
-  EFFECT_FADE_OUT = 5
+  EFFECT_FADE_OUT = 5,
+  EFFECT_PROGRAM = 16 // 16 + slot: uploaded bytecode (effect_vm.h)
+};
+
+// How an overlay layer combines with the layers below it (compositor.h)
+enum BlendMode {
+  BLEND_MAX = 0,
+  BLEND_ADD = 1,
+  BLEND_MULTIPLY = 2,
+  BLEND_CROSSFADE = 3,
+  BLEND_REMOVE = 0xFF // drop the layer (layer 0: drop every overlay)
+};
+
+// Easing of the crossfade into a new look (compositor.h)
+enum TransitionCurve {
+  CURVE_LINEAR = 0,
+  CURVE_EASE = 1, // slow start and end
+  CURVE_EASE_IN = 2,
+  CURVE_EASE_OUT = 3
+};
+
+// Every ESP-NOW payload starts with one of these so receivers can dispatch
+// on data[0] instead of guessing from the length.
+enum PacketType {
+  PKT_LIGHT_COMMAND = 0x01,
+  PKT_LIGHT_ACK = 0x02,
+  PKT_CUE_BEGIN = 0x10,
+  PKT_CUE_CHUNK = 0x11,
+  PKT_CUE_COMMIT = 0x12,
+  PKT_CUE_STATUS = 0x13,
+  PKT_CUE_GO = 0x14,
+  PKT_BEACON = 0x20,
+  PKT_ANNOUNCE = 0x21,
+  PKT_PROGRAM = 0x30,
+  PKT_PROGRAM_STATUS = 0x31,
+  PKT_AUDIO = 0x40,
+  PKT_PRIORITY = 0x50,
+  PKT_SHOW_STATE = 0x60,
+  PKT_RATE_PROBE = 0x70,
+  PKT_FW_OFFER = 0x80,
+  PKT_FW_CHUNK = 0x81,
+  PKT_FW_POLL = 0x82,
+  PKT_FW_COMMIT = 0x83,
+  PKT_FW_STATUS = 0x84,
+  PKT_PROVISION = 0x90,
+  PKT_PROVISION_STATUS = 0x91
 };
 
-typedef struct __attribute__((packed)) {
+// CRC-32 (IEEE, reflected), for payloads checked end to end
+inline uint32_t crc32Ieee(const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= p[i];
+    for (uint8_t b = 0; b < 8; b++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+typedef BitSet<MAX_REGIONS> RegionSet;
+
+// In-memory command. Sent as one or more LightCommandFrames
+// (light_protocol.h); `regions` is always indexed by global region.
+// layer 0 is the base look; blend and mix only apply to overlays.
+// transitionMs/curve shape the crossfade when the command changes the look.
+// beatLength ties the effect's cycle to the tempo clock (tempo.h).
+// The regions lit are `regions`, plus every region tagged with one of the
+// groupInclude groups, minus every region tagged with one of the
+// groupExclude groups. Panels resolve the groups against their own region
+// table (EffectEngine::apply); the master does not expand them.
+typedef struct {
   uint8_t sequence;
   uint8_t effect;
   uint8_t brightness;
   uint8_t speed;
   bool debugMode;
   uint8_t panelId;
-  bool regions[MAX_REGIONS];
+  uint8_t layer;
+  uint8_t blend; // BlendMode
+  uint8_t mix;   // overlay strength, 255 = full
+  uint16_t transitionMs; // 0 = cut
+  uint8_t curve;         // TransitionCurve
+  uint8_t beatLength;    // cycle length in quarter beats; 0 = set by speed
+  uint16_t groupInclude; // GROUP_* mask
+  uint16_t groupExclude;
+  RegionSet regions;
 } LightCommand;
 
 // ============================================================================
@@ -96,7 +185,7 @@ typedef struct __attribute__((packed)) {
 // ============================================================================
 
 struct RegionInfo {
-  uint8_t globalIndex;
+  uint16_t globalIndex;
   uint8_t pin;
   const char *name;
   uint8_t verticalPos;
@@ -104,10 +193,12 @@ struct RegionInfo {
 };
 
 // ============================================================================
-// COMPLETE REGION DEFINITIONS (Master reference)
+// COMPLETE REGION DEFINITIONS (master reference, panel defaults)
 // ============================================================================
 
-const RegionInfo ALL_REGIONS[MAX_REGIONS] PROGMEM = {
+#define STAGE_REGIONS 20
+
+const RegionInfo ALL_REGIONS[STAGE_REGIONS] PROGMEM = {
     {0, PIN_P1_BULL_SYMBOL, "BULL_SYMBOL", 0, GROUP_BULL | GROUP_SYMBOL},
     {1, PIN_P1_BULL_HEAD, "BULL_HEAD", 1, GROUP_BULL},
     {2, PIN_P1_BHARATHI_EYES, "BHARATHI_EYES", 2, GROUP_BHARATHI},
@@ -138,99 +229,31 @@ const RegionInfo ALL_REGIONS[MAX_REGIONS] PROGMEM = {
     {19, PIN_P4_RAAVANA_TORSO, "RAAVANA_TORSO", 3, GROUP_RAAVANA}};
 
 // ============================================================================
-// PANEL-SPECIFIC CONFIGURATIONS (only for panel builds)
+// PANEL LAYOUT (default region maps)
 // ============================================================================
 
-#ifdef PANEL_ID
-
-#if PANEL_ID == 1
-#define NUM_REGIONS 5
-const RegionInfo regionConfig[NUM_REGIONS] PROGMEM = {
-    {0, PIN_P1_BULL_SYMBOL, "BULL_SYMBOL", 0, GROUP_BULL | GROUP_SYMBOL},
-    {1, PIN_P1_BULL_HEAD, "BULL_HEAD", 1, GROUP_BULL},
-    {2, PIN_P1_BHARATHI_EYES, "BHARATHI_EYES", 2, GROUP_BHARATHI},
-    {3, PIN_P1_BHARATHI_SYMBOL, "BHARATHI_SYMBOL", 3,
-     GROUP_BHARATHI | GROUP_SYMBOL},
-    {4, PIN_P1_BHARATHI_CLOTH, "BHARATHI_CLOTH", 4, GROUP_BHARATHI}};
-
-#elif PANEL_ID == 2
-#define NUM_REGIONS 6
-const RegionInfo regionConfig[NUM_REGIONS] PROGMEM = {
-    {5, PIN_P2_CONTINENT_F, "CONTINENT_F", 0, GROUP_CONTINENT},
-    {6, PIN_P2_VEENA_SYMBOL, "VEENA_SYMBOL", 1, GROUP_VEENA | GROUP_SYMBOL},
-    {7, PIN_P2_VEENA_REST, "VEENA_REST", 2, GROUP_VEENA},
-    {8, PIN_P2_DANCER_SYMBOL, "DANCER_SYMBOL", 3, GROUP_DANCER | GROUP_SYMBOL},
-    {9, PIN_P2_DANCER_TOP, "DANCER_TOP", 4, GROUP_DANCER},
-    {10, PIN_P2_DANCER_BOTTOM, "DANCER_BOTTOM", 5, GROUP_DANCER}};
-
-#elif PANEL_ID == 3
-#define NUM_REGIONS 5
-const RegionInfo regionConfig[NUM_REGIONS] PROGMEM = {
-    {11, PIN_P3_CONTINENT_U, "CONTINENT_U", 0, GROUP_CONTINENT},
-    {12, PIN_P3_RAAVANA_HEAD, "RAAVANA_HEAD_P3", 1,
-     GROUP_RAAVANA | GROUP_RAAVANA_HEAD},
-    {13, PIN_P3_VALLUVAR_SYMBOL, "VALLUVAR_SYMBOL", 2,
-     GROUP_VALLUVAR | GROUP_SYMBOL},
-    {14, PIN_P3_VALLUVAR_REST, "VALLUVAR_REST", 3, GROUP_VALLUVAR},
-    {15, PIN_P3_CONTINENT_C, "CONTINENT_C", 4, GROUP_CONTINENT}};
-
-#elif PANEL_ID == 4
-#define NUM_REGIONS 4
-const RegionInfo regionConfig[NUM_REGIONS] PROGMEM = {
-    {16, PIN_P4_RAAVANA_HEAD_SYMBOL, "RAAVANA_HEAD_SYMBOL", 0,
-     GROUP_RAAVANA | GROUP_RAAVANA_HEAD | GROUP_SYMBOL},
-    {17, PIN_P4_RAAVANA_HEAD_REST, "RAAVANA_HEAD_REST", 1,
-     GROUP_RAAVANA | GROUP_RAAVANA_HEAD},
-    {18, PIN_P4_RAAVANA_CORE, "RAAVANA_CORE", 2, GROUP_RAAVANA},
-    {19, PIN_P4_RAAVANA_TORSO, "RAAVANA_TORSO", 3, GROUP_RAAVANA}};
-
-#else
-#error "PANEL_ID must be defined as 1, 2, 3, or 4"
-#endif
-
-inline const char *getRegionName(uint8_t index) {
-  if (index >= NUM_REGIONS)
-    return "INVALID";
-  return (const char *)pgm_read_ptr(&regionConfig[index].name);
-}
-
-inline uint8_t getRegionPin(uint8_t index) {
-  if (index >= NUM_REGIONS)
-    return 0;
-  return pgm_read_byte(&regionConfig[index].pin);
-}
-
-inline uint8_t getRegionVerticalPos(uint8_t index) {
-  if (index >= NUM_REGIONS)
-    return 0xFF;
-  return pgm_read_byte(&regionConfig[index].verticalPos);
-}
-
-inline uint8_t getRegionGlobalIndex(uint8_t index) {
-  if (index >= NUM_REGIONS)
-    return 0xFF;
-  return pgm_read_byte(&regionConfig[index].globalIndex);
-}
+// Each panel's slice of ALL_REGIONS, by panel ID. Panels all run the same
+// image; one provisioned with only an ID takes its regions and pins from
+// here (src/panel/identity.h), one given its own map ignores this.
+struct PanelLayout {
+  uint16_t firstRegion;
+  uint16_t regionCount;
+};
 
-inline uint16_t getRegionGroups(uint8_t index) {
-  if (index >= NUM_REGIONS)
-    return GROUP_NONE;
-  return pgm_read_word(&regionConfig[index].groups);
-}
+#define STAGE_PANELS 4
 
-#endif
+const PanelLayout STAGE_LAYOUT[STAGE_PANELS] PROGMEM = {
+    {0, 5}, {5, 6}, {11, 5}, {16, 4}};
 
 // ============================================================================
 // MASTER SEQUENCE HELPERS (auto-generated from ALL_REGIONS)
 // ============================================================================
 
-#ifndef PANEL_ID
-
 class RegionGroups {
 public:
   static void getByGroup(uint16_t groupMask, uint8_t *buffer, uint8_t &count) {
     count = 0;
-    for (uint8_t i = 0; i < MAX_REGIONS; i++) {
+    for (uint8_t i = 0; i < STAGE_REGIONS; i++) {
       uint16_t groups = pgm_read_word(&ALL_REGIONS[i].groups);
       if (groups & groupMask) {
         buffer[count++] = i;
@@ -240,7 +263,7 @@ public:
 
   static uint8_t getCount(uint16_t groupMask) {
     uint8_t count = 0;
-    for (uint8_t i = 0; i < MAX_REGIONS; i++) {
+    for (uint8_t i = 0; i < STAGE_REGIONS; i++) {
       uint16_t groups = pgm_read_word(&ALL_REGIONS[i].groups);
       if (groups & groupMask) {
         count++;
@@ -248,11 +271,28 @@ public:
     }
     return count;
   }
-};
 
-const uint8_t PANEL_REGION_COUNTS[] = {5, 6, 5, 4};
-const uint8_t PANEL_REGION_OFFSETS[] = {0, 5, 11, 16, 20};
+  static void getMask(uint16_t groupMask, RegionSet &out) {
+    out.clearAll();
+    for (uint8_t i = 0; i < STAGE_REGIONS; i++) {
+      if (pgm_read_word(&ALL_REGIONS[i].groups) & groupMask) {
+        out.set(i);
+      }
+    }
+  }
 
-#endif
+  // The regions `cmd` lights once its groups are resolved, as the panels
+  // do it between them. For code that needs plain regions (cue lists).
+  static void expand(const LightCommand &cmd, RegionSet &out) {
+    out = cmd.regions;
+    if (cmd.groupInclude | cmd.groupExclude) {
+      RegionSet group;
+      getMask(cmd.groupInclude, group);
+      out |= group;
+      getMask(cmd.groupExclude, group);
+      out.subtract(group);
+    }
+  }
+};
 
 #endif
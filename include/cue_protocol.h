@@ -0,0 +1,89 @@
+#ifndef CUE_PROTOCOL_H
+#define CUE_PROTOCOL_H
+
+#include "config.h"
+
+// ============================================================================
+// PANEL-RESIDENT CUE LISTS
+// ============================================================================
+//
+// Upload (ahead of the show, unicast per panel):
+//   CUE_BEGIN  -> CUE_CHUNK x N -> CUE_COMMIT   (master -> panel)
+//   CUE_STATUS                                   (panel -> master)
+//
+// Playback (broadcast, repeated CUE_GO_REPEATS times):
+//   CUE_GO "fire cue N when the master clock reads T"
+//
+// Each panel stores only its own regions. A cue with followMs > 0 advances
+// to the next cue on its own, so a panel keeps running through short radio
+// outages and resyncs on the next GO it hears.
+
+#define MAX_CUES 128
+#define CUES_PER_CHUNK 20
+#define CUE_GO_STOP 0xFFFF   // GO with this cue index stops playback
+#define CUE_GO_LEAD_MS 40    // GOs are sent this far ahead of the cue time
+#define CUE_GO_REPEATS 3
+
+typedef struct __attribute__((packed)) {
+  uint32_t regionMask; // panel-local region bits
+  uint8_t effect;
+  uint8_t brightness;
+  uint8_t speed;
+  uint32_t followMs; // auto-advance after this long; 0 = wait for GO
+} PanelCue;
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_CUE_BEGIN
+  uint8_t panelId;
+  uint16_t showId;
+  uint16_t cueCount;
+} CueBeginPacket;
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_CUE_CHUNK
+  uint8_t panelId;
+  uint16_t showId;
+  uint16_t firstCue;
+  uint8_t count;
+  PanelCue cues[CUES_PER_CHUNK];
+} CueChunkPacket;
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_CUE_COMMIT
+  uint8_t panelId;
+  uint16_t showId;
+  uint16_t cueCount;
+  uint32_t crc;
+} CueCommitPacket;
+
+enum CueStatusCode {
+  CUE_STATUS_STORED = 0,
+  CUE_STATUS_MISSING_CHUNKS = 1,
+  CUE_STATUS_BAD_CRC = 2,
+  CUE_STATUS_FLASH_ERROR = 3
+};
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_CUE_STATUS
+  uint8_t panelId;
+  uint16_t showId;
+  uint16_t cueCount;
+  uint8_t status;
+} CueStatusPacket;
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_CUE_GO
+  uint16_t showId;
+  uint16_t cue;
+  uint32_t masterMs; // master clock when sent
+  uint32_t atMs;     // master clock when the cue fires
+} CueGoPacket;
+
+static_assert(sizeof(CueChunkPacket) <= 250, "chunk exceeds ESP-NOW payload");
+
+// CRC-32 over the packed cue array
+inline uint32_t cueListCrc(const PanelCue *cues, uint16_t count) {
+  return crc32Ieee(cues, count * sizeof(PanelCue));
+}
+
+#endif
@@ -0,0 +1,444 @@
+#ifndef EFFECT_VM_H
+#define EFFECT_VM_H
+
+#include "config.h"
+#include <math.h>
+
+// ============================================================================
+// EFFECT BYTECODE
+// ============================================================================
+//
+// Small stack machine for effects uploaded at runtime (program_protocol.h),
+// so a new look needs no reflash. A program runs once per region per frame
+// and leaves that region's level (clamped to 0-255) on top of the stack.
+// Effect EFFECT_PROGRAM + slot selects it like any built-in effect.
+//
+// Values are int32. Levels and phases use 0-255 as the unit circle, so
+// `scale` (a * b / 255) multiplies two levels and `sin`/`tri` take a phase
+// in their low 8 bits.
+//
+// Inputs:  time (ms since the effect started), region (global index), row
+//          (verticalPos), bright, speed (0-100), stage (region count)
+// Math:    add sub mul div mod scale min max neg abs and or xor shl shr
+//          lt gt eq (1 or 0)  sin tri (phase -> 0-255)
+// Stack:   dup swap drop over   (at most VM_STACK deep)
+// Flow:    jz LABEL (pop, jump if 0), jmp LABEL, end
+//
+// Programs are sandboxed: jumps must land on an instruction (checked on
+// upload), stack and division faults stop the program, and every
+// region gets an equal share of VM_FRAME_BUDGET instructions per frame, so
+// a runaway loop costs one frame's budget and never more. A faulted or
+// exhausted region renders dark for that frame.
+
+#define MAX_PROGRAMS 4
+#define MAX_PROGRAM_BYTES 128
+#define VM_STACK 8
+#define VM_FRAME_BUDGET 2048 // instructions per panel frame, all regions
+
+enum VmOp : uint8_t {
+  OP_END = 0,
+  OP_PUSH8,  // + uint8
+  OP_PUSH16, // + int16, little endian
+  OP_TIME,
+  OP_REGION,
+  OP_ROW,
+  OP_BRIGHT,
+  OP_SPEED,
+  OP_STAGE,
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_MOD,
+  OP_SCALE,
+  OP_MIN,
+  OP_MAX,
+  OP_NEG,
+  OP_ABS,
+  OP_AND,
+  OP_OR,
+  OP_XOR,
+  OP_SHL,
+  OP_SHR,
+  OP_LT,
+  OP_GT,
+  OP_EQ,
+  OP_SIN,
+  OP_TRI,
+  OP_DUP,
+  OP_SWAP,
+  OP_DROP,
+  OP_OVER,
+  OP_JZ,  // + int8 offset from the next instruction
+  OP_JMP, // + int8
+  OP_COUNT
+};
+
+// Indexed by VmOp; nullptr for the push forms, which the assembler picks
+// from the literal's size.
+static const char *const VM_OP_NAMES[OP_COUNT] = {
+    "end", nullptr, nullptr, "time", "region", "row",  "bright", "speed",
+    "stage", "add", "sub",   "mul",  "div",    "mod",  "scale",  "min",
+    "max", "neg",   "abs",   "and",  "or",     "xor",  "shl",    "shr",
+    "lt",  "gt",    "eq",    "sin",  "tri",    "dup",  "swap",   "drop",
+    "over", "jz",   "jmp"};
+
+inline uint8_t vmOperandBytes(uint8_t op) {
+  return op == OP_PUSH8 || op == OP_JZ || op == OP_JMP ? 1
+         : op == OP_PUSH16                             ? 2
+                                                       : 0;
+}
+
+struct VmInputs {
+  int32_t time;
+  uint16_t region; // global index, 0 .. MAX_REGIONS - 1
+  uint8_t row;
+  uint8_t bright;
+  uint8_t speed;
+};
+
+// Raised sine, 0 at phase 0, 255 at phase 128
+inline const uint8_t *vmSineTable() {
+  static uint8_t table[256];
+  static bool built = false;
+  if (!built) {
+    for (uint16_t i = 0; i < 256; i++) {
+      table[i] = (uint8_t)(127.5f - 127.5f * cosf(i * 2 * (float)M_PI / 256));
+    }
+    built = true;
+  }
+  return table;
+}
+
+// Check opcodes, operands and jump targets. Returns -1 if the program is
+// valid, else the offset of the first bad byte.
+inline int vmVerify(const uint8_t *code, uint8_t len) {
+  uint8_t starts[(MAX_PROGRAM_BYTES + 8) / 8] = {};
+  if (len > MAX_PROGRAM_BYTES)
+    return MAX_PROGRAM_BYTES;
+  for (uint8_t pc = 0; pc < len;) {
+    if (code[pc] >= OP_COUNT || pc + 1 + vmOperandBytes(code[pc]) > len)
+      return pc;
+    starts[pc / 8] |= 1 << (pc % 8);
+    pc += 1 + vmOperandBytes(code[pc]);
+  }
+  starts[len / 8] |= 1 << (len % 8); // falling off the end is an `end`
+
+  for (uint8_t pc = 0; pc < len; pc += 1 + vmOperandBytes(code[pc])) {
+    if (code[pc] == OP_JZ || code[pc] == OP_JMP) {
+      int target = pc + 2 + (int8_t)code[pc + 1];
+      if (target < 0 || target > len ||
+          !(starts[target / 8] & (1 << (target % 8))))
+        return pc;
+    }
+  }
+  return -1;
+}
+
+// Run a verified program for one region. `budget` is decremented per
+// instruction. Returns the level, or -1 on a fault or an exhausted budget.
+inline int16_t vmRun(const uint8_t *code, uint8_t len, const VmInputs &in,
+                     uint16_t &budget) {
+  int32_t s[VM_STACK];
+  uint8_t sp = 0;
+  uint8_t pc = 0;
+
+#define VM_NEED(n)                                                             \
+  if (sp < (n))                                                                \
+    return -1;
+#define VM_PUSH(v)                                                             \
+  {                                                                            \
+    int32_t pushed = (v);                                                      \
+    if (sp >= VM_STACK)                                                        \
+      return -1;                                                               \
+    s[sp++] = pushed;                                                          \
+  }
+#define VM_BINARY(expr)                                                        \
+  {                                                                            \
+    VM_NEED(2);                                                                \
+    int32_t b = s[--sp];                                                       \
+    int32_t a = s[sp - 1];                                                     \
+    s[sp - 1] = (expr);                                                        \
+  }                                                                            \
+  break;
+
+  while (pc < len) {
+    if (budget == 0)
+      return -1;
+    budget--;
+
+    uint8_t op = code[pc++];
+    switch (op) {
+    case OP_END:
+      pc = len;
+      break;
+    case OP_PUSH8:
+      VM_PUSH(code[pc]);
+      pc++;
+      break;
+    case OP_PUSH16:
+      VM_PUSH((int16_t)(code[pc] | (code[pc + 1] << 8)));
+      pc += 2;
+      break;
+    case OP_TIME:
+      VM_PUSH(in.time);
+      break;
+    case OP_REGION:
+      VM_PUSH(in.region);
+      break;
+    case OP_ROW:
+      VM_PUSH(in.row);
+      break;
+    case OP_BRIGHT:
+      VM_PUSH(in.bright);
+      break;
+    case OP_SPEED:
+      VM_PUSH(in.speed);
+      break;
+    case OP_STAGE:
+      VM_PUSH(STAGE_REGIONS);
+      break;
+    case OP_ADD:
+      VM_BINARY((int32_t)((uint32_t)a + (uint32_t)b));
+    case OP_SUB:
+      VM_BINARY((int32_t)((uint32_t)a - (uint32_t)b));
+    case OP_MUL:
+      VM_BINARY((int32_t)((uint32_t)a * (uint32_t)b));
+    case OP_DIV:
+    case OP_MOD: {
+      VM_NEED(2);
+      int32_t b = s[--sp];
+      int32_t a = s[sp - 1];
+      if (b == 0 || (a == INT32_MIN && b == -1))
+        return -1;
+      s[sp - 1] = op == OP_DIV ? a / b : a % b;
+      break;
+    }
+    case OP_SCALE:
+      VM_BINARY((int32_t)((int64_t)a * b / 255));
+    case OP_MIN:
+      VM_BINARY(a < b ? a : b);
+    case OP_MAX:
+      VM_BINARY(a > b ? a : b);
+    case OP_NEG:
+      VM_NEED(1);
+      s[sp - 1] = (int32_t)(0U - (uint32_t)s[sp - 1]);
+      break;
+    case OP_ABS:
+      VM_NEED(1);
+      if (s[sp - 1] < 0)
+        s[sp - 1] = (int32_t)(0U - (uint32_t)s[sp - 1]);
+      break;
+    case OP_AND:
+      VM_BINARY(a & b);
+    case OP_OR:
+      VM_BINARY(a | b);
+    case OP_XOR:
+      VM_BINARY(a ^ b);
+    case OP_SHL:
+      VM_BINARY((int32_t)((uint32_t)a << (b & 31)));
+    case OP_SHR:
+      VM_BINARY(a >> (b & 31));
+    case OP_LT:
+      VM_BINARY(a < b);
+    case OP_GT:
+      VM_BINARY(a > b);
+    case OP_EQ:
+      VM_BINARY(a == b);
+    case OP_SIN:
+      VM_NEED(1);
+      s[sp - 1] = vmSineTable()[s[sp - 1] & 0xFF];
+      break;
+    case OP_TRI: {
+      VM_NEED(1);
+      uint8_t p = s[sp - 1] & 0xFF;
+      s[sp - 1] = (p < 128 ? p : 255 - p) * 255 / 127;
+      break;
+    }
+    case OP_DUP:
+      VM_NEED(1);
+      VM_PUSH(s[sp - 1]);
+      break;
+    case OP_SWAP: {
+      VM_NEED(2);
+      int32_t t = s[sp - 1];
+      s[sp - 1] = s[sp - 2];
+      s[sp - 2] = t;
+      break;
+    }
+    case OP_DROP:
+      VM_NEED(1);
+      sp--;
+      break;
+    case OP_OVER:
+      VM_NEED(2);
+      VM_PUSH(s[sp - 2]);
+      break;
+    case OP_JZ:
+      VM_NEED(1);
+      pc = s[--sp] == 0 ? pc + 1 + (int8_t)code[pc] : pc + 1;
+      break;
+    case OP_JMP:
+      pc = pc + 1 + (int8_t)code[pc];
+      break;
+    default:
+      return -1;
+    }
+  }
+
+#undef VM_NEED
+#undef VM_PUSH
+#undef VM_BINARY
+
+  if (sp == 0)
+    return 0;
+  int32_t v = s[sp - 1];
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// ============================================================================
+// PROGRAM SLOTS
+// ============================================================================
+
+struct EffectProgram {
+  uint8_t length; // 0 = empty slot (renders dark)
+  uint32_t crc;
+  uint8_t code[MAX_PROGRAM_BYTES];
+};
+
+// Shared by every engine on the device. Only the thread that renders may
+// change a slot.
+inline EffectProgram *effectPrograms() {
+  static EffectProgram slots[MAX_PROGRAMS];
+  return slots;
+}
+
+// ============================================================================
+// ASSEMBLER
+// ============================================================================
+//
+// Text to bytecode, for the master (MQTT uploads) and the host tools.
+// Whitespace-separated words: an op name, an integer literal (pushed), a
+// label definition `name:` or a jump `jz name` / `jmp name`. `;` starts a
+// comment that runs to the end of the line.
+//
+//   ; breathing, each row a little behind the one below
+//   time 3 shr  row 8 mul  sub  tri  bright scale
+
+#define VM_MAX_LABELS 8
+#define VM_MAX_WORD 16
+
+// Returns the program length, or -1 with `error` naming the problem.
+inline int vmAssemble(const char *src, uint8_t *out, const char **error) {
+  char labels[VM_MAX_LABELS][VM_MAX_WORD];
+  uint8_t labelAt[VM_MAX_LABELS];
+  uint8_t labelCount = 0;
+
+  // Pass 0 sizes every instruction and records labels; pass 1 emits
+  for (uint8_t pass = 0; pass < 2; pass++) {
+    uint8_t n = 0;
+    const char *p = src;
+    for (;;) {
+      while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == ';') {
+        if (*p == ';') {
+          while (*p && *p != '\n')
+            p++;
+        } else {
+          p++;
+        }
+      }
+      if (!*p)
+        break;
+
+      char word[VM_MAX_WORD];
+      uint8_t w = 0;
+      while (*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r' &&
+             *p != ';') {
+        if (w + 1 >= VM_MAX_WORD) {
+          *error = "word too long";
+          return -1;
+        }
+        word[w++] = *p++;
+      }
+      word[w] = 0;
+
+      if (word[w - 1] == ':') {
+        word[w - 1] = 0;
+        if (pass == 0) {
+          if (labelCount >= VM_MAX_LABELS) {
+            *error = "too many labels";
+            return -1;
+          }
+          strcpy(labels[labelCount], word);
+          labelAt[labelCount++] = n;
+        }
+        continue;
+      }
+
+      char *end;
+      long literal = strtol(word, &end, 0);
+      int op = -1;
+      if (*end == 0) {
+        if (literal < -32768 || literal > 32767) {
+          *error = "literal out of range (-32768..32767)";
+          return -1;
+        }
+        op = literal >= 0 && literal <= 255 ? OP_PUSH8 : OP_PUSH16;
+      } else {
+        for (uint8_t i = 0; i < OP_COUNT; i++) {
+          if (VM_OP_NAMES[i] && !strcmp(word, VM_OP_NAMES[i]))
+            op = i;
+        }
+        if (op < 0) {
+          *error = "unknown word";
+          return -1;
+        }
+      }
+
+      uint8_t size = 1 + vmOperandBytes(op);
+      if (n + size > MAX_PROGRAM_BYTES) {
+        *error = "program too long";
+        return -1;
+      }
+      if (pass == 1) {
+        out[n] = op;
+        if (op == OP_PUSH8) {
+          out[n + 1] = literal;
+        } else if (op == OP_PUSH16) {
+          out[n + 1] = literal & 0xFF;
+          out[n + 2] = (literal >> 8) & 0xFF;
+        }
+      }
+
+      if (op == OP_JZ || op == OP_JMP) {
+        // The label is the next word
+        while (*p == ' ' || *p == '\t')
+          p++;
+        w = 0;
+        while (*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r' &&
+               *p != ';' && w + 1 < VM_MAX_WORD)
+          word[w++] = *p++;
+        word[w] = 0;
+        if (pass == 1) {
+          int target = -1;
+          for (uint8_t i = 0; i < labelCount; i++) {
+            if (!strcmp(word, labels[i]))
+              target = labelAt[i];
+          }
+          int offset = target - (n + size);
+          if (target < 0 || offset < -128 || offset > 127) {
+            *error = target < 0 ? "unknown label" : "jump too far";
+            return -1;
+          }
+          out[n + 1] = (uint8_t)(int8_t)offset;
+        }
+      }
+      n += size;
+    }
+    if (pass == 1)
+      return n;
+  }
+  return -1;
+}
+
+#endif
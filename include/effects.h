@@ -0,0 +1,302 @@
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+#include "config.h"
+#include "effect_vm.h"
+#include "tempo.h"
+
+// ============================================================================
+// EFFECT ENGINE
+// ============================================================================
+//
+// Renders one panel's regions into a Framebuffer. All effect state lives in
+// the engine instead of function statics, and time is passed in, so the
+// same code drives a panel's loop() and the host show renderer (which runs
+// one engine per panel against a simulated clock).
+//
+// Every effect is the same computation per region:
+//
+//   level[r] = lo[r] + (hi[r] - lo[r]) * shape[pos - offset[r]] / 255
+//
+// `pos` is the effect clock for this frame, shared by the whole panel.
+// `offset` is the region's phase lag from its place on the stage, and lo/hi
+// are its endpoints, set when a command arrives. Effects differ only in
+// data (EFFECT_SPECS): the shape table, how fast pos moves and how offsets
+// are derived. A frame is one pass over the regions with no per-effect
+// branches.
+//
+// Cyclic effects keep their phase across commands with the same effect, so
+// a sequence re-sending breathing does not restart the breath. Their phase
+// starts when the effect arrives, which all panels see within one loop, so
+// a stage-wide wave stays one motion across panels. Static and fades
+// restart on every command, fading from what each region shows right now.
+//
+// EFFECT_PROGRAM + slot runs an uploaded program (effect_vm.h) per region
+// instead, within VM_FRAME_BUDGET instructions per frame. Like the cyclic
+// effects, its clock keeps running while the same program is re-sent.
+//
+// A command with beatLength set ties the effect to the tempo clock
+// (tempo.h) instead of `speed`: a cyclic effect's pos is the tempo clock's
+// phase within a cycle of beatLength quarter beats, so every panel runs it
+// in step with the beat and a cycle that fits a bar starts on the downbeat.
+// A fade lasts beatLength quarter beats at the tempo when it starts.
+//
+// render() draws one engine into a framebuffer. The compositor (compositor.h)
+// instead calls prepare() once per frame and reads level() per region, so
+// several engines can be blended in a single pass.
+
+#define MAX_PANEL_REGIONS 16 // one LEDC channel per region
+
+struct Framebuffer {
+  uint8_t level[MAX_PANEL_REGIONS];
+  bool dirty;
+
+  void set(uint8_t region, uint8_t value) {
+    if (region < MAX_PANEL_REGIONS && level[region] != value) {
+      level[region] = value;
+      dirty = true;
+    }
+  }
+};
+
+enum EffectShape : uint8_t {
+  SHAPE_RAMP = 0,     // 0 -> 255
+  SHAPE_TRIANGLE = 1, // 0 -> 255 -> 0
+  SHAPE_BUMP = 2,     // 255 at 0, gone one stage region either side
+  SHAPE_COUNT = 3
+};
+
+struct EffectSpec {
+  uint8_t shape;
+  bool cyclic;      // pos wraps; otherwise it runs 0 -> 255 once and holds
+  bool fromCurrent; // lo = the region's level when the command arrived
+  bool toZero;      // hi = 0 instead of the command's brightness
+  uint8_t rowLag;   // phase lag per verticalPos step, 1/256 of a cycle
+  bool stageWide;   // phase spread over the global index of every region
+  uint32_t slowMs;  // cycle (or fade) length at speed 0
+  uint32_t fastMs;  // ...and at speed 100
+};
+
+// Indexed by EffectType. Lengths match the stepped effects these replaced.
+static const EffectSpec EFFECT_SPECS[] = {
+    /* STATIC    */ {SHAPE_RAMP, false, false, false, 0, false, 0, 0},
+    /* BREATHING */ {SHAPE_TRIANGLE, true, false, false, 8, false, 5100, 510},
+    /* WAVE      */
+    {SHAPE_BUMP, true, false, false, 0, true, 1000UL * STAGE_REGIONS,
+     100UL * STAGE_REGIONS},
+    /* PULSE     */ {SHAPE_TRIANGLE, true, false, false, 0, false, 1560, 260},
+    /* FADE_IN   */ {SHAPE_RAMP, false, true, false, 0, false, 2550, 255},
+    /* FADE_OUT  */ {SHAPE_RAMP, false, true, true, 0, false, 2550, 255}};
+
+#define EFFECT_SPEC_COUNT (sizeof(EFFECT_SPECS) / sizeof(EFFECT_SPECS[0]))
+
+// Shape lookup tables, built once and shared by every engine
+struct EffectShapes {
+  uint8_t table[SHAPE_COUNT][256];
+
+  EffectShapes() {
+    const uint16_t halfWidth = 256 / STAGE_REGIONS;
+    for (uint16_t i = 0; i < 256; i++) {
+      table[SHAPE_RAMP][i] = i;
+      table[SHAPE_TRIANGLE][i] = (i < 128 ? i : 255 - i) * 255 / 127;
+      uint16_t dist = i < 128 ? i : 256 - i;
+      table[SHAPE_BUMP][i] =
+          dist < halfWidth ? 255 - dist * 255 / halfWidth : 0;
+    }
+  }
+};
+
+inline const EffectShapes &effectShapes() {
+  static EffectShapes shapes;
+  return shapes;
+}
+
+class EffectEngine {
+public:
+  LightCommand state = {};
+
+  // `layout` is the panel's slice of a RegionInfo table (the identity's
+  // table on a panel, part of ALL_REGIONS in the renderer).
+  void begin(const RegionInfo *layout, uint8_t count) {
+    regionCount = count < MAX_PANEL_REGIONS ? count : MAX_PANEL_REGIONS;
+    for (uint8_t r = 0; r < regionCount; r++) {
+      globalIndex[r] = pgm_read_word(&layout[r].globalIndex);
+      verticalPos[r] = pgm_read_byte(&layout[r].verticalPos);
+      groups[r] = pgm_read_word(&layout[r].groups);
+    }
+    shapes = &effectShapes();
+    faults = 0;
+    clear();
+  }
+
+  // Back to dark with no command, as after begin()
+  void clear() {
+    for (uint8_t r = 0; r < regionCount; r++) {
+      lo[r] = hi[r] = offset[r] = 0;
+    }
+    state = {};
+    lastEffect = 0xFF;
+    pos = 0;
+    shape = shapes->table[SHAPE_RAMP];
+    program = nullptr;
+  }
+
+  // Regions a program could not finish (fault or budget) since begin()
+  uint32_t programFaults() const { return faults; }
+
+  uint8_t regions() const { return regionCount; }
+
+  bool regionActive(uint8_t region) const {
+    return state.regions.test(globalIndex[region]);
+  }
+
+  // Take a new command. Returns true if the effect type changed. O(regions),
+  // and the only place effect types are told apart.
+  bool apply(const LightCommand &cmd, uint32_t now) {
+    // What each region shows right now, for effects that start from it
+    uint8_t current[MAX_PANEL_REGIONS];
+    prepare(now);
+    for (uint8_t r = 0; r < regionCount; r++) {
+      current[r] = level(r);
+    }
+
+    const EffectSpec &spec = specFor(cmd.effect);
+    bool changed = cmd.effect != lastEffect;
+    state = cmd;
+    lastEffect = cmd.effect;
+
+    // Group-addressed: our own regions' tags decide, exclusion first
+    if (cmd.groupInclude | cmd.groupExclude) {
+      for (uint8_t r = 0; r < regionCount; r++) {
+        if (groups[r] & cmd.groupExclude) {
+          state.regions.clear(globalIndex[r]);
+        } else if (groups[r] & cmd.groupInclude) {
+          state.regions.set(globalIndex[r]);
+        }
+      }
+    }
+
+    uint32_t length =
+        cmd.beatLength
+            ? cmd.beatLength * tempoClock().beatMs() / 4
+            : map(min(cmd.speed, (uint8_t)100), 0, 100, spec.slowMs,
+                  spec.fastMs);
+    if (spec.cyclic) {
+      if (changed) {
+        phase = 0;
+        lastRender = now;
+      }
+      phaseStep = length ? 0xFFFFFFFFUL / length : 0;
+    } else {
+      startMs = now;
+      fadeMs = length;
+    }
+
+    program = nullptr;
+    if (cmd.effect >= EFFECT_PROGRAM &&
+        cmd.effect < EFFECT_PROGRAM + MAX_PROGRAMS) {
+      program = &effectPrograms()[cmd.effect - EFFECT_PROGRAM];
+      if (changed) {
+        programStart = now;
+      }
+    }
+
+    for (uint8_t r = 0; r < regionCount; r++) {
+      uint8_t target = regionActive(r) ? cmd.brightness : 0;
+      lo[r] = spec.fromCurrent && target ? current[r] : 0;
+      hi[r] = spec.toZero ? 0 : target;
+      offset[r] = spec.rowLag * verticalPos[r] +
+                  (spec.stageWide ? globalIndex[r] * 256 / STAGE_REGIONS : 0);
+    }
+    return changed;
+  }
+
+  // Advance the effect clock to `now`; level() then reads this frame
+  void prepare(uint32_t now) {
+    const EffectSpec &spec = specFor(state.effect);
+    if (spec.cyclic && state.beatLength) {
+      // Kept in phase, so dropping beatLength later carries on from here
+      pos = tempoClock().cyclePhase(now, state.beatLength);
+      phase = (uint32_t)pos << 24;
+    } else if (spec.cyclic) {
+      phase += (now - lastRender) * phaseStep;
+      pos = phase >> 24;
+    } else {
+      uint32_t elapsed = now - startMs;
+      pos = elapsed >= fadeMs ? 255 : elapsed * 255 / fadeMs;
+    }
+    lastRender = now;
+    shape = shapes->table[spec.shape];
+    if (program) {
+      programTime = now - programStart;
+      programBudget = regionCount ? VM_FRAME_BUDGET / regionCount : 0;
+    }
+  }
+
+  uint8_t level(uint8_t r) const {
+    if (program) {
+      return runProgram(r);
+    }
+    int16_t span = hi[r] - lo[r];
+    return lo[r] + span * shape[(uint8_t)(pos - offset[r])] / 255;
+  }
+
+  void render(uint32_t now, Framebuffer &fb) {
+    prepare(now);
+    for (uint8_t r = 0; r < regionCount; r++) {
+      fb.set(r, level(r));
+    }
+  }
+
+private:
+  uint8_t regionCount = 0;
+  uint8_t lastEffect = 0xFF;
+  const EffectShapes *shapes = nullptr;
+
+  // This frame, from prepare()
+  uint8_t pos = 0;
+  const uint8_t *shape = nullptr;
+
+  // Uploaded program, when the effect is one
+  const EffectProgram *program = nullptr;
+  uint32_t programStart = 0;
+  int32_t programTime = 0;
+  uint16_t programBudget = 0; // per region
+  mutable uint32_t faults = 0;
+
+  // Effect clock
+  uint32_t phase = 0;     // cyclic: fraction of a cycle, full scale 2^32
+  uint32_t phaseStep = 0; // per millisecond
+  uint32_t lastRender = 0;
+  uint32_t startMs = 0; // one-shot: when the command arrived
+  uint32_t fadeMs = 0;
+
+  // Per-region state, one array per field
+  uint16_t globalIndex[MAX_PANEL_REGIONS];
+  uint8_t verticalPos[MAX_PANEL_REGIONS];
+  uint16_t groups[MAX_PANEL_REGIONS];
+  uint8_t offset[MAX_PANEL_REGIONS];
+  uint8_t lo[MAX_PANEL_REGIONS];
+  uint8_t hi[MAX_PANEL_REGIONS];
+
+  // Regions outside the command stay dark, as with built-in effects
+  uint8_t runProgram(uint8_t r) const {
+    if (hi[r] == 0)
+      return 0;
+    VmInputs in = {programTime, globalIndex[r], verticalPos[r],
+                   state.brightness, state.speed};
+    uint16_t budget = programBudget;
+    int16_t v = vmRun(program->code, program->length, in, budget);
+    if (v < 0) {
+      faults++;
+      return 0;
+    }
+    return v;
+  }
+
+  static const EffectSpec &specFor(uint8_t effect) {
+    return EFFECT_SPECS[effect < EFFECT_SPEC_COUNT ? effect : (uint8_t)EFFECT_STATIC];
+  }
+};
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef FIRMWARE_PROTOCOL_H
+#define FIRMWARE_PROTOCOL_H
+
+#include "config.h"
+
+// ============================================================================
+// PANEL FIRMWARE DISTRIBUTION
+// ============================================================================
+//
+// The master holds one panel image and sends it to every panel at once:
+//
+//   FW_OFFER   image size, SHA-256 and the panels it is for  (broadcast)
+//   FW_CHUNK   one FW_CHUNK_BYTES piece of the image          (broadcast)
+//   FW_POLL    "report your missing chunks from index N"      (unicast)
+//   FW_STATUS  state, chunks held, a window of missing bits   (panel -> master)
+//   FW_COMMIT  verify the hash and boot the new image         (broadcast)
+//
+// The first round broadcasts every chunk. Then the master polls each panel
+// for the chunks it missed and the next round broadcasts the union of
+// them, once, however many panels lost each one. A rollout to N panels
+// therefore takes about as long as to one: only the polls grow with N.
+//
+// Panels write chunks straight into their spare OTA slot and keep the bitmap
+// of chunks held in NVS, so an interrupted rollout (either end rebooting)
+// carries on where it stopped when the same image is offered again. Every
+// packet carries the image ID, the first four bytes of its SHA-256, so a
+// chunk of a different image is never written into this one.
+//
+// A panel only switches its boot partition once the whole slot hashes to
+// the offered SHA-256, then restarts into the new image.
+
+#define FW_CHUNK_BYTES 240
+#define FW_MAX_CHUNKS 8192 // 1.9 MiB, more than an app slot on a 4 MB board
+#define FW_BITMAP_BYTES (FW_MAX_CHUNKS / 8)
+#define FW_WINDOW_CHUNKS 1600 // missing bits per FW_STATUS
+#define FW_SECTOR_BYTES 4096  // flash erase unit
+
+enum FirmwareState : uint8_t {
+  FW_STATE_IDLE = 0,        // nothing offered, or not to this panel
+  FW_STATE_ERASING = 1,     // clearing the slot; chunks not taken yet
+  FW_STATE_RECEIVING = 2,
+  FW_STATE_COMPLETE = 3,    // every chunk held, waiting for COMMIT
+  FW_STATE_VERIFIED = 4,    // hash matched, boot slot switched, restarting
+  FW_STATE_BAD_HASH = 5,    // held chunks dropped; the next offer starts over
+  FW_STATE_FLASH_ERROR = 6,
+  FW_STATE_TOO_LARGE = 7,   // image bigger than the OTA slot
+  FW_STATE_CURRENT = 8,     // already running this image
+  FW_STATE_COUNT = 9
+};
+
+static const char *const FW_STATE_NAMES[FW_STATE_COUNT] = {
+    "idle",     "erasing",     "receiving", "complete", "verified",
+    "bad_hash", "flash_error", "too_large", "current"};
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_FW_OFFER
+  uint32_t imageId;
+  uint32_t size;
+  uint8_t sha256[32];
+  uint32_t panelMask; // bit (id - 1)
+} FwOfferPacket;
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_FW_CHUNK
+  uint32_t imageId;
+  uint16_t index;
+  uint8_t data[FW_CHUNK_BYTES]; // shorter for the last chunk
+} FwChunkPacket;
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_FW_POLL
+  uint32_t imageId;
+  uint8_t panelId;
+  uint16_t window; // first chunk of the window to report
+} FwPollPacket;
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_FW_COMMIT
+  uint32_t imageId;
+  uint32_t panelMask;
+} FwCommitPacket;
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_FW_STATUS
+  uint8_t panelId;
+  uint32_t imageId; // 0 before any offer
+  uint8_t state;    // FirmwareState
+  uint16_t held;    // chunks written so far
+  uint16_t window;
+  uint8_t missing[FW_WINDOW_CHUNKS / 8]; // bit i: chunk window + i
+} FwStatusPacket;
+
+static_assert(sizeof(FwChunkPacket) <= 250, "chunk exceeds ESP-NOW payload");
+static_assert(sizeof(FwStatusPacket) <= 250, "status exceeds ESP-NOW payload");
+
+inline uint16_t fwChunkCount(uint32_t size) {
+  return (size + FW_CHUNK_BYTES - 1) / FW_CHUNK_BYTES;
+}
+
+inline uint16_t fwChunkLength(uint32_t size, uint16_t index) {
+  uint32_t start = (uint32_t)index * FW_CHUNK_BYTES;
+  return start >= size ? 0 : min(size - start, (uint32_t)FW_CHUNK_BYTES);
+}
+
+inline bool fwBit(const uint8_t *bits, uint16_t i) {
+  return bits[i >> 3] & (1 << (i & 7));
+}
+
+inline void fwSetBit(uint8_t *bits, uint16_t i) { bits[i >> 3] |= 1 << (i & 7); }
+
+inline void fwClearBit(uint8_t *bits, uint16_t i) {
+  bits[i >> 3] &= ~(1 << (i & 7));
+}
+
+inline uint32_t fwImageId(const uint8_t *sha256) {
+  return sha256[0] | (uint32_t)sha256[1] << 8 | (uint32_t)sha256[2] << 16 |
+         (uint32_t)sha256[3] << 24;
+}
+
+// SHA-256 (FIPS 180-4), so master, panels and the host simulator check the
+// image the same way
+class Sha256 {
+public:
+  Sha256() { begin(); }
+
+  void begin() {
+    static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                     0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                     0x1f83d9ab, 0x5be0cd19};
+    memcpy(h, init, sizeof(h));
+    length = 0;
+    used = 0;
+  }
+
+  void update(const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    length += len;
+    while (len > 0) {
+      size_t n = min(len, (size_t)(64 - used));
+      memcpy(block + used, p, n);
+      used += n;
+      p += n;
+      len -= n;
+      if (used == 64) {
+        compress();
+        used = 0;
+      }
+    }
+  }
+
+  void finish(uint8_t out[32]) {
+    uint64_t bits = length * 8;
+    uint8_t pad = 0x80;
+    update(&pad, 1);
+    pad = 0;
+    while (used != 56) {
+      update(&pad, 1);
+    }
+    for (int i = 7; i >= 0; i--) {
+      block[56 + 7 - i] = bits >> (i * 8);
+    }
+    compress();
+    for (uint8_t i = 0; i < 8; i++) {
+      out[i * 4] = h[i] >> 24;
+      out[i * 4 + 1] = h[i] >> 16;
+      out[i * 4 + 2] = h[i] >> 8;
+      out[i * 4 + 3] = h[i];
+    }
+  }
+
+private:
+  uint32_t h[8];
+  uint8_t block[64];
+  uint64_t length;
+  uint8_t used;
+
+  static uint32_t rotr(uint32_t x, uint8_t n) { return (x >> n) | (x << (32 - n)); }
+
+  void compress() {
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+        0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+        0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+        0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+        0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t w[64];
+    for (uint8_t i = 0; i < 16; i++) {
+      w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+             (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (uint8_t i = 16; i < 64; i++) {
+      uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5],
+             g = h[6], hh = h[7];
+    for (uint8_t i = 0; i < 64; i++) {
+      uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) +
+                    ((e & f) ^ (~e & g)) + k[i] + w[i];
+      uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) +
+                    ((a & b) ^ (a & c) ^ (b & c));
+      hh = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += hh;
+  }
+};
+
+#endif
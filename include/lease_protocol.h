@@ -0,0 +1,111 @@
+#ifndef LEASE_PROTOCOL_H
+#define LEASE_PROTOCOL_H
+
+#include "config.h"
+#include "link_protocol.h"
+#include "show_journal.h"
+
+// ============================================================================
+// MASTER LEASE: ACTIVE AND STANDBY MASTERS
+// ============================================================================
+//
+// A second master can stand by for the first. Only the master holding the
+// lease talks to the panels, and every beacon it sends renews the lease and
+// carries its term. Alongside each beacon (and shortly after every change
+// of scene) it broadcasts a SHOW_STATE packet with the scene and the
+// sequence player's position. The standby sends nothing: it follows the
+// beacons' tempo clock and priority state and keeps the latest show state.
+// When no beacon has come for LEASE_TIMEOUT_MS it claims the lease with the
+// next term, carries the show on from that state and beacons at once.
+//
+// Panels follow whichever master holds the lease. A beacon from another
+// master takes it over when its lease beats the holder's (leaseBeats()) or
+// the holder has been silent for LEASE_TIMEOUT_MS; everything else from a
+// master that does not hold the lease is dropped. A master that comes back
+// after a failover therefore cannot fight the one that replaced it: its
+// old term loses, and it stands by as soon as it hears the newer one.
+//
+// Worst case from the active master's last beacon to the panels taking
+// commands from the standby is LEASE_TIMEOUT_MS plus one show task sleep.
+
+#define LEASE_TIMEOUT_MS (2 * BEACON_INTERVAL_MS + 500)
+#define SHOW_STATE_MIN_INTERVAL_MS 50 // between changes in a command burst
+#define SHOW_STATE_IDLE 0xFF          // no sequence running
+
+// A newer term wins; on a tie the lower MAC, so two masters that claimed
+// at the same moment settle on the same one the panels do.
+inline bool leaseBeats(uint16_t term, const uint8_t *mac, uint16_t otherTerm,
+                       const uint8_t *otherMac) {
+  int16_t newer = (int16_t)(term - otherTerm);
+  return newer > 0 || (newer == 0 && memcmp(mac, otherMac, 6) < 0);
+}
+
+// What a standby needs to carry the show on. `data` holds the scene (the
+// last base-layer command, as a journal record relative to an empty
+// command) followed by the sequence player's command relative to the scene.
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_SHOW_STATE
+  uint16_t term;
+  uint8_t sequence;   // SHOW_STATE_IDLE when no sequence is running
+  uint8_t step;       // the step the player runs next
+  uint32_t stepDueMs; // until that step, from when this was sent
+  uint8_t sceneLength;
+  uint8_t playerLength;
+  uint8_t data[2 * JOURNAL_MAX_RECORD];
+} ShowStatePacket;
+
+#define SHOW_STATE_HEADER offsetof(ShowStatePacket, data)
+static_assert(sizeof(ShowStatePacket) <= 250,
+              "show state exceeds ESP-NOW payload");
+
+// Which master holds the lease, as far as this device has heard. Panels
+// use it from the receive callback, masters from the show task.
+class MasterLease {
+public:
+  // A beacon from `mac`. False when that master does not hold the lease
+  // and its beacon does not take it over.
+  bool onBeacon(const uint8_t *mac, uint16_t beaconTerm, uint32_t now) {
+    bool other = holding && memcmp(mac, holder, 6) != 0;
+    if (other && (int32_t)(now - lastBeacon) < LEASE_TIMEOUT_MS &&
+        !leaseBeats(beaconTerm, mac, leaseTerm, holder)) {
+      rejected++;
+      return false;
+    }
+    if (!holding || other) {
+      memcpy(holder, mac, 6);
+      changes++;
+    }
+    holding = true;
+    leaseTerm = beaconTerm;
+    lastBeacon = now;
+    return true;
+  }
+
+  // Any other packet a master sends
+  bool accept(const uint8_t *mac) {
+    if (!holding || memcmp(mac, holder, 6) == 0) {
+      return true;
+    }
+    rejected++;
+    return false;
+  }
+
+  // Forget the holder; the next beacon heard takes the lease
+  void reset() { holding = false; }
+
+  bool held() const { return holding; }
+  uint16_t term() const { return leaseTerm; }
+  const uint8_t *holderMac() const { return holder; }
+  uint32_t lastBeaconAt() const { return lastBeacon; }
+
+  volatile uint32_t changes = 0;  // times a different master took over
+  volatile uint32_t rejected = 0; // packets from a master without the lease
+
+private:
+  bool holding = false;
+  uint8_t holder[6] = {};
+  uint16_t leaseTerm = 0;
+  uint32_t lastBeacon = 0;
+};
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef LIGHT_PROTOCOL_H
+#define LIGHT_PROTOCOL_H
+
+#include "config.h"
+
+// ============================================================================
+// LIGHT COMMAND FRAMES
+// ============================================================================
+//
+// A LightCommand goes out as one or more frames. Every frame repeats the
+// scalar fields and carries one slice of the region bitmask:
+//
+//   maskBytes   length of the whole mask, trimmed after the highest set bit
+//   maskOffset  byte offset of this frame's slice
+//
+// Up to LIGHT_FRAME_MASK_BYTES * 8 regions fit in one frame, so the split
+// only happens on very large rigs. A panel only waits for the frames that
+// overlap its own regions; bytes past maskBytes are zero.
+//
+// A group-addressed command (LIGHT_FLAG_GROUPS) has its include and exclude
+// group masks, little-endian, ahead of the slice in every frame. The panels
+// resolve them against their own regions, so a command such as "all of
+// RAAVANA but not the head" needs no region bits at all.
+//
+// A command with LIGHT_FLAG_ACK set is confirmed by every panel it reaches
+// with a LIGHT_ACK once the panel has applied it. The master only asks for
+// that on commands the app gave an id (src/master/acks.h), not on sequence
+// steps or replays.
+
+#define LIGHT_FRAME_HEADER 20
+#define LIGHT_FLAG_ACK 0x01
+#define LIGHT_FLAG_GROUPS 0x02
+#define LIGHT_FRAME_GROUP_BYTES 4
+#define LIGHT_FRAME_MASK_BYTES                                                 \
+  (250 - LIGHT_FRAME_HEADER - LIGHT_FRAME_GROUP_BYTES)
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_LIGHT_COMMAND
+  uint8_t sequence;
+  uint8_t effect;
+  uint8_t brightness;
+  uint8_t speed;
+  uint8_t debugMode;
+  uint8_t panelId;
+  uint8_t commandId; // same for every frame of one command
+  uint8_t layer;
+  uint8_t blend;
+  uint8_t mix;
+  uint16_t transitionMs;
+  uint8_t curve;
+  uint8_t beatLength;
+  uint8_t flags; // LIGHT_FLAG_*
+  uint16_t maskBytes;
+  uint16_t maskOffset;
+  uint8_t payload[LIGHT_FRAME_GROUP_BYTES + LIGHT_FRAME_MASK_BYTES];
+} LightCommandFrame;
+
+static_assert(offsetof(LightCommandFrame, payload) == LIGHT_FRAME_HEADER,
+              "frame header size");
+static_assert(sizeof(LightCommandFrame) <= 250, "frame exceeds ESP-NOW payload");
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_LIGHT_ACK
+  uint8_t panelId;
+  uint8_t commandId;
+} LightAckPacket;
+
+inline uint8_t lightFrameCount(const LightCommand &cmd) {
+  uint16_t bytes = cmd.regions.usedBytes();
+  return bytes == 0 ? 1
+                    : (bytes + LIGHT_FRAME_MASK_BYTES - 1) /
+                          LIGHT_FRAME_MASK_BYTES;
+}
+
+// Fill frame `index` of `cmd`. Returns the number of bytes to send.
+inline uint8_t lightFrameEncode(const LightCommand &cmd, uint8_t commandId,
+                                uint8_t index, LightCommandFrame &frame,
+                                uint8_t flags = 0) {
+  uint16_t total = cmd.regions.usedBytes();
+  uint16_t offset = index * LIGHT_FRAME_MASK_BYTES;
+  uint16_t slice = offset < total ? total - offset : 0;
+  if (slice > LIGHT_FRAME_MASK_BYTES)
+    slice = LIGHT_FRAME_MASK_BYTES;
+
+  frame.type = PKT_LIGHT_COMMAND;
+  frame.sequence = cmd.sequence;
+  frame.effect = cmd.effect;
+  frame.brightness = cmd.brightness;
+  frame.speed = cmd.speed;
+  frame.debugMode = cmd.debugMode;
+  frame.panelId = cmd.panelId;
+  frame.commandId = commandId;
+  frame.layer = cmd.layer;
+  frame.blend = cmd.blend;
+  frame.mix = cmd.mix;
+  frame.transitionMs = cmd.transitionMs;
+  frame.curve = cmd.curve;
+  frame.beatLength = cmd.beatLength;
+  frame.maskBytes = total;
+  frame.maskOffset = offset;
+  uint8_t *mask = frame.payload;
+  if (cmd.groupInclude | cmd.groupExclude) {
+    flags |= LIGHT_FLAG_GROUPS;
+    mask[0] = cmd.groupInclude & 0xFF;
+    mask[1] = cmd.groupInclude >> 8;
+    mask[2] = cmd.groupExclude & 0xFF;
+    mask[3] = cmd.groupExclude >> 8;
+    mask += LIGHT_FRAME_GROUP_BYTES;
+  }
+  frame.flags = flags;
+  cmd.regions.toBytes(mask, offset, slice);
+  return (mask - (uint8_t *)&frame) + slice;
+}
+
+// Receiver side. Collects the frames that cover [firstRegion, firstRegion +
+// regionCount) and reports the command once all of them have arrived.
+class LightFrameAssembler {
+public:
+  LightFrameAssembler() {}
+  LightFrameAssembler(uint16_t firstRegion, uint16_t regionCount) {
+    begin(firstRegion, regionCount);
+  }
+
+  // The regions this receiver drives. regionCount >= 1.
+  void begin(uint16_t firstRegion, uint16_t regionCount) {
+    firstByte = firstRegion / 8;
+    lastByte = (firstRegion + regionCount - 1) / 8;
+    reset();
+  }
+
+  // Returns true when `out` holds a complete command.
+  bool accept(const uint8_t *data, int len, LightCommand &out) {
+    if (len < LIGHT_FRAME_HEADER)
+      return false;
+    const LightCommandFrame &f = *(const LightCommandFrame *)data;
+    const uint8_t *mask = f.payload;
+    uint16_t slice = len - LIGHT_FRAME_HEADER;
+    if (f.flags & LIGHT_FLAG_GROUPS) {
+      if (slice < LIGHT_FRAME_GROUP_BYTES)
+        return false;
+      mask += LIGHT_FRAME_GROUP_BYTES;
+      slice -= LIGHT_FRAME_GROUP_BYTES;
+    }
+    if (f.maskOffset % LIGHT_FRAME_MASK_BYTES != 0 ||
+        f.maskOffset + slice > f.maskBytes)
+      return false;
+
+    if (!started || f.commandId != commandId) {
+      started = true;
+      done = false;
+      commandId = f.commandId;
+      commandFlags = f.flags;
+      cmd.sequence = f.sequence;
+      cmd.effect = f.effect;
+      cmd.brightness = f.brightness;
+      cmd.speed = f.speed;
+      cmd.debugMode = f.debugMode;
+      cmd.panelId = f.panelId;
+      cmd.layer = f.layer;
+      cmd.blend = f.blend;
+      cmd.mix = f.mix;
+      cmd.transitionMs = f.transitionMs;
+      cmd.curve = f.curve;
+      cmd.beatLength = f.beatLength;
+      bool grouped = f.flags & LIGHT_FLAG_GROUPS;
+      cmd.groupInclude = grouped ? f.payload[0] | f.payload[1] << 8 : 0;
+      cmd.groupExclude = grouped ? f.payload[2] | f.payload[3] << 8 : 0;
+      cmd.regions.clearAll();
+      missing = framesCovering(f.maskBytes);
+    }
+    if (done)
+      return false; // repeat of a command we already delivered
+
+    cmd.regions.fromBytes(mask, f.maskOffset, slice);
+    missing &= ~(1UL << (f.maskOffset / LIGHT_FRAME_MASK_BYTES));
+    if (missing)
+      return false;
+
+    done = true;
+    out = cmd;
+    return true;
+  }
+
+  // Forget the last command, e.g. when a different sender takes over and
+  // its command IDs could repeat ours
+  void reset() { started = false; }
+
+  // The command accept() last completed
+  uint8_t lastCommandId() const { return commandId; }
+  bool ackRequested() const { return commandFlags & LIGHT_FLAG_ACK; }
+
+private:
+  uint16_t firstByte = 0;
+  uint16_t lastByte = 0;
+  bool started = false;
+  bool done = false;
+  uint8_t commandId = 0;
+  uint8_t commandFlags = 0;
+  uint32_t missing = 0; // bit per frame index still needed
+  LightCommand cmd = {};
+
+  uint32_t framesCovering(uint16_t maskBytes) const {
+    if (firstByte >= maskBytes)
+      return 0; // all our regions are off
+    uint16_t last = lastByte < maskBytes ? lastByte : maskBytes - 1;
+    uint32_t mask = 0;
+    for (uint16_t i = firstByte / LIGHT_FRAME_MASK_BYTES;
+         i <= last / LIGHT_FRAME_MASK_BYTES && i < 32; i++) {
+      mask |= 1UL << i;
+    }
+    return mask;
+  }
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef LINK_PROTOCOL_H
+#define LINK_PROTOCOL_H
+
+#include "config.h"
+
+// ============================================================================
+// DISCOVERY: MASTER BEACON AND PANEL ANNOUNCE
+// ============================================================================
+//
+// The master broadcasts a BEACON every BEACON_INTERVAL_MS listing which
+// panel IDs it currently knows. A panel broadcasts an ANNOUNCE at boot,
+// whenever a beacon does not list its ID, and every ANNOUNCE_INTERVAL_MS as
+// a keep-alive. The master builds its peer table from announces; nothing
+// about panel MACs or region layout is compiled into the master.
+//
+// The beacon also carries the master's tempo clock (tempo.h): bpm, bar
+// length and the beat position at masterMs. The master sends one at once
+// when the tempo changes instead of waiting for the next interval.
+//
+// `priority` repeats the latched blackout/hold state (priority_protocol.h)
+// for panels that missed the PRIORITY packets themselves, and `term` is the
+// lease the sending master holds (lease_protocol.h).
+
+#define MAX_PANELS 32
+#define BEACON_INTERVAL_MS 1000
+#define ANNOUNCE_INTERVAL_MS 10000
+#define PEER_TIMEOUT_MS (3 * ANNOUNCE_INTERVAL_MS + 5000)
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_BEACON
+  uint8_t channel;
+  uint16_t seq;
+  uint32_t masterMs;
+  uint32_t knownPanels; // bit (id - 1) set for every panel in the table
+  uint16_t bpmX100;
+  uint8_t beatsPerBar;
+  uint32_t beat;         // whole beats since the tempo clock started
+  uint16_t beatFraction; // 1/65536 of a beat
+  uint8_t priority;      // PriorityAction in force
+  uint16_t term;         // lease term of the sending master
+} BeaconPacket;
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_ANNOUNCE
+  uint8_t panelId;
+  uint16_t firstRegion; // global index of the panel's region 0
+  uint8_t regionCount;
+  uint16_t uptimeS;
+} AnnouncePacket;
+
+static_assert(MAX_PANELS <= 32, "knownPanels is a 32-bit mask");
+
+#endif
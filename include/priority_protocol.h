@@ -0,0 +1,120 @@
+#ifndef PRIORITY_PROTOCOL_H
+#define PRIORITY_PROTOCOL_H
+
+#include "config.h"
+
+// ============================================================================
+// PRIORITY LANE: BLACKOUT, HOLD, RELEASE
+// ============================================================================
+//
+// Stage-wide overrides that must not wait behind anything. The master sends
+// the first PRIORITY packet straight from the MQTT callback, past the
+// command queue and its coalescing, then repeats it PRIORITY_REPEATS times
+// from the show task (PRIORITY_REPEAT_MS after the first) and stops any
+// running sequence, replay or cue show. Every beacon carries the current
+// state too, so a panel that missed all the copies, or rebooted, catches up
+// within a beacon interval.
+//
+// On a panel the state is a latch over the output, not a light command:
+//
+//   BLACKOUT  every region dark
+//   HOLD      the output stays frozen on the frame it is showing
+//   RELEASE   back to whatever the layers render now
+//
+// Light commands keep being applied underneath a blackout or hold, so the
+// next look can be set up and revealed with a release. The receive callback
+// wakes loop(), which flushes the change at once instead of on its next
+// frame.
+
+#define PRIORITY_REPEATS 2
+static const uint8_t PRIORITY_REPEAT_MS[PRIORITY_REPEATS] = {10, 30};
+
+// A beacon sent before a priority packet can arrive after it; beacons do
+// not override a packet this recent.
+#define PRIORITY_BEACON_GRACE_MS 1500
+
+enum PriorityAction : uint8_t {
+  PRIORITY_RELEASE = 0,
+  PRIORITY_BLACKOUT = 1,
+  PRIORITY_HOLD = 2
+};
+
+static const char *const PRIORITY_NAMES[] = {"release", "blackout", "hold"};
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_PRIORITY
+  uint8_t action;
+  uint16_t seq; // the same for every copy of one command
+} PriorityPacket;
+
+inline bool parsePriority(const char *name, uint8_t &action) {
+  for (uint8_t i = 0; i < sizeof(PRIORITY_NAMES) / sizeof(*PRIORITY_NAMES);
+       i++) {
+    if (strcmp(name, PRIORITY_NAMES[i]) == 0) {
+      action = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Panel side. Packets arrive on the WiFi task, beacons and the output on
+// loop(); take() hands loop() each change once.
+class PriorityLatch {
+public:
+  // Receive callback. Returns true for the first copy of a command.
+  bool onPacket(const PriorityPacket &pkt, int64_t nowUs) {
+    if (seen && pkt.seq == seq) {
+      return false;
+    }
+    seen = true;
+    seq = pkt.seq;
+    receivedUs = nowUs;
+    packetAt = (uint32_t)(nowUs / 1000);
+    state =
+        pkt.action <= PRIORITY_HOLD ? pkt.action : (uint8_t)PRIORITY_RELEASE;
+    return true;
+  }
+
+  // loop(), from the master's beacon
+  void onBeacon(uint8_t action, uint32_t now) {
+    if (action > PRIORITY_HOLD ||
+        (seen && now - packetAt < PRIORITY_BEACON_GRACE_MS)) {
+      return;
+    }
+    if (action != state) {
+      receivedUs = (int64_t)now * 1000;
+      state = action;
+    }
+  }
+
+  // loop(). True when the state changed since the last call.
+  bool take(uint8_t &action, int64_t &sinceUs) {
+    uint8_t now = state;
+    if (now == applied) {
+      return false;
+    }
+    applied = now;
+    action = now;
+    sinceUs = receivedUs;
+    return true;
+  }
+
+  uint8_t current() const { return applied; }
+
+  // Put back a state kept over a reset, before the first frame
+  void restore(uint8_t action) {
+    state = applied =
+        action <= PRIORITY_HOLD ? action : (uint8_t)PRIORITY_RELEASE;
+  }
+
+private:
+  volatile uint8_t state = PRIORITY_RELEASE;
+  volatile uint16_t seq = 0;
+  volatile bool seen = false;
+  volatile int64_t receivedUs = 0;
+  volatile uint32_t packetAt = 0;
+  uint8_t applied = PRIORITY_RELEASE; // loop() only
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef PROGRAM_PROTOCOL_H
+#define PROGRAM_PROTOCOL_H
+
+#include "config.h"
+#include "effect_vm.h"
+
+// ============================================================================
+// EFFECT PROGRAM UPLOAD
+// ============================================================================
+//
+//   PROGRAM         master -> panel   one slot's bytecode, unicast
+//   PROGRAM_STATUS  panel -> master   stored, or why not
+//
+// A program fits in one frame. The panel checks the CRC and verifies the
+// bytecode (vmVerify) before it stores the slot in NVS and swaps it in, so
+// a bad upload leaves the previous program running.
+
+enum ProgramStatusCode {
+  PROGRAM_STATUS_STORED = 0,
+  PROGRAM_STATUS_BAD_CRC = 1,
+  PROGRAM_STATUS_INVALID = 2, // rejected by vmVerify
+  PROGRAM_STATUS_FLASH_ERROR = 3
+};
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_PROGRAM
+  uint8_t panelId;
+  uint8_t slot;
+  uint8_t length;
+  uint32_t crc; // crc32Ieee over code[0..length)
+  uint8_t code[MAX_PROGRAM_BYTES];
+} ProgramPacket;
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_PROGRAM_STATUS
+  uint8_t panelId;
+  uint8_t slot;
+  uint8_t status;
+  int16_t errorAt; // vmVerify offset when INVALID, else -1
+  uint32_t crc;
+} ProgramStatusPacket;
+
+static_assert(sizeof(ProgramPacket) <= 250, "program exceeds ESP-NOW payload");
+
+#endif
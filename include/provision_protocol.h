@@ -0,0 +1,63 @@
+#ifndef PROVISION_PROTOCOL_H
+#define PROVISION_PROTOCOL_H
+
+#include "config.h"
+
+// ============================================================================
+// PANEL PROVISIONING
+// ============================================================================
+//
+//   PROVISION         master -> all     ID and region map for one panel
+//   PROVISION_STATUS  panel -> master   stored, or why not
+//
+// Every panel runs the same image and keeps its ID and region map in NVS
+// (src/panel/identity.h). PROVISION is broadcast, since a panel with no ID
+// is not a peer yet, and names its target by MAC: the panel's factory MAC
+// (printed at boot, and in the master's log when an unprovisioned panel
+// announces) or the AA:AA:AA:AA:AA:<id> it runs with once provisioned.
+//
+// regionCount 0 means the stage's default map for that ID (STAGE_LAYOUT).
+// Otherwise the panel drives regions firstRegion .. firstRegion + count - 1,
+// all below MAX_REGIONS, with the pins given. A panel stores a new identity
+// and restarts into it; the same identity again is only answered, so
+// repeats are harmless.
+
+#define PROVISION_MAX_REGIONS 16 // one LEDC channel per region
+#define PROVISION_REPEATS 3
+
+enum ProvisionStatusCode {
+  PROVISION_STORED = 0,    // restarting with the new identity
+  PROVISION_UNCHANGED = 1, // already had it
+  PROVISION_INVALID = 2,   // bad ID, region range or pin
+  PROVISION_FLASH_ERROR = 3
+};
+
+static const char *const PROVISION_STATUS_NAMES[] = {"stored", "unchanged",
+                                                     "invalid", "flash_error"};
+
+typedef struct __attribute__((packed)) {
+  uint8_t pin;
+  uint8_t verticalPos;
+  uint16_t groups; // GROUP_* mask
+} ProvisionRegion;
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_PROVISION
+  uint8_t target[6];
+  uint8_t panelId;
+  uint16_t firstRegion;
+  uint8_t regionCount; // 0 = STAGE_LAYOUT for panelId
+  ProvisionRegion regions[PROVISION_MAX_REGIONS]; // regionCount of them sent
+} ProvisionPacket;
+
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_PROVISION_STATUS
+  uint8_t panelId;
+  uint8_t factoryMac[6];
+  uint8_t status;
+} ProvisionStatusPacket;
+
+static_assert(sizeof(ProvisionPacket) <= 250,
+              "provision exceeds ESP-NOW payload");
+
+#endif
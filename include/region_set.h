@@ -0,0 +1,180 @@
+#ifndef REGION_SET_H
+#define REGION_SET_H
+
+#include <stdint.h>
+#include <string.h>
+
+// ============================================================================
+// REGION BITSET
+// ============================================================================
+//
+// Fixed-capacity bitset stored as 32-bit words, bit i of the set at bit
+// (i % 32) of word (i / 32). Whole-set operations work a word at a time and
+// iteration skips empty words, so cost follows the number of words and set
+// bits rather than the capacity. Plain aggregate: `= {}` clears it and it
+// can be copied with memcpy.
+//
+// Byte order for the wire and the journal is little-endian (bit i is bit
+// (i % 8) of byte (i / 8)), independent of the host.
+
+template <uint16_t N> struct BitSet {
+  static const uint16_t CAPACITY = N;
+  static const uint16_t WORDS = (N + 31) / 32;
+  static const uint16_t BYTES = (N + 7) / 8;
+
+  uint32_t words[WORDS];
+
+  bool test(uint16_t i) const {
+    return i < N && ((words[i >> 5] >> (i & 31)) & 1);
+  }
+
+  void set(uint16_t i) {
+    if (i < N)
+      words[i >> 5] |= 1UL << (i & 31);
+  }
+
+  void clear(uint16_t i) {
+    if (i < N)
+      words[i >> 5] &= ~(1UL << (i & 31));
+  }
+
+  void assign(uint16_t i, bool on) { on ? set(i) : clear(i); }
+
+  void clearAll() { memset(words, 0, sizeof(words)); }
+
+  void setAll() {
+    memset(words, 0xFF, sizeof(words));
+    trimTail();
+  }
+
+  // Set or clear `count` bits starting at `first`, a word at a time
+  void assignRange(uint16_t first, uint16_t count, bool on) {
+    if (first >= N)
+      return;
+    if (count > N - first)
+      count = N - first;
+    while (count) {
+      uint16_t w = first >> 5;
+      uint8_t bit = first & 31;
+      uint8_t take = count < 32 - bit ? count : 32 - bit;
+      uint32_t mask = (take == 32 ? 0xFFFFFFFFUL : ((1UL << take) - 1)) << bit;
+      words[w] = on ? (words[w] | mask) : (words[w] & ~mask);
+      first += take;
+      count -= take;
+    }
+  }
+
+  // Up to 32 bits starting at `first`, shifted down to bit 0
+  uint32_t extract(uint16_t first, uint8_t count) const {
+    if (first >= N || count == 0)
+      return 0;
+    uint16_t w = first >> 5;
+    uint8_t bit = first & 31;
+    uint32_t v = words[w] >> bit;
+    if (bit && w + 1 < WORDS)
+      v |= words[w + 1] << (32 - bit);
+    return count >= 32 ? v : v & ((1UL << count) - 1);
+  }
+
+  // OR the low `count` bits of `bits` in at `first`
+  void deposit(uint16_t first, uint32_t bits, uint8_t count) {
+    if (first >= N || count == 0)
+      return;
+    if (count < 32)
+      bits &= (1UL << count) - 1;
+    uint16_t w = first >> 5;
+    uint8_t bit = first & 31;
+    words[w] |= bits << bit;
+    if (bit && w + 1 < WORDS)
+      words[w + 1] |= bits >> (32 - bit);
+    trimTail();
+  }
+
+  bool any() const {
+    for (uint16_t w = 0; w < WORDS; w++) {
+      if (words[w])
+        return true;
+    }
+    return false;
+  }
+
+  uint16_t count() const {
+    uint16_t n = 0;
+    for (uint16_t w = 0; w < WORDS; w++) {
+      n += __builtin_popcount(words[w]);
+    }
+    return n;
+  }
+
+  // Calls fn(index) for every set bit in ascending order
+  template <typename Fn> void forEach(Fn fn) const {
+    for (uint16_t w = 0; w < WORDS; w++) {
+      uint32_t v = words[w];
+      while (v) {
+        fn((uint16_t)((w << 5) + __builtin_ctz(v)));
+        v &= v - 1;
+      }
+    }
+  }
+
+  // Bytes needed to carry every set bit (0 for an empty set)
+  uint16_t usedBytes() const {
+    for (uint16_t w = WORDS; w-- > 0;) {
+      if (words[w])
+        return w * 4 + (32 - __builtin_clz(words[w]) + 7) / 8;
+    }
+    return 0;
+  }
+
+  // Copy `len` bytes starting at byte `offset` to `out`
+  void toBytes(uint8_t *out, uint16_t offset, uint16_t len) const {
+    for (uint16_t i = 0; i < len; i++) {
+      uint16_t b = offset + i;
+      out[i] = b < BYTES ? (uint8_t)(words[b >> 2] >> ((b & 3) * 8)) : 0;
+    }
+  }
+
+  // Overwrite `len` bytes starting at byte `offset` from `in`
+  void fromBytes(const uint8_t *in, uint16_t offset, uint16_t len) {
+    for (uint16_t i = 0; i < len && offset + i < BYTES; i++) {
+      uint16_t b = offset + i;
+      uint8_t shift = (b & 3) * 8;
+      words[b >> 2] = (words[b >> 2] & ~(0xFFUL << shift)) |
+                      ((uint32_t)in[i] << shift);
+    }
+    trimTail();
+  }
+
+  BitSet &operator|=(const BitSet &o) {
+    for (uint16_t w = 0; w < WORDS; w++)
+      words[w] |= o.words[w];
+    return *this;
+  }
+
+  BitSet &operator&=(const BitSet &o) {
+    for (uint16_t w = 0; w < WORDS; w++)
+      words[w] &= o.words[w];
+    return *this;
+  }
+
+  // Clear every bit that is set in `o`
+  BitSet &subtract(const BitSet &o) {
+    for (uint16_t w = 0; w < WORDS; w++)
+      words[w] &= ~o.words[w];
+    return *this;
+  }
+
+  bool operator==(const BitSet &o) const {
+    return memcmp(words, o.words, sizeof(words)) == 0;
+  }
+  bool operator!=(const BitSet &o) const { return !(*this == o); }
+
+private:
+  // Keep bits past N clear so usedBytes() and == stay exact
+  void trimTail() {
+    if (N & 31)
+      words[WORDS - 1] &= (1UL << (N & 31)) - 1;
+  }
+};
+
+#endif
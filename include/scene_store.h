@@ -0,0 +1,186 @@
+#ifndef SCENE_STORE_H
+#define SCENE_STORE_H
+
+#include "config.h"
+#include "show_journal.h"
+#include "tempo.h"
+#include <Preferences.h>
+#include <esp_system.h>
+
+// ============================================================================
+// LAST SCENE, KEPT ACROSS RESETS
+// ============================================================================
+//
+// Master and panels both remember the last base-layer command they applied
+// so they can put it back on the lights straight after a reset instead of
+// waiting for the network, together with the tempo its beat-locked effects
+// ran at. The command is kept as one journal record (show_journal.h)
+// relative to an empty command, in two places:
+//
+//   RTC memory  written on every save; survives software, watchdog and
+//               most brownout resets and is read back in microseconds
+//   NVS         written from tick() once the scene has been left alone for
+//               SCENE_SETTLE_MS (or SCENE_MAX_DIRTY_MS into a busy
+//               sequence), so stepping sequences do not wear the flash;
+//               survives power loss
+//
+// A flash write stalls both cores for a few ms, which is why it waits for a
+// quiet moment rather than happening inside save().
+
+#define SCENE_NVS_NAMESPACE "scene"
+#define SCENE_SETTLE_MS 2000
+#define SCENE_MAX_DIRTY_MS 30000
+#define SCENE_RTC_MAGIC 0x5343454EUL // "SCEN"
+
+enum SceneSource : uint8_t { SCENE_NONE = 0, SCENE_RTC = 1, SCENE_NVS = 2 };
+
+static const char *const SCENE_SOURCE_NAMES[] = {"none", "RTC memory",
+                                                 "flash"};
+
+struct SceneRecord {
+  uint32_t magic;
+  uint8_t version; // JOURNAL_VERSION it was encoded with
+  uint8_t length;
+  uint8_t data[JOURNAL_MAX_RECORD];
+  uint16_t bpmX100;
+  uint8_t beatsPerBar;
+  uint32_t crc; // crc32Ieee over everything from version up to here
+};
+
+RTC_NOINIT_ATTR static SceneRecord rtcScene;
+
+inline const char *resetReasonName(esp_reset_reason_t reason) {
+  switch (reason) {
+  case ESP_RST_POWERON:
+    return "power on";
+  case ESP_RST_EXT:
+    return "reset pin";
+  case ESP_RST_SW:
+    return "software";
+  case ESP_RST_PANIC:
+    return "panic";
+  case ESP_RST_INT_WDT:
+  case ESP_RST_TASK_WDT:
+  case ESP_RST_WDT:
+    return "watchdog";
+  case ESP_RST_DEEPSLEEP:
+    return "deep sleep";
+  case ESP_RST_BROWNOUT:
+    return "brownout";
+  default:
+    return "unknown";
+  }
+}
+
+class SceneStore {
+public:
+  // Fill `cmd` with the saved scene and put the tempo clock back where it
+  // was. RTC first, then NVS.
+  SceneSource load(LightCommand &cmd) {
+    if (decode(rtcScene, cmd)) {
+      return SCENE_RTC;
+    }
+    SceneRecord stored;
+    Preferences prefs;
+    if (!prefs.begin(SCENE_NVS_NAMESPACE, true)) {
+      return SCENE_NONE;
+    }
+    size_t len = prefs.getBytes("last", &stored, sizeof(stored));
+    prefs.end();
+    if (len == sizeof(stored) && decode(stored, cmd)) {
+      rtcScene = stored;
+      return SCENE_NVS;
+    }
+    return SCENE_NONE;
+  }
+
+  // A repeat of the saved scene (e.g. the restored one coming back through
+  // the show) costs no flash write.
+  void save(const LightCommand &cmd, uint32_t now) {
+    LightCommand empty = {};
+    uint8_t data[JOURNAL_MAX_RECORD];
+    uint8_t length = journalEncode(empty, cmd, 0, data);
+    if (rtcScene.magic == SCENE_RTC_MAGIC &&
+        rtcScene.version == JOURNAL_VERSION && rtcScene.length == length &&
+        memcmp(rtcScene.data, data, length) == 0) {
+      return;
+    }
+    memset(&rtcScene, 0, sizeof(rtcScene)); // the CRC covers the padding
+    rtcScene.magic = SCENE_RTC_MAGIC;
+    rtcScene.version = JOURNAL_VERSION;
+    rtcScene.length = length;
+    memcpy(rtcScene.data, data, length);
+    stamp(now);
+  }
+
+  // The tempo changed under the current scene. Nothing is saved until
+  // there is a scene to go with it.
+  void saveTempo(uint32_t now) {
+    if (rtcScene.magic == SCENE_RTC_MAGIC &&
+        (rtcScene.bpmX100 != tempoClock().bpmX100() ||
+         rtcScene.beatsPerBar != tempoClock().beatsPerBar())) {
+      stamp(now);
+    }
+  }
+
+  // Write the scene to NVS if it is due. Returns true after a write.
+  bool tick(uint32_t now) {
+    if (!dirty || (now - changedAt < SCENE_SETTLE_MS &&
+                   now - dirtySince < SCENE_MAX_DIRTY_MS)) {
+      return false;
+    }
+    dirty = false;
+    Preferences prefs;
+    bool ok = prefs.begin(SCENE_NVS_NAMESPACE, false) &&
+              prefs.putBytes("last", &rtcScene, sizeof(rtcScene)) ==
+                  sizeof(rtcScene);
+    prefs.end();
+    writes++;
+    if (!ok) {
+      failures++;
+    }
+    return ok;
+  }
+
+  uint32_t writes = 0;
+  uint32_t failures = 0;
+
+private:
+  bool dirty = false;
+  uint32_t changedAt = 0;
+  uint32_t dirtySince = 0;
+
+  void stamp(uint32_t now) {
+    rtcScene.bpmX100 = tempoClock().bpmX100();
+    rtcScene.beatsPerBar = tempoClock().beatsPerBar();
+    rtcScene.crc = checksum(rtcScene);
+    if (!dirty) {
+      dirtySince = now;
+    }
+    dirty = true;
+    changedAt = now;
+  }
+
+  static uint32_t checksum(const SceneRecord &r) {
+    return crc32Ieee(&r.version, offsetof(SceneRecord, crc) -
+                                     offsetof(SceneRecord, version));
+  }
+
+  static bool decode(const SceneRecord &r, LightCommand &cmd) {
+    if (r.magic != SCENE_RTC_MAGIC || r.length > JOURNAL_MAX_RECORD ||
+        r.version != JOURNAL_VERSION || r.crc != checksum(r)) {
+      return false;
+    }
+    LightCommand decoded = {};
+    uint32_t dtUs;
+    if (journalDecode(r.data, r.length, decoded, dtUs) != r.length) {
+      return false;
+    }
+    cmd = decoded;
+    tempoClock().setBpm(r.bpmX100, millis());
+    tempoClock().setBeatsPerBar(r.beatsPerBar);
+    return true;
+  }
+};
+
+#endif
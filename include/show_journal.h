@@ -0,0 +1,229 @@
+#ifndef SHOW_JOURNAL_H
+#define SHOW_JOURNAL_H
+
+#include "config.h"
+
+// ============================================================================
+// SHOW JOURNAL FORMAT
+// ============================================================================
+//
+// Append-only log of dispatched LightCommands. After a fixed header, each
+// record is:
+//
+//   varint  dt_us    microseconds since the previous record (first: 0)
+//   uint8   fields   JF_* bitmask of fields that differ from the previous
+//   ...              one byte per changed scalar field, in bit order, then
+//                    if JF_REGIONS is set: varint byte count and the
+//                    region bitmask trimmed after its highest set bit, then
+//                    if JF_EXTENDED is set: a JX_* bitmask and the groups
+//                    it names, in bit order
+//
+// Fields are relative to the previous record (an all-zero command for the
+// first one), so a typical sequence step costs 3-6 bytes. Readers accept
+// JOURNAL_VERSION only.
+
+#define JOURNAL_MAGIC 0x43455254UL // "TREC"
+#define JOURNAL_VERSION 6
+
+#define JOURNAL_REGION_BYTES RegionSet::BYTES
+#define JOURNAL_MAX_RECORD (5 + 1 + 6 + 2 + JOURNAL_REGION_BYTES + 1 + 3 + 3 + 1 + 4)
+
+enum JournalField {
+  JF_SEQUENCE = 1 << 0,
+  JF_EFFECT = 1 << 1,
+  JF_BRIGHTNESS = 1 << 2,
+  JF_SPEED = 1 << 3,
+  JF_DEBUG = 1 << 4,
+  JF_PANEL = 1 << 5,
+  JF_REGIONS = 1 << 6,
+  JF_EXTENDED = 1 << 7
+};
+
+enum JournalExtension {
+  JX_LAYER = 1 << 0,      // layer, blend, mix
+  JX_TRANSITION = 1 << 1, // transitionMs (little endian), curve
+  JX_TEMPO = 1 << 2,      // beatLength
+  JX_GROUPS = 1 << 3      // groupInclude, groupExclude (little endian)
+};
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t reserved;
+  uint16_t maxRegions;
+} JournalHeader;
+
+static_assert(JOURNAL_MAX_RECORD <= 255, "record length is a uint8_t");
+
+// Encode `cmd` relative to `prev`. `out` must hold JOURNAL_MAX_RECORD bytes.
+// Returns the record length.
+inline uint8_t journalEncode(const LightCommand &prev, const LightCommand &cmd,
+                             uint32_t dtUs, uint8_t *out) {
+  uint8_t n = 0;
+  do {
+    uint8_t b = dtUs & 0x7F;
+    dtUs >>= 7;
+    out[n++] = dtUs ? (b | 0x80) : b;
+  } while (dtUs);
+
+  uint8_t &fields = out[n++];
+  fields = 0;
+
+  const uint8_t scalars[6][2] = {
+      {prev.sequence, cmd.sequence}, {prev.effect, cmd.effect},
+      {prev.brightness, cmd.brightness}, {prev.speed, cmd.speed},
+      {prev.debugMode, cmd.debugMode}, {prev.panelId, cmd.panelId}};
+  for (uint8_t f = 0; f < 6; f++) {
+    if (scalars[f][0] != scalars[f][1]) {
+      fields |= 1 << f;
+      out[n++] = scalars[f][1];
+    }
+  }
+
+  if (prev.regions != cmd.regions) {
+    fields |= JF_REGIONS;
+    uint16_t bytes = cmd.regions.usedBytes();
+    out[n++] = bytes >= 0x80 ? ((bytes & 0x7F) | 0x80) : bytes;
+    if (bytes >= 0x80)
+      out[n++] = bytes >> 7;
+    cmd.regions.toBytes(out + n, 0, bytes);
+    n += bytes;
+  }
+
+  uint8_t ext = 0;
+  if (prev.layer != cmd.layer || prev.blend != cmd.blend ||
+      prev.mix != cmd.mix)
+    ext |= JX_LAYER;
+  if (prev.transitionMs != cmd.transitionMs || prev.curve != cmd.curve)
+    ext |= JX_TRANSITION;
+  if (prev.beatLength != cmd.beatLength)
+    ext |= JX_TEMPO;
+  if (prev.groupInclude != cmd.groupInclude ||
+      prev.groupExclude != cmd.groupExclude)
+    ext |= JX_GROUPS;
+  if (ext) {
+    fields |= JF_EXTENDED;
+    out[n++] = ext;
+  }
+  if (ext & JX_LAYER) {
+    out[n++] = cmd.layer;
+    out[n++] = cmd.blend;
+    out[n++] = cmd.mix;
+  }
+  if (ext & JX_TRANSITION) {
+    out[n++] = cmd.transitionMs & 0xFF;
+    out[n++] = cmd.transitionMs >> 8;
+    out[n++] = cmd.curve;
+  }
+  if (ext & JX_TEMPO) {
+    out[n++] = cmd.beatLength;
+  }
+  if (ext & JX_GROUPS) {
+    out[n++] = cmd.groupInclude & 0xFF;
+    out[n++] = cmd.groupInclude >> 8;
+    out[n++] = cmd.groupExclude & 0xFF;
+    out[n++] = cmd.groupExclude >> 8;
+  }
+  return n;
+}
+
+// Decode one record from `in`, applying it on top of `state`. Returns the
+// number of bytes consumed, or 0 if `avail` does not hold a full record.
+inline uint8_t journalDecode(const uint8_t *in, uint16_t avail,
+                             LightCommand &state, uint32_t &dtUs) {
+  uint8_t n = 0;
+  uint32_t dt = 0;
+  for (uint8_t shift = 0;; shift += 7) {
+    if (n >= avail || shift > 28)
+      return 0;
+    uint8_t b = in[n++];
+    dt |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80))
+      break;
+  }
+
+  if (n >= avail)
+    return 0;
+  uint8_t fields = in[n++];
+
+  uint8_t need = 0;
+  for (uint8_t f = 0; f < 6; f++) {
+    need += (fields >> f) & 1;
+  }
+  if (avail - n < need)
+    return 0;
+
+  uint16_t regionBytes = 0;
+  uint16_t at = n + need;
+  if (fields & JF_REGIONS) {
+    if (at >= avail)
+      return 0;
+    regionBytes = in[at] & 0x7F;
+    uint8_t lenBytes = 1;
+    if (in[at] & 0x80) {
+      if (at + 1 >= avail)
+        return 0;
+      regionBytes |= in[at + 1] << 7;
+      lenBytes = 2;
+    }
+    if (regionBytes > JOURNAL_REGION_BYTES ||
+        avail - at - lenBytes < regionBytes)
+      return 0;
+    at += lenBytes + regionBytes;
+  }
+  uint8_t ext = 0;
+  if (fields & JF_EXTENDED) {
+    if (at >= avail)
+      return 0;
+    ext = in[at++];
+  }
+  uint8_t extBytes = (ext & JX_LAYER ? 3 : 0) +
+                     (ext & JX_TRANSITION ? 3 : 0) + (ext & JX_TEMPO ? 1 : 0) +
+                     (ext & JX_GROUPS ? 4 : 0);
+  if (avail - at < extBytes)
+    return 0;
+
+  // debugMode is a bool: read its byte through a uint8_t, whatever it holds
+  uint8_t debugMode = state.debugMode;
+  uint8_t *scalars[6] = {&state.sequence,   &state.effect,
+                         &state.brightness, &state.speed,
+                         &debugMode,        &state.panelId};
+  for (uint8_t f = 0; f < 6; f++) {
+    if (fields & (1 << f)) {
+      *scalars[f] = in[n++];
+    }
+  }
+  state.debugMode = debugMode != 0;
+  if (fields & JF_REGIONS) {
+    n += (in[n] & 0x80) ? 2 : 1;
+    state.regions.clearAll();
+    state.regions.fromBytes(in + n, 0, regionBytes);
+    n += regionBytes;
+  }
+  if (fields & JF_EXTENDED) {
+    n++;
+  }
+  if (ext & JX_LAYER) {
+    state.layer = in[n++];
+    state.blend = in[n++];
+    state.mix = in[n++];
+  }
+  if (ext & JX_TRANSITION) {
+    state.transitionMs = in[n] | (in[n + 1] << 8);
+    state.curve = in[n + 2];
+    n += 3;
+  }
+  if (ext & JX_TEMPO) {
+    state.beatLength = in[n++];
+  }
+  if (ext & JX_GROUPS) {
+    state.groupInclude = in[n] | (in[n + 1] << 8);
+    state.groupExclude = in[n + 2] | (in[n + 3] << 8);
+    n += 4;
+  }
+
+  dtUs = dt;
+  return n;
+}
+
+#endif
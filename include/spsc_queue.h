@@ -0,0 +1,68 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stdint.h>
+
+// ============================================================================
+// BOUNDED SINGLE-PRODUCER / SINGLE-CONSUMER QUEUE
+// ============================================================================
+//
+// Lock-free ring buffer for handing fixed-size items from one task to
+// another (e.g. network core -> show core). Exactly one task may push and
+// exactly one task may pop. N must be a power of two; one slot is never left
+// unused because head/tail are free-running counters.
+
+template <typename T, uint32_t N> class SpscQueue {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  SpscQueue() : head(0), tail(0) {}
+
+  // Producer side. Returns false (and leaves the queue untouched) when full.
+  bool push(const T &item) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) >= N) {
+      return false;
+    }
+    slots[t & (N - 1)] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false when empty.
+  bool pop(T &out) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    out = slots[h & (N - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. The next item pop() would return, or nullptr when empty.
+  // Valid until that pop().
+  const T *peek() const {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &slots[h & (N - 1)];
+  }
+
+  // Approximate when called from a third task; exact from either end.
+  uint32_t size() const {
+    return tail.load(std::memory_order_acquire) -
+           head.load(std::memory_order_acquire);
+  }
+
+  static uint32_t capacity() { return N; }
+
+private:
+  T slots[N];
+  std::atomic<uint32_t> head;
+  std::atomic<uint32_t> tail;
+};
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef TEMPO_H
+#define TEMPO_H
+
+#include <stdint.h>
+
+// ============================================================================
+// TEMPO CLOCK
+// ============================================================================
+//
+// A beat position that advances at the current BPM. The master owns the
+// tempo (set over MQTT or by tap) and broadcasts bpm and position in every
+// BEACON; each panel runs its own clock and steers it onto the master's.
+// Effects with a beatLength take their phase from here instead of from the
+// time since their command, so they line up with the music and with each
+// other across panels. Beat 0 is a downbeat, so any cycle that divides a bar
+// starts on every downbeat.
+//
+// position() is continuous: a tempo change only changes the rate from now
+// on, and any correction (tap, downbeat, a beacon from the master) is slewed
+// in as a temporary change of rate, never a jump. A slew is given at least
+// one beat and a rate between 0.5x and 1.5x, so the beat never runs
+// backwards. Only a clock that is more than a bar out (a panel that just
+// booted) snaps.
+
+#define TEMPO_ONE_BEAT 65536UL // position units per beat
+#define TEMPO_QUARTER_BEAT (TEMPO_ONE_BEAT / 4)
+#define TEMPO_DEFAULT_BPM_X100 12000
+#define TEMPO_MIN_BPM_X100 2000
+#define TEMPO_MAX_BPM_X100 30000
+#define TEMPO_DEFAULT_BEATS_PER_BAR 4
+#define TEMPO_MAX_BEATS_PER_BAR 16
+#define TEMPO_TAPS 8               // taps averaged for tap tempo
+#define TEMPO_TAP_TIMEOUT_MS 2000  // a longer gap starts a new tap series
+
+class TempoClock {
+public:
+  uint16_t bpmX100() const { return bpm; }
+  uint8_t beatsPerBar() const { return barBeats; }
+  uint32_t beatMs() const { return 6000000UL / bpm; }
+
+  // Beats x TEMPO_ONE_BEAT since the clock started, at `now` (ms)
+  uint64_t position(uint32_t now) const {
+    uint32_t elapsed = sinceAnchor(now);
+    uint64_t p = anchorPos + (uint64_t)elapsed * bpm * TEMPO_ONE_BEAT / 6000000;
+    if (slewMs) {
+      uint32_t t = elapsed < slewMs ? elapsed : slewMs;
+      p += (int64_t)slew * t / slewMs;
+    }
+    return p;
+  }
+
+  // Position within a cycle of `quarters` quarter beats, 0-255
+  uint8_t cyclePhase(uint32_t now, uint8_t quarters) const {
+    uint64_t cycle = (uint64_t)quarters * TEMPO_QUARTER_BEAT;
+    return cycle ? position(now) % cycle * 256 / cycle : 0;
+  }
+
+  void setBpm(uint32_t bpmX100, uint32_t now) {
+    rebase(now);
+    bpm = clampBpm(bpmX100);
+    if (slew) {
+      steer(0, now); // re-spread what is left at the new tempo
+    }
+  }
+
+  void setBeatsPerBar(uint8_t beats) {
+    barBeats = beats == 0 ? 1
+               : beats > TEMPO_MAX_BEATS_PER_BAR ? TEMPO_MAX_BEATS_PER_BAR
+                                                 : beats;
+  }
+
+  // `now` is the first beat of a bar
+  void downbeat(uint32_t now) {
+    steer(nearestError(position(now), (uint64_t)barBeats * TEMPO_ONE_BEAT),
+          now);
+  }
+
+  // One tap on the beat. From the second tap of a series the tempo follows
+  // the average interval and the beat is steered onto the taps. Returns
+  // true when the tempo changed.
+  bool tap(uint32_t now) {
+    if (taps > 0 && now - tapAt[(taps - 1) % TEMPO_TAPS] > TEMPO_TAP_TIMEOUT_MS) {
+      taps = 0;
+    }
+    tapAt[taps % TEMPO_TAPS] = now;
+    taps++;
+    if (taps < 2) {
+      return false;
+    }
+    uint8_t used = taps < TEMPO_TAPS ? taps : TEMPO_TAPS;
+    uint32_t first = tapAt[(taps - used) % TEMPO_TAPS];
+    uint32_t span = now - first;
+    if (span == 0) {
+      return false;
+    }
+    setBpm((uint64_t)6000000 * (used - 1) / span, now);
+    steer(nearestError(position(now), TEMPO_ONE_BEAT), now);
+    return true;
+  }
+
+  // Follow a clock that read `target` at `now` at the given tempo (a panel
+  // applying a master beacon)
+  void follow(uint16_t bpmX100, uint8_t beats, uint64_t target,
+              uint32_t now) {
+    setBpm(bpmX100, now);
+    setBeatsPerBar(beats);
+    int64_t error = (int64_t)(target - position(now));
+    uint64_t bar = (uint64_t)barBeats * TEMPO_ONE_BEAT;
+    if (!synced || error > (int64_t)bar || error < -(int64_t)bar) {
+      anchorPos = target;
+      anchorMs = now;
+      slew = 0;
+      slewMs = 0;
+      synced = true;
+    } else {
+      steer(error, now);
+    }
+  }
+
+private:
+  uint16_t bpm = TEMPO_DEFAULT_BPM_X100;
+  uint8_t barBeats = TEMPO_DEFAULT_BEATS_PER_BAR;
+  bool synced = false; // follow() has been called
+
+  uint64_t anchorPos = 0;
+  uint32_t anchorMs = 0;
+  int32_t slew = 0;    // correction being spread over slewMs from anchorMs
+  uint32_t slewMs = 0;
+
+  uint32_t tapAt[TEMPO_TAPS];
+  uint8_t taps = 0;
+
+  // Move the anchor to `now`, keeping whatever part of a slew is still due
+  void rebase(uint32_t now) {
+    uint64_t p = position(now);
+    uint32_t elapsed = sinceAnchor(now);
+    if (slewMs && elapsed < slewMs) {
+      slew -= (int64_t)slew * elapsed / slewMs;
+    } else {
+      slew = 0;
+    }
+    slewMs = slew ? slewMs - (elapsed < slewMs ? elapsed : slewMs) : 0;
+    anchorPos = p;
+    anchorMs = elapsed ? now : anchorMs;
+  }
+
+  // A time stamped just before the last change counts as that change
+  uint32_t sinceAnchor(uint32_t now) const {
+    return (int32_t)(now - anchorMs) > 0 ? now - anchorMs : 0;
+  }
+
+  // Add `error` to the slew, spread over max(1 beat, 2 x |error|)
+  void steer(int64_t error, uint32_t now) {
+    rebase(now);
+    slew += error;
+    if (slew == 0) {
+      slewMs = 0;
+      return;
+    }
+    uint64_t size = slew < 0 ? -(int64_t)slew : slew;
+    uint64_t beats2 = size * 2 > TEMPO_ONE_BEAT ? size * 2 : TEMPO_ONE_BEAT;
+    slewMs = beats2 * beatMs() / TEMPO_ONE_BEAT;
+  }
+
+  // Signed distance from `p` to the nearest multiple of `unit`
+  static int64_t nearestError(uint64_t p, uint64_t unit) {
+    uint64_t r = p % unit;
+    return r < unit / 2 ? -(int64_t)r : (int64_t)(unit - r);
+  }
+
+  static uint16_t clampBpm(uint32_t v) {
+    return v < TEMPO_MIN_BPM_X100   ? TEMPO_MIN_BPM_X100
+           : v > TEMPO_MAX_BPM_X100 ? TEMPO_MAX_BPM_X100
+                                    : v;
+  }
+};
+
+// The clock effects read; one per device, like effectPrograms()
+inline TempoClock &tempoClock() {
+  static TempoClock clock;
+  return clock;
+}
+
+#endif
@@ -0,0 +1,260 @@
+// Audio analysis test bench (host build: pio run -e audiotest)
+//
+// Feeds a WAV file, or a synthetic click track with known beat times,
+// through the master's AudioAnalyzer block by block and reports the cost
+// of each block and the audio-to-light latency budget. With a click track
+// it also scores the beat detector against the clicks it generated.
+//
+//   audiotest --wav song.wav [--csv frames.csv]
+//   audiotest --clicks 128 [--seconds 30] [--noise 2000]
+
+#include "../master/audio.h"
+#include "config.h"
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <vector>
+
+#define DEFAULT_SECONDS 20
+#define DEFAULT_NOISE 1500    // background noise amplitude, int16 units
+#define CLICK_MS 40           // length of each synthetic kick
+#define MATCH_WINDOW_MS 100   // a beat this long after a click counts as a hit
+#define RADIO_MS 2            // one ESP-NOW broadcast, airtime and stack
+#define PANEL_LOOP_MS 10      // panels apply the packet on their next loop
+
+HostSerial Serial;
+uint32_t millis() { return 0; }
+
+// ============================================================================
+// INPUT
+// ============================================================================
+
+// 16-bit PCM of any rate and channel count, mixed to mono and resampled
+// linearly to AUDIO_SAMPLE_RATE
+bool loadWav(const char *path, std::vector<int16_t> &out) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  std::vector<uint8_t> bytes;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    bytes.insert(bytes.end(), buf, buf + n);
+  fclose(f);
+  if (bytes.size() < 12 || memcmp(bytes.data(), "RIFF", 4) ||
+      memcmp(bytes.data() + 8, "WAVE", 4))
+    return false;
+
+  uint16_t channels = 0, bits = 0;
+  uint32_t rate = 0;
+  size_t pos = 12;
+  while (pos + 8 <= bytes.size()) {
+    uint32_t size;
+    memcpy(&size, &bytes[pos + 4], 4);
+    const uint8_t *body = &bytes[pos + 8];
+    if (pos + 8 + size > bytes.size())
+      size = bytes.size() - pos - 8;
+    if (!memcmp(&bytes[pos], "fmt ", 4) && size >= 16) {
+      uint16_t format;
+      memcpy(&format, body, 2);
+      memcpy(&channels, body + 2, 2);
+      memcpy(&rate, body + 4, 4);
+      memcpy(&bits, body + 14, 2);
+      if (format != 1 || bits != 16 || channels == 0 || rate == 0) {
+        fprintf(stderr, "✗ Only 16-bit PCM WAV is supported\n");
+        return false;
+      }
+    } else if (!memcmp(&bytes[pos], "data", 4) && channels) {
+      size_t frames = size / (2 * channels);
+      std::vector<int32_t> mono(frames);
+      for (size_t i = 0; i < frames; i++) {
+        int32_t sum = 0;
+        for (uint16_t c = 0; c < channels; c++) {
+          int16_t s;
+          memcpy(&s, body + (i * channels + c) * 2, 2);
+          sum += s;
+        }
+        mono[i] = sum / channels;
+      }
+      size_t outFrames = (uint64_t)frames * AUDIO_SAMPLE_RATE / rate;
+      out.resize(outFrames);
+      for (size_t i = 0; i < outFrames; i++) {
+        double at = (double)i * rate / AUDIO_SAMPLE_RATE;
+        size_t a = (size_t)at;
+        size_t b = std::min(a + 1, frames - 1);
+        double t = at - a;
+        out[i] = (int16_t)(mono[a] * (1 - t) + mono[b] * t);
+      }
+      return true;
+    }
+    pos += 8 + size + (size & 1);
+  }
+  return false;
+}
+
+// Kick drum on every beat (a decaying 60 Hz thump with a click on top)
+// over noise and a steady pad, so the detector has to ignore sustained
+// energy. Returns the onset of every kick in samples.
+std::vector<uint32_t> synthClicks(float bpm, uint32_t seconds, int noise,
+                                  std::vector<int16_t> &out) {
+  std::vector<uint32_t> onsets;
+  uint32_t total = seconds * AUDIO_SAMPLE_RATE;
+  uint32_t period = (uint32_t)(60.0f * AUDIO_SAMPLE_RATE / bpm);
+  uint32_t clickLen = CLICK_MS * AUDIO_SAMPLE_RATE / 1000;
+  uint32_t rng = 12345;
+  out.assign(total, 0);
+  for (uint32_t i = 0; i < total; i++) {
+    rng = rng * 1103515245 + 12345;
+    float v = ((int32_t)(rng >> 16 & 0xFFFF) - 32768) / 32768.0f * noise;
+    v += 2000 * sinf(2 * (float)M_PI * 440 * i / AUDIO_SAMPLE_RATE);
+    uint32_t since = i % period;
+    if (since < clickLen) {
+      float t = (float)since / AUDIO_SAMPLE_RATE;
+      float decay = expf(-t * 60);
+      v += 24000 * decay * sinf(2 * (float)M_PI * 60 * t);
+      v += 6000 * decay * decay * sinf(2 * (float)M_PI * 1800 * t);
+    }
+    out[i] = (int16_t)std::max(-32768.0f, std::min(32767.0f, v));
+    if (since == 0 && i + clickLen < total)
+      onsets.push_back(i);
+  }
+  return onsets;
+}
+
+// ============================================================================
+// MAIN
+// ============================================================================
+
+void usage() {
+  fprintf(stderr,
+          "usage: audiotest (--wav FILE | --clicks BPM) [options]\n"
+          "  --seconds N  length of the click track (default %d)\n"
+          "  --noise N    click track background noise, int16 units "
+          "(default %d)\n"
+          "  --csv FILE   write time, intensity, bands and beat per block\n",
+          DEFAULT_SECONDS, DEFAULT_NOISE);
+}
+
+int main(int argc, char **argv) {
+  const char *wavPath = nullptr;
+  const char *csvPath = nullptr;
+  float bpm = 0;
+  uint32_t seconds = DEFAULT_SECONDS;
+  int noise = DEFAULT_NOISE;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "--wav"))
+      wavPath = argv[i + 1];
+    else if (!strcmp(argv[i], "--clicks"))
+      bpm = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "--seconds"))
+      seconds = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "--noise"))
+      noise = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "--csv"))
+      csvPath = argv[i + 1];
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if ((argc - 1) % 2 || (wavPath == nullptr) == (bpm <= 0)) {
+    usage();
+    return 2;
+  }
+
+  std::vector<int16_t> samples;
+  std::vector<uint32_t> onsets;
+  if (wavPath) {
+    if (!loadWav(wavPath, samples)) {
+      fprintf(stderr, "✗ Cannot read %s\n", wavPath);
+      return 2;
+    }
+  } else {
+    onsets = synthClicks(bpm, seconds, noise, samples);
+  }
+
+  FILE *csv = csvPath ? fopen(csvPath, "w") : nullptr;
+  if (csv)
+    fprintf(csv, "ms,intensity,bass,lowmid,highmid,treble,beat\n");
+
+  AudioAnalyzer analyzer;
+  std::vector<double> costNs;
+  std::vector<uint32_t> beatsAt; // sample index at the end of the block
+  typedef std::chrono::steady_clock Clock;
+  for (size_t at = 0; at + AUDIO_BLOCK <= samples.size(); at += AUDIO_BLOCK) {
+    auto started = Clock::now();
+    AudioFrame frame = analyzer.process(&samples[at]);
+    costNs.push_back(
+        std::chrono::duration<double, std::nano>(Clock::now() - started)
+            .count());
+    uint32_t readyAt = at + AUDIO_BLOCK;
+    if (frame.beat)
+      beatsAt.push_back(readyAt);
+    if (csv)
+      fprintf(csv, "%u,%u,%u,%u,%u,%u,%d\n",
+              readyAt * 1000 / AUDIO_SAMPLE_RATE, frame.intensity,
+              frame.bands[0], frame.bands[1], frame.bands[2], frame.bands[3],
+              frame.beat);
+  }
+  if (csv)
+    fclose(csv);
+  if (costNs.empty()) {
+    fprintf(stderr, "✗ Less than one block of audio\n");
+    return 2;
+  }
+
+  std::vector<double> sorted = costNs;
+  std::sort(sorted.begin(), sorted.end());
+  double sum = 0;
+  for (double c : costNs)
+    sum += c;
+  printf("%zu blocks of %d samples (%d ms), %zu beats detected\n",
+         costNs.size(), AUDIO_BLOCK, AUDIO_BLOCK_MS, beatsAt.size());
+  printf("Analysis per block: mean %.1f us, p99 %.1f us, max %.1f us\n",
+         sum / costNs.size() / 1000, sorted[sorted.size() * 99 / 100] / 1000,
+         sorted.back() / 1000);
+
+  // Onset to detection, including the wait for the block to fill
+  double detectMeanMs = AUDIO_BLOCK_MS, detectMaxMs = AUDIO_BLOCK_MS;
+  if (!onsets.empty()) {
+    uint32_t window = MATCH_WINDOW_MS * AUDIO_SAMPLE_RATE / 1000;
+    uint32_t hits = 0;
+    double delaySum = 0, delayMax = 0;
+    size_t b = 0;
+    for (uint32_t onset : onsets) {
+      while (b < beatsAt.size() && beatsAt[b] < onset)
+        b++;
+      if (b < beatsAt.size() && beatsAt[b] - onset <= window) {
+        double ms = (beatsAt[b] - onset) * 1000.0 / AUDIO_SAMPLE_RATE;
+        delaySum += ms;
+        delayMax = std::max(delayMax, ms);
+        hits++;
+        b++;
+      }
+    }
+    uint32_t extra = beatsAt.size() - hits;
+    printf("Clicks: %zu, detected %u (%.0f%%), false beats %u\n",
+           onsets.size(), hits, 100.0 * hits / onsets.size(), extra);
+    if (hits) {
+      detectMeanMs = delaySum / hits;
+      detectMaxMs = delayMax;
+    }
+  }
+
+  double analysisMs = sorted.back() / 1e6;
+  printf("\nAudio to light      mean      worst\n");
+  printf("  detection   %9.1f ms %7.1f ms%s\n", detectMeanMs, detectMaxMs,
+         onsets.empty() ? "  (block length; use --clicks to measure)" : "");
+  printf("  analysis    %9.2f ms %7.2f ms  (host; the ESP32 is slower)\n",
+         sum / costNs.size() / 1e6, analysisMs);
+  printf("  radio       %9.1f ms %7.1f ms\n", (double)RADIO_MS,
+         (double)RADIO_MS);
+  printf("  panel loop  %9.1f ms %7.1f ms\n", PANEL_LOOP_MS / 2.0,
+         (double)PANEL_LOOP_MS);
+  printf("  total       %9.1f ms %7.1f ms\n",
+         detectMeanMs + sum / costNs.size() / 1e6 + RADIO_MS +
+             PANEL_LOOP_MS / 2.0,
+         detectMaxMs + analysisMs + RADIO_MS + PANEL_LOOP_MS);
+  return 0;
+}
@@ -0,0 +1,505 @@
+// Firmware rollout simulator (host build: pio run -e fwsim)
+//
+// Runs the master's FirmwareSender against N panels' FirmwareReceivers on a
+// simulated clock and reports how long a rollout takes as the panel count
+// grows. Each panel's OTA slot is memory that behaves like NOR flash
+// (erase to 0xFF, writes only clear bits), so a chunk written into a sector
+// that was not erased shows up as a bad hash.
+//
+// The radio is one shared channel: every frame holds it for its airtime at
+// --rate Mbps, and a send is refused while RADIO_QUEUE frames are waiting,
+// as esp_now_send() does. Each panel loses each frame independently with
+// probability --loss percent; unicasts (polls and status replies) are
+// retried by the MAC up to UNICAST_TRIES times. Panels run loop() every
+// 10 ms, erase one sector per loop while preparing their slot, queue at
+// most PANEL_QUEUE packets in between, and hash the slot on COMMIT.
+//
+//   fwsim [--panels 1,2,4,8,16,32] [--size 1000000] [--loss 5] [--rate 1]
+//         [--burst 2] [--spacing 6] [--interrupt 50] [--seed 1]
+//
+// --interrupt P stops the master P% of the way into the first data round
+// and resets every panel, which reload their progress from "NVS", then
+// starts the rollout again: the chunks sent overall show what resuming
+// saved.
+
+#include "../master/firmware.h"
+#include "../panel/firmware.h"
+#include "config.h"
+#include <deque>
+#include <queue>
+#include <vector>
+
+#define DEFAULT_SIZE 1000000
+#define DEFAULT_LOSS 5
+#define DEFAULT_RATE 1
+#define SLOT_BYTES 0x140000 // app1 in the default partition table
+#define PANEL_LOOP_MS 10
+#define PANEL_QUEUE 16 // firmwarePackets on the panel
+#define ERASE_MS 45    // one 4 KB sector
+#define HASH_KB_PER_MS 2
+#define RADIO_QUEUE 8
+#define UNICAST_TRIES 4
+#define FRAME_OVERHEAD_BYTES 43 // MAC header, ESP-NOW vendor element, FCS
+#define PREAMBLE_US 192         // 802.11b long preamble
+#define ACK_US 304
+#define MAX_STEPS 16
+#define SIM_TIMEOUT_MS 600000
+#define SHOW_TASK_MAX_SLEEP_MS 20 // as on the master
+
+HostSerial Serial;
+static uint64_t simUs = 0;
+uint32_t millis() { return simUs / 1000; }
+
+// ============================================================================
+// SIMULATED PANELS AND RADIO
+// ============================================================================
+
+class MemoryStore {
+public:
+  std::vector<uint8_t> slot;
+
+  // Whatever the last image left there
+  MemoryStore() : slot(SLOT_BYTES, 0x5A) {}
+
+  uint32_t capacity() { return slot.size(); }
+
+  bool erase(uint32_t offset) {
+    erases++;
+    memset(&slot[offset], 0xFF, FW_SECTOR_BYTES);
+    return true;
+  }
+
+  bool write(uint32_t offset, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      slot[offset + i] &= data[i];
+    }
+    return true;
+  }
+
+  bool read(uint32_t offset, uint8_t *data, size_t len) {
+    memcpy(data, &slot[offset], len);
+    return true;
+  }
+
+  bool loadProgress(uint32_t &imageId, uint32_t &size, uint8_t *held,
+                    size_t bytes) {
+    if (savedHeld.size() != bytes)
+      return false;
+    imageId = savedId;
+    size = savedSize;
+    memcpy(held, savedHeld.data(), bytes);
+    return true;
+  }
+
+  void saveProgress(uint32_t imageId, uint32_t size, const uint8_t *held,
+                    size_t bytes) {
+    savedId = imageId;
+    savedSize = size;
+    savedHeld.assign(held, held + bytes);
+  }
+
+  bool loadInstalled(uint8_t *sha256) {
+    if (!hasInstalled)
+      return false;
+    memcpy(sha256, installed, 32);
+    return true;
+  }
+
+  // No restart is simulated, so the new image counts as running at once
+  bool activate(const uint8_t *sha256, uint32_t size) {
+    if (size > capacity())
+      return false;
+    memcpy(installed, sha256, 32);
+    hasInstalled = true;
+    savedHeld.clear();
+    return true;
+  }
+
+  uint32_t erases = 0;
+
+private:
+  uint32_t savedId = 0;
+  uint32_t savedSize = 0;
+  std::vector<uint8_t> savedHeld;
+  uint8_t installed[32] = {};
+  bool hasInstalled = false;
+};
+
+struct Packet {
+  uint8_t len;
+  uint8_t data[250];
+};
+
+struct SimPanel {
+  uint8_t id;
+  FirmwareReceiver<MemoryStore> rx;
+  std::deque<Packet> queue;
+  uint64_t nextLoopUs;
+  uint32_t drops;
+
+  // Reset: RAM is gone, the slot and NVS are not
+  void reboot(uint64_t now) {
+    MemoryStore store = rx.store;
+    rx = FirmwareReceiver<MemoryStore>();
+    rx.store = store;
+    rx.begin(id);
+    queue.clear();
+    nextLoopUs = now + PANEL_LOOP_MS * 1000 * (id % 4 + 1);
+  }
+};
+
+struct Delivery {
+  uint64_t atUs;
+  uint8_t to; // 0 = master, else panel id (0xFF = every panel)
+  Packet pkt;
+  bool operator<(const Delivery &o) const { return atUs > o.atUs; }
+};
+
+struct Sim {
+  std::vector<SimPanel> panels;
+  std::priority_queue<Delivery> air;
+  std::deque<uint64_t> radioQueue; // end of airtime of frames not yet sent
+  uint64_t radioFreeUs = 0;
+  uint32_t lossPct = DEFAULT_LOSS;
+  float rateMbps = DEFAULT_RATE;
+  std::deque<FwStatusPacket> toMaster;
+  uint32_t frames = 0;
+
+  uint32_t frameUs(size_t len) const {
+    return PREAMBLE_US + (uint32_t)((len + FRAME_OVERHEAD_BYTES) * 8 / rateMbps);
+  }
+
+  bool lost() const { return (uint32_t)(rand() % 100) < lossPct; }
+
+  // Queue a frame on the shared channel. `to` as in Delivery.
+  bool send(uint8_t to, const uint8_t *data, size_t len) {
+    while (!radioQueue.empty() && radioQueue.front() <= simUs) {
+      radioQueue.pop_front();
+    }
+    if (radioQueue.size() >= RADIO_QUEUE)
+      return false;
+    uint64_t start = std::max(simUs, radioFreeUs);
+    uint64_t end = start + frameUs(len);
+    bool delivered = true;
+    if (to != 0xFF) {
+      // Retried until an ACK comes back
+      delivered = false;
+      for (uint8_t t = 0; t < UNICAST_TRIES && !delivered; t++) {
+        delivered = !lost();
+        end += ACK_US + (delivered ? 0 : frameUs(len));
+      }
+    }
+    radioFreeUs = end;
+    radioQueue.push_back(end);
+    frames++;
+    Delivery d;
+    d.atUs = end;
+    d.to = to;
+    d.pkt.len = len;
+    memcpy(d.pkt.data, data, len);
+    if (delivered) {
+      air.push(d);
+    }
+    return true;
+  }
+
+  void deliver(const Delivery &d) {
+    if (d.to == 0) {
+      FwStatusPacket status;
+      memcpy(&status, d.pkt.data, sizeof(status));
+      toMaster.push_back(status);
+      return;
+    }
+    for (SimPanel &p : panels) {
+      if ((d.to == 0xFF && !lost()) || d.to == p.id) {
+        if (p.queue.size() < PANEL_QUEUE) {
+          p.queue.push_back(d.pkt);
+        } else {
+          p.drops++;
+        }
+      }
+    }
+  }
+
+  // One pass of the panel's loop(), as firmwareTick() runs it
+  void panelLoop(SimPanel &p) {
+    uint64_t busyUs = 0;
+    while (!p.queue.empty()) {
+      Packet pkt = p.queue.front();
+      p.queue.pop_front();
+      switch (pkt.data[0]) {
+      case PKT_FW_OFFER:
+        p.rx.onOffer(*(const FwOfferPacket *)pkt.data);
+        break;
+      case PKT_FW_CHUNK:
+        p.rx.onChunk(*(const FwChunkPacket *)pkt.data, pkt.len);
+        break;
+      case PKT_FW_POLL:
+        if (((const FwPollPacket *)pkt.data)->panelId == p.id) {
+          FwStatusPacket status;
+          p.rx.status(((const FwPollPacket *)pkt.data)->window, status);
+          send(0, (const uint8_t *)&status, sizeof(status));
+        }
+        break;
+      case PKT_FW_COMMIT:
+        if (p.rx.onCommit(*(const FwCommitPacket *)pkt.data, millis())) {
+          busyUs += (uint64_t)p.rx.chunks() * FW_CHUNK_BYTES / HASH_KB_PER_MS;
+        }
+        break;
+      }
+    }
+    if (p.rx.tick()) {
+      busyUs += ERASE_MS * 1000;
+    }
+    p.nextLoopUs = simUs + busyUs + PANEL_LOOP_MS * 1000;
+  }
+};
+
+static Sim *sim = nullptr;
+
+bool simSend(uint8_t panelId, const uint8_t *data, size_t len) {
+  return sim->send(panelId ? panelId : 0xFF, data, len);
+}
+
+static std::vector<uint8_t> image;
+
+bool simRead(uint32_t offset, uint8_t *data, uint16_t len) {
+  if (offset + len > image.size())
+    return false;
+  memcpy(data, &image[offset], len);
+  return true;
+}
+
+// Runs the sender until it finishes or, with stopAtChunks, until that many
+// chunks have gone out. Returns false on the simulation timeout.
+bool runRollout(Sim &s, FirmwareSender &sender, uint32_t stopAtChunks) {
+  uint64_t masterAtUs = simUs;
+  uint64_t limitUs = simUs + (uint64_t)SIM_TIMEOUT_MS * 1000;
+  while (sender.running()) {
+    if (stopAtChunks && sender.chunksSent >= stopAtChunks) {
+      sender.stop(millis());
+      return true;
+    }
+    // Next event: the master's tick, a frame landing, or a panel's loop
+    uint64_t next = masterAtUs;
+    if (!s.air.empty()) {
+      next = std::min(next, s.air.top().atUs);
+    }
+    for (SimPanel &p : s.panels) {
+      next = std::min(next, p.nextLoopUs);
+    }
+    simUs = std::max(simUs, next);
+    if (simUs > limitUs)
+      return false;
+
+    while (!s.air.empty() && s.air.top().atUs <= simUs) {
+      Delivery d = s.air.top();
+      s.air.pop();
+      s.deliver(d);
+    }
+    for (SimPanel &p : s.panels) {
+      if (p.nextLoopUs <= simUs) {
+        s.panelLoop(p);
+      }
+    }
+    // A status wakes the show task, as the receive callback's queue does
+    bool woken = !s.toMaster.empty();
+    while (!s.toMaster.empty()) {
+      sender.onStatus(s.toMaster.front());
+      s.toMaster.pop_front();
+    }
+    if (woken || masterAtUs <= simUs) {
+      uint32_t wait = sender.tick(millis(), simSend);
+      wait = std::max(std::min(wait, (uint32_t)SHOW_TASK_MAX_SLEEP_MS), 1U);
+      masterAtUs = simUs + wait * 1000ULL;
+    }
+  }
+  return true;
+}
+
+// ============================================================================
+// MAIN
+// ============================================================================
+
+struct Options {
+  uint8_t counts[MAX_STEPS] = {1, 2, 4, 8, 16, 32};
+  uint8_t steps = 6;
+  uint32_t size = DEFAULT_SIZE;
+  uint32_t lossPct = DEFAULT_LOSS;
+  float rateMbps = DEFAULT_RATE;
+  uint8_t burst = FW_DEFAULT_BURST;
+  uint16_t spacingMs = FW_DEFAULT_SPACING_MS;
+  uint32_t interruptPct = 0;
+  uint32_t seed = 1;
+};
+
+struct Result {
+  bool finished;
+  uint32_t ms;
+  uint8_t rounds;
+  uint32_t chunksSent;
+  uint32_t frames;
+  uint32_t polls;
+  uint32_t erases;
+  uint32_t drops;
+  uint8_t verified;
+};
+
+Result runPanels(const Options &opt, uint8_t count, const uint8_t *sha) {
+  srand(opt.seed);
+  Sim s;
+  s.lossPct = opt.lossPct;
+  s.rateMbps = opt.rateMbps;
+  s.panels.resize(count);
+  sim = &s;
+  simUs = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    s.panels[i].id = i + 1;
+    s.panels[i].drops = 0;
+    s.panels[i].reboot(0);
+  }
+
+  FirmwarePlan plan = {};
+  plan.size = image.size();
+  memcpy(plan.sha256, sha, 32);
+  plan.panelMask = count >= 32 ? 0xFFFFFFFFUL : (1UL << count) - 1;
+  plan.burst = opt.burst;
+  plan.spacingMs = opt.spacingMs;
+
+  Result r = {};
+  FirmwareSender sender;
+  sender.start(plan, simRead, millis());
+  r.finished = true;
+  if (opt.interruptPct) {
+    uint32_t stopAt = fwChunkCount(plan.size) * opt.interruptPct / 100;
+    r.finished = runRollout(s, sender, stopAt);
+    r.chunksSent = sender.chunksSent;
+    r.polls = sender.polls;
+    for (SimPanel &p : s.panels) {
+      p.reboot(simUs);
+    }
+    s.air = std::priority_queue<Delivery>();
+    sender.start(plan, simRead, millis());
+  }
+  r.finished = r.finished && runRollout(s, sender, 0);
+  r.ms = millis();
+  r.rounds = sender.round;
+  r.chunksSent += sender.chunksSent;
+  r.polls += sender.polls;
+  r.frames = s.frames;
+  for (SimPanel &p : s.panels) {
+    r.erases += p.rx.store.erases;
+    r.drops += p.drops;
+    r.verified += sender.state[p.id] == FW_STATE_VERIFIED;
+  }
+  return r;
+}
+
+// Known answer from FIPS 180-2, so a broken hash cannot pass as a rollout
+bool checkSha256() {
+  static const uint8_t abc[32] = {
+      0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40,
+      0xde, 0x5d, 0xae, 0x22, 0x23, 0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17,
+      0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad};
+  Sha256 sha;
+  sha.update("abc", 3);
+  uint8_t out[32];
+  sha.finish(out);
+  return memcmp(out, abc, 32) == 0;
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: fwsim [options]\n"
+          "  --panels N[,N...]  panel counts to roll out to (default "
+          "1,2,4,8,16,32)\n"
+          "  --size BYTES       image size (default %d)\n"
+          "  --loss PCT         frames lost per panel (default %d)\n"
+          "  --rate MBPS        PHY rate for airtime (default %d)\n"
+          "  --burst N          chunks per master tick (default %d)\n"
+          "  --spacing MS       between bursts (default %d)\n"
+          "  --interrupt PCT    stop and reset everything this far into the "
+          "first round, then resume\n"
+          "  --seed N           loss pattern (default 1)\n",
+          DEFAULT_SIZE, DEFAULT_LOSS, DEFAULT_RATE, FW_DEFAULT_BURST,
+          FW_DEFAULT_SPACING_MS);
+}
+
+int main(int argc, char **argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[++i] : nullptr;
+    if (!val) {
+      usage();
+      return 2;
+    }
+    if (!strcmp(arg, "--panels")) {
+      opt.steps = 0;
+      for (char *p = (char *)val; *p && opt.steps < MAX_STEPS;) {
+        opt.counts[opt.steps++] = std::min(strtoul(p, &p, 10), 32UL);
+        if (*p == ',')
+          p++;
+      }
+    } else if (!strcmp(arg, "--size")) {
+      opt.size = strtoul(val, nullptr, 10);
+    } else if (!strcmp(arg, "--loss")) {
+      opt.lossPct = std::min(atoi(val), 90);
+    } else if (!strcmp(arg, "--rate")) {
+      opt.rateMbps = atof(val);
+    } else if (!strcmp(arg, "--burst")) {
+      opt.burst = atoi(val);
+    } else if (!strcmp(arg, "--spacing")) {
+      opt.spacingMs = atoi(val);
+    } else if (!strcmp(arg, "--interrupt")) {
+      opt.interruptPct = std::min(atoi(val), 99);
+    } else if (!strcmp(arg, "--seed")) {
+      opt.seed = strtoul(val, nullptr, 10);
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (opt.size == 0 || opt.size > SLOT_BYTES || opt.rateMbps <= 0 ||
+      opt.burst == 0) {
+    usage();
+    return 2;
+  }
+  if (!checkSha256()) {
+    fprintf(stderr, "✗ SHA-256 known-answer test failed\n");
+    return 1;
+  }
+
+  image.resize(opt.size);
+  srand(opt.seed ^ 0x5EED);
+  for (uint8_t &b : image) {
+    b = rand();
+  }
+  uint8_t sha[32];
+  Sha256 hash;
+  hash.update(image.data(), image.size());
+  hash.finish(sha);
+
+  printf("# %u bytes, %u chunks, %u%% loss, %.1f Mbps, burst %u every %u ms\n",
+         opt.size, fwChunkCount(opt.size), opt.lossPct, opt.rateMbps,
+         opt.burst, opt.spacingMs);
+  printf("# panels verified rounds  chunks  sent/img  frames  polls  erases "
+         "qdrops   secs  vs 1\n");
+  uint32_t firstMs = 0;
+  bool ok = true;
+  for (uint8_t i = 0; i < opt.steps; i++) {
+    uint8_t count = opt.counts[i];
+    if (count == 0)
+      continue;
+    Result r = runPanels(opt, count, sha);
+    if (!firstMs)
+      firstMs = r.ms;
+    printf("%8u %8u %6u %7u %9.2f %7u %6u %7u %6u %6.1f %5.2f%s\n", count,
+           r.verified, r.rounds, r.chunksSent,
+           (float)r.chunksSent / fwChunkCount(opt.size), r.frames, r.polls,
+           r.erases, r.drops, r.ms / 1000.0f, (float)r.ms / firstMs,
+           r.finished ? "" : "  (timed out)");
+    ok &= r.finished && r.verified == count;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Just enough of the Arduino core for the shared headers (config, effects,
+// sequences, journal) to compile in the host tools. Each tool defines
+// millis() (the renderer's is a simulated clock) and the Serial object,
+// which writes to stderr only when enabled.
+
+#include <algorithm>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_ptr(p) (*(const void *const *)(p))
+
+using std::max;
+using std::min;
+
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+uint32_t millis();
+
+class HostSerial {
+public:
+  bool enabled = false;
+
+  void print(const char *s) { out("%s", s); }
+  void print(char c) { out("%c", c); }
+  void print(int v) { out("%d", v); }
+  void print(unsigned v) { out("%u", v); }
+  void print(long v) { out("%ld", v); }
+  void print(unsigned long v) { out("%lu", v); }
+  void print(double v) { out("%.2f", v); }
+
+  template <typename T> void println(T v) {
+    print(v);
+    println();
+  }
+  void println() { out("\n"); }
+
+  void printf(const char *fmt, ...) {
+    if (!enabled)
+      return;
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+  }
+
+private:
+  template <typename T> void out(const char *fmt, T v) {
+    if (enabled)
+      fprintf(stderr, fmt, v);
+  }
+  void out(const char *s) {
+    if (enabled)
+      fputs(s, stderr);
+  }
+};
+
+extern HostSerial Serial;
+
+#endif
@@ -0,0 +1,482 @@
+// MQTT load generator (host build: pio run -e loadgen)
+//
+// Stands in for the broker: the master (built with env:master_bench, or any
+// build with MQTT_SERVER pointing here) connects to this program, which
+// speaks just enough MQTT 3.1.1 to accept the connection, then publishes
+// command streams at fixed rates straight down the master's subscription.
+// Each rate step is bracketed by {"bench": "start"} and {"bench":
+// "report"}, and the master's report is printed next to what was sent.
+//
+//   loadgen --rate 50,100,200,400 [--seconds 10] [--debug 80] [--pad 600]
+//   loadgen --rate 400 --priority 20
+//
+// --priority mixes blackout/release pairs into the stream, to measure the
+// priority lane's worst case while the normal queue is under load.
+//
+// Like a real broker, outgoing QoS 0 messages queue up while the master's
+// TCP window is closed and are dropped once --queue messages are waiting.
+
+#include "config.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#define DEFAULT_PORT 1883
+#define DEFAULT_SECONDS 10
+#define DEFAULT_QUEUE 1000 // mosquitto's max_queued_messages default
+#define SETTLE_MS 2000     // let the master drain before asking for a report
+#define REPORT_TIMEOUT_MS 5000
+#define MAX_STEPS 16
+
+HostSerial Serial;
+
+static const char *commandTopic = "ta25stage/command";
+static const char *benchTopic = "ta25stage/master/bench";
+
+typedef std::chrono::steady_clock Clock;
+static const Clock::time_point started = Clock::now();
+
+uint32_t millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                                                               started)
+      .count();
+}
+
+// ============================================================================
+// BROKER STAND-IN
+// ============================================================================
+
+struct Options {
+  uint16_t port = DEFAULT_PORT;
+  uint32_t rates[MAX_STEPS];
+  uint8_t steps = 0;
+  uint32_t seconds = DEFAULT_SECONDS;
+  uint8_t debugPct = 100;
+  uint16_t regions = 4;
+  uint8_t panels = 0;
+  uint32_t pad = 0;
+  uint32_t queueLimit = DEFAULT_QUEUE;
+  uint32_t priority = 0; // blackout/release commands per step
+};
+
+class BrokerLink {
+public:
+  int fd = -1;
+  bool subscribed = false;
+  uint32_t queueDrops = 0; // dropped here because the master fell behind
+  uint32_t queuePeak = 0;
+  std::string benchReport; // payload of the last message on benchTopic
+
+  bool accept(uint16_t port) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listener, (sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listener, 1) < 0) {
+      fprintf(stderr, "✗ Cannot listen on port %u: %s\n", port,
+              strerror(errno));
+      return false;
+    }
+    fprintf(stderr, "Waiting for the master on port %u...\n", port);
+
+    sockaddr_in peer = {};
+    socklen_t peerLen = sizeof(peer);
+    fd = ::accept(listener, (sockaddr *)&peer, &peerLen);
+    close(listener);
+    if (fd < 0)
+      return false;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fprintf(stderr, "✓ Master connected from %s\n", inet_ntoa(peer.sin_addr));
+    return true;
+  }
+
+  // Queue a QoS 0 PUBLISH on the command topic. Returns false if dropped.
+  bool publish(const std::string &payload) {
+    if (outbox.size() >= queueLimit) {
+      queueDrops++;
+      return false;
+    }
+    std::string pkt;
+    size_t topicLen = strlen(commandTopic);
+    pkt.push_back(0x30);
+    remainingLength(pkt, 2 + topicLen + payload.size());
+    pkt.push_back(topicLen >> 8);
+    pkt.push_back(topicLen & 0xFF);
+    pkt.append(commandTopic);
+    pkt.append(payload);
+    outbox.push_back(pkt);
+    if (outbox.size() > queuePeak) {
+      queuePeak = outbox.size();
+    }
+    return true;
+  }
+
+  size_t queued() const { return outbox.size(); }
+
+  void setQueueLimit(uint32_t limit) { queueLimit = limit; }
+
+  // Move bytes both ways for up to waitMs. Returns false once the master
+  // has gone.
+  bool service(int waitMs) {
+    pollfd p = {fd, POLLIN, 0};
+    if (!outbox.empty())
+      p.events |= POLLOUT;
+    if (poll(&p, 1, waitMs) < 0 && errno != EINTR)
+      return false;
+    if (p.revents & (POLLERR | POLLHUP))
+      return false;
+
+    if (p.revents & POLLIN) {
+      uint8_t buf[2048];
+      ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n == 0 || (n < 0 && errno != EAGAIN))
+        return false;
+      if (n > 0)
+        inbox.insert(inbox.end(), buf, buf + n);
+      while (handlePacket()) {
+      }
+    }
+
+    while (!outbox.empty()) {
+      const std::string &head = outbox.front();
+      ssize_t n = send(fd, head.data() + sent, head.size() - sent,
+                       MSG_NOSIGNAL);
+      if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+      sent += n;
+      if (sent < head.size())
+        break;
+      outbox.pop_front();
+      sent = 0;
+    }
+    return true;
+  }
+
+private:
+  uint32_t queueLimit = DEFAULT_QUEUE;
+  std::deque<std::string> outbox;
+  size_t sent = 0; // bytes of outbox.front() already written
+  std::vector<uint8_t> inbox;
+
+  static void remainingLength(std::string &out, size_t len) {
+    do {
+      uint8_t b = len & 0x7F;
+      len >>= 7;
+      out.push_back(len ? (b | 0x80) : b);
+    } while (len);
+  }
+
+  void reply(const uint8_t *pkt, size_t len) {
+    outbox.push_front(std::string((const char *)pkt, len));
+    // Never cut into a message that is half written
+    if (sent && outbox.size() > 1) {
+      std::swap(outbox[0], outbox[1]);
+    }
+  }
+
+  // Consume one complete packet from the inbox, if there is one
+  bool handlePacket() {
+    size_t len = 0, pos = 1;
+    for (uint8_t shift = 0;; shift += 7) {
+      if (pos >= inbox.size() || shift > 21)
+        return false;
+      uint8_t b = inbox[pos++];
+      len |= (size_t)(b & 0x7F) << shift;
+      if (!(b & 0x80))
+        break;
+    }
+    if (inbox.size() < pos + len)
+      return false;
+
+    uint8_t type = inbox[0] >> 4;
+    const uint8_t *body = inbox.data() + pos;
+    switch (type) {
+    case 1: { // CONNECT
+      static const uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+      reply(connack, sizeof(connack));
+      break;
+    }
+    case 3: { // PUBLISH from the master (status, bench report)
+      if (len >= 2) {
+        size_t topicLen = (body[0] << 8) | body[1];
+        size_t skip = 2 + topicLen + ((inbox[0] & 0x06) ? 2 : 0);
+        if (skip <= len) {
+          std::string topic((const char *)body + 2, topicLen);
+          if (topic == benchTopic) {
+            benchReport.assign((const char *)body + skip, len - skip);
+          }
+        }
+      }
+      break;
+    }
+    case 8: { // SUBSCRIBE
+      if (len >= 2) {
+        uint8_t suback[] = {0x90, 0x03, body[0], body[1], 0x00};
+        reply(suback, sizeof(suback));
+        subscribed = true;
+      }
+      break;
+    }
+    case 12: { // PINGREQ
+      static const uint8_t pingresp[] = {0xD0, 0x00};
+      reply(pingresp, sizeof(pingresp));
+      break;
+    }
+    default:
+      break;
+    }
+    inbox.erase(inbox.begin(), inbox.begin() + pos + len);
+    return true;
+  }
+};
+
+// ============================================================================
+// COMMAND STREAMS
+// ============================================================================
+
+static uint32_t rng = 1;
+static uint32_t nextRandom(uint32_t n) {
+  rng = rng * 1103515245 + 12345;
+  return (rng >> 8) % n;
+}
+
+std::string makeCommand(const Options &opt) {
+  char buf[96];
+  std::string s;
+  if (nextRandom(100) < opt.debugPct) {
+    snprintf(buf, sizeof(buf),
+             "{\"debug\":true,\"panelId\":%u,\"effect\":%u,\"brightness\":%u,"
+             "\"speed\":%u,\"regions\":[",
+             opt.panels ? nextRandom(opt.panels + 1) : 0, nextRandom(6),
+             nextRandom(256), nextRandom(101));
+    s = buf;
+    for (uint16_t i = 0; i < opt.regions; i++) {
+      snprintf(buf, sizeof(buf), i ? ",%u" : "%u",
+               nextRandom(std::max<uint32_t>(STAGE_REGIONS, opt.regions)));
+      s += buf;
+    }
+    s += "]";
+  } else {
+    snprintf(buf, sizeof(buf),
+             "{\"debug\":false,\"sequence\":%u,\"effect\":%u,"
+             "\"brightness\":%u,\"speed\":%u",
+             nextRandom(4), nextRandom(6), nextRandom(256), nextRandom(101));
+    s = buf;
+  }
+  if (opt.pad) {
+    s += ",\"pad\":\"";
+    s.append(opt.pad, 'x');
+    s += "\"";
+  }
+  s += "}";
+  return s;
+}
+
+// Pull "key": <number> out of the flat-ish JSON report
+long field(const std::string &json, const char *key) {
+  std::string needle = std::string("\"") + key + "\":";
+  size_t at = json.find(needle);
+  return at == std::string::npos ? -1
+                                 : strtol(json.c_str() + at + needle.size(),
+                                          nullptr, 10);
+}
+
+bool wait(BrokerLink &link, uint32_t ms) {
+  uint32_t until = millis() + ms;
+  while ((int32_t)(until - millis()) > 0) {
+    if (!link.service(until - millis()))
+      return false;
+  }
+  return true;
+}
+
+// One rate step. Returns false if the master went away.
+bool runStep(BrokerLink &link, const Options &opt, uint32_t rate) {
+  link.queueDrops = 0;
+  link.queuePeak = 0;
+  link.benchReport.clear();
+  link.setQueueLimit(1000000); // control messages are never dropped
+  link.publish("{\"bench\":\"start\"}");
+  if (!wait(link, 500))
+    return false;
+  link.setQueueLimit(opt.queueLimit);
+
+  uint32_t published = 0, bytes = 0, priority = 0, priorityDrops = 0;
+  uint32_t total = rate * opt.seconds;
+  Clock::time_point t0 = Clock::now();
+  while (published < total) {
+    double elapsed =
+        std::chrono::duration<double>(Clock::now() - t0).count();
+    uint32_t due = std::min<uint32_t>(total, elapsed * rate);
+    for (; published < due; published++) {
+      // Spread evenly through the step, always ending on a release
+      if (priority < opt.priority &&
+          published >= (uint64_t)total * priority / opt.priority) {
+        bool release = priority % 2 || priority + 1 == opt.priority;
+        if (!link.publish(release ? "{\"priority\":\"release\"}"
+                                  : "{\"priority\":\"blackout\"}")) {
+          priorityDrops++;
+        }
+        priority++;
+      }
+      std::string cmd = makeCommand(opt);
+      bytes += cmd.size();
+      link.publish(cmd);
+    }
+    if (!link.service(1))
+      return false;
+  }
+  double sendSeconds =
+      std::chrono::duration<double>(Clock::now() - t0).count();
+
+  // Wait for the backlog to reach the master, then for it to drain
+  while (link.queued() > 0) {
+    if (!link.service(10))
+      return false;
+  }
+  if (!wait(link, SETTLE_MS))
+    return false;
+
+  link.setQueueLimit(1000000);
+  link.publish("{\"bench\":\"report\"}");
+  uint32_t deadline = millis() + REPORT_TIMEOUT_MS;
+  while (link.benchReport.empty() && (int32_t)(deadline - millis()) > 0) {
+    if (!link.service(10))
+      return false;
+  }
+
+  const std::string &r = link.benchReport;
+  uint32_t offered = published - link.queueDrops;
+  long received = field(r, "received");
+  printf("%7u %7u %6u %7u %7ld %6ld %7ld %6ld %6ld %7ld %6ld %6ld %6ld %6ld "
+         "%7ld\n",
+         rate, published, bytes / std::max<uint32_t>(published, 1),
+         link.queueDrops,
+         received >= 0 ? (long)offered - received : -1, received,
+         field(r, "accepted"),
+         field(r, "parse_errors") + field(r, "queue_drops"),
+         field(r, "coalesced"), field(r, "forwarded"),
+         field(r, "send_errors"), field(r, "p50"), field(r, "p90"),
+         field(r, "p99"), field(r, "max"));
+  if (opt.priority) {
+    printf("        priority: %u sent, %u brkdrop, %ld received, p99 %ld us, "
+           "max %ld us\n",
+           priority, priorityDrops, field(r, "priority_samples"),
+           field(r, "priority_p99"), field(r, "priority_max"));
+  }
+  fflush(stdout);
+  if (r.empty()) {
+    fprintf(stderr, "⚠ No bench report from the master at %u/s\n", rate);
+  } else if (sendSeconds > opt.seconds * 1.1) {
+    fprintf(stderr, "⚠ Generator fell behind at %u/s (%.1f s)\n", rate,
+            sendSeconds);
+  }
+  return true;
+}
+
+// ============================================================================
+// MAIN
+// ============================================================================
+
+void usage() {
+  fprintf(stderr,
+          "usage: loadgen --rate N[,N...] [options]\n"
+          "  --seconds N   length of each rate step (default %d)\n"
+          "  --debug PCT   share of direct-control commands; the rest start "
+          "sequences (default 100)\n"
+          "  --regions N   regions listed per direct-control command "
+          "(default 4)\n"
+          "  --panels N    address panels 0..N at random (default 0 = "
+          "broadcast only)\n"
+          "  --pad BYTES   extra payload bytes, to probe the MQTT buffer size\n"
+          "  --priority N  blackout/release commands mixed into each step\n"
+          "  --queue N     broker-side queue limit in messages (default %d)\n"
+          "  --port N      port to listen on (default %d)\n",
+          DEFAULT_SECONDS, DEFAULT_QUEUE, DEFAULT_PORT);
+}
+
+int main(int argc, char **argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[++i] : nullptr;
+    if (!val) {
+      usage();
+      return 2;
+    }
+    if (!strcmp(arg, "--rate")) {
+      for (char *p = (char *)val; *p && opt.steps < MAX_STEPS;) {
+        opt.rates[opt.steps++] = strtoul(p, &p, 10);
+        if (*p == ',')
+          p++;
+      }
+    } else if (!strcmp(arg, "--seconds")) {
+      opt.seconds = atoi(val);
+    } else if (!strcmp(arg, "--debug")) {
+      opt.debugPct = std::min(atoi(val), 100);
+    } else if (!strcmp(arg, "--regions")) {
+      opt.regions = std::min(atoi(val), MAX_REGIONS);
+    } else if (!strcmp(arg, "--panels")) {
+      opt.panels = std::min(atoi(val), 255);
+    } else if (!strcmp(arg, "--pad")) {
+      opt.pad = atoi(val);
+    } else if (!strcmp(arg, "--priority")) {
+      opt.priority = atoi(val);
+    } else if (!strcmp(arg, "--queue")) {
+      opt.queueLimit = atoi(val);
+    } else if (!strcmp(arg, "--port")) {
+      opt.port = atoi(val);
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (opt.steps == 0 || opt.seconds == 0) {
+    usage();
+    return 2;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  BrokerLink link;
+  if (!link.accept(opt.port))
+    return 2;
+  while (!link.subscribed) {
+    if (!link.service(100)) {
+      fprintf(stderr, "✗ Master disconnected before subscribing\n");
+      return 1;
+    }
+  }
+  fprintf(stderr, "✓ Master subscribed, %u step(s) of %u s\n", opt.steps,
+          opt.seconds);
+
+  // sent:    published by the generator
+  // brkdrop: dropped here while the master was not reading
+  // lost:    reached the socket but never arrived at the callback
+  //          (oversized for the PubSubClient buffer)
+  // drop:    parse errors + show queue full on the master
+  printf("# rate/s    sent  bytes brkdrop    lost   recv  accept   drop "
+         "coalsc forward  txerr    p50    p90    p99     max\n");
+  for (uint8_t s = 0; s < opt.steps; s++) {
+    if (!runStep(link, opt, opt.rates[s])) {
+      fprintf(stderr, "✗ Master disconnected during the %u/s step\n",
+              opt.rates[s]);
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,147 @@
+#ifndef ACKS_H
+#define ACKS_H
+
+#include "config.h"
+#include "light_protocol.h"
+#include "link_protocol.h"
+
+// ============================================================================
+// COMMAND ACKNOWLEDGEMENTS
+// ============================================================================
+//
+// A command that carries an "id" is answered on the ack topic, once:
+//
+//   applied   every panel it addressed sent LIGHT_ACK after applying it
+//   partial   ACK_TIMEOUT_MS passed first; the panels that did not confirm
+//             are listed, so the app can resend to just those
+//   sent      priority commands, once the first copy is on air (panels do
+//             not confirm those; the lane repeats them instead)
+//
+// or with one of the nack reasons below. A light command is tracked from
+// the moment it goes out until its acks are in; the latency reported per
+// panel runs from the command's arrival over MQTT to its LIGHT_ACK, so it
+// includes the master's queue and both radio hops.
+//
+// The receive callback queues LIGHT_ACKs for the show task, which owns the
+// tracker and hands finished results to the net task for publishing.
+
+#define ACK_SLOTS 8          // light commands awaiting confirmation
+#define ACK_TIMEOUT_MS 500   // then reported as partial
+#define ACK_NO_ID 0          // the command carried no id
+
+enum AckStatus : uint8_t {
+  ACK_APPLIED = 0,
+  ACK_PARTIAL = 1,
+  ACK_SENT = 2,
+  NACK_PARSE_ERROR = 3, // the id is unknown, so it is reported as 0
+  NACK_QUEUE_FULL = 4,
+  NACK_SUPERSEDED = 5,  // a later command for the same layer replaced it
+  NACK_PREEMPTED = 6,   // a blackout or hold arrived after it
+  NACK_UNREACHABLE = 7, // unknown panel, or the radio refused the frame
+  NACK_NO_PANELS = 8,   // broadcast with no panel discovered yet
+  NACK_BAD_SEQUENCE = 9,
+  NACK_BUSY = 10 // ACK_SLOTS commands already awaiting confirmation
+};
+
+static const char *const ACK_STATUS_NAMES[] = {
+    "applied",     "partial",     "sent",      "parse_error",
+    "queue_full",  "superseded",  "preempted", "unreachable",
+    "no_panels",   "bad_sequence", "busy"};
+
+inline bool ackPositive(uint8_t status) { return status <= ACK_SENT; }
+
+// One answer for the ack topic. Panel bits are (id - 1), as in knownMask.
+struct CommandAck {
+  uint32_t id;
+  uint8_t status;
+  uint32_t expected;
+  uint32_t confirmed;
+  uint16_t latencyMs[MAX_PANELS]; // for the confirmed panels
+};
+
+// A LIGHT_ACK as the receive callback saw it
+struct AckEvent {
+  uint8_t panelId;
+  uint8_t commandId;
+  int64_t receivedUs;
+};
+
+class AckTracker {
+public:
+  AckTracker() { memset(slots, 0, sizeof(slots)); }
+
+  // Show task, once a command with an id is on air. False when every slot
+  // is taken.
+  bool begin(uint32_t id, uint8_t commandId, uint32_t expected,
+             int64_t arrivedUs, uint32_t now) {
+    for (uint8_t i = 0; i < ACK_SLOTS; i++) {
+      Slot &s = slots[i];
+      if (!s.used) {
+        s.used = true;
+        s.commandId = commandId;
+        s.sentAt = now;
+        s.arrivedUs = arrivedUs;
+        s.ack.id = id;
+        s.ack.expected = expected;
+        s.ack.confirmed = 0;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void onAck(const AckEvent &ev) {
+    if (ev.panelId == 0 || ev.panelId > MAX_PANELS) {
+      return;
+    }
+    uint32_t bit = 1UL << (ev.panelId - 1);
+    for (uint8_t i = 0; i < ACK_SLOTS; i++) {
+      Slot &s = slots[i];
+      if (s.used && s.commandId == ev.commandId && (s.ack.expected & bit) &&
+          !(s.ack.confirmed & bit)) {
+        int64_t ms = (ev.receivedUs - s.arrivedUs) / 1000;
+        s.ack.latencyMs[ev.panelId - 1] =
+            ms < 0 ? 0 : ms > 0xFFFF ? 0xFFFF : (uint16_t)ms;
+        s.ack.confirmed |= bit;
+        return;
+      }
+    }
+    // Late (already reported as partial) or a repeat; nothing to do
+  }
+
+  // Show task. Takes out one command that is complete or timed out.
+  bool poll(uint32_t now, CommandAck &out) {
+    for (uint8_t i = 0; i < ACK_SLOTS; i++) {
+      Slot &s = slots[i];
+      if (!s.used) {
+        continue;
+      }
+      bool complete = s.ack.confirmed == s.ack.expected;
+      if (complete || now - s.sentAt >= ACK_TIMEOUT_MS) {
+        s.ack.status = complete ? ACK_APPLIED : ACK_PARTIAL;
+        out = s.ack;
+        s.used = false;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void clear() {
+    for (uint8_t i = 0; i < ACK_SLOTS; i++) {
+      slots[i].used = false;
+    }
+  }
+
+private:
+  struct Slot {
+    bool used;
+    uint8_t commandId;
+    uint32_t sentAt;
+    int64_t arrivedUs;
+    CommandAck ack;
+  };
+  Slot slots[ACK_SLOTS];
+};
+
+#endif
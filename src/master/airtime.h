@@ -0,0 +1,384 @@
+#ifndef AIRTIME_H
+#define AIRTIME_H
+
+#include "bench.h"
+#include "config.h"
+#include "link_protocol.h"
+#include "sequences.h"
+#include <Arduino.h>
+#include <esp_wifi.h>
+
+// ============================================================================
+// ESP-NOW PHY RATE AND AIRTIME
+// ============================================================================
+//
+// ESP-NOW goes out at 1 Mbps 802.11b unless told otherwise, which keeps a
+// 24-byte command frame on air for ~730 us before the panel's ACK. The rate
+// is one setting for all of the master's ESP-NOW traffic (the IDF in the
+// Arduino core has esp_wifi_config_espnow_rate() but no per-peer rate),
+// kept in NVS and changed at runtime:
+//
+//   AIR_RATES     the settings offered, by name ("1M" ... "LR250")
+//   AirtimeMeter  counts every frame against the rate it went out at:
+//                 frames, bytes, estimated airtime, sends the driver
+//                 refused, unicasts the panel did not acknowledge, and the
+//                 time from esp_now_send() to its send callback
+//   RateSweep     steps through a set of rates, sending probe frames to
+//                 every known panel, and picks the one with the lowest
+//                 callback latency whose delivery stays reliable
+//
+// The long-range rates need WIFI_PROTOCOL_LR at both ends. Master and
+// panels enable it next to b/g/n, which leaves normal traffic alone.
+//
+// Airtime is estimated from the 802.11 framing (preamble, symbols, and the
+// ACK for a unicast), not measured. Retries and waiting for a busy channel
+// show up in the callback latency instead.
+
+enum AirModulation : uint8_t {
+  AIR_DSSS = 0, // 802.11b, long preamble
+  AIR_OFDM = 1, // 802.11g
+  AIR_HT = 2,   // 802.11n, HT20, long guard interval
+  AIR_LR = 3    // Espressif long range
+};
+
+struct AirRate {
+  const char *name;
+  wifi_phy_rate_t phy;
+  uint8_t modulation;
+  uint16_t kbps;
+};
+
+static const AirRate AIR_RATES[] = {
+    {"1M", WIFI_PHY_RATE_1M_L, AIR_DSSS, 1000},
+    {"2M", WIFI_PHY_RATE_2M_L, AIR_DSSS, 2000},
+    {"5.5M", WIFI_PHY_RATE_5M_L, AIR_DSSS, 5500},
+    {"11M", WIFI_PHY_RATE_11M_L, AIR_DSSS, 11000},
+    {"6M", WIFI_PHY_RATE_6M, AIR_OFDM, 6000},
+    {"12M", WIFI_PHY_RATE_12M, AIR_OFDM, 12000},
+    {"24M", WIFI_PHY_RATE_24M, AIR_OFDM, 24000},
+    {"54M", WIFI_PHY_RATE_54M, AIR_OFDM, 54000},
+    {"MCS0", WIFI_PHY_RATE_MCS0_LGI, AIR_HT, 6500},
+    {"MCS3", WIFI_PHY_RATE_MCS3_LGI, AIR_HT, 26000},
+    {"MCS7", WIFI_PHY_RATE_MCS7_LGI, AIR_HT, 65000},
+    {"LR500", WIFI_PHY_RATE_LORA_500K, AIR_LR, 500},
+    {"LR250", WIFI_PHY_RATE_LORA_250K, AIR_LR, 250}};
+#define AIR_RATE_COUNT (sizeof(AIR_RATES) / sizeof(AIR_RATES[0]))
+#define AIR_RATE_DEFAULT 0 // "1M", what ESP-NOW uses out of the box
+#define AIR_RATE_NONE 0xFF
+
+static_assert(AIR_RATE_COUNT <= 16, "RateSweepPlan.rateMask is 16 bits");
+
+inline uint8_t airRateByName(const char *name) {
+  for (uint8_t i = 0; i < AIR_RATE_COUNT; i++) {
+    if (strcasecmp(name, AIR_RATES[i].name) == 0) {
+      return i;
+    }
+  }
+  return AIR_RATE_NONE;
+}
+
+// MAC header, action frame and vendor element headers, and FCS around the
+// ESP-NOW payload
+#define ESPNOW_FRAME_OVERHEAD 43
+#define AIR_ACK_BYTES 14
+
+// Microseconds on air for one 802.11 frame of `bytes` bytes
+inline uint32_t airFrameUs(uint8_t modulation, uint32_t kbps, uint32_t bytes) {
+  uint32_t bits = bytes * 8;
+  if (modulation == AIR_OFDM || modulation == AIR_HT) {
+    // 4 us symbols, plus the 16 SERVICE and 6 tail bits; HT mixed format
+    // sends 16 us of HT training fields after the legacy preamble
+    uint32_t perSymbol = kbps * 4 / 1000;
+    uint32_t symbols = (16 + bits + 6 + perSymbol - 1) / perSymbol;
+    return (modulation == AIR_HT ? 36 : 20) + 4 * symbols;
+  }
+  // Long preamble and header. Espressif does not document LR framing, so
+  // LR is costed the same way at its nominal rate.
+  return 192 + (bits * 1000 + kbps - 1) / kbps;
+}
+
+// One ESP-NOW frame with `payload` bytes, plus SIFS and the panel's ACK at
+// the basic rate for a unicast
+inline uint32_t airtimeUs(const AirRate &rate, uint16_t payload,
+                          bool unicast) {
+  uint32_t us =
+      airFrameUs(rate.modulation, rate.kbps, ESPNOW_FRAME_OVERHEAD + payload);
+  if (unicast) {
+    bool ofdm = rate.modulation == AIR_OFDM || rate.modulation == AIR_HT;
+    us += ofdm ? 16 + airFrameUs(AIR_OFDM, 6000, AIR_ACK_BYTES)
+               : 10 + airFrameUs(AIR_DSSS, 1000, AIR_ACK_BYTES);
+  }
+  return us;
+}
+
+// ============================================================================
+// AIRTIME METER (any task)
+// ============================================================================
+//
+// The driver calls the send callback once per accepted frame, in send
+// order, so each callback is matched with the oldest send still in flight.
+// A frame the driver refuses gets no callback and is skipped. Two tasks
+// sending at once, or a burst of more than AIR_IN_FLIGHT frames, can
+// mismatch a pair, which only costs a latency sample. Broadcasts always
+// report success, so delivery is only counted for unicasts.
+
+#define AIR_IN_FLIGHT 16
+
+struct AirRateStats {
+  uint32_t frames;    // accepted by the driver
+  uint32_t bytes;     // ESP-NOW payload
+  uint32_t airtimeUs; // estimated
+  uint32_t sendErrors; // esp_now_send() refused (TX queue full)
+  uint32_t unicasts;
+  uint32_t deliveryFails;    // unicasts the panel did not acknowledge
+  LatencyHistogram callback; // esp_now_send() to its send callback
+};
+
+class AirtimeMeter {
+public:
+  AirtimeMeter() {
+    for (uint8_t i = 0; i < AIR_RATE_COUNT; i++) {
+      clearRate(i);
+    }
+  }
+
+  uint8_t rate() const { return current; }
+  void setRate(uint8_t index) { current = index; }
+
+  const AirRateStats &stats(uint8_t index) const { return rates[index]; }
+
+  void reset() {
+    portENTER_CRITICAL(&mux);
+    for (uint8_t i = 0; i < AIR_RATE_COUNT; i++) {
+      clearRate(i);
+    }
+    portEXIT_CRITICAL(&mux);
+  }
+
+  void resetRate(uint8_t index) {
+    portENTER_CRITICAL(&mux);
+    clearRate(index);
+    portEXIT_CRITICAL(&mux);
+  }
+
+  // Before esp_now_send(). Returns the ticket for sent().
+  uint32_t sending(bool unicast, int64_t nowUs) {
+    portENTER_CRITICAL(&mux);
+    uint32_t ticket = nextTicket++;
+    Flight &f = flights[ticket % AIR_IN_FLIGHT];
+    f.ticket = ticket;
+    f.startUs = nowUs;
+    f.rate = current;
+    f.unicast = unicast;
+    f.refused = false;
+    portEXIT_CRITICAL(&mux);
+    return ticket;
+  }
+
+  // After esp_now_send() returns
+  void sent(uint32_t ticket, uint16_t payload, bool accepted) {
+    portENTER_CRITICAL(&mux);
+    Flight &f = flights[ticket % AIR_IN_FLIGHT];
+    bool tracked = f.ticket == ticket; // not yet overwritten
+    uint8_t r = tracked ? f.rate : current;
+    bool unicast = tracked && f.unicast;
+    AirRateStats &s = rates[r];
+    if (accepted) {
+      s.frames++;
+      s.bytes += payload;
+      s.airtimeUs += airtimeUs(AIR_RATES[r], payload, unicast);
+      if (unicast) {
+        s.unicasts++;
+      }
+    } else {
+      s.sendErrors++;
+      if (tracked) {
+        f.refused = true;
+      }
+    }
+    portEXIT_CRITICAL(&mux);
+  }
+
+  // ESP-NOW send callback
+  void done(bool delivered, int64_t nowUs) {
+    portENTER_CRITICAL(&mux);
+    while (nextDone != nextTicket) {
+      Flight &f = flights[nextDone % AIR_IN_FLIGHT];
+      bool mine = f.ticket == nextDone && !f.refused;
+      nextDone++;
+      if (!mine) {
+        continue; // refused, or overwritten by a later send
+      }
+      AirRateStats &s = rates[f.rate];
+      s.callback.record(nowUs - f.startUs);
+      if (f.unicast && !delivered) {
+        s.deliveryFails++;
+      }
+      break;
+    }
+    portEXIT_CRITICAL(&mux);
+  }
+
+private:
+  struct Flight {
+    uint32_t ticket;
+    int64_t startUs;
+    uint8_t rate;
+    bool unicast;
+    bool refused;
+  };
+
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+  AirRateStats rates[AIR_RATE_COUNT];
+  Flight flights[AIR_IN_FLIGHT] = {};
+  uint32_t nextTicket = 0;
+  uint32_t nextDone = 0;
+  volatile uint8_t current = AIR_RATE_DEFAULT;
+
+  void clearRate(uint8_t index) {
+    AirRateStats &s = rates[index];
+    s.frames = 0;
+    s.bytes = 0;
+    s.airtimeUs = 0;
+    s.sendErrors = 0;
+    s.unicasts = 0;
+    s.deliveryFails = 0;
+    s.callback.reset();
+  }
+};
+
+// ============================================================================
+// RATE SWEEP (show task)
+// ============================================================================
+//
+// For each rate in the plan: switch to it, clear its counters, send
+// `probes` rounds of one RATE_PROBE to every known panel, spaced so live
+// traffic still gets through, then wait for the last callbacks. A rate
+// qualifies when at least RATE_SWEEP_MIN_DELIVERY percent of its unicasts
+// were acknowledged; the best is the qualifying rate with the lowest 95th
+// percentile callback latency. Live commands keep going out during the
+// sweep, at whichever rate is being tried.
+
+#define RATE_SWEEP_PROBES 50
+#define RATE_SWEEP_BYTES 24 // a light command frame on the 20-region stage
+#define RATE_SWEEP_INTERVAL_MS 10
+#define RATE_SWEEP_SETTLE_MS 200
+#define RATE_SWEEP_MIN_DELIVERY 99 // percent
+
+// Panels ignore these; only the MAC-level ACK matters
+typedef struct __attribute__((packed)) {
+  uint8_t type; // PKT_RATE_PROBE
+  uint8_t rate; // index into AIR_RATES
+  uint8_t round;
+  uint8_t padding[247];
+} RateProbePacket;
+
+struct RateSweepPlan {
+  uint16_t rateMask; // bit per AIR_RATES entry
+  uint8_t probes;    // rounds per rate
+  uint8_t bytes;     // probe payload size
+  bool apply;        // stay on the best rate afterwards
+};
+
+typedef bool (*ProbeSendFn)(uint8_t panelId, const uint8_t *data, size_t len);
+typedef bool (*RateApplyFn)(uint8_t index);
+
+class RateSweep {
+public:
+  // Results of the last sweep, for the net task once `completed` changes
+  RateSweepPlan plan = {};
+  uint8_t best = AIR_RATE_NONE;
+  uint8_t previous = AIR_RATE_DEFAULT;
+  volatile uint32_t completed = 0;
+
+  bool running() const { return rate != AIR_RATE_NONE; }
+
+  // False when there is nothing to probe
+  bool start(const RateSweepPlan &p, uint32_t knownPanels, uint8_t current) {
+    if (!knownPanels || !(p.rateMask & ((1U << AIR_RATE_COUNT) - 1))) {
+      return false;
+    }
+    plan = p;
+    panels = knownPanels;
+    previous = current;
+    best = AIR_RATE_NONE;
+    rate = nextRate(0);
+    round = 0;
+    switched = false;
+    nextAt = 0;
+    return true;
+  }
+
+  uint32_t tick(uint32_t now, AirtimeMeter &meter, ProbeSendFn send,
+                RateApplyFn applyRate) {
+    if (!running())
+      return SEQ_IDLE;
+    if (nextAt && (int32_t)(now - nextAt) < 0)
+      return nextAt - now;
+
+    if (!switched) {
+      switched = applyRate(rate);
+      if (!switched) {
+        return advance(now, applyRate); // the driver would not take it
+      }
+      meter.resetRate(rate);
+    }
+
+    if (round < plan.probes) {
+      RateProbePacket probe = {};
+      probe.type = PKT_RATE_PROBE;
+      probe.rate = rate;
+      probe.round = round;
+      uint8_t len = plan.bytes < 3 ? 3 : plan.bytes;
+      for (uint8_t id = 1; id <= MAX_PANELS; id++) {
+        if (panels & (1UL << (id - 1))) {
+          send(id, (const uint8_t *)&probe, len);
+        }
+      }
+      round++;
+      nextAt = now + (round < plan.probes ? RATE_SWEEP_INTERVAL_MS
+                                          : RATE_SWEEP_SETTLE_MS);
+      return nextAt - now;
+    }
+
+    const AirRateStats &s = meter.stats(rate);
+    uint32_t delivered = s.unicasts - s.deliveryFails;
+    if (s.unicasts && delivered * 100 >= s.unicasts * RATE_SWEEP_MIN_DELIVERY &&
+        (best == AIR_RATE_NONE ||
+         s.callback.percentile(95) < meter.stats(best).callback.percentile(95))) {
+      best = rate;
+    }
+    return advance(now, applyRate);
+  }
+
+private:
+  uint32_t panels = 0;
+  uint8_t rate = AIR_RATE_NONE;
+  uint8_t round = 0;
+  bool switched = false;
+  uint32_t nextAt = 0;
+
+  uint8_t nextRate(uint8_t from) const {
+    for (uint8_t i = from; i < AIR_RATE_COUNT; i++) {
+      if (plan.rateMask & (1U << i)) {
+        return i;
+      }
+    }
+    return AIR_RATE_NONE;
+  }
+
+  uint32_t advance(uint32_t now, RateApplyFn applyRate) {
+    rate = nextRate(rate + 1);
+    round = 0;
+    switched = false;
+    nextAt = 0;
+    if (running()) {
+      return 0;
+    }
+    applyRate(plan.apply && best != AIR_RATE_NONE ? best : previous);
+    completed++;
+    return SEQ_IDLE;
+  }
+};
+
+#endif
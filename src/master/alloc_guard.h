@@ -0,0 +1,198 @@
+#ifndef ALLOC_GUARD_H
+#define ALLOC_GUARD_H
+
+#include <Arduino.h>
+#include <stdlib.h>
+
+// ============================================================================
+// HEAP ALLOCATION GUARD
+// ============================================================================
+//
+// The steady-state paths (MQTT receive and decode, dispatch to ESP-NOW,
+// heartbeat) run on queues, static buffers and StaticJsonDocuments, so a
+// master can run for days without fragmenting the heap. Built with
+// ALLOC_GUARD and malloc, calloc and realloc wrapped at link time
+// (env:master_heapcheck) every allocation is checked against the zone the
+// calling task is in:
+//
+//   AllocScope   marks a steady-state path; an allocation inside counts
+//                against its zone, and with ALLOC_GUARD=2 aborts with the
+//                zone's name so the backtrace shows the culprit
+//   AllocExempt  marks a call into the network stack or NVS from inside a
+//                zone (esp_now_send, a socket write, a Preferences write).
+//                Those keep their own pools and are counted as "system"
+//
+// Only the net and show tasks are watched. Allocations the WiFi and lwIP
+// tasks make for themselves, and anything that calls heap_caps_malloc()
+// directly, are not seen. Without ALLOC_GUARD the classes compile to
+// nothing.
+
+#ifndef ALLOC_GUARD
+#define ALLOC_GUARD 0
+#endif
+
+enum AllocZone : uint8_t {
+  ALLOC_ZONE_NONE = 0,
+  ALLOC_ZONE_MQTT = 1,      // MQTT callback: decode and hand-off
+  ALLOC_ZONE_DISPATCH = 2,  // show task: light commands, sequences, beacons
+  ALLOC_ZONE_HEARTBEAT = 3, // status heartbeat
+  ALLOC_ZONES = 4
+};
+
+static const char *const ALLOC_ZONE_NAMES[ALLOC_ZONES] = {"none", "mqtt",
+                                                          "dispatch",
+                                                          "heartbeat"};
+
+struct AllocStats {
+  volatile uint32_t count[ALLOC_ZONES]; // [ALLOC_ZONE_NONE] is unused
+  volatile uint32_t bytes[ALLOC_ZONES];
+  volatile uint32_t system; // exempt calls into the network stack or NVS
+};
+
+#if ALLOC_GUARD
+
+#define ALLOC_GUARD_TASKS 2
+
+struct AllocTaskState {
+  TaskHandle_t task;
+  uint8_t zone;
+  uint8_t exempt;
+};
+
+inline AllocStats &allocStats() {
+  static AllocStats stats;
+  return stats;
+}
+
+inline AllocTaskState *allocTaskStates() {
+  static AllocTaskState states[ALLOC_GUARD_TASKS];
+  return states;
+}
+
+// The calling task's state, or nullptr for a task that is not watched
+inline AllocTaskState *allocTaskState() {
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  if (!self) {
+    return nullptr; // before the scheduler runs
+  }
+  AllocTaskState *states = allocTaskStates();
+  for (uint8_t i = 0; i < ALLOC_GUARD_TASKS; i++) {
+    if (states[i].task == self) {
+      return &states[i];
+    }
+  }
+  return nullptr;
+}
+
+// First thing in a task that uses AllocScope
+inline void allocGuardWatchTask() {
+  AllocTaskState *states = allocTaskStates();
+  for (uint8_t i = 0; i < ALLOC_GUARD_TASKS; i++) {
+    if (!states[i].task) {
+      states[i].task = xTaskGetCurrentTaskHandle();
+      return;
+    }
+  }
+}
+
+inline void allocGuardNote(size_t size) {
+  AllocTaskState *state = allocTaskState();
+  if (!state || state->zone == ALLOC_ZONE_NONE) {
+    return;
+  }
+  AllocStats &stats = allocStats();
+  if (state->exempt) {
+    stats.system++;
+    return;
+  }
+  stats.count[state->zone]++;
+  stats.bytes[state->zone] += size;
+#if ALLOC_GUARD >= 2
+  // ets_printf writes straight to the UART without allocating
+  ets_printf("\n✗ Heap allocation of %u bytes in the %s path\n",
+             (unsigned)size, ALLOC_ZONE_NAMES[state->zone]);
+  abort();
+#endif
+}
+
+class AllocScope {
+public:
+  explicit AllocScope(AllocZone zone) : state(allocTaskState()) {
+    if (state) {
+      previous = state->zone;
+      state->zone = zone;
+    }
+  }
+  ~AllocScope() { end(); }
+
+  // Leave the zone early, ahead of work that is not steady state
+  void end() {
+    if (state) {
+      state->zone = previous;
+      state = nullptr;
+    }
+  }
+
+private:
+  AllocTaskState *state;
+  uint8_t previous = ALLOC_ZONE_NONE;
+};
+
+class AllocExempt {
+public:
+  AllocExempt() : state(allocTaskState()) {
+    if (state) {
+      state->exempt++;
+    }
+  }
+  ~AllocExempt() {
+    if (state) {
+      state->exempt--;
+    }
+  }
+
+private:
+  AllocTaskState *state;
+};
+
+// Linked in place of the C library's with -Wl,--wrap=malloc (and calloc,
+// realloc); operator new ends up in malloc as well
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  allocGuardNote(size);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  allocGuardNote(count * size);
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  allocGuardNote(size);
+  return __real_realloc(ptr, size);
+}
+}
+
+#else
+
+inline void allocGuardWatchTask() {}
+
+class AllocScope {
+public:
+  explicit AllocScope(AllocZone) {}
+  void end() {}
+};
+
+class AllocExempt {
+public:
+  AllocExempt() {}
+};
+
+#endif
+
+#endif
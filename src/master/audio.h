@@ -0,0 +1,198 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include "audio_protocol.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// ============================================================================
+// AUDIO ANALYSIS
+// ============================================================================
+//
+// Runs once per block of AUDIO_BLOCK mono samples at AUDIO_SAMPLE_RATE
+// (16 ms), on the master's audio task or in the host test tool
+// (src/audiotest). Integer arithmetic throughout; the float math only
+// builds the tables once.
+//
+//   Hann window -> 256-point fixed-point FFT -> AUDIO_BANDS band energies
+//   -> log levels (0.75 dB steps) -> envelope follower with auto-ranging
+//   -> intensity; rise over per-band baseline -> adaptive threshold -> beat
+//
+// The FFT halves its data every stage, so it cannot overflow on full-scale
+// input and the spectrum comes out scaled by 1/N. The log step keeps the
+// band levels meaningful across that range.
+
+#define AUDIO_SAMPLE_RATE 16000
+#define AUDIO_BLOCK 256 // samples per block, also the FFT size
+#define AUDIO_FFT_BITS 8
+#define AUDIO_BLOCK_MS (AUDIO_BLOCK * 1000 / AUDIO_SAMPLE_RATE)
+
+#define AUDIO_FLUX_HISTORY 16      // blocks averaged for the beat threshold
+#define AUDIO_BEAT_REFRACTORY 6    // blocks (~100 ms) between beats
+#define AUDIO_FLUX_DEADBAND 8      // log steps (6 dB) of rise ignored as noise
+#define AUDIO_RANGE 40             // log steps (30 dB) mapped onto 0-255
+#define AUDIO_PEAK_DECAY_BLOCKS 16 // auto-range falls 1 step per this many
+
+// First FFT bin of each band (62.5 Hz per bin); the last band runs to N/2
+static const uint8_t AUDIO_BAND_START[AUDIO_BANDS + 1] = {1, 3, 11, 41, 128};
+
+struct AudioFrame {
+  uint8_t intensity; // envelope, 0-255 after auto-ranging
+  uint8_t bands[AUDIO_BANDS];
+  bool beat;
+};
+
+class AudioAnalyzer {
+public:
+  AudioAnalyzer() {
+    for (uint16_t i = 0; i < AUDIO_BLOCK; i++) {
+      window[i] = (int16_t)(32767 * (0.5f - 0.5f * cosf(2 * (float)M_PI * i /
+                                                          AUDIO_BLOCK)));
+    }
+    for (uint16_t i = 0; i < AUDIO_BLOCK / 2; i++) {
+      cosTable[i] = (int16_t)(16384 * cosf(2 * (float)M_PI * i / AUDIO_BLOCK));
+      sinTable[i] = (int16_t)(16384 * sinf(2 * (float)M_PI * i / AUDIO_BLOCK));
+    }
+    reset();
+  }
+
+  void reset() {
+    memset(baseline, 0, sizeof(baseline));
+    memset(fluxHistory, 0, sizeof(fluxHistory));
+    fluxSum = 0;
+    fluxAt = 0;
+    envelope = 0;
+    peak = AUDIO_RANGE;
+    peakAge = 0;
+    sinceBeat = AUDIO_BEAT_REFRACTORY;
+    beats = 0;
+  }
+
+  uint32_t beatCount() const { return beats; }
+
+  AudioFrame process(const int16_t *samples) {
+    for (uint16_t i = 0; i < AUDIO_BLOCK; i++) {
+      uint16_t j = reverse(i);
+      re[j] = (int32_t)samples[i] * window[i] >> 15;
+      im[j] = 0;
+    }
+    fft();
+
+    AudioFrame out;
+    uint8_t logBands[AUDIO_BANDS];
+    uint8_t loudest = 0;
+    int32_t flux = 0;
+    for (uint8_t b = 0; b < AUDIO_BANDS; b++) {
+      uint32_t energy = 0;
+      for (uint8_t k = AUDIO_BAND_START[b]; k < AUDIO_BAND_START[b + 1]; k++) {
+        uint32_t e = (uint32_t)(re[k] * re[k]) + (uint32_t)(im[k] * im[k]);
+        energy = energy + e < energy ? 0xFFFFFFFF : energy + e;
+      }
+      logBands[b] = log2x4(energy);
+      if (logBands[b] > loudest)
+        loudest = logBands[b];
+
+      // Onsets show up as a band rising over its own running average; bass
+      // counts double. The narrow low bands swing several dB from block to
+      // block on noise alone, hence the average and the deadband.
+      int32_t level16 = (int32_t)logBands[b] << 4;
+      int32_t rise = (level16 - baseline[b]) / 16 - AUDIO_FLUX_DEADBAND;
+      if (rise > 0)
+        flux += b == 0 ? 2 * rise : rise;
+      baseline[b] += (level16 - baseline[b]) / 8;
+    }
+
+    // Envelope: fast attack, slow release, in log steps x 16
+    int32_t target = loudest << 4;
+    envelope += (target - envelope) * (target > envelope ? 8 : 1) / 16;
+
+    // Auto-range: the loudest recent level maps to 255
+    if (loudest >= peak) {
+      peak = loudest;
+      peakAge = 0;
+    } else if (++peakAge >= AUDIO_PEAK_DECAY_BLOCKS && peak > AUDIO_RANGE) {
+      peak--;
+      peakAge = 0;
+    }
+    int32_t floor16 = (peak - AUDIO_RANGE) << 4;
+    out.intensity = clamp((envelope - floor16) * 255 / (AUDIO_RANGE << 4));
+    for (uint8_t b = 0; b < AUDIO_BANDS; b++) {
+      out.bands[b] = clamp(((int32_t)logBands[b] - (peak - AUDIO_RANGE)) *
+                           255 / AUDIO_RANGE);
+    }
+
+    // Beat: flux well above its recent average, at most one per refractory
+    int32_t mean = fluxSum / AUDIO_FLUX_HISTORY;
+    out.beat = sinceBeat >= AUDIO_BEAT_REFRACTORY &&
+               flux > mean * 3 / 2 + 6 && out.intensity > 32;
+    sinceBeat = out.beat ? 0 : sinceBeat + 1;
+    if (out.beat)
+      beats++;
+    fluxSum += flux - fluxHistory[fluxAt];
+    fluxHistory[fluxAt] = flux;
+    fluxAt = (fluxAt + 1) % AUDIO_FLUX_HISTORY;
+    return out;
+  }
+
+private:
+  int16_t window[AUDIO_BLOCK];
+  int16_t cosTable[AUDIO_BLOCK / 2];
+  int16_t sinTable[AUDIO_BLOCK / 2];
+  int32_t re[AUDIO_BLOCK];
+  int32_t im[AUDIO_BLOCK];
+
+  int32_t baseline[AUDIO_BANDS]; // log steps x 16, per band
+  int32_t fluxHistory[AUDIO_FLUX_HISTORY];
+  int32_t fluxSum;
+  uint8_t fluxAt;
+  int32_t envelope; // log steps x 16
+  uint8_t peak;
+  uint8_t peakAge;
+  uint8_t sinceBeat;
+  uint32_t beats;
+
+  static uint16_t reverse(uint16_t i) {
+    uint16_t r = 0;
+    for (uint8_t b = 0; b < AUDIO_FFT_BITS; b++) {
+      r = (r << 1) | ((i >> b) & 1);
+    }
+    return r;
+  }
+
+  // In-place radix-2 decimation in time on bit-reversed input, halving each
+  // stage. Q14 twiddles keep both products of a butterfly within int32.
+  void fft() {
+    for (uint16_t len = 2; len <= AUDIO_BLOCK; len <<= 1) {
+      uint16_t half = len >> 1;
+      uint16_t step = AUDIO_BLOCK / len;
+      for (uint16_t start = 0; start < AUDIO_BLOCK; start += len) {
+        for (uint16_t k = 0; k < half; k++) {
+          int32_t c = cosTable[k * step];
+          int32_t s = sinTable[k * step];
+          int32_t *ar = &re[start + k], *ai = &im[start + k];
+          int32_t *br = &re[start + k + half], *bi = &im[start + k + half];
+          int32_t tr = (*br * c + *bi * s) >> 14;
+          int32_t ti = (*bi * c - *br * s) >> 14;
+          *br = (*ar - tr) >> 1;
+          *bi = (*ai - ti) >> 1;
+          *ar = (*ar + tr) >> 1;
+          *ai = (*ai + ti) >> 1;
+        }
+      }
+    }
+  }
+
+  // 4 * log2(energy), i.e. 0.75 dB steps; 0 for x < 1
+  static uint8_t log2x4(uint32_t x) {
+    if (x == 0)
+      return 0;
+    uint8_t bits = 31 - __builtin_clz(x);
+    uint8_t frac = bits >= 2 ? (x >> (bits - 2)) & 3 : (x << (2 - bits)) & 3;
+    return bits * 4 + frac;
+  }
+
+  static uint8_t clamp(int32_t v) { return v < 0 ? 0 : v > 255 ? 255 : v; }
+};
+
+#endif
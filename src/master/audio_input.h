@@ -0,0 +1,81 @@
+#ifndef AUDIO_INPUT_H
+#define AUDIO_INPUT_H
+
+#include "audio.h"
+#include <driver/i2s.h>
+
+// ============================================================================
+// I2S MICROPHONE INPUT
+// ============================================================================
+//
+// Built only with -D AUDIO_INPUT=1 (env:master_audio). Reads a MEMS
+// microphone with 24-bit I2S output (INMP441, SPH0645 and similar; L/R tied
+// low) as 32-bit left-channel slots and scales each to int16. read() blocks
+// on the DMA queue for one analysis block, so the audio task paces itself
+// at one block per 16 ms without any timer.
+
+#ifndef AUDIO_I2S_BCK
+#define AUDIO_I2S_BCK 26
+#endif
+#ifndef AUDIO_I2S_WS
+#define AUDIO_I2S_WS 25
+#endif
+#ifndef AUDIO_I2S_DATA
+#define AUDIO_I2S_DATA 33
+#endif
+#ifndef AUDIO_I2S_SHIFT
+#define AUDIO_I2S_SHIFT 14 // 32-bit slot to int16, with 4x gain for speech-level mics
+#endif
+
+#define AUDIO_DMA_BUFFERS 4
+
+class AudioInput {
+public:
+  bool begin() {
+    i2s_config_t config = {};
+    config.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX);
+    config.sample_rate = AUDIO_SAMPLE_RATE;
+    config.bits_per_sample = I2S_BITS_PER_SAMPLE_32BIT;
+    config.channel_format = I2S_CHANNEL_FMT_ONLY_LEFT;
+    config.communication_format = I2S_COMM_FORMAT_STAND_I2S;
+    config.intr_alloc_flags = ESP_INTR_FLAG_LEVEL1;
+    config.dma_buf_count = AUDIO_DMA_BUFFERS;
+    config.dma_buf_len = AUDIO_BLOCK;
+
+    i2s_pin_config_t pins = {};
+    pins.mck_io_num = I2S_PIN_NO_CHANGE;
+    pins.bck_io_num = AUDIO_I2S_BCK;
+    pins.ws_io_num = AUDIO_I2S_WS;
+    pins.data_out_num = I2S_PIN_NO_CHANGE;
+    pins.data_in_num = AUDIO_I2S_DATA;
+
+    if (i2s_driver_install(I2S_NUM_0, &config, 0, nullptr) != ESP_OK) {
+      return false;
+    }
+    if (i2s_set_pin(I2S_NUM_0, &pins) != ESP_OK) {
+      i2s_driver_uninstall(I2S_NUM_0);
+      return false;
+    }
+    return true;
+  }
+
+  // One block of AUDIO_BLOCK samples. False on a driver error or short read.
+  bool read(int16_t *out) {
+    size_t bytes = 0;
+    if (i2s_read(I2S_NUM_0, raw, sizeof(raw), &bytes, portMAX_DELAY) !=
+            ESP_OK ||
+        bytes != sizeof(raw)) {
+      return false;
+    }
+    for (uint16_t i = 0; i < AUDIO_BLOCK; i++) {
+      int32_t s = raw[i] >> AUDIO_I2S_SHIFT;
+      out[i] = s > 32767 ? 32767 : s < -32768 ? -32768 : s;
+    }
+    return true;
+  }
+
+private:
+  int32_t raw[AUDIO_BLOCK];
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <string.h>
+
+// ============================================================================
+// LOAD BENCHMARK COUNTERS
+// ============================================================================
+//
+// Filled in on every command, reset by {"bench": "start"} and published on
+// ta25stage/master/bench by {"bench": "report"}. The host load generator
+// (src/loadgen) drives both; see docs/protocols.md.
+//
+// Each counter has one writer (net task, show task or the ESP-NOW send
+// callback). A reset from the net task may race an update from another
+// task, which only costs a sample.
+
+// Log-linear histogram: four buckets per power of two, so any percentile
+// read back is within 25% of the true value. Covers up to ~16 s.
+#define LATENCY_BUCKETS 92
+
+class LatencyHistogram {
+public:
+  void reset() {
+    memset(buckets, 0, sizeof(buckets));
+    samples = 0;
+    maxUs = 0;
+  }
+
+  void record(uint32_t us) {
+    buckets[bucketOf(us)]++;
+    samples++;
+    if (us > maxUs) {
+      maxUs = us;
+    }
+  }
+
+  uint32_t count() const { return samples; }
+  uint32_t max() const { return maxUs; }
+
+  // Upper bound of the bucket holding the given percentile (0-100)
+  uint32_t percentile(float pct) const {
+    if (samples == 0)
+      return 0;
+    uint32_t rank = (uint32_t)(samples * pct / 100.0f);
+    if (rank >= samples)
+      rank = samples - 1;
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+      seen += buckets[i];
+      if (seen > rank)
+        return upperBound(i) < maxUs ? upperBound(i) : maxUs;
+    }
+    return maxUs;
+  }
+
+private:
+  uint32_t buckets[LATENCY_BUCKETS];
+  uint32_t samples;
+  uint32_t maxUs;
+
+  static uint8_t bucketOf(uint32_t us) {
+    if (us < 4)
+      return us;
+    uint8_t bits = 32 - __builtin_clz(us);
+    uint8_t sub = (us >> (bits - 3)) & 3; // two bits below the top one
+    uint16_t i = (bits - 2) * 4 + sub;
+    return i < LATENCY_BUCKETS ? i : LATENCY_BUCKETS - 1;
+  }
+
+  static uint32_t upperBound(uint8_t i) {
+    if (i < 4)
+      return i;
+    uint8_t bits = i / 4 + 2;
+    return ((uint32_t)(4 + i % 4 + 1) << (bits - 3)) - 1;
+  }
+};
+
+struct BenchMetrics {
+  volatile uint32_t received;      // messages handed over by PubSubClient
+  volatile uint32_t parseErrors;   // not valid JSON (or truncated)
+  volatile uint32_t accepted;      // decoded and queued for the show task
+  volatile uint32_t queueDrops;    // rejected because the queue was full
+  volatile uint32_t coalesced;     // superseded in the queue, never sent
+  volatile uint32_t forwarded;     // light commands handled by the show task
+  volatile uint32_t frames;        // ESP-NOW frames queued for the radio
+  volatile uint32_t sendErrors;    // esp_now_send() refused (TX queue full)
+  volatile uint32_t deliveryFails; // unicast frames not acknowledged
+  volatile uint32_t queuePeak;
+  LatencyHistogram latency;        // MQTT callback to ESP-NOW dispatch
+  LatencyHistogram priority;       // same, for the priority lane
+  int64_t startedUs;
+};
+
+#endif
@@ -0,0 +1,272 @@
+#ifndef CUES_H
+#define CUES_H
+
+#include "config.h"
+#include "cue_protocol.h"
+#include "peers.h"
+#include "recorder.h"
+#include "sequences.h"
+#include <atomic>
+
+// ============================================================================
+// MASTER CUE LISTS
+// ============================================================================
+//
+// A CueShow is the master's view of a show: one full LightCommand per cue
+// plus how long it holds. It is built on the net task (from MQTT JSON or
+// the recorded journal), handed to the show task, split per panel and
+// uploaded. During playback the show task only sends CUE_GO packets.
+
+#define CUE_UPLOAD_SPACING_MS 8
+
+struct ShowCue {
+  LightCommand cmd;
+  uint32_t holdMs; // 0 = wait for a manual GO
+};
+
+struct CueShow {
+  uint16_t showId;
+  uint16_t count;
+  ShowCue cues[MAX_CUES];
+};
+
+// Convert a full command into one panel's cue. Commands addressed to a
+// different panel leave this panel's previous cue unchanged.
+PanelCue panelCueFor(const ShowCue &cue, uint8_t panelId,
+                     const PeerEntry &peer, const PanelCue *previous) {
+  if (cue.cmd.panelId != 0 && cue.cmd.panelId != panelId && previous) {
+    PanelCue same = *previous;
+    same.followMs = cue.holdMs;
+    return same;
+  }
+
+  // Cues carry plain region bits, so groups are resolved here
+  RegionSet regions;
+  RegionGroups::expand(cue.cmd, regions);
+  PanelCue pc = {};
+  pc.regionMask = regions.extract(
+      peer.firstRegion, peer.regionCount < 32 ? peer.regionCount : 32);
+  pc.effect = cue.cmd.effect;
+  pc.brightness = cue.cmd.brightness;
+  pc.speed = cue.cmd.speed;
+  pc.followMs = cue.holdMs;
+  return pc;
+}
+
+// Net task. One cue per journal record; each cue holds until the next
+// record's timestamp. The final cue waits for a GO.
+bool compileShowFromJournal(CueShow &show) {
+  JournalReader reader;
+  if (!reader.open())
+    return false;
+
+  show.count = 0;
+  LightCommand cmd;
+  uint32_t dt;
+  uint32_t sinceCueUs = 0;
+  while (show.count < MAX_CUES && reader.next(cmd, dt)) {
+    sinceCueUs += dt;
+    // Cue lists carry the base look only; overlay records are skipped
+    if (cmd.layer != 0 || cmd.blend == BLEND_REMOVE)
+      continue;
+    if (show.count > 0) {
+      show.cues[show.count - 1].holdMs = sinceCueUs / 1000;
+    }
+    sinceCueUs = 0;
+    show.cues[show.count].cmd = cmd;
+    show.cues[show.count].holdMs = 0;
+    show.count++;
+  }
+  reader.close();
+  return show.count > 0;
+}
+
+// ============================================================================
+// CUE UPLOADER (show task)
+// ============================================================================
+//
+// Sends BEGIN, CHUNKs and COMMIT to each known panel in turn, one packet
+// per CUE_UPLOAD_SPACING_MS so the ESP-NOW TX queue never overflows.
+
+typedef bool (*PacketSendFn)(uint8_t panelId, const uint8_t *data, size_t len);
+
+class CueUploader {
+public:
+  // Last CUE_STATUS per panel, written from the ESP-NOW receive callback
+  volatile uint16_t panelShowId[MAX_PANELS + 1] = {};
+  volatile uint8_t panelStatus[MAX_PANELS + 1] = {};
+
+  bool busy() const { return panel != 0; }
+
+  void start(const CueShow &source, PeerTable &table) {
+    show = &source;
+    peers = &table;
+    panel = peers->nextKnown(0);
+    if (!panel) {
+      Serial.println("⚠ No panels discovered, cue upload skipped");
+      return;
+    }
+    nextChunk = 0;
+    phase = PHASE_BEGIN;
+    nextSendAt = millis();
+    Serial.print("Uploading show ");
+    Serial.print(show->showId);
+    Serial.print(" (");
+    Serial.print(show->count);
+    Serial.println(" cues) to panels");
+  }
+
+  uint32_t tick(uint32_t now, PacketSendFn send) {
+    if (!busy())
+      return SEQ_IDLE;
+    if ((int32_t)(now - nextSendAt) < 0)
+      return nextSendAt - now;
+
+    switch (phase) {
+    case PHASE_BEGIN: {
+      if (!buildPanelCues()) {
+        // Panel timed out since the last step
+        panel = peers->nextKnown(panel);
+        return busy() ? 0 : SEQ_IDLE;
+      }
+      CueBeginPacket pkt = {PKT_CUE_BEGIN, panel, show->showId, show->count};
+      send(panel, (const uint8_t *)&pkt, sizeof(pkt));
+      phase = PHASE_CHUNKS;
+      break;
+    }
+    case PHASE_CHUNKS: {
+      CueChunkPacket pkt;
+      pkt.type = PKT_CUE_CHUNK;
+      pkt.panelId = panel;
+      pkt.showId = show->showId;
+      pkt.firstCue = nextChunk;
+      pkt.count = min((uint16_t)CUES_PER_CHUNK,
+                      (uint16_t)(show->count - nextChunk));
+      memcpy(pkt.cues, panelCues + nextChunk, pkt.count * sizeof(PanelCue));
+      send(panel, (const uint8_t *)&pkt,
+           offsetof(CueChunkPacket, cues) + pkt.count * sizeof(PanelCue));
+      nextChunk += pkt.count;
+      if (nextChunk >= show->count) {
+        phase = PHASE_COMMIT;
+      }
+      break;
+    }
+    case PHASE_COMMIT: {
+      CueCommitPacket pkt = {PKT_CUE_COMMIT, panel, show->showId, show->count,
+                             cueListCrc(panelCues, show->count)};
+      send(panel, (const uint8_t *)&pkt, sizeof(pkt));
+      nextChunk = 0;
+      phase = PHASE_BEGIN;
+      panel = peers->nextKnown(panel);
+      if (!panel) {
+        Serial.println("✓ Cue upload sent to all panels");
+      }
+      break;
+    }
+    }
+
+    nextSendAt = now + CUE_UPLOAD_SPACING_MS;
+    return busy() ? CUE_UPLOAD_SPACING_MS : SEQ_IDLE;
+  }
+
+private:
+  enum Phase { PHASE_BEGIN, PHASE_CHUNKS, PHASE_COMMIT };
+
+  const CueShow *show = nullptr;
+  PeerTable *peers = nullptr;
+  uint8_t panel = 0; // 0 = idle
+  uint16_t nextChunk = 0;
+  Phase phase = PHASE_BEGIN;
+  uint32_t nextSendAt = 0;
+  PanelCue panelCues[MAX_CUES];
+
+  bool buildPanelCues() {
+    PeerEntry *peer = peers->get(panel);
+    if (!peer)
+      return false;
+    for (uint16_t i = 0; i < show->count; i++) {
+      panelCues[i] = panelCueFor(show->cues[i], panel, *peer,
+                                 i > 0 ? &panelCues[i - 1] : nullptr);
+    }
+    return true;
+  }
+};
+
+// ============================================================================
+// CUE RUNNER (show task)
+// ============================================================================
+//
+// Clocks a loaded show by sending GO packets ahead of each cue time. Panels
+// auto-follow on their own; the GOs keep them aligned with the master.
+
+class CueRunner {
+public:
+  bool active() const { return running; }
+  uint16_t currentCue() const { return cue; }
+
+  // Fire `first` at now + lead. With `clock` set, keep sending GOs along
+  // the show's hold times; otherwise this is a single manual GO.
+  void start(const CueShow &source, uint16_t first, bool clock, uint32_t now,
+             PacketSendFn send) {
+    show = &source;
+    if (first >= show->count) {
+      Serial.print("Cue ");
+      Serial.print(first);
+      Serial.println(" is not in the loaded show");
+      return;
+    }
+    cue = first;
+    cueAt = now + CUE_GO_LEAD_MS;
+    running = clock;
+    sendGo(cue, cueAt, now, send);
+  }
+
+  void stop(uint32_t now, PacketSendFn send) {
+    running = false;
+    if (show) {
+      sendGo(CUE_GO_STOP, now, now, send);
+    }
+  }
+
+  uint32_t tick(uint32_t now, PacketSendFn send) {
+    if (!running)
+      return SEQ_IDLE;
+
+    uint32_t hold = show->cues[cue].holdMs;
+    if (hold == 0) {
+      // Waiting for a manual GO; panels hold as well
+      running = false;
+      return SEQ_IDLE;
+    }
+
+    uint32_t nextAt = cueAt + hold;
+    if ((int32_t)(now + CUE_GO_LEAD_MS - nextAt) < 0)
+      return nextAt - CUE_GO_LEAD_MS - now;
+
+    if (cue + 1 >= show->count) {
+      Serial.println("✓ Cue show complete");
+      running = false;
+      return SEQ_IDLE;
+    }
+
+    cue++;
+    cueAt = nextAt;
+    sendGo(cue, cueAt, now, send);
+    return 0; // re-evaluate against the new cue's hold time
+  }
+
+private:
+  const CueShow *show = nullptr;
+  uint16_t cue = 0;
+  uint32_t cueAt = 0;
+  bool running = false;
+
+  void sendGo(uint16_t index, uint32_t at, uint32_t now, PacketSendFn send) {
+    CueGoPacket pkt = {PKT_CUE_GO, show->showId, index, now, at};
+    for (uint8_t i = 0; i < CUE_GO_REPEATS; i++) {
+      send(0, (const uint8_t *)&pkt, sizeof(pkt));
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,369 @@
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+#include "config.h"
+#include "firmware_protocol.h"
+#include "link_protocol.h"
+#include "sequences.h"
+
+// ============================================================================
+// PANEL FIRMWARE ROLLOUT (show task)
+// ============================================================================
+//
+// Sends one panel image to a set of panels at once (firmware_protocol.h):
+//
+//   OFFER   broadcast FW_OFFER_REPEATS times
+//   POLL    ask each panel for its missing chunks, a window at a time, and
+//           collect their union; wait while any panel is still erasing
+//   DATA    broadcast every chunk in the union once, `burst` chunks every
+//           `spacingMs`, then POLL again
+//   COMMIT  once every panel holds every chunk; then poll until each one
+//           has checked the hash and switched slots
+//
+// A panel that stops answering polls is dropped from the rollout and the
+// rest carry on. So does one that reports an end state (verified, already
+// current, bad hash, flash error, too large). After FW_MAX_ROUNDS data
+// rounds the rollout stops; sending the same image again resumes it.
+//
+// The image itself is read through FirmwareReadFn, from LittleFS on the
+// master and from memory in the simulator (src/fwsim).
+
+#define FW_DEFAULT_BURST 2      // chunks per tick
+#define FW_DEFAULT_SPACING_MS 6 // between bursts: ~80 KB/s, most of 1M
+#define FW_OFFER_REPEATS 3
+#define FW_OFFER_SPACING_MS 50
+#define FW_POLL_TIMEOUT_MS 100
+#define FW_POLL_RETRIES 3
+#define FW_ERASE_POLL_MS 500 // re-poll while a panel erases its slot
+#define FW_ERASE_TIMEOUT_MS 60000
+#define FW_MAX_ROUNDS 12
+#define FW_VERIFY_POLL_MS 250
+#define FW_RECOMMIT_MS 3000 // a panel still waiting for COMMIT gets another
+#define FW_VERIFY_TIMEOUT_MS 15000
+
+typedef bool (*FirmwareSendFn)(uint8_t panelId, const uint8_t *data,
+                               size_t len);
+typedef bool (*FirmwareReadFn)(uint32_t offset, uint8_t *data, uint16_t len);
+
+// Indexed by FirmwareSender::Phase
+static const char *const FW_PHASE_NAMES[] = {"idle", "offer", "poll", "data",
+                                             "commit"};
+
+struct FirmwarePlan {
+  uint32_t size;
+  uint8_t sha256[32];
+  uint32_t panelMask; // bit (id - 1)
+  uint8_t burst;
+  uint16_t spacingMs;
+};
+
+class FirmwareSender {
+public:
+  // Progress and results, for the net task; final once `completed` changes
+  FirmwarePlan plan = {};
+  uint8_t state[MAX_PANELS + 1]; // last FirmwareState each panel reported
+  uint16_t held[MAX_PANELS + 1];
+  uint32_t lostMask = 0; // panels that stopped answering
+  volatile uint8_t round = 0;
+  volatile uint32_t chunksSent = 0;
+  uint32_t polls = 0;
+  uint32_t elapsedMs = 0;
+  bool readFailed = false;
+  volatile uint32_t completed = 0;
+
+  bool running() const { return phase != PHASE_IDLE; }
+  uint16_t chunks() const { return chunkCount; }
+  const char *phaseName() const { return FW_PHASE_NAMES[phase]; }
+
+  // False when there is nothing to send or no one to send it to
+  bool start(const FirmwarePlan &p, FirmwareReadFn reader, uint32_t now) {
+    if (!p.panelMask || p.size == 0 || fwChunkCount(p.size) > FW_MAX_CHUNKS)
+      return false;
+    plan = p;
+    if (!plan.burst) {
+      plan.burst = FW_DEFAULT_BURST;
+    }
+    read = reader;
+    imageId = fwImageId(plan.sha256);
+    chunkCount = fwChunkCount(plan.size);
+    active = plan.panelMask;
+    lostMask = 0;
+    memset(state, FW_STATE_IDLE, sizeof(state));
+    memset(held, 0, sizeof(held));
+    round = 0;
+    chunksSent = 0;
+    polls = 0;
+    readFailed = false;
+    committing = false;
+    startedAt = now;
+    beginOffer(now);
+    return true;
+  }
+
+  // Panels keep what they have; the same image resumes from there
+  void stop(uint32_t now) {
+    if (running()) {
+      finish(now);
+    }
+  }
+
+  void onStatus(const FwStatusPacket &pkt) {
+    if (phase != PHASE_POLL || !waiting || pkt.panelId != pollPanel ||
+        pkt.window != pollWindow)
+      return;
+    waiting = false;
+    retries = 0;
+    state[pollPanel] =
+        pkt.state < FW_STATE_COUNT ? pkt.state : (uint8_t)FW_STATE_IDLE;
+    held[pollPanel] = pkt.held;
+
+    if (pkt.imageId != imageId || pkt.state == FW_STATE_IDLE) {
+      needOffer = true; // missed every offer
+    } else if (pkt.state == FW_STATE_ERASING) {
+      erasing = true;
+    } else if (pkt.state == FW_STATE_RECEIVING) {
+      for (uint16_t i = 0; i < FW_WINDOW_CHUNKS; i++) {
+        uint32_t chunk = (uint32_t)pollWindow + i;
+        if (chunk < chunkCount && fwBit(pkt.missing, i)) {
+          fwSetBit(needed, chunk);
+        }
+      }
+      if ((uint32_t)pollWindow + FW_WINDOW_CHUNKS < chunkCount) {
+        pollWindow += FW_WINDOW_CHUNKS;
+        return; // same panel, next window
+      }
+    } else if (pkt.state == FW_STATE_COMPLETE) {
+      awaitingVerify |= committing;
+    } else {
+      active &= ~(1UL << (pollPanel - 1)); // an end state
+    }
+    nextPanel(pollPanel);
+  }
+
+  uint32_t tick(uint32_t now, FirmwareSendFn send) {
+    if (!running())
+      return SEQ_IDLE;
+    if ((int32_t)(now - waitUntil) < 0)
+      return waitUntil - now;
+
+    switch (phase) {
+    case PHASE_OFFER: {
+      FwOfferPacket pkt;
+      pkt.type = PKT_FW_OFFER;
+      pkt.imageId = imageId;
+      pkt.size = plan.size;
+      memcpy(pkt.sha256, plan.sha256, 32);
+      pkt.panelMask = active;
+      send(0, (const uint8_t *)&pkt, sizeof(pkt));
+      if (++repeats >= FW_OFFER_REPEATS) {
+        offerAt = now;
+        beginPoll();
+      }
+      return wait(now, FW_OFFER_SPACING_MS);
+    }
+    case PHASE_POLL:
+      return pollTick(now, send);
+    case PHASE_DATA:
+      return dataTick(now, send);
+    case PHASE_COMMIT: {
+      FwCommitPacket pkt = {PKT_FW_COMMIT, imageId, active};
+      send(0, (const uint8_t *)&pkt, sizeof(pkt));
+      if (++repeats >= FW_OFFER_REPEATS) {
+        if (!committing) {
+          committing = true;
+          verifyAt = now;
+        }
+        commitAt = now;
+        beginPoll();
+        return wait(now, FW_VERIFY_POLL_MS);
+      }
+      return wait(now, FW_OFFER_SPACING_MS);
+    }
+    default:
+      return SEQ_IDLE;
+    }
+  }
+
+private:
+  enum Phase {
+    PHASE_IDLE,
+    PHASE_OFFER,
+    PHASE_POLL,
+    PHASE_DATA,
+    PHASE_COMMIT
+  };
+
+  Phase phase = PHASE_IDLE;
+  FirmwareReadFn read = nullptr;
+  uint32_t imageId = 0;
+  uint16_t chunkCount = 0;
+  uint32_t active = 0; // panels still in the rollout
+  uint32_t startedAt = 0;
+  uint32_t waitUntil = 0;
+  uint8_t repeats = 0;
+
+  // POLL
+  uint8_t pollPanel = 0; // 0 = pass finished
+  uint16_t pollWindow = 0;
+  bool waiting = false;
+  uint32_t deadline = 0;
+  uint8_t retries = 0;
+  bool needOffer = false;
+  bool erasing = false;
+  uint32_t offerAt = 0;
+
+  // COMMIT and after
+  bool committing = false;
+  bool awaitingVerify = false;
+  uint32_t commitAt = 0;
+  uint32_t verifyAt = 0;
+
+  // DATA: chunks some panel still lacks
+  uint8_t needed[FW_BITMAP_BYTES];
+  uint16_t cursor = 0;
+
+  uint32_t wait(uint32_t now, uint32_t ms) {
+    waitUntil = now + ms;
+    return ms;
+  }
+
+  void beginOffer(uint32_t now) {
+    phase = PHASE_OFFER;
+    repeats = 0;
+    waitUntil = now;
+  }
+
+  void beginPoll() {
+    phase = PHASE_POLL;
+    memset(needed, 0, sizeof(needed));
+    needOffer = false;
+    erasing = false;
+    awaitingVerify = false;
+    waiting = false;
+    nextPanel(0);
+  }
+
+  void nextPanel(uint8_t after) {
+    pollPanel = 0;
+    pollWindow = 0;
+    retries = 0;
+    for (uint8_t id = after + 1; id <= MAX_PANELS; id++) {
+      if (active & (1UL << (id - 1))) {
+        pollPanel = id;
+        return;
+      }
+    }
+  }
+
+  uint32_t pollTick(uint32_t now, FirmwareSendFn send) {
+    if (waiting) {
+      if ((int32_t)(now - deadline) < 0)
+        return deadline - now;
+      waiting = false;
+      if (++retries > FW_POLL_RETRIES) {
+        lostMask |= 1UL << (pollPanel - 1);
+        active &= ~(1UL << (pollPanel - 1));
+        nextPanel(pollPanel);
+      }
+    }
+    if (pollPanel) {
+      FwPollPacket pkt = {PKT_FW_POLL, imageId, pollPanel, pollWindow};
+      send(pollPanel, (const uint8_t *)&pkt, sizeof(pkt));
+      polls++;
+      waiting = true;
+      deadline = now + FW_POLL_TIMEOUT_MS;
+      return FW_POLL_TIMEOUT_MS;
+    }
+    return endPass(now);
+  }
+
+  // Every active panel has answered (or been dropped); decide what next
+  uint32_t endPass(uint32_t now) {
+    if (!active) {
+      return finish(now);
+    }
+    if (committing) {
+      if (!awaitingVerify || now - verifyAt >= FW_VERIFY_TIMEOUT_MS) {
+        return finish(now);
+      }
+      if (now - commitAt >= FW_RECOMMIT_MS) {
+        phase = PHASE_COMMIT;
+        repeats = 0;
+        return 0;
+      }
+      beginPoll();
+      return wait(now, FW_VERIFY_POLL_MS);
+    }
+    if (needOffer) {
+      if (++round > FW_MAX_ROUNDS) {
+        return finish(now);
+      }
+      beginOffer(now);
+      return 0;
+    }
+    if (erasing) {
+      if (now - offerAt >= FW_ERASE_TIMEOUT_MS) {
+        return finish(now);
+      }
+      beginPoll();
+      return wait(now, FW_ERASE_POLL_MS);
+    }
+    if (nextNeeded(0) < chunkCount) {
+      if (++round > FW_MAX_ROUNDS) {
+        return finish(now);
+      }
+      phase = PHASE_DATA;
+      cursor = 0;
+      return 0;
+    }
+    phase = PHASE_COMMIT;
+    repeats = 0;
+    return 0;
+  }
+
+  uint32_t dataTick(uint32_t now, FirmwareSendFn send) {
+    for (uint8_t n = 0; n < plan.burst; n++) {
+      uint16_t index = nextNeeded(cursor);
+      if (index >= chunkCount) {
+        beginPoll();
+        return 0;
+      }
+      FwChunkPacket pkt;
+      pkt.type = PKT_FW_CHUNK;
+      pkt.imageId = imageId;
+      pkt.index = index;
+      uint16_t len = fwChunkLength(plan.size, index);
+      if (!read((uint32_t)index * FW_CHUNK_BYTES, pkt.data, len)) {
+        readFailed = true;
+        return finish(now);
+      }
+      if (!send(0, (const uint8_t *)&pkt, offsetof(FwChunkPacket, data) + len))
+        break; // radio queue full; this chunk goes next tick
+      fwClearBit(needed, index);
+      cursor = index + 1;
+      chunksSent++;
+    }
+    return wait(now, plan.spacingMs ? plan.spacingMs : FW_DEFAULT_SPACING_MS);
+  }
+
+  uint16_t nextNeeded(uint16_t from) const {
+    for (uint16_t i = from; i < chunkCount; i++) {
+      if (!needed[i >> 3]) {
+        i |= 7; // skip a clear byte
+        continue;
+      }
+      if (fwBit(needed, i))
+        return i;
+    }
+    return chunkCount;
+  }
+
+  uint32_t finish(uint32_t now) {
+    elapsedMs = now - startedAt;
+    phase = PHASE_IDLE;
+    completed++;
+    return SEQ_IDLE;
+  }
+};
+
+#endif
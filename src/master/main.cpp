@@ -1,10 +1,37 @@
 // master main.cpp
+#include "acks.h"
+#include "airtime.h"
+#include "alloc_guard.h"
+#include "audio_protocol.h"
+#include "bench.h"
 #include "config.h"
+#include "cues.h"
+#include "firmware.h"
+#include "lease_protocol.h"
+#include "light_protocol.h"
+#include "link_protocol.h"
+#include "peers.h"
+#include "priority_protocol.h"
+#include "program_protocol.h"
+#include "provision_protocol.h"
+#include "recorder.h"
+#include "scene_store.h"
+#include "sequences.h"
+#include "spsc_queue.h"
+#include "standby.h"
+#include "tempo.h"
 #include <ArduinoJson.h>
+#include <HTTPClient.h>
+#include <LittleFS.h>
+#include <Preferences.h>
 #include <PubSubClient.h>
 #include <WiFi.h>
+#include <esp_heap_caps.h>
 #include <esp_now.h>
 #include <esp_wifi.h>
+#if AUDIO_INPUT
+#include "audio_input.h"
+#endif
 
 // WiFi Credentials
 const char *ssid = "arcane";
@@ -14,612 +41,3245 @@ const char *password = "hisashiburi";
 // const char *ssid = "Navam";
 // const char *password = "kskm2626";
 
-// MQTT Broker
-const char *mqtt_server = "broker.emqx.io";
-const int mqtt_port = 1883;
+// MQTT Broker. Override with -D MQTT_SERVER=\"192.168.1.20\" to use a local
+// broker or the load generator (env:master_bench).
+#ifndef MQTT_SERVER
+#define MQTT_SERVER "broker.emqx.io"
+#endif
+#ifndef MQTT_PORT
+#define MQTT_PORT 1883
+#endif
+const char *mqtt_server = MQTT_SERVER;
+const int mqtt_port = MQTT_PORT;
 
 const char *command_topic = "ta25stage/command";
 const char *status_topic = "ta25stage/master/status";
+const char *bench_topic = "ta25stage/master/bench";
+const char *audio_topic = "ta25stage/master/audio";
+const char *boot_topic = "ta25stage/master/boot";
+const char *channel_topic = "ta25stage/master/channel";
+const char *lease_topic = "ta25stage/master/lease";
+const char *ack_topic = "ta25stage/master/ack";
+const char *airtime_topic = "ta25stage/master/airtime";
+const char *firmware_topic = "ta25stage/master/firmware";
+const char *provision_topic = "ta25stage/master/provision";
+const char *firmware_data_topic = "ta25stage/firmware"; // image upload
 
 WiFiClient espClient;
 PubSubClient client(espClient);
 
 LightCommand currentCommand;
-
-void runSequence0();
-void runSequence1();
-void runSequence2();
-void runSequence3();
-
-bool sequenceRunning = false;
+portMUX_TYPE currentCommandMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Test sequence at power-up, for bench checks of a fresh rig. Off by
+// default: a master that resets mid-show restores the last scene instead.
+#ifndef BOOT_TEST_SEQUENCE
+#define BOOT_TEST_SEQUENCE 0
+#endif
+#define BOOT_TEST_DELAY_MS 3000
+
+// The last base-layer command, restored at boot (scene_store.h). Show task
+// only, like currentCommand's writer.
+SceneStore scene;
+
+// Boot milestones in ms since reset, 0 until reached; published once on
+// boot_topic at the first broker connect.
+struct BootMetrics {
+  esp_reset_reason_t resetReason;
+  SceneSource sceneSource;
+  uint32_t espnowMs;    // ESP-NOW up
+  uint32_t firstSendMs; // first light command on air (restored or live)
+  uint32_t wifiMs;      // associated and got an IP
+  uint32_t mqttMs;      // broker connected
+  volatile uint32_t firstCommandMs; // first MQTT message
+  bool reported;
+};
+BootMetrics boot_metrics = {};
+
+// ============================================================================
+// TASK LAYOUT
+// ============================================================================
+//
+// Core 0 ("net"):  WiFi/MQTT state machine, PubSubClient, JSON decode,
+//                  heartbeat. Pushes decoded commands into commandQueue.
+// Core 1 ("show"): drains commandQueue, steps sequences, sends ESP-NOW.
+// Core 0 ("audio", AUDIO_INPUT builds only): reads the microphone and runs
+//                  the analyzer, one block per 16 ms, above the net task so
+//                  a busy broker cannot delay it. Hands AUDIO packets to the
+//                  show task through audioPackets.
+//
+// The queue is the only hand-off between the two, so broker stalls or MQTT
+// bursts cannot delay cue dispatch.
+
+enum CommandKind : uint8_t {
+  CMD_LIGHT = 0,        // LightCommand (direct control or sequence start)
+  CMD_REPLAY_START = 1, // arg: 1 = loop
+  CMD_REPLAY_STOP = 2,
+  CMD_CUE_UPLOAD = 3, // cueStaging is ready
+  CMD_CUE_RUN = 4,    // arg: 1 = run the show, 0 = single GO; cue: index
+  CMD_CUE_STOP = 5,
+  CMD_PROGRAM_UPLOAD = 6, // programStaging is ready
+  CMD_TEMPO_SET = 7,      // cue: bpm x100, arg: beats per bar (0 = either
+                          // unchanged)
+  CMD_TEMPO_TAP = 8,      // enqueuedUs is the tap
+  CMD_TEMPO_DOWNBEAT = 9, // enqueuedUs is the first beat of a bar
+  CMD_RATE_SET = 10,      // arg: index into AIR_RATES
+  CMD_RATE_SWEEP = 11,    // sweepStaging is ready
+  CMD_FIRMWARE_SEND = 12, // firmwareStaging is ready
+  CMD_FIRMWARE_STOP = 13,
+  CMD_PROVISION = 14 // provisionStaging is ready
+};
+
+struct QueuedCommand {
+  uint8_t kind;
+  uint8_t arg;
+  uint16_t cue;
+  LightCommand cmd;
+  int64_t enqueuedUs;
+  uint32_t ackId; // the command's "id", ACK_NO_ID without one
+};
+
+#define COMMAND_QUEUE_DEPTH 32
+#define NET_TASK_CORE 0
+#define SHOW_TASK_CORE 1
+#define NET_TASK_STACK 8192
+#define SHOW_TASK_STACK 4096
+#define SHOW_TASK_MAX_SLEEP_MS 20
+
+SpscQueue<QueuedCommand, COMMAND_QUEUE_DEPTH> commandQueue;
+TaskHandle_t netTaskHandle = nullptr;
+TaskHandle_t showTaskHandle = nullptr;
+
+struct TaskMetrics {
+  volatile uint32_t queuePeak;      // deepest queue seen since last report
+  volatile uint32_t queueDrops;     // commands rejected because queue full
+  volatile uint32_t dispatched;     // ESP-NOW sends from the show task
+  volatile uint32_t latencyMaxUs;   // worst enqueue->send since last report
+  volatile uint64_t latencySumUs;   // for the average since last report
+  volatile uint32_t latencySamples;
+  volatile uint64_t netBusyUs;      // time spent working (not sleeping)
+  volatile uint64_t showBusyUs;
+};
+
+TaskMetrics task_metrics = {};
+int64_t task_metrics_since = 0;
+
+SequencePlayer player;
+ShowRecorder recorder;
+ShowReplayer replayer;
+
+// The net task fills cueStaging, then the show task copies it into
+// cueActive; cueStagingPending guards the hand-off.
+CueShow cueStaging;
+CueShow cueActive;
+std::atomic<bool> cueStagingPending(false);
+CueUploader cueUploader;
+CueRunner cueRunner;
+
+// Same hand-off for effect program uploads
+ProgramPacket programStaging;
+std::atomic<bool> programStagingPending(false);
+
+// And for PROVISION. The show task keeps the last panel that announced
+// without an ID, so provisioning can default to it.
+ProvisionPacket provisionStaging;
+uint8_t provisionStagingLen = 0;
+std::atomic<bool> provisionStagingPending(false);
+portMUX_TYPE unprovisionedMux = portMUX_INITIALIZER_UNLOCKED;
+uint8_t unprovisioned_mac[6];
+uint32_t unprovisioned_seen = 0; // millis(), 0 = none heard
+
+// Discovery. Announces are queued by the receive callback and applied to
+// the peer table by the show task, its only writer.
+PeerTable peers;
+SpscQueue<PeerEvent, 16> peerEvents;
+// Regions a stage-wide command covers: the stage map, or further if a
+// provisioned panel drives regions beyond it. Show task -> net task.
+std::atomic<uint16_t> stage_region_end(STAGE_REGIONS);
+uint16_t beacon_seq = 0;
+uint32_t last_beacon = 0;
+bool beacon_due = false; // send one now (tempo changed); show task only
+
+// ESP-NOW follows the STA onto whatever channel the router uses. When that
+// changes, panels lose the beacons and scan for them (src/panel/
+// rendezvous.h); the master answers every ANNOUNCE with a beacon and sends
+// them every CHANNEL_BURST_INTERVAL_MS for CHANNEL_BURST_MS so a scanning
+// panel finds it within one dwell. The net task spots the change, the show
+// task times how long until every panel it knew has announced again.
+#define CHANNEL_BURST_MS 10000
+#define CHANNEL_BURST_INTERVAL_MS 100
+#define CHANNEL_NVS_NAMESPACE "link"
+
+struct ChannelMetrics {
+  uint8_t channel;  // ESP-NOW channel now (0 before the first association)
+  uint8_t previous; // before the last move
+  uint32_t moves;
+  uint32_t movedAt;              // millis() of the last move
+  volatile uint32_t waitingMask; // panels not heard from since the move
+  volatile uint32_t recoveryMs;  // move to last panel back, 0 while waiting
+};
+ChannelMetrics channel_metrics = {};
+std::atomic<bool> channel_moved(false); // net task -> show task
+uint32_t channel_burst_until = 0;       // show task only
+bool channel_wait_any = false;          // moved before any panel was known
+
+struct FanoutMetrics {
+  volatile uint32_t broadcastUs;  // last esp_now_send() to the broadcast MAC
+  volatile uint32_t unicastUs;    // last unicast send incl. slot management
+  volatile uint32_t routeFailures; // unicast to an unknown panel
+  volatile uint32_t peerEventDrops;
+};
+FanoutMetrics fanout_metrics = {};
+
+// ESP-NOW PHY rate (airtime.h). Every frame goes out through radioSend() so
+// the meter sees it. The rate is only changed on the show task; the net
+// task keeps it in NVS, next to the channel.
+AirtimeMeter airtime;
+RateSweep rateSweep; // show task only
+RateSweepPlan sweepStaging;
+std::atomic<bool> sweepStagingPending(false);
+int64_t airtime_since_us = 0; // last reset of the meter
+
+// Panel firmware (firmware.h). The net task fetches the image into
+// FIRMWARE_PATH, over HTTP or in pieces on firmware_data_topic, and keeps
+// its size and hash in NVS so a rollout resumes after a master reset
+// without fetching again. The show task reads the file while it sends.
+#define FIRMWARE_PATH "/panel.bin"
+#define FIRMWARE_NVS_NAMESPACE "fw"
+#define FIRMWARE_FETCH_TIMEOUT_MS 10000 // no data for this long: give up
+#define FIRMWARE_FETCH_TICK_BYTES 4096  // per net task pass
+FirmwareSender firmwareSender; // show task
+FirmwarePlan firmwareStaging;
+std::atomic<bool> firmwareStagingPending(false);
+SpscQueue<FwStatusPacket, 8> firmwareStatus; // receive callback -> show task
+File firmwareFile;                           // show task, while sending
+
+struct FirmwareFetch {
+  bool active;
+  bool http;       // else MQTT pieces
+  uint32_t size;   // expected
+  uint32_t written;
+  bool checkSha;
+  uint8_t expected[32];
+  uint32_t lastDataAt;
+  Sha256 sha;
+  File file;
+};
+FirmwareFetch firmware_fetch = {}; // net task
+HTTPClient firmware_http;
+uint32_t firmware_size = 0; // net task: the image in FIRMWARE_PATH, 0 = none
+uint8_t firmware_sha[32];
+
+// Tags the frames of one light command. Seeded at boot so a panel does not
+// take the first command after a master reboot for a repeat.
+uint8_t light_command_id = 0;
+
+// Command acknowledgements (acks.h). LIGHT_ACKs reach the show task through
+// ackEvents; answers reach the net task from the show task through
+// showAcks and from the MQTT callback itself through netAcks. A full queue
+// drops the answer, and the app's retry covers it.
+AckTracker acks; // show task only
+SpscQueue<AckEvent, 32> ackEvents;
+SpscQueue<CommandAck, 8> showAcks;
+SpscQueue<CommandAck, 8> netAcks;
+uint32_t ack_next_id = ACK_NO_ID; // show task: the next sendESPNowCommand()
+int64_t ack_next_us = 0;          // asks the panels to confirm this id
+
+// Load benchmark counters (bench.h). Per-command serial logging is switched
+// off for the length of a bench run so the UART does not set the pace.
+BenchMetrics bench_metrics = {};
+volatile bool command_log = true;
+
+volatile bool audio_streaming = false; // AUDIO packets going out
+
+// Priority lane (priority_protocol.h). The net task sends the first copy
+// itself and stages the packet; the show task stops playback and sends the
+// repeats. priority_state is what beacons repeat.
+std::atomic<uint8_t> priority_state(PRIORITY_RELEASE);
+PriorityPacket priorityStaging;
+int64_t priorityStagingUs; // when the command arrived
+std::atomic<bool> priorityStagingPending(false);
+uint16_t priority_seq = 0; // net task only; seeded like light_command_id
+#define PRIORITY_NVS_NAMESPACE "priority"
+int64_t priority_preempt_us = 0; // show task: light commands queued before
+                                 // this blackout/hold are dropped
+
+// Hot standby (lease_protocol.h). The default build starts out holding the
+// lease at term 0; one built with MASTER_STANDBY=1 (env:master_standby)
+// starts as the standby and only claims the lease once it has been
+// associated for LEASE_TIMEOUT_MS without hearing a beacon. After that the
+// two behave the same: either can take over from the other, and either
+// stands by when it hears a lease that beats its own.
+#ifndef MASTER_STANDBY
+#define MASTER_STANDBY 0
+#endif
+
+struct LeaseEvent {
+  uint8_t mac[6];
+  uint32_t receivedAt;
+  uint8_t len;
+  uint8_t data[sizeof(ShowStatePacket)]; // a BEACON or a SHOW_STATE
+};
+
+struct LeaseMetrics {
+  uint32_t takeovers;
+  uint32_t standDowns;
+  uint32_t lastFailoverMs;            // holder's last beacon to our first
+  volatile uint32_t ignoredCommands;  // MQTT and console input on standby
+  volatile uint32_t eventDrops;
+};
+LeaseMetrics lease_metrics = {};
+std::atomic<bool> master_active(!MASTER_STANDBY);
+SpscQueue<LeaseEvent, 4> leaseEvents;
+MasterLease lease;      // show task only: the holder while standing by
+ShowMirror mirror;      // show task only
+uint16_t lease_term = 0; // ours while active; show task only
+uint8_t own_mac[6];
+std::atomic<uint32_t> lease_listen_from(0); // net task: associated since,
+                                            // 0 while WiFi is down
+bool show_state_due = false; // show task only
+uint32_t last_show_state = 0;
+
+// Audio analysis. The master-wide depth replaces a per-command audioReactive
+// flag: panels scale whatever they render, so every effect follows the music.
+#if AUDIO_INPUT
+#define AUDIO_DEFAULT_DEPTH 160
+#define AUDIO_TASK_CORE 0
+#define AUDIO_TASK_STACK 3072 // the analyzer's buffers are globals
+#define AUDIO_TASK_PRIORITY 2
+
+AudioInput audioInput;
+AudioAnalyzer audioAnalyzer;
+SpscQueue<AudioPacket, 4> audioPackets;
+TaskHandle_t audioTaskHandle = nullptr;
+std::atomic<bool> audio_enabled(true);
+volatile uint8_t audio_depth = AUDIO_DEFAULT_DEPTH;
+
+struct AudioMetrics {
+  volatile uint32_t blocks;       // analysed since the last report
+  volatile uint32_t readErrors;
+  volatile uint32_t queueDrops;   // show task fell a whole queue behind
+  volatile uint32_t analysisMaxUs;
+  volatile uint64_t analysisSumUs;
+};
+AudioMetrics audio_metrics = {};
+#endif
 
 // Connection management
+//
+// WiFi and MQTT are driven by a small state machine ticked on the net task.
+// WiFi link changes arrive as events (on the WiFi task) and only set flags
+// here; MQTT connect attempts are spaced by an exponential backoff timer so
+// that a dead broker never stalls ESP-NOW output or running sequences.
+enum LinkState : uint8_t {
+  LINK_WIFI_CONNECTING = 0, // waiting for association + DHCP
+  LINK_MQTT_BACKOFF = 1,    // WiFi up, waiting for next broker attempt
+  LINK_UP = 2               // WiFi and MQTT connected
+};
+
+struct LinkMetrics {
+  uint32_t wifiDrops;       // STA disconnect events
+  uint32_t wifiReconnects;  // GOT_IP events after the first one
+  uint32_t mqttAttempts;    // broker connect attempts
+  uint32_t mqttFailures;    // failed broker connect attempts
+  uint32_t mqttReconnects;  // successful connects after the first one
+  uint32_t lastOutageMs;    // duration of the most recent outage
+  uint32_t longestOutageMs; // worst outage since boot
+  uint32_t totalOutageMs;   // sum of all finished outages
+};
+
+LinkState link_state = LINK_WIFI_CONNECTING;
+LinkMetrics link_metrics = {};
+
+volatile bool wifi_got_ip = false;    // set by WiFi event handler
+volatile bool wifi_lost = false;      // set by WiFi event handler
+volatile uint8_t wifi_disc_reason = 0;
+
 uint8_t mqtt_fail_count = 0;
-uint16_t retry_timeout = 5;
+uint32_t mqtt_backoff_ms = 0;
+unsigned long next_mqtt_attempt = 0;
+unsigned long next_wifi_retry = 0;
+unsigned long outage_start = 0; // 0 while the link is up
+bool ever_connected = false;
 unsigned long last_heartbeat = 0;
-unsigned long last_wifi_check = 0;
 const unsigned long HEARTBEAT_INTERVAL = 30000;
-const unsigned long WIFI_CHECK_INTERVAL = 60000;
-const uint8_t MAX_MQTT_RETRIES = 5;
-const uint16_t MAX_RETRY_TIMEOUT = 120;
+const uint32_t MQTT_BACKOFF_MIN_MS = 1000;
+const uint32_t MQTT_BACKOFF_MAX_MS = 60000;
+const unsigned long WIFI_RETRY_INTERVAL = 10000;
+const uint16_t MQTT_SOCKET_TIMEOUT_S = 2;
+// The status heartbeat with every counter at its widest is about 1350
+// bytes; the buffer PubSubClient allocates by default holds 994 of payload
+// on status_topic. Both are sized for the heartbeat, plus MQTT header and
+// topic.
+const size_t STATUS_JSON_SIZE = 1408;
+const uint16_t MQTT_BUFFER_SIZE = STATUS_JSON_SIZE + 64;
 
 bool wifi_connected = false;
 bool mqtt_connected = false;
-bool low_power_mode = false;
+
+void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info) {
+  switch (event) {
+  case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+    wifi_got_ip = true;
+    break;
+  case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+    wifi_disc_reason = info.wifi_sta_disconnected.reason;
+    wifi_lost = true;
+    break;
+  default:
+    break;
+  }
+}
 
 void setup_wifi() {
-  delay(10);
   Serial.println();
   Serial.print("Connecting to ");
   Serial.println(ssid);
 
   WiFi.mode(WIFI_AP_STA);
+  // b/g/n plus long range, so the LR ESP-NOW rates can be chosen (airtime.h)
+  esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G |
+                                         WIFI_PROTOCOL_11N | WIFI_PROTOCOL_LR);
+  WiFi.setAutoReconnect(false); // reconnects are paced by connectionTick()
+  WiFi.onEvent(onWiFiEvent);
   WiFi.begin(ssid, password);
 
-  uint8_t retry_count = 0;
-  while (WiFi.status() != WL_CONNECTED && retry_count < 60) {
-    delay(500);
-    Serial.print(".");
-    retry_count++;
-  }
-
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("\n✓ WiFi connected");
-    Serial.print("IP address: ");
-    Serial.println(WiFi.localIP());
-    Serial.print("MAC address: ");
-    Serial.println(WiFi.macAddress());
-    wifi_connected = true;
-  } else {
-    Serial.println("\n✗ Failed to connect to WiFi");
-    wifi_connected = false;
-  }
+  outage_start = millis();
+  next_wifi_retry = millis() + WIFI_RETRY_INTERVAL;
 }
 
-void checkWiFiStatus() {
-  if (WiFi.status() != WL_CONNECTED) {
-    Serial.println("⚠ WiFi disconnected, reconnecting...");
-    wifi_connected = false;
-    setup_wifi();
-  }
-}
+void publishChannelReport() {
+  StaticJsonDocument<192> doc;
+  doc["device"] = "master";
+  doc["channel"] = channel_metrics.channel;
+  doc["previous"] = channel_metrics.previous;
+  doc["moves"] = channel_metrics.moves;
+  doc["waiting_mask"] = channel_metrics.waitingMask;
+  doc["recovery_ms"] = channel_metrics.recoveryMs;
 
-void publishHeartbeat() {
-  if (!client.connected())
-    return;
+  char buffer[192];
+  serializeJson(doc, buffer);
+  client.publish(channel_topic, buffer);
+}
 
-  StaticJsonDocument<512> doc;
+// Net task. On every takeover and stand-down, and every heartbeat interval
+// in place of the status heartbeat while standing by, so the app sees one
+// master on status_topic.
+void publishLeaseReport() {
+  bool active = master_active.load();
+  const uint8_t *mac = active ? own_mac : lease.holderMac();
+  char holder[18];
+  snprintf(holder, sizeof(holder), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0],
+           mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+  StaticJsonDocument<320> doc;
   doc["device"] = "master";
-  doc["uptime"] = millis() / 1000;
-  doc["wifi_rssi"] = WiFi.RSSI();
-  doc["wifi_connected"] = wifi_connected;
-  doc["mqtt_connected"] = mqtt_connected;
-  doc["mqtt_fails"] = mqtt_fail_count;
-  doc["free_heap"] = ESP.getFreeHeap();
-  doc["last_command"]["sequence"] = currentCommand.sequence;
-  doc["last_command"]["effect"] = currentCommand.effect;
-  doc["last_command"]["brightness"] = currentCommand.brightness;
-  doc["last_command"]["speed"] = currentCommand.speed;
-  doc["last_command"]["debugMode"] = currentCommand.debugMode;
-  doc["last_command"]["panelId"] = currentCommand.panelId;
+  doc["role"] = active ? "active" : "standby";
+  doc["term"] = active ? lease_term : lease.term();
+  doc["holder"] = active || lease.held() ? holder : "";
+  doc["takeovers"] = lease_metrics.takeovers;
+  doc["stand_downs"] = lease_metrics.standDowns;
+  doc["last_failover_ms"] = lease_metrics.lastFailoverMs;
+  doc["ignored_commands"] = lease_metrics.ignoredCommands;
+  if (!active && mirror.valid()) {
+    doc["state_age_ms"] = millis() - mirror.receivedAt();
+    doc["sequence_running"] = mirror.sequenceRunning();
+  }
 
-  char buffer[512];
+  char buffer[320];
   serializeJson(doc, buffer);
+  client.publish(lease_topic, buffer);
+}
 
-  if (client.publish(status_topic, buffer)) {
-    Serial.println("✓ Heartbeat published");
+// Net task, on every association. The channel the master last used is kept
+// in NVS so a move across a reboot is reported too.
+void checkWiFiChannel() {
+  uint8_t wifi_channel = WiFi.channel();
+  Serial.print("Master WiFi Channel: ");
+  Serial.println(wifi_channel);
+
+  if (channel_metrics.channel == 0) {
+    Preferences prefs;
+    if (prefs.begin(CHANNEL_NVS_NAMESPACE, true)) {
+      channel_metrics.channel = prefs.getUChar("channel", 0);
+      prefs.end();
+    }
+  }
+  if (wifi_channel == channel_metrics.channel) {
+    return;
+  }
+
+  channel_metrics.previous = channel_metrics.channel;
+  channel_metrics.channel = wifi_channel;
+  Preferences prefs;
+  if (prefs.begin(CHANNEL_NVS_NAMESPACE, false)) {
+    prefs.putUChar("channel", wifi_channel);
+    prefs.end();
+  }
+  if (channel_metrics.previous == 0) {
+    return; // nothing to compare with on the very first association
   }
+
+  Serial.print("⚠ ESP-NOW channel moved from ");
+  Serial.print(channel_metrics.previous);
+  Serial.print(" to ");
+  Serial.print(wifi_channel);
+  Serial.println(", panels will scan for it");
+  channel_metrics.moves++;
+  channel_metrics.movedAt = millis();
+  channel_moved.store(true);
 }
 
-void enterLowPowerMode() {
+void printConnectivityHelp() {
   Serial.println("\n===============================================");
-  Serial.println("✗ ENTERING LOW POWER MODE");
+  Serial.println("⚠ MQTT BROKER UNREACHABLE");
   Serial.println("===============================================");
-  Serial.println("Maximum retry attempts exceeded.");
+  Serial.println("Show control keeps running; retrying in background.");
   Serial.println("\nTROUBLESHOOTING STEPS:");
   Serial.println("1. Check MQTT broker connectivity");
-  Serial.println("   - Ping: broker.emqx.io");
-  Serial.println("   - Test port: 1883");
+  Serial.print("   - Ping: ");
+  Serial.println(mqtt_server);
+  Serial.print("   - Test port: ");
+  Serial.println(mqtt_port);
   Serial.println("2. Check WiFi signal strength");
   Serial.print("   - Current RSSI: ");
   Serial.println(WiFi.RSSI());
   Serial.println("3. Verify router/internet connection");
   Serial.println("4. Check firewall settings");
-  Serial.println("\nDevice will enter deep sleep for 5 minutes...");
-  Serial.println("Press reset button to restart immediately.");
   Serial.println("===============================================");
-  Serial.flush();
-
-  low_power_mode = true;
-  esp_deep_sleep(5 * 60 * 1000000ULL);
 }
 
-// ESP-NOW send callback
-void onDataSent(const uint8_t *mac_addr, esp_now_send_status_t status) {
-  char macStr[18];
-  snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X", mac_addr[0],
-           mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
-
-  Serial.print("Packet to ");
-  Serial.print(macStr);
-  Serial.print(" - Status: ");
-  Serial.println(status == ESP_NOW_SEND_SUCCESS ? "Success" : "Fail");
+void beginOutage(unsigned long now) {
+  if (outage_start == 0) {
+    outage_start = now;
+  }
 }
 
-void setup_espnow() {
-  // Get the WiFi channel the master is connected on
-  int8_t wifi_channel = WiFi.channel();
-  Serial.print("Master WiFi Channel: ");
-  Serial.println(wifi_channel);
+void endOutage(unsigned long now) {
+  if (outage_start == 0)
+    return;
 
-  // VALIDATION: Check if it matches the expected channel
-  if (wifi_channel != ESPNOW_WIFI_CHANNEL) {
-    Serial.println("===============================================");
-    Serial.println("WARNING: WiFi CHANNEL MISMATCH!");
-    Serial.print("Expected channel: ");
-    Serial.println(ESPNOW_WIFI_CHANNEL);
-    Serial.print("Actual channel: ");
-    Serial.println(wifi_channel);
-    Serial.println("ESP-NOW communication will FAIL!");
-    Serial.println("===============================================");
-    Serial.println("ACTION REQUIRED:");
-    Serial.println("1. Update ESPNOW_WIFI_CHANNEL in common.h to: " +
-                   String(wifi_channel));
-    Serial.println("2. Re-upload to all panel ESP32s");
-    Serial.println("OR");
-    Serial.println("3. Change your router to use channel " +
-                   String(ESPNOW_WIFI_CHANNEL));
-    Serial.println("===============================================");
-
-    // Optional: halt execution until fixed
-    // while(1) { delay(1000); }
-  } else {
-    Serial.println("✓ WiFi channel matches ESPNOW_WIFI_CHANNEL");
+  uint32_t duration = now - outage_start;
+  link_metrics.lastOutageMs = duration;
+  link_metrics.totalOutageMs += duration;
+  if (duration > link_metrics.longestOutageMs) {
+    link_metrics.longestOutageMs = duration;
   }
+  outage_start = 0;
 
-  // Initialize ESP-NOW
-  if (esp_now_init() != ESP_OK) {
-    Serial.println("Error initializing ESP-NOW");
-    return;
+  Serial.print("✓ Link restored after ");
+  Serial.print(duration);
+  Serial.println(" ms");
+}
+
+uint32_t currentOutageMs() {
+  return outage_start == 0 ? 0 : millis() - outage_start;
+}
+
+void scheduleMqttAttempt(unsigned long now) {
+  if (mqtt_backoff_ms == 0) {
+    mqtt_backoff_ms = MQTT_BACKOFF_MIN_MS;
+  } else if (mqtt_backoff_ms < MQTT_BACKOFF_MAX_MS) {
+    mqtt_backoff_ms = min(mqtt_backoff_ms * 2, MQTT_BACKOFF_MAX_MS);
   }
 
-  // Register send callback
-  esp_now_register_send_cb(onDataSent);
+  // +/-25% jitter keeps several masters from hammering the broker in step
+  int32_t jitter =
+      (int32_t)random(mqtt_backoff_ms / 2) - (int32_t)(mqtt_backoff_ms / 4);
+  uint32_t wait = mqtt_backoff_ms + jitter;
+  next_mqtt_attempt = now + wait;
 
-  // Register all panel peers
-  esp_now_peer_info_t peerInfo = {};
-  peerInfo.channel = wifi_channel; // Use actual channel
-  peerInfo.encrypt = false;
-  peerInfo.ifidx = WIFI_IF_STA;
+  Serial.print("Retrying MQTT in ");
+  Serial.print(wait / 1000.0, 1);
+  Serial.println(" s");
+}
 
-  // Add Panel 1
-  memcpy(peerInfo.peer_addr, panel1_mac, 6);
-  if (esp_now_add_peer(&peerInfo) != ESP_OK) {
-    Serial.println("Failed to add Panel 1");
+void printBootMilestone(const char *what, uint32_t ms) {
+  Serial.print("  ");
+  Serial.print(what);
+  if (ms) {
+    Serial.print(ms);
+    Serial.println(" ms");
   } else {
-    Serial.println("Panel 1 added");
+    Serial.println("-");
   }
+}
 
-  // Add Panel 2
-  memcpy(peerInfo.peer_addr, panel2_mac, 6);
-  if (esp_now_add_peer(&peerInfo) != ESP_OK) {
-    Serial.println("Failed to add Panel 2");
-  } else {
-    Serial.println("Panel 2 added");
-  }
+// Net task, once. Also on serial for a master with no broker.
+void publishBootReport() {
+  boot_metrics.reported = true;
+  Serial.print("Boot: reset by ");
+  Serial.print(resetReasonName(boot_metrics.resetReason));
+  Serial.print(", scene from ");
+  Serial.println(SCENE_SOURCE_NAMES[boot_metrics.sceneSource]);
+  printBootMilestone("ESP-NOW up      ", boot_metrics.espnowMs);
+  printBootMilestone("first light cmd ", boot_metrics.firstSendMs);
+  printBootMilestone("WiFi            ", boot_metrics.wifiMs);
+  printBootMilestone("MQTT            ", boot_metrics.mqttMs);
+
+  StaticJsonDocument<256> doc;
+  doc["device"] = "master";
+  doc["reset_reason"] = resetReasonName(boot_metrics.resetReason);
+  doc["scene"] = SCENE_SOURCE_NAMES[boot_metrics.sceneSource];
+  doc["espnow_ms"] = boot_metrics.espnowMs;
+  doc["first_send_ms"] = boot_metrics.firstSendMs;
+  doc["wifi_ms"] = boot_metrics.wifiMs;
+  doc["mqtt_ms"] = boot_metrics.mqttMs;
+
+  char buffer[256];
+  serializeJson(doc, buffer);
+  client.publish(boot_topic, buffer);
+}
 
-  // Add Panel 3
-  memcpy(peerInfo.peer_addr, panel3_mac, 6);
-  if (esp_now_add_peer(&peerInfo) != ESP_OK) {
-    Serial.println("Failed to add Panel 3");
-  } else {
-    Serial.println("Panel 3 added");
-  }
+// The client ID comes from the MAC and the session is persistent (clean
+// session off), so with the QoS 1 subscription the broker keeps commands
+// published while we reconnect and delivers them when we are back.
+void attemptMqttConnect(unsigned long now) {
+  char clientId[24];
+  snprintf(clientId, sizeof(clientId), "ESP32Master-%02x%02x%02x",
+           own_mac[3], own_mac[4], own_mac[5]);
 
-  // Add Panel 4
-  memcpy(peerInfo.peer_addr, panel4_mac, 6);
-  if (esp_now_add_peer(&peerInfo) != ESP_OK) {
-    Serial.println("Failed to add Panel 4");
+  Serial.print("Attempting MQTT connection...");
+  link_metrics.mqttAttempts++;
+
+  if (client.connect(clientId, nullptr, nullptr, nullptr, 0, false, nullptr,
+                     false)) {
+    Serial.println("✓ connected");
+    client.subscribe(command_topic, 1);
+    client.subscribe(firmware_data_topic, 1);
+
+    if (ever_connected) {
+      link_metrics.mqttReconnects++;
+    }
+    ever_connected = true;
+    mqtt_connected = true;
+    mqtt_fail_count = 0;
+    mqtt_backoff_ms = 0;
+    link_state = LINK_UP;
+    endOutage(millis());
+    if (!boot_metrics.reported) {
+      boot_metrics.mqttMs = millis();
+      publishBootReport();
+    }
   } else {
-    Serial.println("Panel 4 added");
-  }
+    Serial.print("✗ failed, rc=");
+    Serial.println(client.state());
 
-  Serial.println("ESP-NOW initialized");
+    link_metrics.mqttFailures++;
+    if (mqtt_fail_count < 0xFF) {
+      mqtt_fail_count++;
+    }
+    scheduleMqttAttempt(now);
+
+    if (mqtt_backoff_ms == MQTT_BACKOFF_MAX_MS &&
+        mqtt_fail_count % 10 == 0) {
+      printConnectivityHelp();
+    }
+  }
 }
 
-void sendESPNowCommand(LightCommand &cmd) {
-  if (cmd.panelId == 0) {
-    esp_err_t result = esp_now_send(0, (uint8_t *)&cmd, sizeof(LightCommand));
-    if (result == ESP_OK) {
-      Serial.println("Broadcast sent successfully");
-    } else {
-      Serial.println("Error broadcasting");
+// Advance the WiFi/MQTT state machine. Never blocks longer than a single
+// bounded broker connect attempt.
+void connectionTick() {
+  unsigned long now = millis();
+
+  if (wifi_lost) {
+    wifi_lost = false;
+    if (wifi_connected) {
+      Serial.print("⚠ WiFi disconnected (reason ");
+      Serial.print(wifi_disc_reason);
+      Serial.println(")");
+      link_metrics.wifiDrops++;
     }
-  } else {
-    uint8_t *target_mac = nullptr;
-    switch (cmd.panelId) {
-    case 1:
-      target_mac = panel1_mac;
-      break;
-    case 2:
-      target_mac = panel2_mac;
-      break;
-    case 3:
-      target_mac = panel3_mac;
-      break;
-    case 4:
-      target_mac = panel4_mac;
-      break;
-    default:
-      Serial.println("Invalid panel ID");
-      return;
+    wifi_connected = false;
+    mqtt_connected = false;
+    lease_listen_from.store(0);
+    link_state = LINK_WIFI_CONNECTING;
+    beginOutage(now);
+    next_wifi_retry = now + WIFI_RETRY_INTERVAL;
+  }
+
+  if (wifi_got_ip) {
+    wifi_got_ip = false;
+    if (!wifi_connected) {
+      if (boot_metrics.wifiMs == 0) {
+        boot_metrics.wifiMs = now;
+      }
+      Serial.println("✓ WiFi connected");
+      Serial.print("IP address: ");
+      Serial.println(WiFi.localIP());
+      char macStr[18];
+      snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
+               own_mac[0], own_mac[1], own_mac[2], own_mac[3], own_mac[4],
+               own_mac[5]);
+      Serial.print("MAC address: ");
+      Serial.println(macStr);
+      checkWiFiChannel();
+      // On the router's channel now, so silence from the active master
+      // means something
+      lease_listen_from.store(now | 1);
+
+      if (link_metrics.wifiDrops > 0) {
+        link_metrics.wifiReconnects++;
+      }
+    }
+    wifi_connected = true;
+    link_state = LINK_MQTT_BACKOFF;
+    mqtt_backoff_ms = 0;
+    next_mqtt_attempt = now;
+  }
+
+  switch (link_state) {
+  case LINK_WIFI_CONNECTING:
+    if ((long)(now - next_wifi_retry) >= 0) {
+      Serial.println("WiFi still down, retrying association");
+      WiFi.disconnect();
+      WiFi.begin(ssid, password);
+      next_wifi_retry = now + WIFI_RETRY_INTERVAL;
     }
+    break;
 
-    esp_err_t result =
-        esp_now_send(target_mac, (uint8_t *)&cmd, sizeof(LightCommand));
-    if (result == ESP_OK) {
-      Serial.print("Sent to Panel ");
-      Serial.println(cmd.panelId);
+  case LINK_MQTT_BACKOFF:
+    if ((long)(now - next_mqtt_attempt) >= 0) {
+      attemptMqttConnect(now);
+    }
+    break;
+
+  case LINK_UP:
+    if (!client.connected()) {
+      Serial.print("⚠ MQTT connection lost, rc=");
+      Serial.println(client.state());
+      mqtt_connected = false;
+      link_state = LINK_MQTT_BACKOFF;
+      beginOutage(now);
+      scheduleMqttAttempt(now);
     } else {
-      Serial.println("Error sending");
+      client.loop();
     }
+    break;
   }
 }
 
-void mqttCallback(char *topic, byte *payload, unsigned int length) {
-  Serial.print("MQTT message on topic: ");
-  Serial.println(topic);
+// Net task. The last panel heard announcing without an ID, if it is still
+// around
+bool lastUnprovisioned(uint8_t *mac) {
+  portENTER_CRITICAL(&unprovisionedMux);
+  uint32_t seen = unprovisioned_seen;
+  memcpy(mac, unprovisioned_mac, 6);
+  portEXIT_CRITICAL(&unprovisionedMux);
+  return seen && millis() - seen < PEER_TIMEOUT_MS;
+}
 
-  StaticJsonDocument<1024> doc;
-  DeserializationError error = deserializeJson(doc, payload, length);
+// Net task, with the heartbeat and as soon as a new panel without an ID is
+// heard. Its own topic, so whoever provisions panels is told without
+// waiting up to a heartbeat interval.
+void publishProvisionReport(const uint8_t *mac) {
+  char macStr[18];
+  snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0],
+           mac[1], mac[2], mac[3], mac[4], mac[5]);
 
-  if (error) {
-    Serial.print("JSON parse failed: ");
-    Serial.println(error.f_str());
+  StaticJsonDocument<96> doc;
+  doc["device"] = "master";
+  doc["unprovisioned"] = (const char *)macStr;
+
+  char buffer[96];
+  serializeJson(doc, buffer);
+  client.publish(provision_topic, buffer);
+}
+
+// Net task. The document and buffer are static: nothing on this path
+// touches the heap (ALLOC_ZONE_HEARTBEAT).
+void publishHeartbeat() {
+  if (!client.connected())
+    return;
+
+  AllocScope zone(ALLOC_ZONE_HEARTBEAT);
+  static StaticJsonDocument<1280> doc; // 61 members, 16 bytes each
+  doc.clear();
+  doc["device"] = "master";
+  doc["uptime"] = millis() / 1000;
+  doc["wifi_rssi"] = WiFi.RSSI();
+  doc["wifi_connected"] = wifi_connected;
+  doc["mqtt_connected"] = mqtt_connected;
+  doc["mqtt_fails"] = mqtt_fail_count;
+  doc["link"]["state"] = link_state;
+  doc["link"]["wifi_drops"] = link_metrics.wifiDrops;
+  doc["link"]["wifi_reconnects"] = link_metrics.wifiReconnects;
+  doc["link"]["mqtt_attempts"] = link_metrics.mqttAttempts;
+  doc["link"]["mqtt_failures"] = link_metrics.mqttFailures;
+  doc["link"]["mqtt_reconnects"] = link_metrics.mqttReconnects;
+  doc["link"]["last_outage_ms"] = link_metrics.lastOutageMs;
+  doc["link"]["longest_outage_ms"] = link_metrics.longestOutageMs;
+  doc["link"]["total_outage_ms"] = link_metrics.totalOutageMs;
+  JsonObject heap = doc.createNestedObject("heap");
+  heap["free"] = ESP.getFreeHeap();
+  heap["min_free"] = ESP.getMinFreeHeap();
+  heap["largest_block"] = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+#if ALLOC_GUARD
+  JsonObject allocs = heap.createNestedObject("allocs");
+  const AllocStats &stats = allocStats();
+  allocs["mqtt"] = stats.count[ALLOC_ZONE_MQTT];
+  allocs["dispatch"] = stats.count[ALLOC_ZONE_DISPATCH];
+  allocs["heartbeat"] = stats.count[ALLOC_ZONE_HEARTBEAT];
+  allocs["system"] = stats.system;
+#endif
+
+  // Window metrics are reset after each report; updates from the show task
+  // may race with the reset, which only costs a sample.
+  int64_t now = esp_timer_get_time();
+  float window = (float)(now - task_metrics_since);
+  JsonObject tasks = doc.createNestedObject("tasks");
+  tasks["queue_depth"] = commandQueue.size();
+  tasks["queue_peak"] = task_metrics.queuePeak;
+  tasks["queue_drops"] = task_metrics.queueDrops;
+  tasks["dispatched"] = task_metrics.dispatched;
+  tasks["latency_avg_us"] =
+      task_metrics.latencySamples
+          ? (uint32_t)(task_metrics.latencySumUs / task_metrics.latencySamples)
+          : 0;
+  tasks["latency_max_us"] = task_metrics.latencyMaxUs;
+  tasks["net_cpu_pct"] = 100.0f * task_metrics.netBusyUs / window;
+  tasks["show_cpu_pct"] = 100.0f * task_metrics.showBusyUs / window;
+  tasks["net_stack_free"] = uxTaskGetStackHighWaterMark(netTaskHandle);
+  tasks["show_stack_free"] = uxTaskGetStackHighWaterMark(showTaskHandle);
+  task_metrics.queuePeak = commandQueue.size();
+  task_metrics.latencyMaxUs = 0;
+  task_metrics.latencySumUs = 0;
+  task_metrics.latencySamples = 0;
+  task_metrics.netBusyUs = 0;
+  task_metrics.showBusyUs = 0;
+  task_metrics_since = now;
+
+  JsonObject peer = doc.createNestedObject("peers");
+  peer["known"] = peers.knownCount();
+  peer["known_mask"] = peers.knownMask();
+  peer["unicast_slots"] = peers.registeredCount();
+  peer["broadcast_us"] = fanout_metrics.broadcastUs;
+  peer["unicast_us"] = fanout_metrics.unicastUs;
+  peer["route_failures"] = fanout_metrics.routeFailures;
+  peer["rate"] = AIR_RATES[airtime.rate()].name;
+
+  JsonObject rec = doc.createNestedObject("recorder");
+  rec["recording"] = recorder.recording();
+  rec["replaying"] = replayer.active();
+  rec["records"] = recorder.records;
+  rec["bytes"] = recorder.bytes;
+  rec["overruns"] = recorder.overruns;
+  rec["capture_avg_us"] =
+      recorder.captureSamples
+          ? (uint32_t)(recorder.captureSumUs / recorder.captureSamples)
+          : 0;
+  rec["capture_max_us"] = recorder.captureMaxUs;
+  rec["flush_max_us"] = recorder.flushMaxUs;
+  rec["replay_late_max_us"] = replayer.lateMaxUs;
+
+  LightCommand last;
+  portENTER_CRITICAL(&currentCommandMux);
+  last = currentCommand;
+  portEXIT_CRITICAL(&currentCommandMux);
+  doc["last_command"]["sequence"] = last.sequence;
+  doc["last_command"]["effect"] = last.effect;
+  doc["last_command"]["brightness"] = last.brightness;
+  doc["last_command"]["speed"] = last.speed;
+  doc["last_command"]["debugMode"] = last.debugMode;
+  doc["last_command"]["panelId"] = last.panelId;
+
+  static char buffer[STATUS_JSON_SIZE];
+  size_t len = measureJson(doc);
+  if (doc.overflowed() || len >= sizeof(buffer)) {
+    Serial.printf("✗ Heartbeat too large (%u bytes), not published\n",
+                  (unsigned)len);
     return;
   }
+  serializeJson(doc, buffer, sizeof(buffer));
 
-  LightCommand cmd;
+  AllocExempt socket; // lwIP allocates the segment
+  if (client.publish(status_topic, buffer)) {
+    Serial.println("✓ Heartbeat published");
+  } else {
+    Serial.printf("✗ Heartbeat publish failed (%u bytes)\n", (unsigned)len);
+  }
+}
 
-  for (int i = 0; i < MAX_REGIONS; i++) {
-    cmd.regions[i] = false;
+// ESP-NOW send callback
+void onDataSent(const uint8_t *mac_addr, esp_now_send_status_t status) {
+  airtime.done(status == ESP_NOW_SEND_SUCCESS, esp_timer_get_time());
+  if (status != ESP_NOW_SEND_SUCCESS) {
+    bench_metrics.deliveryFails++;
   }
+  // ~60 AUDIO broadcasts a second would bury everything else
+  if (!command_log ||
+      (audio_streaming && memcmp(mac_addr, broadcast_mac, 6) == 0))
+    return;
 
-  cmd.debugMode = doc["debug"] | false;
+  char macStr[18];
+  snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X", mac_addr[0],
+           mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
 
-  if (cmd.debugMode) {
-    cmd.panelId = doc["panelId"] | 0;
-    cmd.sequence = 0;
-    cmd.effect = doc["effect"] | EFFECT_STATIC;
-    cmd.brightness = doc["brightness"] | DEFAULT_BRIGHTNESS;
-    cmd.speed = doc["speed"] | DEFAULT_SPEED;
+  Serial.print("Packet to ");
+  Serial.print(macStr);
+  Serial.print(" - Status: ");
+  Serial.println(status == ESP_NOW_SEND_SUCCESS ? "Success" : "Fail");
+}
 
-    if (doc.containsKey("regions")) {
-      JsonArray regions = doc["regions"].as<JsonArray>();
-      for (int region : regions) {
-        if (region >= 0 && region < MAX_REGIONS) {
-          cmd.regions[region] = true;
-        }
+// ESP-NOW receive callback (panel replies, and the other master's beacons
+// and show state). Runs on the WiFi task, so it only records state for the
+// other tasks to pick up.
+void onDataRecv(const uint8_t *mac_addr, const uint8_t *data, int data_len) {
+  if (data_len < 1)
+    return;
+
+  switch (data[0]) {
+  case PKT_LIGHT_ACK:
+    if (data_len == sizeof(LightAckPacket)) {
+      const LightAckPacket *pkt = (const LightAckPacket *)data;
+      AckEvent ev = {pkt->panelId, pkt->commandId, esp_timer_get_time()};
+      ackEvents.push(ev); // full: reported as missing, the app retries
+    }
+    break;
+  case PKT_BEACON:
+  case PKT_SHOW_STATE:
+    if ((data[0] == PKT_BEACON && data_len == sizeof(BeaconPacket)) ||
+        (data[0] == PKT_SHOW_STATE && data_len >= (int)SHOW_STATE_HEADER &&
+         data_len <= (int)sizeof(ShowStatePacket))) {
+      LeaseEvent ev;
+      memcpy(ev.mac, mac_addr, 6);
+      ev.receivedAt = millis();
+      ev.len = data_len;
+      memcpy(ev.data, data, data_len);
+      if (!leaseEvents.push(ev)) {
+        lease_metrics.eventDrops++;
       }
-    } else {
-      for (int i = 0; i < MAX_REGIONS; i++) {
-        cmd.regions[i] = true;
+    }
+    break;
+  case PKT_ANNOUNCE:
+    if (data_len == sizeof(AnnouncePacket)) {
+      PeerEvent ev;
+      memcpy(&ev.announce, data, sizeof(AnnouncePacket));
+      memcpy(ev.mac, mac_addr, 6);
+      if (!peerEvents.push(ev)) {
+        fanout_metrics.peerEventDrops++;
       }
     }
-
-    Serial.println("Debug mode: Direct region control");
-    currentCommand = cmd;
-    sendESPNowCommand(cmd);
-  } else {
-    cmd.sequence = doc["sequence"] | 0;
-    cmd.effect = doc["effect"] | EFFECT_STATIC;
-    cmd.brightness = doc["brightness"] | DEFAULT_BRIGHTNESS;
-    cmd.speed = doc["speed"] | DEFAULT_SPEED;
-    cmd.panelId = 0;
-
-    currentCommand = cmd;
-
-    Serial.print("Running sequence ");
-    Serial.print(cmd.sequence);
-    Serial.print(" with effect ");
-    Serial.println(cmd.effect);
-
-    switch (cmd.sequence) {
-    case 0:
-      runSequence0();
-      break;
-    case 1:
-      runSequence1();
-      break;
-    case 2:
-      runSequence2();
-      break;
-    case 3:
-      runSequence3();
-      break;
-    default:
-      Serial.print("Unknown sequence ID: ");
-      Serial.println(cmd.sequence);
+    break;
+  case PKT_CUE_STATUS:
+    if (data_len == sizeof(CueStatusPacket)) {
+      CueStatusPacket pkt;
+      memcpy(&pkt, data, sizeof(pkt));
+      if (pkt.panelId >= 1 && pkt.panelId <= MAX_PANELS) {
+        cueUploader.panelShowId[pkt.panelId] = pkt.showId;
+        cueUploader.panelStatus[pkt.panelId] = pkt.status;
+      }
+      Serial.print("Panel ");
+      Serial.print(pkt.panelId);
+      Serial.print(pkt.status == CUE_STATUS_STORED ? " stored show "
+                                                   : " rejected show ");
+      Serial.print(pkt.showId);
+      Serial.print(" (status ");
+      Serial.print(pkt.status);
+      Serial.println(")");
+    }
+    break;
+  case PKT_FW_STATUS:
+    if (data_len == sizeof(FwStatusPacket)) {
+      FwStatusPacket pkt;
+      memcpy(&pkt, data, sizeof(pkt));
+      if (firmwareStatus.push(pkt)) {
+        xTaskNotifyGive(showTaskHandle); // the rollout waits on it
+      }
+    }
+    break;
+  case PKT_PROVISION_STATUS:
+    if (data_len == sizeof(ProvisionStatusPacket)) {
+      ProvisionStatusPacket pkt;
+      memcpy(&pkt, data, sizeof(pkt));
+      Serial.printf("%s %02X:%02X:%02X:%02X:%02X:%02X (panel %u): %s\n",
+                    pkt.status <= PROVISION_UNCHANGED ? "✓ Provisioned"
+                                                      : "✗ Not provisioned",
+                    pkt.factoryMac[0], pkt.factoryMac[1], pkt.factoryMac[2],
+                    pkt.factoryMac[3], pkt.factoryMac[4], pkt.factoryMac[5],
+                    pkt.panelId,
+                    pkt.status <= PROVISION_FLASH_ERROR
+                        ? PROVISION_STATUS_NAMES[pkt.status]
+                        : "?");
     }
+    break;
+  case PKT_PROGRAM_STATUS:
+    if (data_len == sizeof(ProgramStatusPacket)) {
+      ProgramStatusPacket pkt;
+      memcpy(&pkt, data, sizeof(pkt));
+      Serial.print("Panel ");
+      Serial.print(pkt.panelId);
+      Serial.print(pkt.status == PROGRAM_STATUS_STORED ? " stored program "
+                                                       : " rejected program ");
+      Serial.print(pkt.slot);
+      Serial.print(" (status ");
+      Serial.print(pkt.status);
+      Serial.println(")");
+    }
+    break;
+  default:
+    break;
   }
 }
 
-void setAllRegions(bool state, LightCommand &cmd) {
-  for (int i = 0; i < MAX_REGIONS; i++) {
-    cmd.regions[i] = state;
+// Any task. The one place ESP-NOW frames go out, so each is counted
+// against the rate it was sent at.
+esp_err_t radioSend(const uint8_t *mac, const uint8_t *data, size_t len) {
+  bool unicast = memcmp(mac, broadcast_mac, 6) != 0;
+  uint32_t ticket = airtime.sending(unicast, esp_timer_get_time());
+  esp_err_t result;
+  {
+    AllocExempt radio; // the WiFi driver's own frame buffers
+    result = esp_now_send(mac, data, len);
   }
+  airtime.sent(ticket, len, result == ESP_OK);
+  return result;
 }
 
-void setRegionsByList(const uint8_t *regionList, uint8_t count, bool state,
-                      LightCommand &cmd) {
-  for (uint8_t i = 0; i < count; i++) {
-    cmd.regions[regionList[i]] = state;
+// Show task, and setup() before it starts
+bool applyAirRate(uint8_t index) {
+  if (index >= AIR_RATE_COUNT ||
+      esp_wifi_config_espnow_rate(WIFI_IF_STA, AIR_RATES[index].phy) !=
+          ESP_OK) {
+    Serial.println("✗ ESP-NOW rate not accepted by the driver");
+    return false;
   }
+  airtime.setRate(index);
+  return true;
 }
 
-void runSequence0() {
-  Serial.println("\n=== Running Sequence 0: Test Sequence ===");
-  sequenceRunning = true;
-
-  LightCommand cmd;
-  cmd.sequence = 0;
-  cmd.panelId = 0;
-  cmd.debugMode = false;
-
-  Serial.println("Step 1: All regions full brightness (2s)");
-  setAllRegions(true, cmd);
-  cmd.effect = EFFECT_STATIC;
-  cmd.brightness = 255;
-  cmd.speed = 50;
-  sendESPNowCommand(cmd);
-  delay(2000);
-
-  Serial.println("Step 2: Wave effect (5s)");
-  cmd.effect = EFFECT_WAVE;
-  cmd.speed = 60;
-  sendESPNowCommand(cmd);
-  delay(5000);
-
-  Serial.println("Step 3: Pulse fast (3s)");
-  cmd.effect = EFFECT_PULSE;
-  cmd.speed = 80;
-  sendESPNowCommand(cmd);
-  delay(3000);
-
-  Serial.println("Step 4: Pulse slow (3s)");
-  cmd.speed = 30;
-  sendESPNowCommand(cmd);
-  delay(3000);
-
-  Serial.println("Step 5: Fade in (3s)");
-  cmd.effect = EFFECT_FADE_IN;
-  cmd.speed = 50;
-  sendESPNowCommand(cmd);
-  delay(3000);
-
-  Serial.println("Step 6: Fade out (3s)");
-  cmd.effect = EFFECT_FADE_OUT;
-  sendESPNowCommand(cmd);
-  delay(3000);
-
-  Serial.println("Step 7: All off");
-  cmd.effect = EFFECT_STATIC;
-  cmd.brightness = 0;
-  sendESPNowCommand(cmd);
-  delay(500);
-
-  Serial.println("✓ Sequence 0 complete\n");
-  sequenceRunning = false;
-}
-
-void runSequence1() {
-  Serial.println("\n=== Running Sequence 1: Vertical Sweep ===");
-  sequenceRunning = true;
+// Net task
+void saveAirRate(uint8_t index) {
+  AllocExempt nvs;
+  Preferences prefs;
+  if (prefs.begin(CHANNEL_NVS_NAMESPACE, false)) {
+    prefs.putString("rate", AIR_RATES[index].name);
+    prefs.end();
+  }
+}
 
-  LightCommand cmd;
-  cmd.sequence = 1;
-  cmd.panelId = 0;
-  cmd.debugMode = false;
-  cmd.effect = currentCommand.effect;
-  cmd.brightness = currentCommand.brightness;
-  cmd.speed = currentCommand.speed;
-
-  setAllRegions(false, cmd);
-
-  Serial.println("Forward sweep: top to bottom");
-  for (uint8_t region = 0; region < MAX_REGIONS; region++) {
-    cmd.regions[region] = true;
-    sendESPNowCommand(cmd);
-    delay(300);
+void setup_espnow() {
+  // Initialize ESP-NOW
+  if (esp_now_init() != ESP_OK) {
+    Serial.println("Error initializing ESP-NOW");
+    return;
   }
 
-  Serial.println("Hold all lit (2s)");
-  delay(2000);
+  // Register send/receive callbacks
+  esp_now_register_send_cb(onDataSent);
+  esp_now_register_recv_cb(onDataRecv);
 
-  Serial.println("Reverse sweep: bottom to top");
-  for (int region = MAX_REGIONS - 1; region >= 0; region--) {
-    cmd.regions[region] = false;
-    sendESPNowCommand(cmd);
-    delay(300);
+  // Panels are discovered at runtime; only the broadcast peer is static
+  esp_now_peer_info_t peerInfo = {};
+  memcpy(peerInfo.peer_addr, broadcast_mac, 6);
+  peerInfo.channel = 0; // Follow whatever channel the STA ends up on
+  peerInfo.encrypt = false;
+  peerInfo.ifidx = WIFI_IF_STA;
+  if (esp_now_add_peer(&peerInfo) != ESP_OK) {
+    Serial.println("Failed to add broadcast peer");
   }
 
-  Serial.println("✓ Sequence 1 complete\n");
-  sequenceRunning = false;
-}
-
-void runSequence2() {
-  Serial.println("\n=== Running Sequence 2: Group Narrative ===");
-  sequenceRunning = true;
+  // The rate chosen last ({"airtime": "rate"} or a sweep), else 1M
+  char rateName[8] = "";
+  Preferences prefs;
+  if (prefs.begin(CHANNEL_NVS_NAMESPACE, true)) {
+    if (prefs.isKey("rate")) {
+      prefs.getString("rate", rateName, sizeof(rateName));
+    }
+    prefs.end();
+  }
+  uint8_t rate = airRateByName(rateName);
+  if (rate != AIR_RATE_NONE && applyAirRate(rate)) {
+    Serial.print("✓ ESP-NOW rate ");
+    Serial.println(AIR_RATES[rate].name);
+  }
 
-  LightCommand cmd;
-  cmd.sequence = 2;
-  cmd.panelId = 0;
-  cmd.debugMode = false;
-  cmd.effect = currentCommand.effect;
-  cmd.brightness = currentCommand.brightness;
-  cmd.speed = currentCommand.speed;
-
-  setAllRegions(false, cmd);
-
-  Serial.println("Step 1: Light SYMBOL group");
-  uint8_t symbolBuf[MAX_REGIONS];
-  uint8_t symbolCount;
-  RegionGroups::getByGroup(GROUP_SYMBOL, symbolBuf, symbolCount);
-  setRegionsByList(symbolBuf, symbolCount, true, cmd);
-  sendESPNowCommand(cmd);
-  delay(4000);
-
-  Serial.println("Step 2: Add RAAVANA_HEAD group");
-  uint8_t raavanaHeadBuf[MAX_REGIONS];
-  uint8_t raavanaHeadCount;
-  RegionGroups::getByGroup(GROUP_RAAVANA_HEAD, raavanaHeadBuf,
-                           raavanaHeadCount);
-  setRegionsByList(raavanaHeadBuf, raavanaHeadCount, true, cmd);
-  sendESPNowCommand(cmd);
-  delay(4000);
-
-  Serial.println("Step 3: Expand to full RAAVANA group");
-  uint8_t raavanaBuf[MAX_REGIONS];
-  uint8_t raavanaCount;
-  RegionGroups::getByGroup(GROUP_RAAVANA, raavanaBuf, raavanaCount);
-  setRegionsByList(raavanaBuf, raavanaCount, true, cmd);
-  sendESPNowCommand(cmd);
-  delay(5000);
-
-  Serial.println("Step 4: Light CONTINENT group");
-  uint8_t continentBuf[MAX_REGIONS];
-  uint8_t continentCount;
-  RegionGroups::getByGroup(GROUP_CONTINENT, continentBuf, continentCount);
-  setRegionsByList(continentBuf, continentCount, true, cmd);
-  sendESPNowCommand(cmd);
-  delay(5000);
-
-  Serial.println("Step 5: All off");
-  cmd.effect = EFFECT_STATIC;
-  cmd.brightness = 0;
-  sendESPNowCommand(cmd);
-  delay(1000);
-
-  Serial.println("✓ Sequence 2 complete\n");
-  sequenceRunning = false;
-}
-
-void runSequence3() {
-  Serial.println("\n=== Running Sequence 3: Symbol Emergence ===");
-  sequenceRunning = true;
+  Serial.println("ESP-NOW initialized");
+}
 
-  LightCommand cmd;
-  cmd.sequence = 3;
-  cmd.panelId = 0;
-  cmd.debugMode = false;
-  cmd.effect = currentCommand.effect;
-  cmd.brightness = currentCommand.brightness;
-  cmd.speed = currentCommand.speed;
-
-  setAllRegions(false, cmd);
-
-  Serial.println("Step 1: Light SYMBOL regions");
-  uint8_t symbolBuf[MAX_REGIONS];
-  uint8_t symbolCount;
-  RegionGroups::getByGroup(GROUP_SYMBOL, symbolBuf, symbolCount);
-  setRegionsByList(symbolBuf, symbolCount, true, cmd);
-  sendESPNowCommand(cmd);
-  delay(3000);
-
-  Serial.println("Step 2: Add all other regions");
-  setAllRegions(true, cmd);
-  sendESPNowCommand(cmd);
-  delay(5000);
-
-  Serial.println("Step 3: All off");
-  cmd.effect = EFFECT_STATIC;
-  cmd.brightness = 0;
-  sendESPNowCommand(cmd);
-  delay(1000);
-
-  Serial.println("✓ Sequence 3 complete\n");
-  sequenceRunning = false;
-}
-
-void reconnect() {
-  if (client.connected()) {
-    mqtt_connected = true;
-    mqtt_fail_count = 0;
-    retry_timeout = 5;
-    return;
+// panelId 0 is a single broadcast frame regardless of panel count. A
+// standby sends nothing at all.
+bool sendPacket(uint8_t panelId, const uint8_t *data, size_t len) {
+  if (!master_active.load()) {
+    return false;
   }
+  int64_t start = esp_timer_get_time();
 
-  Serial.print("Attempting MQTT connection...");
-  String clientId = "ESP32Master-" + String(random(0xffff), HEX);
+  if (panelId == 0) {
+    bool ok = radioSend(broadcast_mac, data, len) == ESP_OK;
+    fanout_metrics.broadcastUs = esp_timer_get_time() - start;
+    ok ? bench_metrics.frames++ : bench_metrics.sendErrors++;
+    return ok;
+  }
 
-  if (client.connect(clientId.c_str())) {
-    Serial.println("✓ connected");
-    mqtt_connected = true;
-    mqtt_fail_count = 0;
-    retry_timeout = 5;
+  PeerEntry *peer = peers.route(panelId, millis());
+  if (!peer) {
+    fanout_metrics.routeFailures++;
+    Serial.print("Panel ");
+    Serial.print(panelId);
+    Serial.println(" not discovered");
+    return false;
+  }
+  bool ok = radioSend(peer->mac, data, len) == ESP_OK;
+  fanout_metrics.unicastUs = esp_timer_get_time() - start;
+  ok ? bench_metrics.frames++ : bench_metrics.sendErrors++;
+  return ok;
+}
 
-    client.subscribe(command_topic);
-  } else {
-    Serial.print("✗ failed, rc=");
-    Serial.println(client.state());
+// Show task. A panel announcing as 0 has no ID yet (src/panel/identity.h).
+void noteUnprovisioned(const uint8_t *mac, uint32_t now) {
+  portENTER_CRITICAL(&unprovisionedMux);
+  bool known = unprovisioned_seen && memcmp(unprovisioned_mac, mac, 6) == 0;
+  memcpy(unprovisioned_mac, mac, 6);
+  unprovisioned_seen = now ? now : 1;
+  portEXIT_CRITICAL(&unprovisionedMux);
+  if (!known) {
+    Serial.printf("⚠ Unprovisioned panel at %02X:%02X:%02X:%02X:%02X:%02X\n",
+                  mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  }
+}
 
-    mqtt_connected = false;
-    mqtt_fail_count++;
+// Show task. Applies queued announces, expires silent panels and sends the
+// periodic beacon.
+// Show task. Beacon the stage: lease term, tempo and which panels we know.
+void sendBeacon(uint32_t now) {
+  beacon_due = false;
+  last_beacon = now;
+  const TempoClock &tempo = tempoClock();
+  uint64_t position = tempo.position(now);
+  BeaconPacket beacon = {PKT_BEACON,
+                         (uint8_t)WiFi.channel(),
+                         beacon_seq++,
+                         now,
+                         peers.knownMask(),
+                         tempo.bpmX100(),
+                         tempo.beatsPerBar(),
+                         (uint32_t)(position / TEMPO_ONE_BEAT),
+                         (uint16_t)(position % TEMPO_ONE_BEAT),
+                         priority_state.load(),
+                         lease_term};
+  sendPacket(0, (const uint8_t *)&beacon, sizeof(beacon));
+}
 
-    if (mqtt_fail_count >= MAX_MQTT_RETRIES) {
-      Serial.println("⚠ Max MQTT retries exceeded");
-      checkWiFiStatus();
+void peerTick(uint32_t now) {
+  AllocScope zone(ALLOC_ZONE_DISPATCH);
+  if (channel_moved.exchange(false)) {
+    channel_metrics.recoveryMs = 0;
+    // Right after a reboot no panel is known yet; time the first one back
+    channel_metrics.waitingMask = peers.knownMask();
+    channel_wait_any = channel_metrics.waitingMask == 0;
+    channel_burst_until = now + CHANNEL_BURST_MS;
+    beacon_due = true;
+  }
 
-      if (mqtt_fail_count >= MAX_MQTT_RETRIES * 2) {
-        enterLowPowerMode();
+  PeerEvent ev;
+  bool layoutChanged = false;
+  while (peerEvents.pop(ev)) {
+    // A scanning panel probes each channel with an announce; answer at once
+    beacon_due = true;
+    uint8_t id = ev.announce.panelId;
+    uint32_t bit = id >= 1 && id <= MAX_PANELS ? 1UL << (id - 1) : 0;
+    if ((channel_metrics.waitingMask & bit) || (channel_wait_any && bit)) {
+      channel_wait_any = false;
+      channel_metrics.waitingMask &= ~bit;
+      if (channel_metrics.waitingMask == 0) {
+        channel_metrics.recoveryMs = now - channel_metrics.movedAt;
+        Serial.print("✓ All panels back on channel ");
+        Serial.print(channel_metrics.channel);
+        Serial.print(" after ");
+        Serial.print(channel_metrics.recoveryMs);
+        Serial.println(" ms");
       }
     }
-
-    retry_timeout = (retry_timeout + 10 > MAX_RETRY_TIMEOUT)
-                        ? MAX_RETRY_TIMEOUT
-                        : (retry_timeout + 10);
-    Serial.print("Retrying in ");
-    Serial.print(retry_timeout);
-    Serial.println(" seconds...");
-    delay(retry_timeout * 1000);
+    if (id == 0) {
+      noteUnprovisioned(ev.mac, now);
+      continue;
+    }
+    if (peers.update(ev.announce, ev.mac, now)) {
+      layoutChanged = true;
+      char macStr[18];
+      snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
+               ev.mac[0], ev.mac[1], ev.mac[2], ev.mac[3], ev.mac[4],
+               ev.mac[5]);
+      Serial.print("✓ Panel ");
+      Serial.print(ev.announce.panelId);
+      Serial.print(" discovered at ");
+      Serial.print(macStr);
+      Serial.print(" (regions ");
+      Serial.print(ev.announce.firstRegion);
+      Serial.print("-");
+      Serial.print(ev.announce.firstRegion + ev.announce.regionCount - 1);
+      Serial.println(")");
+    }
   }
-}
 
-void setup() {
-  Serial.begin(115200);
-
-  Serial.println("\n=== MASTER ESP32 ===");
-
-  setup_wifi();
-  setup_espnow();
+  uint8_t dropped = peers.expire(now);
+  if (dropped) {
+    Serial.print("⚠ ");
+    Serial.print(dropped);
+    Serial.println(" panel(s) stopped announcing");
+  }
+  if (layoutChanged || dropped) {
+    uint16_t regionEnd = peers.regionEnd();
+    stage_region_end.store(regionEnd > STAGE_REGIONS ? regionEnd
+                                                     : STAGE_REGIONS);
+  }
 
-  client.setServer(mqtt_server, mqtt_port);
-  client.setCallback(mqttCallback);
+  if (!master_active.load()) {
+    return; // the holder answers announces and beacons
+  }
+  uint32_t interval = (int32_t)(channel_burst_until - now) > 0
+                          ? CHANNEL_BURST_INTERVAL_MS
+                          : BEACON_INTERVAL_MS;
+  bool beaconSent = false;
+  if (beacon_due || now - last_beacon >= interval) {
+    sendBeacon(now);
+    beaconSent = true;
+  }
 
-  Serial.println("\nStarting test sequence in 3 seconds...");
-  delay(3000);
-  runSequence0();
+  // For a standby, if there is one: with every beacon, and soon after the
+  // scene changes
+  if (beaconSent || (show_state_due &&
+                     now - last_show_state >= SHOW_STATE_MIN_INTERVAL_MS)) {
+    show_state_due = false;
+    last_show_state = now;
+    LightCommand current;
+    portENTER_CRITICAL(&currentCommandMux);
+    current = currentCommand;
+    portEXIT_CRITICAL(&currentCommandMux);
+    static ShowStatePacket state;
+    size_t len = showStateEncode(current, player, lease_term, now, state);
+    sendPacket(0, (const uint8_t *)&state, len);
+  }
 }
 
-void loop() {
-  if (low_power_mode)
-    return;
-
-  if (!client.connected()) {
-    reconnect();
-  } else {
-    client.loop();
+#ifdef SIMULATED_PANELS
+// Populate the peer table with SIMULATED_PANELS virtual panels and time
+// routing and fan-out. Unicast frames to the fake MACs go unacknowledged,
+// but the cost of esp_now_send() and slot eviction is what is measured.
+void runPeerBenchmark() {
+  const uint8_t panelCount = min(SIMULATED_PANELS, MAX_PANELS);
+  Serial.println("\n=== Peer table benchmark ===");
+
+  for (uint8_t id = 1; id <= panelCount; id++) {
+    AnnouncePacket a = {PKT_ANNOUNCE, id, (uint16_t)((id - 1) * 8), 8, 0};
+    uint8_t mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, id};
+    peers.update(a, mac, millis());
   }
 
-  unsigned long currentMillis = millis();
-
-  if (currentMillis - last_heartbeat >= HEARTBEAT_INTERVAL) {
-    last_heartbeat = currentMillis;
-    publishHeartbeat();
+  const uint32_t lookups = 100000;
+  volatile uint32_t sink = 0;
+  int64_t t0 = esp_timer_get_time();
+  for (uint32_t i = 0; i < lookups; i++) {
+    sink += peers.get(1 + i % panelCount)->regionCount;
   }
-
-  if (currentMillis - last_wifi_check >= WIFI_CHECK_INTERVAL) {
-    last_wifi_check = currentMillis;
-    checkWiFiStatus();
+  int64_t lookupNs = (esp_timer_get_time() - t0) * 1000 / lookups;
+
+  LightCommand cmd = {};
+  LightCommandFrame frame;
+  uint8_t len = lightFrameEncode(cmd, 0, 0, frame);
+  uint8_t failed = 0;
+  t0 = esp_timer_get_time();
+  for (uint8_t id = 1; id <= panelCount; id++) {
+    frame.panelId = id;
+    if (!sendPacket(id, (const uint8_t *)&frame, len)) {
+      failed++;
+    }
+    delay(2); // keep the ESP-NOW TX queue from overflowing
+  }
+  int64_t unicastUs = esp_timer_get_time() - t0 - 2000LL * panelCount;
+
+  frame.panelId = 0;
+  t0 = esp_timer_get_time();
+  sendPacket(0, (const uint8_t *)&frame, len);
+  int64_t broadcastUs = esp_timer_get_time() - t0;
+
+  Serial.printf("Panels: %u (unicast slots: %u)\n", panelCount,
+                peers.registeredCount());
+  Serial.printf("Memory: %u bytes/peer, %u bytes table\n",
+                (unsigned)sizeof(PeerEntry), (unsigned)sizeof(PeerTable));
+  Serial.printf("Route lookup: %lld ns\n", (long long)lookupNs);
+  Serial.printf("Fan-out unicast x%u: %lld us (%u send errors)\n", panelCount,
+                (long long)unicastUs, failed);
+  Serial.printf("Fan-out broadcast: %lld us\n", (long long)broadcastUs);
+  Serial.println("============================\n");
+}
+#endif
+
+#ifdef BENCHMARK_REGIONS
+// Per-command region handling at one rig size: build an "all but one" mask,
+// serialise it as the master does and decode it as a panel does, once with
+// the word-wide bitset and once with one bool per region as LightCommand
+// used to carry.
+template <uint16_t N> void benchRegionCapacity() {
+  const uint16_t iterations = 2000;
+  BitSet<N> tx, rx;
+  bool flags[N];
+  uint8_t bytes[BitSet<N>::BYTES];
+  volatile uint32_t sink = 0;
+
+  int64_t t0 = esp_timer_get_time();
+  for (uint16_t it = 0; it < iterations; it++) {
+    tx.clearAll();
+    tx.assignRange(0, N, true);
+    tx.clear(it % N);
+    uint16_t used = tx.usedBytes();
+    tx.toBytes(bytes, 0, used);
+    rx.clearAll();
+    rx.fromBytes(bytes, 0, used);
+    sink += rx.extract(N / 2, 8) + rx.count();
   }
+  int64_t bitsetNs = (esp_timer_get_time() - t0) * 1000 / iterations;
+
+  t0 = esp_timer_get_time();
+  for (uint16_t it = 0; it < iterations; it++) {
+    for (uint16_t i = 0; i < N; i++)
+      flags[i] = true;
+    flags[it % N] = false;
+    memset(bytes, 0, sizeof(bytes));
+    for (uint16_t i = 0; i < N; i++) {
+      if (flags[i])
+        bytes[i >> 3] |= 1 << (i & 7);
+    }
+    uint32_t active = 0;
+    for (uint16_t i = 0; i < N; i++) {
+      flags[i] = (bytes[i >> 3] >> (i & 7)) & 1;
+      active += flags[i];
+    }
+    for (uint8_t r = 0; r < 8; r++)
+      active += flags[N / 2 + r];
+    sink += active;
+  }
+  int64_t boolNs = (esp_timer_get_time() - t0) * 1000 / iterations;
+
+  Serial.printf("%4u regions: %6lld ns bitset, %6lld ns bool[], %u bytes\n",
+                N, (long long)bitsetNs, (long long)boolNs,
+                (unsigned)sizeof(BitSet<N>));
+}
+
+void runRegionBenchmark() {
+  Serial.println("\n=== Region set benchmark (per command) ===");
+  benchRegionCapacity<20>();
+  benchRegionCapacity<64>();
+  benchRegionCapacity<128>();
+  benchRegionCapacity<256>();
+  benchRegionCapacity<512>();
+  Serial.println("==========================================\n");
+}
+#endif
+
+// Net or show task, into that task's queue. Commands without an id get no
+// answer, except a parse error, whose id cannot be known.
+void queueAnswer(SpscQueue<CommandAck, 8> &queue, uint32_t id,
+                 uint8_t status) {
+  if (id == ACK_NO_ID && status != NACK_PARSE_ERROR) {
+    return;
+  }
+  CommandAck ack = {};
+  ack.id = id;
+  ack.status = status;
+  queue.push(ack);
+}
+
+// Show task. A light command with an id has just gone out (`ok` if every
+// frame did); wait for the panels it addressed.
+void trackCommand(uint32_t id, uint8_t panelId, bool ok) {
+  uint32_t expected = panelId == 0 ? peers.knownMask() : 1UL << (panelId - 1);
+  if (!ok) {
+    queueAnswer(showAcks, id, NACK_UNREACHABLE);
+  } else if (expected == 0) {
+    queueAnswer(showAcks, id, NACK_NO_PANELS);
+  } else if (!acks.begin(id, light_command_id, expected, ack_next_us,
+                         millis())) {
+    queueAnswer(showAcks, id, NACK_BUSY);
+  }
+}
+
+// Show task. Confirmations in, finished commands out to the net task.
+void ackTick(uint32_t now) {
+  AckEvent ev;
+  while (ackEvents.pop(ev)) {
+    acks.onAck(ev);
+  }
+  static CommandAck done;
+  while (acks.poll(now, done)) {
+    showAcks.push(done);
+  }
+}
+
+// Net task. One message on ack_topic per answer, e.g.
+// {"id":7,"ack":true,"status":"partial","panels":[1,2],"latency_ms":[18,21],
+//  "missing":[3]}
+void publishAck(const CommandAck &ack) {
+  static StaticJsonDocument<1792> doc; // three arrays of up to MAX_PANELS
+  doc.clear();
+  doc["id"] = ack.id;
+  doc["ack"] = ackPositive(ack.status);
+  doc["status"] = ACK_STATUS_NAMES[ack.status];
+  if (ack.status == ACK_APPLIED || ack.status == ACK_PARTIAL) {
+    JsonArray panels = doc.createNestedArray("panels");
+    JsonArray latency = doc.createNestedArray("latency_ms");
+    for (uint8_t id = 1; id <= MAX_PANELS; id++) {
+      if (ack.confirmed & (1UL << (id - 1))) {
+        panels.add(id);
+        latency.add(ack.latencyMs[id - 1]);
+      }
+    }
+    if (ack.status == ACK_PARTIAL) {
+      JsonArray missing = doc.createNestedArray("missing");
+      for (uint8_t id = 1; id <= MAX_PANELS; id++) {
+        if ((ack.expected & ~ack.confirmed) & (1UL << (id - 1))) {
+          missing.add(id);
+        }
+      }
+    }
+  }
+
+  static char buffer[512];
+  serializeJson(doc, buffer);
+  client.publish(ack_topic, buffer);
+}
+
+void publishAcks() {
+  static CommandAck ack;
+  while (client.connected() && (netAcks.pop(ack) || showAcks.pop(ack))) {
+    publishAck(ack);
+  }
+}
+
+// Show task
+void sendESPNowCommand(LightCommand &cmd) {
+  AllocScope zone(ALLOC_ZONE_DISPATCH);
+  task_metrics.dispatched++;
+  recorder.capture(cmd);
+  if (boot_metrics.firstSendMs == 0) {
+    boot_metrics.firstSendMs = millis();
+  }
+
+  uint32_t ackId = ack_next_id;
+  ack_next_id = ACK_NO_ID;
+
+  static LightCommandFrame frame;
+  uint8_t frames = lightFrameCount(cmd);
+  light_command_id++;
+  bool ok = true;
+  for (uint8_t i = 0; i < frames; i++) {
+    uint8_t len = lightFrameEncode(cmd, light_command_id, i, frame,
+                                   ackId != ACK_NO_ID ? LIGHT_FLAG_ACK : 0);
+    ok &= sendPacket(cmd.panelId, (const uint8_t *)&frame, len);
+  }
+  if (ackId != ACK_NO_ID) {
+    trackCommand(ackId, cmd.panelId, ok);
+  }
+  if (!command_log) {
+    return;
+  } else if (cmd.panelId == 0) {
+    Serial.println(ok ? "Broadcast sent successfully" : "Error broadcasting");
+  } else if (ok) {
+    Serial.print("Sent to Panel ");
+    Serial.println(cmd.panelId);
+  } else {
+    Serial.println("Error sending");
+  }
+}
+
+// Net task -> show task hand-off. Keeps enqueuedUs if the caller already
+// stamped it (light commands are stamped on arrival, before JSON decode).
+bool enqueueCommand(QueuedCommand &item) {
+  if (item.enqueuedUs == 0) {
+    item.enqueuedUs = esp_timer_get_time();
+  }
+  if (!commandQueue.push(item)) {
+    task_metrics.queueDrops++;
+    bench_metrics.queueDrops++;
+    if (command_log) {
+      Serial.println("⚠ Command queue full, dropping command");
+    }
+    return false;
+  }
+
+  uint32_t depth = commandQueue.size();
+  if (depth > task_metrics.queuePeak) {
+    task_metrics.queuePeak = depth;
+  }
+  if (depth > bench_metrics.queuePeak) {
+    bench_metrics.queuePeak = depth;
+  }
+  xTaskNotifyGive(showTaskHandle);
+  return true;
+}
+
+void enqueueControl(CommandKind kind, uint8_t arg) {
+  QueuedCommand item = {};
+  item.kind = kind;
+  item.arg = arg;
+  enqueueCommand(item);
+}
+
+// Net task. Recording and replay are mutually exclusive: the journal is
+// closed before the show task opens it for replay.
+void handleShowControl(const char *record, const char *replay, bool loop) {
+  if (record && strcmp(record, "start") == 0) {
+    enqueueControl(CMD_REPLAY_STOP, 0);
+    recorder.start();
+  } else if (record && strcmp(record, "stop") == 0) {
+    recorder.stop();
+  }
+
+  if (replay && strcmp(replay, "start") == 0) {
+    recorder.stop();
+    enqueueControl(CMD_REPLAY_START, loop ? 1 : 0);
+  } else if (replay && strcmp(replay, "stop") == 0) {
+    enqueueControl(CMD_REPLAY_STOP, 0);
+  }
+}
+
+// Net task. {"tempo": {"bpm": 128, "beatsPerBar": 4}} sets the tempo;
+// {"tempo": "tap"} and {"tempo": "downbeat"} are timed by their arrival.
+void enqueueTempo(CommandKind kind, int64_t atUs, uint16_t bpmX100 = 0,
+                  uint8_t beatsPerBar = 0) {
+  QueuedCommand item = {};
+  item.kind = kind;
+  item.enqueuedUs = atUs;
+  item.cue = bpmX100;
+  item.arg = beatsPerBar;
+  enqueueCommand(item);
+}
+
+void handleTempoControl(JsonVariant tempo, int64_t arrivedUs) {
+  if (tempo.is<JsonObject>()) {
+    float bpm = tempo["bpm"] | 0.0f;
+    uint8_t beats = tempo["beatsPerBar"] | 0;
+    if (bpm != 0 && (bpm * 100 < TEMPO_MIN_BPM_X100 ||
+                     bpm * 100 > TEMPO_MAX_BPM_X100)) {
+      Serial.print("✗ Tempo must be between ");
+      Serial.print(TEMPO_MIN_BPM_X100 / 100);
+      Serial.print(" and ");
+      Serial.print(TEMPO_MAX_BPM_X100 / 100);
+      Serial.println(" BPM");
+      return;
+    }
+    enqueueTempo(CMD_TEMPO_SET, arrivedUs, (uint16_t)(bpm * 100 + 0.5f),
+                 beats);
+  } else if (strcmp(tempo | "", "tap") == 0) {
+    enqueueTempo(CMD_TEMPO_TAP, arrivedUs);
+  } else if (strcmp(tempo | "", "downbeat") == 0) {
+    enqueueTempo(CMD_TEMPO_DOWNBEAT, arrivedUs);
+  } else {
+    Serial.println("Unknown tempo action");
+  }
+}
+
+// Net task, serial console or MQTT callback: straight to the radio, then
+// the show task takes over. Latency counts from when the command arrived.
+void sendPriority(uint8_t action, int64_t arrivedUs) {
+  PriorityPacket pkt = {PKT_PRIORITY, action, ++priority_seq};
+  esp_err_t result =
+      radioSend(broadcast_mac, (const uint8_t *)&pkt, sizeof(pkt));
+  uint32_t latency = esp_timer_get_time() - arrivedUs;
+  bench_metrics.priority.record(latency);
+  bench_metrics.frames++;
+
+  priority_state.store(action);
+  priorityStaging = pkt;
+  priorityStagingUs = arrivedUs;
+  priorityStagingPending.store(true);
+  xTaskNotifyGive(showTaskHandle);
+
+  Serial.printf("⚡ %s sent in %u us%s\n", PRIORITY_NAMES[action],
+                (unsigned)latency, result == ESP_OK ? "" : " (send refused)");
+
+  // After the send: a master that reboots mid-blackout must not have its
+  // beacons release the stage
+  AllocExempt nvs;
+  Preferences prefs;
+  if (prefs.begin(PRIORITY_NVS_NAMESPACE, false)) {
+    prefs.putUChar("state", action);
+    prefs.end();
+  }
+}
+
+// Net task. One message per rate that carried traffic since the last reset,
+// so the counters of a whole sweep never outgrow the MQTT buffer.
+void publishAirtimeReport() {
+  uint8_t current = airtime.rate();
+  float elapsedUs = (float)(esp_timer_get_time() - airtime_since_us);
+  for (uint8_t i = 0; i < AIR_RATE_COUNT; i++) {
+    const AirRateStats &s = airtime.stats(i);
+    if (i != current && s.frames == 0 && s.sendErrors == 0)
+      continue;
+    StaticJsonDocument<512> doc;
+    doc["rate"] = AIR_RATES[i].name;
+    doc["current"] = i == current;
+    doc["frames"] = s.frames;
+    doc["bytes"] = s.bytes;
+    doc["airtime_us"] = s.airtimeUs;
+    doc["airtime_pct"] = 100.0f * s.airtimeUs / elapsedUs;
+    doc["frame_airtime_us"] = s.frames ? s.airtimeUs / s.frames : 0;
+    doc["send_errors"] = s.sendErrors;
+    doc["unicasts"] = s.unicasts;
+    doc["delivery_fails"] = s.deliveryFails;
+    doc["failure_pct"] =
+        s.unicasts ? 100.0f * s.deliveryFails / s.unicasts : 0.0f;
+    JsonObject cb = doc.createNestedObject("callback_us");
+    cb["samples"] = s.callback.count();
+    cb["p50"] = s.callback.percentile(50);
+    cb["p95"] = s.callback.percentile(95);
+    cb["max"] = s.callback.max();
+
+    char buffer[384];
+    serializeJson(doc, buffer);
+    client.publish(airtime_topic, buffer);
+  }
+}
+
+// Net task, MQTT or console. Refused while a sweep owns the rate.
+void requestAirRate(uint8_t rate) {
+  if (rateSweep.running() || sweepStagingPending.load()) {
+    Serial.println("⚠ Rate sweep running; rate left alone");
+    return;
+  }
+  enqueueControl(CMD_RATE_SET, rate);
+  saveAirRate(rate);
+  Serial.print("ESP-NOW rate ");
+  Serial.println(AIR_RATES[rate].name);
+}
+
+void requestRateSweep(const RateSweepPlan &plan) {
+  if (rateSweep.running() || sweepStagingPending.load()) {
+    Serial.println("⚠ Rate sweep already running");
+    return;
+  }
+  sweepStaging = plan;
+  sweepStagingPending.store(true);
+  enqueueControl(CMD_RATE_SWEEP, 0);
+}
+
+// Net task, once the show task has finished a sweep
+void finishRateSweep() {
+  const RateSweepPlan &plan = rateSweep.plan;
+  uint8_t best = rateSweep.best;
+  bool applied = plan.apply && best != AIR_RATE_NONE;
+  Serial.println("Rate sweep:  rate   delivered  p95 us  airtime us");
+  for (uint8_t i = 0; i < AIR_RATE_COUNT; i++) {
+    if (!(plan.rateMask & (1U << i)))
+      continue;
+    const AirRateStats &s = airtime.stats(i);
+    Serial.printf("%s %-6s %5u/%-5u %6u  %6u\n", i == best ? "  ✓" : "   ",
+                  AIR_RATES[i].name, (unsigned)(s.unicasts - s.deliveryFails),
+                  (unsigned)s.unicasts, (unsigned)s.callback.percentile(95),
+                  (unsigned)airtimeUs(AIR_RATES[i], plan.bytes, true));
+  }
+  if (best == AIR_RATE_NONE) {
+    Serial.println("⚠ No rate delivered reliably; rate unchanged");
+  } else if (applied) {
+    saveAirRate(best);
+  }
+  Serial.print("ESP-NOW rate ");
+  Serial.println(AIR_RATES[applied ? best : rateSweep.previous].name);
+
+  if (!client.connected())
+    return;
+  publishAirtimeReport();
+  StaticJsonDocument<256> doc;
+  doc["sweep"] = "done";
+  doc["best"] = best == AIR_RATE_NONE ? nullptr : AIR_RATES[best].name;
+  doc["applied"] = applied;
+  doc["rate"] = AIR_RATES[applied ? best : rateSweep.previous].name;
+  doc["probes"] = plan.probes;
+  doc["bytes"] = plan.bytes;
+  doc["min_delivery_pct"] = RATE_SWEEP_MIN_DELIVERY;
+  char buffer[256];
+  serializeJson(doc, buffer);
+  client.publish(airtime_topic, buffer);
+}
+
+// Net task. {"airtime": "report" | "reset" | "rate" | "sweep", ...}
+void handleAirtimeControl(JsonDocument &doc) {
+  const char *action = doc["airtime"] | "";
+  if (strcmp(action, "report") == 0) {
+    publishAirtimeReport();
+  } else if (strcmp(action, "reset") == 0) {
+    airtime.reset();
+    airtime_since_us = esp_timer_get_time();
+  } else if (strcmp(action, "rate") == 0) {
+    const char *name = doc["rate"] | "";
+    uint8_t rate = airRateByName(name);
+    if (rate == AIR_RATE_NONE) {
+      Serial.printf("✗ Unknown ESP-NOW rate \"%s\"\n", name);
+      return;
+    }
+    requestAirRate(rate);
+  } else if (strcmp(action, "sweep") == 0) {
+    RateSweepPlan plan = {};
+    plan.probes = constrain(doc["probes"] | RATE_SWEEP_PROBES, 1, 255);
+    plan.bytes = constrain(doc["bytes"] | RATE_SWEEP_BYTES, 3,
+                           (int)sizeof(RateProbePacket));
+    plan.apply = doc["apply"] | false;
+    if (doc.containsKey("rates")) {
+      for (JsonVariant name : doc["rates"].as<JsonArray>()) {
+        uint8_t rate = airRateByName(name | "");
+        if (rate != AIR_RATE_NONE) {
+          plan.rateMask |= 1U << rate;
+        }
+      }
+    } else {
+      plan.rateMask = (1U << AIR_RATE_COUNT) - 1;
+    }
+    requestRateSweep(plan);
+  } else {
+    Serial.print("Unknown airtime action: ");
+    Serial.println(action);
+  }
+}
+
+bool parseSha256(const char *hex, uint8_t *out) {
+  if (!hex || strlen(hex) != 64)
+    return false;
+  for (uint8_t i = 0; i < 32; i++) {
+    char pair[3] = {hex[i * 2], hex[i * 2 + 1], 0};
+    char *end;
+    out[i] = strtoul(pair, &end, 16);
+    if (*end)
+      return false;
+  }
+  return true;
+}
+
+void formatSha256(const uint8_t *sha, char *out) {
+  for (uint8_t i = 0; i < 32; i++) {
+    snprintf(out + i * 2, 3, "%02x", sha[i]);
+  }
+}
+
+// Net task, at boot and after each fetch
+void loadFirmwareImage() {
+  AllocExempt nvs;
+  Preferences prefs;
+  firmware_size = 0;
+  if (prefs.begin(FIRMWARE_NVS_NAMESPACE, true)) {
+    uint32_t size = prefs.getUInt("size", 0);
+    if (prefs.getBytes("sha", firmware_sha, 32) == 32) {
+      firmware_size = size;
+    }
+    prefs.end();
+  }
+  if (!firmware_size || !LittleFS.exists(FIRMWARE_PATH)) {
+    firmware_size = 0;
+    return;
+  }
+  File f = LittleFS.open(FIRMWARE_PATH, FILE_READ);
+  if (!f || f.size() != firmware_size) {
+    firmware_size = 0;
+  }
+}
+
+void publishFirmwareEvent(const char *event, const char *detail) {
+  Serial.print(strcmp(event, "failed") == 0 ? "✗ Panel image " : "Panel image ");
+  Serial.print(event);
+  if (detail) {
+    Serial.print(": ");
+    Serial.print(detail);
+  }
+  Serial.println();
+  if (!client.connected())
+    return;
+  StaticJsonDocument<256> doc;
+  doc["image"] = event;
+  if (detail) {
+    doc["detail"] = detail;
+  }
+  if (firmware_fetch.active && !firmware_fetch.http) {
+    doc["next_offset"] = firmware_fetch.written; // where to carry on
+  }
+  if (firmware_size) {
+    char hex[65];
+    formatSha256(firmware_sha, hex);
+    doc["bytes"] = firmware_size;
+    doc["sha256"] = hex;
+  }
+  char buffer[256];
+  serializeJson(doc, buffer);
+  client.publish(firmware_topic, buffer);
+}
+
+bool firmwareBusy() {
+  return firmwareSender.running() || firmwareStagingPending.load();
+}
+
+// Net task. The file is replaced, so not while a rollout reads it.
+bool beginFirmwareFetch(bool http, uint32_t size, const char *sha) {
+  if (firmwareBusy() || firmware_fetch.active) {
+    Serial.println("⚠ Firmware rollout or fetch running; image left alone");
+    return false;
+  }
+  FirmwareFetch &f = firmware_fetch;
+  f.checkSha = parseSha256(sha, f.expected);
+  if (sha && !f.checkSha) {
+    publishFirmwareEvent("failed", "sha256 must be 64 hex digits");
+    return false;
+  }
+  f.file = LittleFS.open(FIRMWARE_PATH, FILE_WRITE);
+  if (!f.file) {
+    publishFirmwareEvent("failed", "cannot open " FIRMWARE_PATH);
+    return false;
+  }
+  f.active = true;
+  f.http = http;
+  f.size = size;
+  f.written = 0;
+  f.lastDataAt = millis();
+  f.sha.begin();
+  firmware_size = 0;
+  return true;
+}
+
+void finishFirmwareFetch(const char *error) {
+  FirmwareFetch &f = firmware_fetch;
+  f.file.close();
+  if (f.http) {
+    firmware_http.end();
+  }
+  uint8_t digest[32];
+  f.sha.finish(digest);
+  if (!error && f.checkSha && memcmp(digest, f.expected, 32) != 0) {
+    error = "sha256 does not match the image";
+  }
+  f.active = false;
+  if (error) {
+    LittleFS.remove(FIRMWARE_PATH);
+    publishFirmwareEvent("failed", error);
+    return;
+  }
+  AllocExempt nvs;
+  Preferences prefs;
+  if (prefs.begin(FIRMWARE_NVS_NAMESPACE, false)) {
+    prefs.putUInt("size", f.written);
+    prefs.putBytes("sha", digest, 32);
+    prefs.end();
+  }
+  firmware_size = f.written;
+  memcpy(firmware_sha, digest, 32);
+  publishFirmwareEvent("ready", nullptr);
+}
+
+bool writeFirmwarePiece(const uint8_t *data, size_t len) {
+  FirmwareFetch &f = firmware_fetch;
+  if (f.written + len > f.size || f.file.write(data, len) != len) {
+    finishFirmwareFetch(f.written + len > f.size ? "more data than size"
+                                                 : "LittleFS full");
+    return false;
+  }
+  f.sha.update(data, len);
+  f.written += len;
+  f.lastDataAt = millis();
+  if (f.written == f.size) {
+    finishFirmwareFetch(nullptr);
+  }
+  return true;
+}
+
+// Net task, every pass: a few KB of an HTTP download at a time, so MQTT and
+// the console keep running
+void firmwareFetchTick() {
+  FirmwareFetch &f = firmware_fetch;
+  if (!f.active)
+    return;
+  if (millis() - f.lastDataAt > FIRMWARE_FETCH_TIMEOUT_MS) {
+    finishFirmwareFetch("timed out");
+    return;
+  }
+  if (!f.http)
+    return;
+  WiFiClient *stream = firmware_http.getStreamPtr();
+  uint8_t buf[512];
+  for (uint32_t taken = 0; f.active && taken < FIRMWARE_FETCH_TICK_BYTES;) {
+    int n = stream ? stream->available() : 0;
+    if (n <= 0)
+      return;
+    n = stream->readBytes(buf, min((size_t)n, sizeof(buf)));
+    if (!writeFirmwarePiece(buf, n))
+      return;
+    taken += n;
+  }
+}
+
+// Net task. Pieces on firmware_data_topic: a little-endian uint32 offset,
+// then up to MQTT_BUFFER_SIZE less the headers of image bytes. They must
+// arrive in order; on a gap the fetch reports the offset it wants next.
+void handleFirmwareData(const uint8_t *payload, unsigned int length) {
+  FirmwareFetch &f = firmware_fetch;
+  if (!f.active || f.http || length < 4)
+    return;
+  uint32_t offset = payload[0] | (uint32_t)payload[1] << 8 |
+                    (uint32_t)payload[2] << 16 | (uint32_t)payload[3] << 24;
+  if (offset != f.written) {
+    if (offset > f.written) {
+      publishFirmwareEvent("gap", nullptr);
+    }
+    return; // a repeat, or one after a lost piece
+  }
+  writeFirmwarePiece(payload + 4, length - 4);
+}
+
+void startFirmwareDownload(const char *url, const char *sha) {
+  {
+    AllocExempt http; // the client's own buffers
+    if (!firmware_http.begin(url)) {
+      publishFirmwareEvent("failed", "bad url");
+      return;
+    }
+    int code = firmware_http.GET();
+    int size = firmware_http.getSize();
+    if (code != HTTP_CODE_OK || size <= 0) {
+      firmware_http.end();
+      publishFirmwareEvent("failed", code != HTTP_CODE_OK
+                                         ? "HTTP request failed"
+                                         : "no Content-Length");
+      return;
+    }
+    if (!beginFirmwareFetch(true, size, sha)) {
+      firmware_http.end();
+      return;
+    }
+  }
+  Serial.print("Fetching panel image, ");
+  Serial.print(firmware_fetch.size);
+  Serial.println(" bytes");
+}
+
+// Net task, MQTT or console. `panels` 0 = every known panel.
+void requestFirmwareRollout(uint32_t panels, uint8_t burst,
+                            uint16_t spacingMs) {
+  if (firmwareBusy() || firmware_fetch.active) {
+    Serial.println("⚠ Firmware rollout or fetch already running");
+    return;
+  }
+  if (!firmware_size) {
+    publishFirmwareEvent("failed", "no panel image; fetch one first");
+    return;
+  }
+  firmwareStaging.size = firmware_size;
+  memcpy(firmwareStaging.sha256, firmware_sha, 32);
+  firmwareStaging.panelMask = panels;
+  firmwareStaging.burst = burst;
+  firmwareStaging.spacingMs = spacingMs;
+  firmwareStagingPending.store(true);
+  enqueueControl(CMD_FIRMWARE_SEND, 0);
+}
+
+// Net task, on each new round and once the rollout is over
+void publishFirmwareReport(bool done) {
+  const FirmwareSender &fw = firmwareSender;
+  if (done) {
+    Serial.print(fw.readFailed ? "✗ Firmware rollout stopped, image unreadable"
+                               : "✓ Firmware rollout finished");
+    Serial.printf(" in %u ms, %u rounds, %u/%u chunks sent\n",
+                  (unsigned)fw.elapsedMs, (unsigned)fw.round,
+                  (unsigned)fw.chunksSent, (unsigned)fw.chunks());
+    for (uint8_t id = 1; id <= MAX_PANELS; id++) {
+      if (fw.plan.panelMask & (1UL << (id - 1))) {
+        Serial.printf("  Panel %u: %s, %u/%u chunks\n", id,
+                      (fw.lostMask & (1UL << (id - 1)))
+                          ? "no answer"
+                          : FW_STATE_NAMES[fw.state[id]],
+                      fw.held[id], fw.chunks());
+      }
+    }
+  }
+  if (!client.connected())
+    return;
+  StaticJsonDocument<1024> doc;
+  doc["rollout"] = done ? "done" : fw.phaseName();
+  doc["round"] = fw.round;
+  doc["chunks"] = fw.chunks();
+  doc["chunks_sent"] = fw.chunksSent;
+  if (done) {
+    doc["ms"] = fw.elapsedMs;
+    doc["polls"] = fw.polls;
+  }
+  JsonObject panels = doc.createNestedObject("panels");
+  for (uint8_t id = 1; id <= MAX_PANELS; id++) {
+    if (!(fw.plan.panelMask & (1UL << (id - 1))))
+      continue;
+    char key[4];
+    snprintf(key, sizeof(key), "%u", id);
+    JsonObject p = panels.createNestedObject(key);
+    p["state"] = (fw.lostMask & (1UL << (id - 1)))
+                     ? "no_answer"
+                     : FW_STATE_NAMES[fw.state[id]];
+    p["held"] = fw.held[id];
+  }
+  char buffer[1024];
+  serializeJson(doc, buffer);
+  client.publish(firmware_topic, buffer);
+}
+
+// Net task. {"firmware": "fetch" | "begin" | "send" | "stop" | "status", ...}
+void handleFirmwareControl(JsonDocument &doc) {
+  const char *action = doc["firmware"] | "";
+  if (strcmp(action, "fetch") == 0) {
+    startFirmwareDownload(doc["url"] | "", doc["sha256"]);
+  } else if (strcmp(action, "begin") == 0) {
+    uint32_t size = doc["size"] | 0;
+    if (size == 0 || size > (uint32_t)FW_MAX_CHUNKS * FW_CHUNK_BYTES) {
+      publishFirmwareEvent("failed", "size missing or too large");
+    } else if (beginFirmwareFetch(false, size, doc["sha256"])) {
+      publishFirmwareEvent("receiving", nullptr);
+    }
+  } else if (strcmp(action, "send") == 0) {
+    uint32_t panels = 0;
+    for (JsonVariant id : doc["panels"].as<JsonArray>()) {
+      uint8_t panel = id | 0;
+      if (panel >= 1 && panel <= MAX_PANELS) {
+        panels |= 1UL << (panel - 1);
+      }
+    }
+    requestFirmwareRollout(panels, constrain(doc["burst"] | 0, 0, 8),
+                           constrain(doc["spacing"] | 0, 0, 100));
+  } else if (strcmp(action, "stop") == 0) {
+    enqueueControl(CMD_FIRMWARE_STOP, 0);
+  } else if (strcmp(action, "status") == 0) {
+    publishFirmwareEvent(firmware_fetch.active ? "receiving"
+                         : firmware_size       ? "ready"
+                                               : "none",
+                         nullptr);
+    publishFirmwareReport(false);
+  } else {
+    Serial.print("Unknown firmware action: ");
+    Serial.println(action);
+  }
+}
+
+bool parseMac(const char *text, uint8_t *out) {
+  if (!text || strlen(text) != 17)
+    return false;
+  for (uint8_t i = 0; i < 6; i++) {
+    char pair[3] = {text[i * 3], text[i * 3 + 1], 0};
+    char *end;
+    out[i] = strtoul(pair, &end, 16);
+    if (*end || (i < 5 && text[i * 3 + 2] != ':'))
+      return false;
+  }
+  return true;
+}
+
+// Net task. `count` 0 gives the panel the stage layout for `panel`.
+void requestProvision(const uint8_t *mac, uint8_t panel, uint16_t first,
+                      uint8_t count, const ProvisionRegion *regions) {
+  if (provisionStagingPending.load()) {
+    Serial.println("⚠ Previous provisioning still pending");
+    return;
+  }
+  ProvisionPacket &pkt = provisionStaging;
+  pkt.type = PKT_PROVISION;
+  memcpy(pkt.target, mac, 6);
+  pkt.panelId = panel;
+  pkt.firstRegion = first;
+  pkt.regionCount = count;
+  if (count) {
+    memcpy(pkt.regions, regions, count * sizeof(ProvisionRegion));
+  }
+  provisionStagingLen =
+      offsetof(ProvisionPacket, regions) + count * sizeof(ProvisionRegion);
+  Serial.printf("Provisioning %02X:%02X:%02X:%02X:%02X:%02X as panel %u\n",
+                mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], panel);
+  provisionStagingPending.store(true);
+  enqueueControl(CMD_PROVISION, 0);
+}
+
+// Net task. {"provision": "set", "panel": 2, "mac": "24:6F:28:..",
+// "first": 5, "regions": [[pin, pos, groups], ...]}. Without "mac", the
+// last unprovisioned panel heard; without "regions", the stage layout.
+void handleProvisionControl(JsonDocument &doc) {
+  const char *action = doc["provision"] | "";
+  if (strcmp(action, "set") != 0) {
+    Serial.print("Unknown provision action: ");
+    Serial.println(action);
+    return;
+  }
+  uint8_t mac[6];
+  if (doc.containsKey("mac") ? !parseMac(doc["mac"], mac)
+                             : !lastUnprovisioned(mac)) {
+    Serial.println("✗ Provision needs \"mac\" (AA:BB:CC:DD:EE:FF); no "
+                   "unprovisioned panel heard");
+    return;
+  }
+  ProvisionRegion regions[PROVISION_MAX_REGIONS];
+  uint8_t count = 0;
+  for (JsonArray r : doc["regions"].as<JsonArray>()) {
+    if (count == PROVISION_MAX_REGIONS) {
+      Serial.print("✗ A panel drives at most ");
+      Serial.print(PROVISION_MAX_REGIONS);
+      Serial.println(" regions");
+      return;
+    }
+    regions[count].pin = r[0] | 0;
+    regions[count].verticalPos = r[1] | count;
+    regions[count].groups = r[2] | 0;
+    count++;
+  }
+  uint8_t panel = doc["panel"] | 0;
+  if (panel < 1 || panel > MAX_PANELS) {
+    Serial.println("✗ Provision needs \"panel\"");
+    return;
+  }
+  requestProvision(mac, panel, doc["first"] | 0, count, regions);
+}
+
+// Net task. Line commands on the USB console, so a recorded show can be
+// started without a broker: "rec start", "rec stop", "play", "play loop",
+// "stop". "tap" and "downbeat" (Enter on each beat) drive the tempo clock;
+// "blackout", "hold" and "release" go out on the priority lane. "rate",
+// "rate NAME" and "sweep" show, set and benchmark the ESP-NOW PHY rate.
+// "fw", "fw send" and "fw stop" show and run the panel firmware rollout.
+// "provision N" makes the last unprovisioned panel heard panel N.
+void pollSerialConsole() {
+  static char line[32];
+  static uint8_t lineLen = 0;
+  uint8_t action;
+
+  while (Serial.available()) {
+    char c = Serial.read();
+    if (c != '\n' && c != '\r') {
+      if (lineLen < sizeof(line) - 1) {
+        line[lineLen++] = c;
+      }
+      continue;
+    }
+    if (lineLen == 0)
+      continue;
+    line[lineLen] = '\0';
+    lineLen = 0;
+
+    if (!master_active.load()) {
+      lease_metrics.ignoredCommands++;
+      Serial.println("⚠ Standing by; use the active master's console");
+      continue;
+    }
+    if (strcmp(line, "rec start") == 0) {
+      handleShowControl("start", nullptr, false);
+    } else if (strcmp(line, "rec stop") == 0) {
+      handleShowControl("stop", nullptr, false);
+    } else if (strcmp(line, "play") == 0) {
+      handleShowControl(nullptr, "start", false);
+    } else if (strcmp(line, "play loop") == 0) {
+      handleShowControl(nullptr, "start", true);
+    } else if (strcmp(line, "stop") == 0) {
+      handleShowControl(nullptr, "stop", false);
+    } else if (strcmp(line, "tap") == 0) {
+      enqueueTempo(CMD_TEMPO_TAP, esp_timer_get_time());
+    } else if (strcmp(line, "downbeat") == 0) {
+      enqueueTempo(CMD_TEMPO_DOWNBEAT, esp_timer_get_time());
+    } else if (parsePriority(line, action)) {
+      sendPriority(action, esp_timer_get_time());
+    } else if (strcmp(line, "rate") == 0) {
+      Serial.print("ESP-NOW rate ");
+      Serial.print(AIR_RATES[airtime.rate()].name);
+      Serial.print(" of");
+      for (uint8_t i = 0; i < AIR_RATE_COUNT; i++) {
+        Serial.print(" ");
+        Serial.print(AIR_RATES[i].name);
+      }
+      Serial.println();
+    } else if (strncmp(line, "rate ", 5) == 0) {
+      uint8_t rate = airRateByName(line + 5);
+      if (rate == AIR_RATE_NONE) {
+        Serial.println("✗ Unknown ESP-NOW rate");
+      } else {
+        requestAirRate(rate);
+      }
+    } else if (strcmp(line, "sweep") == 0) {
+      RateSweepPlan plan = {(uint16_t)((1U << AIR_RATE_COUNT) - 1),
+                            RATE_SWEEP_PROBES, RATE_SWEEP_BYTES, false};
+      requestRateSweep(plan);
+    } else if (strcmp(line, "fw") == 0) {
+      Serial.print("Panel image: ");
+      if (firmware_size) {
+        char hex[65];
+        formatSha256(firmware_sha, hex);
+        Serial.printf("%u bytes, sha256 %s", (unsigned)firmware_size, hex);
+      } else {
+        Serial.print(firmware_fetch.active ? "fetching" : "none");
+      }
+      Serial.print(" | Rollout: ");
+      Serial.print(firmwareSender.running() ? firmwareSender.phaseName()
+                                            : "idle");
+      Serial.printf(", round %u, %u chunks sent\n",
+                    (unsigned)firmwareSender.round,
+                    (unsigned)firmwareSender.chunksSent);
+    } else if (strcmp(line, "fw send") == 0) {
+      requestFirmwareRollout(0, 0, 0);
+    } else if (strcmp(line, "fw stop") == 0) {
+      enqueueControl(CMD_FIRMWARE_STOP, 0);
+    } else if (strncmp(line, "provision ", 10) == 0) {
+      uint8_t mac[6];
+      int panel = atoi(line + 10);
+      if (!lastUnprovisioned(mac)) {
+        Serial.println("⚠ No unprovisioned panel heard");
+      } else if (panel < 1 || panel > MAX_PANELS) {
+        Serial.println("✗ Usage: provision N");
+      } else {
+        requestProvision(mac, panel, 0, 0, nullptr);
+      }
+    } else {
+      Serial.print("Unknown console command: ");
+      Serial.println(line);
+    }
+  }
+}
+
+// Net task. "groups"/"exclude": a group name or a list of them
+uint16_t parseGroups(JsonVariant names) {
+  uint16_t mask = 0;
+  JsonArray list = names.as<JsonArray>();
+  uint8_t count = list.isNull() ? (names.isNull() ? 0 : 1) : list.size();
+  for (uint8_t i = 0; i < count; i++) {
+    const char *name = (list.isNull() ? names : list[i]) | "";
+    uint8_t g = 0;
+    while (g < NUM_GROUPS && strcasecmp(name, GROUP_NAMES[g]) != 0) {
+      g++;
+    }
+    if (g < NUM_GROUPS) {
+      mask |= 1 << g;
+    } else {
+      Serial.printf("⚠ Unknown group \"%s\" ignored\n", name);
+    }
+  }
+  return mask;
+}
+
+// Net task. {"cues": "upload" | "run" | "go" | "stop", ...}
+void handleCueControl(JsonDocument &doc) {
+  const char *action = doc["cues"] | "";
+
+  if (strcmp(action, "upload") == 0) {
+    if (cueStagingPending.load()) {
+      Serial.println("⚠ Previous cue upload still pending");
+      return;
+    }
+
+    cueStaging.showId = doc["showId"] | 1;
+    if (doc.containsKey("list")) {
+      cueStaging.count = 0;
+      for (JsonVariant c : doc["list"].as<JsonArray>()) {
+        if (cueStaging.count >= MAX_CUES)
+          break;
+        ShowCue &cue = cueStaging.cues[cueStaging.count++];
+        cue.cmd = {};
+        cue.cmd.effect = c["effect"] | EFFECT_STATIC;
+        cue.cmd.brightness = c["brightness"] | DEFAULT_BRIGHTNESS;
+        cue.cmd.speed = c["speed"] | DEFAULT_SPEED;
+        cue.cmd.panelId = c["panelId"] | 0;
+        for (int region : c["regions"].as<JsonArray>()) {
+          if (region >= 0 && region < MAX_REGIONS) {
+            cue.cmd.regions.set(region);
+          }
+        }
+        cue.cmd.groupInclude = parseGroups(c["groups"]);
+        cue.cmd.groupExclude = parseGroups(c["exclude"]);
+        cue.holdMs = c["holdMs"] | 0;
+      }
+    } else if (!compileShowFromJournal(cueStaging)) {
+      Serial.println("✗ No cue list given and no recorded journal");
+      return;
+    }
+
+    cueStagingPending.store(true);
+    enqueueControl(CMD_CUE_UPLOAD, 0);
+  } else if (strcmp(action, "run") == 0 || strcmp(action, "go") == 0) {
+    QueuedCommand item = {};
+    item.kind = CMD_CUE_RUN;
+    item.arg = strcmp(action, "run") == 0;
+    item.cue = doc["cue"] | 0;
+    enqueueCommand(item);
+  } else if (strcmp(action, "stop") == 0) {
+    enqueueControl(CMD_CUE_STOP, 0);
+  } else {
+    Serial.print("Unknown cue action: ");
+    Serial.println(action);
+  }
+}
+
+// Net task. {"program": {"slot": 0, "asm": "time 3 shr tri", "panelId": 0}}
+// Assembles here so a typo is reported before anything goes on air.
+void handleProgramControl(JsonObject program) {
+  if (programStagingPending.load()) {
+    Serial.println("⚠ Previous program upload still pending");
+    return;
+  }
+
+  ProgramPacket &pkt = programStaging;
+  pkt.type = PKT_PROGRAM;
+  pkt.panelId = program["panelId"] | 0;
+  pkt.slot = program["slot"] | 0;
+  if (pkt.slot >= MAX_PROGRAMS) {
+    Serial.print("✗ Program slot must be below ");
+    Serial.println(MAX_PROGRAMS);
+    return;
+  }
+
+  const char *error = "";
+  int length = vmAssemble(program["asm"] | "", pkt.code, &error);
+  if (length < 0) {
+    Serial.print("✗ Program rejected: ");
+    Serial.println(error);
+    return;
+  }
+  pkt.length = length;
+  pkt.crc = crc32Ieee(pkt.code, pkt.length);
+
+  Serial.print("Program for slot ");
+  Serial.print(pkt.slot);
+  Serial.print(": ");
+  Serial.print(pkt.length);
+  Serial.println(" bytes");
+  programStagingPending.store(true);
+  enqueueControl(CMD_PROGRAM_UPLOAD, 0);
+}
+
+// Net task. Publishes the counters gathered since the last "start".
+void publishBenchReport() {
+  StaticJsonDocument<512> doc;
+  doc["device"] = "master";
+  doc["run_ms"] = (uint32_t)((esp_timer_get_time() - bench_metrics.startedUs) /
+                             1000);
+  doc["received"] = bench_metrics.received;
+  doc["parse_errors"] = bench_metrics.parseErrors;
+  doc["accepted"] = bench_metrics.accepted;
+  doc["queue_drops"] = bench_metrics.queueDrops;
+  doc["queue_peak"] = bench_metrics.queuePeak;
+  doc["coalesced"] = bench_metrics.coalesced;
+  doc["forwarded"] = bench_metrics.forwarded;
+  doc["frames"] = bench_metrics.frames;
+  doc["send_errors"] = bench_metrics.sendErrors;
+  doc["delivery_fails"] = bench_metrics.deliveryFails;
+  doc["mqtt_buffer"] = client.getBufferSize();
+
+  const LatencyHistogram &lat = bench_metrics.latency;
+  JsonObject l = doc.createNestedObject("latency_us");
+  l["samples"] = lat.count();
+  l["p50"] = lat.percentile(50);
+  l["p90"] = lat.percentile(90);
+  l["p99"] = lat.percentile(99);
+  l["max"] = lat.max();
+
+  // Flat, so the load generator can pick them out by name
+  const LatencyHistogram &pri = bench_metrics.priority;
+  doc["priority_samples"] = pri.count();
+  doc["priority_p99"] = pri.percentile(99);
+  doc["priority_max"] = pri.max();
+
+  char buffer[512];
+  serializeJson(doc, buffer);
+  if (!client.publish(bench_topic, buffer)) {
+    Serial.println("✗ Bench report did not fit the MQTT buffer");
+  }
+}
+
+// Net task. {"bench": "start" | "report"}
+void handleBenchControl(const char *action) {
+  if (strcmp(action, "start") == 0) {
+    uint32_t queued = commandQueue.size();
+    memset((void *)&bench_metrics, 0, sizeof(bench_metrics));
+    bench_metrics.queuePeak = queued;
+    bench_metrics.startedUs = esp_timer_get_time();
+    command_log = false;
+    Serial.println("Bench run started, command logging off");
+  } else if (strcmp(action, "report") == 0) {
+    command_log = true;
+    publishBenchReport();
+    Serial.printf("Bench: %u received, %u accepted, %u coalesced, %u "
+                  "forwarded, %u dropped\n",
+                  (unsigned)bench_metrics.received,
+                  (unsigned)bench_metrics.accepted,
+                  (unsigned)bench_metrics.coalesced,
+                  (unsigned)bench_metrics.forwarded,
+                  (unsigned)(bench_metrics.parseErrors +
+                             bench_metrics.queueDrops));
+  } else {
+    Serial.print("Unknown bench action: ");
+    Serial.println(action);
+  }
+}
+
+// Net task. {"audio": "on" | "off", "depth": 0-255}. depth is how far
+// panels dim on silence; 0 keeps the stream running but stops modulation.
+void handleAudioControl(JsonVariant action, JsonVariant depth) {
+#if AUDIO_INPUT
+  if (!depth.isNull()) {
+    audio_depth = depth.as<uint8_t>();
+  }
+  const char *a = action | "";
+  if (!strcmp(a, "on")) {
+    audio_enabled.store(true);
+  } else if (!strcmp(a, "off")) {
+    audio_enabled.store(false);
+  }
+  Serial.print("Audio ");
+  Serial.print(audio_enabled.load() ? "on" : "off");
+  Serial.print(", depth ");
+  Serial.println(audio_depth);
+#else
+  Serial.println("⚠ Built without AUDIO_INPUT (use env:master_audio)");
+#endif
+}
+
+#if AUDIO_INPUT
+// Net task, with the heartbeat. Only AUDIO_INPUT builds have these
+// counters, so they get their own topic rather than optional status fields.
+void publishAudioReport() {
+  uint32_t blocks = audio_metrics.blocks;
+  uint32_t avgUs =
+      blocks ? (uint32_t)(audio_metrics.analysisSumUs / blocks) : 0;
+
+  StaticJsonDocument<256> doc;
+  doc["device"] = "master";
+  doc["enabled"] = audio_enabled.load();
+  doc["depth"] = audio_depth;
+  doc["blocks"] = blocks;
+  doc["beats"] = audioAnalyzer.beatCount();
+  doc["analysis_avg_us"] = avgUs;
+  doc["analysis_max_us"] = audio_metrics.analysisMaxUs;
+  doc["read_errors"] = audio_metrics.readErrors;
+  doc["queue_drops"] = audio_metrics.queueDrops;
+  doc["stack_free"] =
+      audioTaskHandle ? uxTaskGetStackHighWaterMark(audioTaskHandle) : 0;
+
+  Serial.printf("Audio: %u blocks, analysis avg %u us, max %u us\n",
+                (unsigned)blocks, (unsigned)avgUs,
+                (unsigned)audio_metrics.analysisMaxUs);
+  audio_metrics.blocks = 0;
+  audio_metrics.analysisSumUs = 0;
+  audio_metrics.analysisMaxUs = 0;
+
+  char buffer[256];
+  serializeJson(doc, buffer);
+  client.publish(audio_topic, buffer);
+}
+#endif
+
+// Runs on the net task: decode only, then hand off to the show task.
+uint8_t parseBlend(const char *name) {
+  if (!strcmp(name, "add"))
+    return BLEND_ADD;
+  if (!strcmp(name, "multiply"))
+    return BLEND_MULTIPLY;
+  if (!strcmp(name, "crossfade"))
+    return BLEND_CROSSFADE;
+  return BLEND_MAX;
+}
+
+uint8_t parseCurve(const char *name) {
+  if (!strcmp(name, "linear"))
+    return CURVE_LINEAR;
+  if (!strcmp(name, "ease_in"))
+    return CURVE_EASE_IN;
+  if (!strcmp(name, "ease_out"))
+    return CURVE_EASE_OUT;
+  return CURVE_EASE;
+}
+
+void mqttCallback(char *topic, byte *payload, unsigned int length) {
+  if (!master_active.load()) {
+    lease_metrics.ignoredCommands++; // the holder gets the same message
+    return;
+  }
+  // Light, tempo and priority commands stay in the zone; the show, cue,
+  // program and bench controls open files or build reports and leave it
+  AllocScope zone(ALLOC_ZONE_MQTT);
+  int64_t arrivedUs = esp_timer_get_time();
+  if (boot_metrics.firstCommandMs == 0) {
+    boot_metrics.firstCommandMs = arrivedUs / 1000;
+    Serial.print("✓ First MQTT command ");
+    Serial.print(boot_metrics.firstCommandMs);
+    Serial.println(" ms after reset");
+  }
+  if (strcmp(topic, firmware_data_topic) == 0) {
+    zone.end();
+    handleFirmwareData(payload, length); // binary, not JSON
+    return;
+  }
+  if (command_log) {
+    Serial.print("MQTT message on topic: ");
+    Serial.println(topic);
+  }
+
+  StaticJsonDocument<1024> doc;
+  DeserializationError error = deserializeJson(doc, payload, length);
+
+  if (error) {
+    bench_metrics.received++;
+    bench_metrics.parseErrors++;
+    Serial.print("JSON parse failed: ");
+    Serial.println(error.f_str());
+    queueAnswer(netAcks, ACK_NO_ID, NACK_PARSE_ERROR);
+    return;
+  }
+  uint32_t id = doc["id"] | (uint32_t)ACK_NO_ID;
+
+  uint8_t action;
+  if (doc.containsKey("priority") &&
+      parsePriority(doc["priority"] | "", action)) {
+    bench_metrics.received++;
+    sendPriority(action, arrivedUs);
+    queueAnswer(netAcks, id, ACK_SENT);
+    return;
+  }
+
+  if (doc.containsKey("bench")) {
+    zone.end();
+    handleBenchControl(doc["bench"] | "");
+    return;
+  }
+  if (doc.containsKey("airtime")) {
+    zone.end();
+    handleAirtimeControl(doc);
+    return;
+  }
+  if (doc.containsKey("firmware")) {
+    zone.end();
+    handleFirmwareControl(doc);
+    return;
+  }
+  if (doc.containsKey("provision")) {
+    zone.end();
+    handleProvisionControl(doc);
+    return;
+  }
+  bench_metrics.received++;
+
+  if (doc.containsKey("cues")) {
+    zone.end();
+    handleCueControl(doc);
+    return;
+  }
+
+  if (doc.containsKey("program")) {
+    zone.end();
+    handleProgramControl(doc["program"].as<JsonObject>());
+    return;
+  }
+
+  if (doc.containsKey("audio")) {
+    handleAudioControl(doc["audio"], doc["depth"]);
+    return;
+  }
+
+  if (doc.containsKey("tempo")) {
+    handleTempoControl(doc["tempo"], arrivedUs);
+    return;
+  }
+
+  if (doc.containsKey("record") || doc.containsKey("replay")) {
+    zone.end();
+    handleShowControl(doc["record"], doc["replay"], doc["loop"] | false);
+    return;
+  }
+
+  QueuedCommand item = {};
+  item.kind = CMD_LIGHT;
+  item.enqueuedUs = arrivedUs;
+  item.ackId = id;
+  LightCommand &cmd = item.cmd;
+
+  cmd.debugMode = doc["debug"] | false;
+  cmd.effect = doc["effect"] | EFFECT_STATIC;
+  cmd.brightness = doc["brightness"] | DEFAULT_BRIGHTNESS;
+  cmd.speed = doc["speed"] | DEFAULT_SPEED;
+  cmd.transitionMs = doc["transition"] | DEFAULT_TRANSITION_MS;
+  cmd.curve = parseCurve(doc["curve"] | "ease");
+  float beats = doc["beats"] | 0.0f; // cycle length on the tempo grid
+  cmd.beatLength = beats <= 0 ? 0 : beats >= 63.75f ? 255 : beats * 4 + 0.5f;
+
+  if (cmd.debugMode) {
+    cmd.panelId = doc["panelId"] | 0;
+    cmd.sequence = 0;
+
+    // Groups are resolved by the panels; the regions given, if any, are
+    // lit as well. Without either, the whole stage (minus "exclude")
+    cmd.groupInclude = parseGroups(doc["groups"]);
+    cmd.groupExclude = parseGroups(doc["exclude"]);
+    if (doc.containsKey("regions")) {
+      JsonArray regions = doc["regions"].as<JsonArray>();
+      for (int region : regions) {
+        if (region >= 0 && region < MAX_REGIONS) {
+          cmd.regions.set(region);
+        }
+      }
+    } else if (!cmd.groupInclude) {
+      // Not setAll(): that sends, journals and saves all 64 mask bytes
+      cmd.regions.assignRange(0, stage_region_end.load(), true);
+    }
+
+    // Overlays (compositor.h); without "layer" this is the base look
+    cmd.layer = doc["layer"] | 0;
+    cmd.blend = parseBlend(doc["blend"] | "max");
+    cmd.mix = doc["mix"] | 255;
+    if (doc["remove"] | false) {
+      cmd.blend = BLEND_REMOVE;
+    }
+  } else {
+    cmd.sequence = doc["sequence"] | 0;
+    cmd.panelId = 0;
+  }
+
+  if (enqueueCommand(item)) {
+    bench_metrics.accepted++;
+  } else {
+    queueAnswer(netAcks, id, NACK_QUEUE_FULL);
+  }
+}
+
+// Runs on the show task.
+void setCurrentCommand(const LightCommand &cmd) {
+  portENTER_CRITICAL(&currentCommandMux);
+  currentCommand = cmd;
+  portEXIT_CRITICAL(&currentCommandMux);
+  show_state_due = true;
+}
+
+void dispatchSequenceStep(LightCommand &cmd) { sendESPNowCommand(cmd); }
+
+void recordForwardLatency(const QueuedCommand &item) {
+  uint32_t latency = esp_timer_get_time() - item.enqueuedUs;
+  task_metrics.latencySumUs += latency;
+  task_metrics.latencySamples++;
+  if (latency > task_metrics.latencyMaxUs) {
+    task_metrics.latencyMaxUs = latency;
+  }
+  bench_metrics.forwarded++;
+  bench_metrics.latency.record(latency);
+}
+
+// Show task, the tempo clock's only writer. Taps and downbeats are timed by
+// when their message arrived, not by when the queue got to them.
+void handleTempoCommand(const QueuedCommand &item) {
+  TempoClock &tempo = tempoClock();
+  uint32_t at = (uint32_t)(item.enqueuedUs / 1000);
+  uint16_t before = tempo.bpmX100();
+  if (item.kind == CMD_TEMPO_SET) {
+    if (item.cue) {
+      tempo.setBpm(item.cue, at);
+    }
+    if (item.arg) {
+      tempo.setBeatsPerBar(item.arg);
+    }
+  } else if (item.kind == CMD_TEMPO_TAP) {
+    tempo.tap(at);
+  } else {
+    tempo.downbeat(at);
+  }
+  beacon_due = true;
+  scene.saveTempo(millis());
+
+  if (command_log || tempo.bpmX100() != before) {
+    Serial.printf("Tempo %u.%02u BPM, %u beats per bar\n",
+                  tempo.bpmX100() / 100, tempo.bpmX100() % 100,
+                  tempo.beatsPerBar());
+  }
+}
+
+// Show task. The image file stays open for the length of a rollout.
+bool readFirmware(uint32_t offset, uint8_t *data, uint16_t len) {
+  return firmwareFile && firmwareFile.seek(offset) &&
+         firmwareFile.read(data, len) == len;
+}
+
+void handleQueuedCommand(QueuedCommand &item) {
+  if (item.kind == CMD_REPLAY_START) {
+    player.stop();
+    replayer.start(item.arg != 0);
+    return;
+  }
+  if (item.kind == CMD_REPLAY_STOP) {
+    replayer.stop();
+    return;
+  }
+  if (item.kind == CMD_CUE_UPLOAD) {
+    cueRunner.stop(millis(), sendPacket);
+    cueActive = cueStaging;
+    cueStagingPending.store(false);
+    cueUploader.start(cueActive, peers);
+    return;
+  }
+  if (item.kind == CMD_CUE_RUN) {
+    player.stop();
+    replayer.stop();
+    cueRunner.start(cueActive, item.cue, item.arg != 0, millis(), sendPacket);
+    return;
+  }
+  if (item.kind == CMD_CUE_STOP) {
+    cueRunner.stop(millis(), sendPacket);
+    return;
+  }
+  if (item.kind == CMD_TEMPO_SET || item.kind == CMD_TEMPO_TAP ||
+      item.kind == CMD_TEMPO_DOWNBEAT) {
+    handleTempoCommand(item);
+    return;
+  }
+  if (item.kind == CMD_RATE_SET || item.kind == CMD_RATE_SWEEP) {
+    if (rateSweep.running()) {
+      Serial.println("⚠ Rate sweep running; rate left alone");
+    } else if (item.kind == CMD_RATE_SET) {
+      applyAirRate(item.arg);
+    } else if (rateSweep.start(sweepStaging, peers.knownMask(),
+                               airtime.rate())) {
+      Serial.println("Rate sweep started");
+    } else {
+      Serial.println("⚠ Rate sweep needs a known panel and a rate");
+    }
+    if (item.kind == CMD_RATE_SWEEP) {
+      sweepStagingPending.store(false);
+    }
+    return;
+  }
+  if (item.kind == CMD_FIRMWARE_SEND) {
+    FirmwarePlan plan = firmwareStaging;
+    firmwareStagingPending.store(false);
+    if (!plan.panelMask) {
+      plan.panelMask = peers.knownMask();
+    }
+    if (firmwareSender.running()) {
+      Serial.println("⚠ Firmware rollout already running");
+      return;
+    }
+    firmwareFile = LittleFS.open(FIRMWARE_PATH, FILE_READ);
+    if (!firmwareFile || !firmwareSender.start(plan, readFirmware, millis())) {
+      firmwareFile.close();
+      Serial.println("⚠ Firmware rollout needs the image and a known panel");
+      return;
+    }
+    Serial.print("Firmware rollout started, ");
+    Serial.print(plan.size);
+    Serial.println(" bytes");
+    return;
+  }
+  if (item.kind == CMD_FIRMWARE_STOP) {
+    firmwareSender.stop(millis());
+    return;
+  }
+  if (item.kind == CMD_PROVISION) {
+    // Broadcast: the target is not a peer until it has an ID
+    ProvisionPacket pkt = provisionStaging;
+    uint8_t len = provisionStagingLen;
+    provisionStagingPending.store(false);
+    for (uint8_t i = 0; i < PROVISION_REPEATS; i++) {
+      sendPacket(0, (const uint8_t *)&pkt, len);
+    }
+    return;
+  }
+  if (item.kind == CMD_PROGRAM_UPLOAD) {
+    // Unicast to every known panel, so each upload is acknowledged
+    ProgramPacket pkt = programStaging;
+    programStagingPending.store(false);
+    size_t len = offsetof(ProgramPacket, code) + pkt.length;
+    for (uint8_t id = peers.nextKnown(0); id; id = peers.nextKnown(id)) {
+      if (pkt.panelId == 0 || pkt.panelId == id) {
+        sendPacket(id, (const uint8_t *)&pkt, len);
+      }
+    }
+    return;
+  }
+
+  AllocScope zone(ALLOC_ZONE_DISPATCH);
+  LightCommand &cmd = item.cmd;
+  ack_next_id = item.ackId; // claimed by the first sendESPNowCommand()
+  ack_next_us = item.enqueuedUs;
+  if (cmd.layer != 0 || cmd.blend == BLEND_REMOVE) {
+    // Overlays play on top of whatever the base layer is doing
+    sendESPNowCommand(cmd);
+    recordForwardLatency(item);
+    return;
+  }
+  setCurrentCommand(cmd);
+  scene.save(cmd, millis());
+
+  // Live commands take over from a replay or cue show
+  replayer.stop();
+  if (cueRunner.active()) {
+    cueRunner.stop(millis(), sendPacket);
+  }
+
+  if (cmd.debugMode) {
+    if (command_log) {
+      Serial.println("Debug mode: Direct region control");
+    }
+    // Direct control takes over from any running sequence
+    player.stop();
+    sendESPNowCommand(cmd);
+  } else {
+    if (command_log) {
+      Serial.print("Running sequence ");
+      Serial.print(cmd.sequence);
+      Serial.print(" with effect ");
+      Serial.println(cmd.effect);
+    }
+    if (player.start(cmd, millis())) {
+      player.tick(millis(), dispatchSequenceStep);
+    }
+  }
+  if (ack_next_id != ACK_NO_ID) { // nothing went out
+    queueAnswer(showAcks, ack_next_id, NACK_BAD_SEQUENCE);
+    ack_next_id = ACK_NO_ID;
+  }
+
+  recordForwardLatency(item);
+}
+
+// A light command carries the full state of its layer on every panel it
+// addresses, so one still waiting in the queue is dead once a later light
+// command sets the same layer on the same panels (or all of them). Dropping
+// it sheds load during MQTT bursts without changing what the panels end up
+// showing. A removal is not a replacement: the overlay it drops may be the
+// one the earlier command was about to add.
+bool supersededBy(const QueuedCommand &item, const QueuedCommand *next) {
+  return next && item.kind == CMD_LIGHT && next->kind == CMD_LIGHT &&
+         next->cmd.layer == item.cmd.layer &&
+         next->cmd.blend != BLEND_REMOVE &&
+         (next->cmd.panelId == 0 || next->cmd.panelId == item.cmd.panelId);
+}
+
+#if AUDIO_INPUT
+// Audio task. Blocks in i2s_read for each block, so it needs no timer and
+// sleeps whenever the DMA buffers are still filling.
+void audioTask(void *arg) {
+  static int16_t samples[AUDIO_BLOCK];
+  uint8_t seq = 0;
+  bool wasEnabled = false;
+  for (;;) {
+    if (!audioInput.read(samples)) {
+      audio_metrics.readErrors++;
+      vTaskDelay(pdMS_TO_TICKS(AUDIO_BLOCK_MS));
+      continue;
+    }
+    bool enabled = audio_enabled.load();
+    if (enabled && !wasEnabled) {
+      audioAnalyzer.reset();
+    }
+    wasEnabled = enabled;
+    audio_streaming = enabled;
+    if (!enabled) {
+      continue; // keep draining DMA so the next block is fresh
+    }
+
+    int64_t start = esp_timer_get_time();
+    AudioFrame frame = audioAnalyzer.process(samples);
+    uint32_t costUs = esp_timer_get_time() - start;
+    audio_metrics.blocks++;
+    audio_metrics.analysisSumUs += costUs;
+    if (costUs > audio_metrics.analysisMaxUs) {
+      audio_metrics.analysisMaxUs = costUs;
+    }
+
+    AudioPacket pkt;
+    pkt.type = PKT_AUDIO;
+    pkt.seq = seq++;
+    pkt.intensity = frame.intensity;
+    pkt.depth = audio_depth;
+    pkt.beatCount = (uint8_t)audioAnalyzer.beatCount();
+    memcpy(pkt.bands, frame.bands, AUDIO_BANDS);
+    if (!audioPackets.push(pkt)) {
+      audio_metrics.queueDrops++;
+    }
+    xTaskNotifyGive(showTaskHandle);
+  }
+}
+
+// Show task. Only the newest packet is worth sending; beatCount carries
+// any beat from the ones skipped.
+void audioTick() {
+  AudioPacket pkt;
+  bool fresh = false;
+  while (audioPackets.pop(pkt)) {
+    fresh = true;
+  }
+  if (fresh) {
+    sendPacket(0, (const uint8_t *)&pkt, sizeof(pkt));
+  }
+}
+#endif
+
+void sceneTick() {
+  uint32_t failures = scene.failures;
+  scene.tick(millis());
+  if (scene.failures != failures) {
+    Serial.println("✗ Failed to save scene to flash");
+  }
+}
+
+// Show task. A blackout or hold ends any sequence, replay or cue show; the
+// packet is repeated on PRIORITY_REPEAT_MS. Returns ms until the next repeat.
+uint32_t priorityTick(uint32_t now) {
+  AllocScope zone(ALLOC_ZONE_DISPATCH);
+  static PriorityPacket repeat;
+  static uint8_t repeated = PRIORITY_REPEATS;
+  static uint32_t firstAt = 0;
+  if (priorityStagingPending.load()) {
+    repeat = priorityStaging;
+    priority_preempt_us =
+        repeat.action == PRIORITY_RELEASE ? 0 : priorityStagingUs;
+    priorityStagingPending.store(false);
+    repeated = 0;
+    firstAt = now;
+    beacon_due = true;
+    if (repeat.action != PRIORITY_RELEASE) {
+      player.stop();
+      show_state_due = true;
+      replayer.stop();
+      if (cueRunner.active()) {
+        cueRunner.stop(now, sendPacket);
+      }
+    }
+  }
+  while (repeated < PRIORITY_REPEATS &&
+         now - firstAt >= PRIORITY_REPEAT_MS[repeated]) {
+    sendPacket(0, (const uint8_t *)&repeat, sizeof(repeat));
+    repeated++;
+  }
+  return repeated < PRIORITY_REPEATS
+             ? PRIORITY_REPEAT_MS[repeated] - (now - firstAt)
+             : UINT32_MAX;
+}
+
+// Show task. Claim the lease and carry the show on from the last state the
+// holder sent. A standby that never heard one restores its own last scene.
+void takeOver(uint32_t now) {
+  uint32_t silentMs =
+      now - (lease.held() ? lease.lastBeaconAt() : lease_listen_from.load());
+  lease_term = lease.term() + 1;
+  master_active.store(true);
+  lease_metrics.takeovers++;
+  lease_metrics.lastFailoverMs = silentMs;
+  show_state_due = true;
+  Serial.printf("⚡ Taking over as active master, term %u, after %u ms "
+                "without beacons\n",
+                lease_term, (unsigned)silentMs);
+  // Panels drop everything but beacons from a master whose term they have
+  // not heard, so the catch-up below would be lost without this going first
+  sendBeacon(now);
+
+  if (mirror.valid()) {
+    LightCommand current = mirror.scene();
+    setCurrentCommand(current);
+    scene.save(current, now);
+    if (mirror.resume(player, now) > 0) {
+      sendESPNowCommand(player.cmd); // where the sequence has got to
+    }
+    if (player.running()) {
+      Serial.printf("✓ Sequence %u carried on at step %u\n", player.id,
+                    player.step);
+    }
+  } else {
+    QueuedCommand restored = {};
+    if (scene.load(restored.cmd) != SCENE_NONE) {
+      restored.kind = CMD_LIGHT;
+      restored.enqueuedUs = esp_timer_get_time();
+      handleQueuedCommand(restored);
+    }
+  }
+
+  if (priority_state.load() != PRIORITY_RELEASE) {
+    Preferences prefs;
+    if (prefs.begin(PRIORITY_NVS_NAMESPACE, false)) {
+      prefs.putUChar("state", priority_state.load());
+      prefs.end();
+    }
+  }
+}
+
+// Show task. Another master holds a lease that beats ours: stop playing and
+// follow it. Panels already ignore us.
+void standDown(uint16_t term, uint32_t now) {
+  master_active.store(false);
+  lease_metrics.standDowns++;
+  player.stop();
+  replayer.stop();
+  cueRunner.stop(now, sendPacket); // nothing goes out any more
+  acks.clear();
+  lease.reset();
+  Serial.printf("⚠ Master with lease term %u is active, standing by\n", term);
+}
+
+// Show task. Beacons and show state from the other master; claims the
+// lease once the holder has gone quiet.
+void leaseTick(uint32_t now) {
+  LeaseEvent ev;
+  while (leaseEvents.pop(ev)) {
+    if (ev.data[0] == PKT_BEACON) {
+      BeaconPacket b;
+      memcpy(&b, ev.data, sizeof(b));
+      if (master_active.load()) {
+        if (!leaseBeats(b.term, ev.mac, lease_term, own_mac)) {
+          continue; // an older master; it stands down when it hears us
+        }
+        standDown(b.term, now);
+      }
+      if (!lease.onBeacon(ev.mac, b.term, ev.receivedAt)) {
+        continue;
+      }
+      // Keep the beat and any blackout, so neither moves at a takeover
+      uint64_t target = (uint64_t)b.beat * TEMPO_ONE_BEAT + b.beatFraction;
+      tempoClock().follow(b.bpmX100, b.beatsPerBar, target, ev.receivedAt);
+      priority_state.store(b.priority <= PRIORITY_HOLD
+                               ? b.priority
+                               : (uint8_t)PRIORITY_RELEASE);
+    } else if (!master_active.load() && lease.held() &&
+               lease.accept(ev.mac)) {
+      mirror.onPacket(ev.data, ev.len, ev.receivedAt);
+    }
+  }
+
+  uint32_t listening = lease_listen_from.load();
+  if (master_active.load() || listening == 0) {
+    return; // off the router's channel, silence proves nothing
+  }
+  uint32_t since = listening;
+  if (lease.held() && (int32_t)(lease.lastBeaconAt() - listening) > 0) {
+    since = lease.lastBeaconAt();
+  }
+  if ((int32_t)(now - since) >= LEASE_TIMEOUT_MS) {
+    takeOver(now);
+  }
+}
+
+uint32_t firmwareTick(uint32_t now) {
+  FwStatusPacket status;
+  while (firmwareStatus.pop(status)) {
+    firmwareSender.onStatus(status);
+  }
+  uint32_t untilNext = firmwareSender.tick(now, sendPacket);
+  if (!firmwareSender.running() && firmwareFile) {
+    firmwareFile.close();
+  }
+  return untilNext;
+}
+
+void showTask(void *arg) {
+  allocGuardWatchTask();
+  for (;;) {
+    int64_t start = esp_timer_get_time();
+    leaseTick(millis());
+    uint32_t untilRepeat = priorityTick(millis());
+
+#if AUDIO_INPUT
+    audioTick();
+#endif
+    QueuedCommand item;
+    while (commandQueue.pop(item)) {
+      bool superseded = supersededBy(item, commandQueue.peek());
+      if (superseded ||
+          (item.kind == CMD_LIGHT && item.enqueuedUs < priority_preempt_us)) {
+        bench_metrics.coalesced++;
+        queueAnswer(showAcks, item.ackId,
+                    superseded ? NACK_SUPERSEDED : NACK_PREEMPTED);
+        continue;
+      }
+      handleQueuedCommand(item);
+    }
+    uint32_t untilNext = player.tick(millis(), dispatchSequenceStep);
+    untilNext = min(untilNext, replayer.tick(esp_timer_get_time(),
+                                             dispatchSequenceStep));
+    untilNext = min(untilNext, cueUploader.tick(millis(), sendPacket));
+    untilNext = min(untilNext, cueRunner.tick(millis(), sendPacket));
+    untilNext = min(untilNext, rateSweep.tick(millis(), airtime, sendPacket,
+                                              applyAirRate));
+    untilNext = min(untilNext, firmwareTick(millis()));
+    untilNext = min(untilNext, untilRepeat);
+    peerTick(millis());
+    ackTick(millis());
+    sceneTick();
+
+    task_metrics.showBusyUs += esp_timer_get_time() - start;
+
+    // Sleep until the next sequence step or a new command, whichever first
+    uint32_t sleepMs = min(untilNext, (uint32_t)SHOW_TASK_MAX_SLEEP_MS);
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sleepMs));
+  }
+}
+
+void netTask(void *arg) {
+  allocGuardWatchTask();
+  for (;;) {
+    int64_t start = esp_timer_get_time();
+
+    connectionTick();
+    pollSerialConsole();
+    publishAcks();
+    recorder.flush(false);
+
+    unsigned long currentMillis = millis();
+    bool heartbeat_due = currentMillis - last_heartbeat >= HEARTBEAT_INTERVAL;
+    if (heartbeat_due) {
+      last_heartbeat = currentMillis;
+      if (master_active.load()) {
+        publishHeartbeat();
+#if AUDIO_INPUT
+        publishAudioReport();
+#endif
+      } else if (client.connected()) {
+        publishLeaseReport();
+      }
+    }
+
+    // On every change of role
+    static uint32_t reportedRoleChanges = 0;
+    uint32_t roleChanges = lease_metrics.takeovers + lease_metrics.standDowns;
+    if (client.connected() && roleChanges != reportedRoleChanges) {
+      reportedRoleChanges = roleChanges;
+      publishLeaseReport();
+    }
+
+    // A panel waiting for an ID: once when it is first heard, then with
+    // every heartbeat until it is provisioned or goes quiet
+    static uint8_t reportedUnprovisioned[6] = {};
+    uint8_t waiting[6];
+    if (client.connected() && master_active.load() &&
+        lastUnprovisioned(waiting) &&
+        (heartbeat_due ||
+         memcmp(waiting, reportedUnprovisioned, 6) != 0)) {
+      memcpy(reportedUnprovisioned, waiting, 6);
+      publishProvisionReport(waiting);
+    }
+
+    firmwareFetchTick();
+    static uint32_t reportedRollouts = 0;
+    static uint8_t reportedRound = 0;
+    if (firmwareSender.completed != reportedRollouts) {
+      reportedRollouts = firmwareSender.completed;
+      reportedRound = 0;
+      publishFirmwareReport(true);
+    } else if (firmwareSender.running() &&
+               firmwareSender.round != reportedRound) {
+      reportedRound = firmwareSender.round;
+      publishFirmwareReport(false);
+    }
+
+    static uint32_t reportedSweeps = 0;
+    if (rateSweep.completed != reportedSweeps) {
+      reportedSweeps = rateSweep.completed;
+      finishRateSweep();
+    }
+
+    // Once when the move is seen, once more when every panel is back
+    static uint32_t reportedMoves = 0;
+    static uint32_t reportedRecoveryMs = 0;
+    if (client.connected() &&
+        (channel_metrics.moves != reportedMoves ||
+         channel_metrics.recoveryMs != reportedRecoveryMs)) {
+      reportedMoves = channel_metrics.moves;
+      reportedRecoveryMs = channel_metrics.recoveryMs;
+      publishChannelReport();
+    }
+
+    task_metrics.netBusyUs += esp_timer_get_time() - start;
+    vTaskDelay(pdMS_TO_TICKS(5));
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+
+  Serial.println("\n=== MASTER ESP32 ===");
+
+  boot_metrics.resetReason = esp_reset_reason();
+  Serial.print("Reset: ");
+  Serial.println(resetReasonName(boot_metrics.resetReason));
+
+  // Radio first, so the restored scene can go out as soon as the show task
+  // starts; WiFi association carries on in the background.
+  setup_wifi();
+  setup_espnow();
+  esp_wifi_get_mac(WIFI_IF_STA, own_mac);
+  light_command_id = esp_random();
+  priority_seq = esp_random();
+  boot_metrics.espnowMs = millis();
+
+  Preferences prefs;
+  if (prefs.begin(PRIORITY_NVS_NAMESPACE, true)) {
+    uint8_t held = prefs.getUChar("state", PRIORITY_RELEASE);
+    prefs.end();
+    if (held == PRIORITY_BLACKOUT || held == PRIORITY_HOLD) {
+      priority_state.store(held);
+      Serial.print("⚠ Still in ");
+      Serial.print(PRIORITY_NAMES[held]);
+      Serial.println(" from before the reset");
+    }
+  }
+
+#if MASTER_STANDBY
+  Serial.println("Standby master: following the active master's lease");
+#endif
+
+  // Queued before the tasks exist, so it is the show task's first command.
+  // A standby keeps it for when it takes over.
+  QueuedCommand restored = {};
+  boot_metrics.sceneSource = scene.load(restored.cmd);
+  if (boot_metrics.sceneSource != SCENE_NONE && master_active.load()) {
+    restored.kind = CMD_LIGHT;
+    restored.enqueuedUs = esp_timer_get_time();
+    commandQueue.push(restored);
+    Serial.print("✓ Restoring last scene from ");
+    Serial.print(SCENE_SOURCE_NAMES[boot_metrics.sceneSource]);
+    Serial.print(" (sequence ");
+    Serial.print(restored.cmd.sequence);
+    Serial.print(", effect ");
+    Serial.print(restored.cmd.effect);
+    Serial.println(")");
+  }
+
+  if (!LittleFS.begin(true)) {
+    Serial.println("✗ LittleFS mount failed, recorder unavailable");
+  }
+  loadFirmwareImage();
+  if (firmware_size) {
+    Serial.print("✓ Panel image ");
+    Serial.print(firmware_size);
+    Serial.println(" bytes in flash");
+  }
+#ifdef SIMULATED_PANELS
+  runPeerBenchmark();
+#endif
+#ifdef BENCHMARK_REGIONS
+  runRegionBenchmark();
+#endif
+
+  client.setServer(mqtt_server, mqtt_port);
+  if (!client.setBufferSize(MQTT_BUFFER_SIZE)) {
+    Serial.println("✗ MQTT buffer allocation failed");
+  }
+  client.setCallback(mqttCallback);
+  client.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+  espClient.setTimeout(MQTT_SOCKET_TIMEOUT_S);
+
+#if BOOT_TEST_SEQUENCE
+  if (boot_metrics.sceneSource == SCENE_NONE && master_active.load()) {
+    Serial.println("\nStarting test sequence in 3 seconds...");
+    LightCommand test = {};
+    test.sequence = 0;
+    player.start(test, millis() + BOOT_TEST_DELAY_MS);
+  }
+#endif
+
+  task_metrics_since = esp_timer_get_time();
+  xTaskCreatePinnedToCore(showTask, "show", SHOW_TASK_STACK, nullptr, 3,
+                          &showTaskHandle, SHOW_TASK_CORE);
+  xTaskCreatePinnedToCore(netTask, "net", NET_TASK_STACK, nullptr, 1,
+                          &netTaskHandle, NET_TASK_CORE);
+#if AUDIO_INPUT
+  if (audioInput.begin()) {
+    xTaskCreatePinnedToCore(audioTask, "audio", AUDIO_TASK_STACK, nullptr,
+                            AUDIO_TASK_PRIORITY, &audioTaskHandle,
+                            AUDIO_TASK_CORE);
+    Serial.println("✓ Audio input on I2S0, streaming to panels");
+  } else {
+    Serial.println("✗ I2S init failed, audio input unavailable");
+  }
+#endif
+}
+
+void loop() {
+  // All work happens in the pinned net/show tasks
+  vTaskDelete(nullptr);
 }
@@ -0,0 +1,168 @@
+#ifndef PEERS_H
+#define PEERS_H
+
+#include "config.h"
+#include "link_protocol.h"
+#include <esp_now.h>
+
+// ============================================================================
+// PEER TABLE
+// ============================================================================
+//
+// Indexed directly by panel ID, so routing a command is one array access no
+// matter how many panels are installed. Only the show task writes the table;
+// announces from the receive callback reach it through a queue.
+//
+// ESP-NOW caps registered peers at 20, so broadcasts (panelId 0) go to the
+// broadcast address as a single frame, and unicast slots are handed out on
+// demand with least-recently-used eviction.
+
+#define ESPNOW_UNICAST_SLOTS 16
+
+enum PeerFlags {
+  PEER_KNOWN = 1 << 0,      // announced and not timed out
+  PEER_REGISTERED = 1 << 1  // currently holds an ESP-NOW unicast slot
+};
+
+struct PeerEntry {
+  uint8_t mac[6];
+  uint8_t flags;
+  uint8_t regionCount;
+  uint16_t firstRegion;
+  uint32_t lastSeenMs;
+  uint32_t lastTxMs;
+};
+
+struct PeerEvent {
+  AnnouncePacket announce;
+  uint8_t mac[6];
+};
+
+class PeerTable {
+public:
+  PeerTable() : knownPanels(0), registered(0) {
+    memset(entries, 0, sizeof(entries));
+  }
+
+  // O(1); nullptr for unknown or out-of-range IDs
+  PeerEntry *get(uint8_t panelId) {
+    if (panelId == 0 || panelId > MAX_PANELS)
+      return nullptr;
+    PeerEntry *e = &entries[panelId];
+    return (e->flags & PEER_KNOWN) ? e : nullptr;
+  }
+
+  uint32_t knownMask() const { return knownPanels; }
+  uint8_t knownCount() const { return __builtin_popcount(knownPanels); }
+  uint8_t registeredCount() const { return registered; }
+
+  // One past the highest global region of any known panel, 0 if none
+  uint16_t regionEnd() const {
+    uint16_t end = 0;
+    for (uint8_t id = nextKnown(0); id; id = nextKnown(id)) {
+      const PeerEntry &e = entries[id];
+      if (e.firstRegion + e.regionCount > end)
+        end = e.firstRegion + e.regionCount;
+    }
+    return end;
+  }
+
+  // Next known panel ID after `after` (0 to start), or 0 when done
+  uint8_t nextKnown(uint8_t after) const {
+    uint32_t rest = after >= MAX_PANELS ? 0 : knownPanels >> after;
+    return rest ? after + 1 + __builtin_ctz(rest) : 0;
+  }
+
+  // Returns true if the panel is new or its MAC/layout changed.
+  bool update(const AnnouncePacket &a, const uint8_t *mac, uint32_t now) {
+    if (a.panelId == 0 || a.panelId > MAX_PANELS)
+      return false;
+
+    PeerEntry &e = entries[a.panelId];
+    bool changed = !(e.flags & PEER_KNOWN) || memcmp(e.mac, mac, 6) != 0 ||
+                   e.firstRegion != a.firstRegion ||
+                   e.regionCount != a.regionCount;
+
+    if (changed && (e.flags & PEER_REGISTERED)) {
+      unregister(e);
+    }
+
+    memcpy(e.mac, mac, 6);
+    e.firstRegion = a.firstRegion;
+    e.regionCount = a.regionCount;
+    e.lastSeenMs = now;
+    e.flags |= PEER_KNOWN;
+    knownPanels |= 1UL << (a.panelId - 1);
+    return changed;
+  }
+
+  // Forget panels that stopped announcing. Returns how many were dropped.
+  uint8_t expire(uint32_t now) {
+    uint8_t dropped = 0;
+    for (uint8_t id = nextKnown(0); id; id = nextKnown(id)) {
+      PeerEntry &e = entries[id];
+      if (now - e.lastSeenMs > PEER_TIMEOUT_MS) {
+        if (e.flags & PEER_REGISTERED) {
+          unregister(e);
+        }
+        e.flags = 0;
+        knownPanels &= ~(1UL << (id - 1));
+        dropped++;
+      }
+    }
+    return dropped;
+  }
+
+  // Make sure the panel holds a unicast slot, evicting the least recently
+  // used one if all slots are taken. Returns the entry or nullptr.
+  PeerEntry *route(uint8_t panelId, uint32_t now) {
+    PeerEntry *e = get(panelId);
+    if (!e)
+      return nullptr;
+
+    if (!(e->flags & PEER_REGISTERED)) {
+      if (registered >= ESPNOW_UNICAST_SLOTS) {
+        evictLeastRecent();
+      }
+      esp_now_peer_info_t info = {};
+      memcpy(info.peer_addr, e->mac, 6);
+      info.channel = 0;
+      info.encrypt = false;
+      info.ifidx = WIFI_IF_STA;
+      esp_err_t err = esp_now_add_peer(&info);
+      if (err != ESP_OK && err != ESP_ERR_ESPNOW_EXIST)
+        return nullptr;
+      e->flags |= PEER_REGISTERED;
+      registered++;
+    }
+    e->lastTxMs = now;
+    return e;
+  }
+
+private:
+  PeerEntry entries[MAX_PANELS + 1]; // [0] unused
+  uint32_t knownPanels;
+  uint8_t registered;
+
+  void unregister(PeerEntry &e) {
+    esp_now_del_peer(e.mac);
+    e.flags &= ~PEER_REGISTERED;
+    registered--;
+  }
+
+  void evictLeastRecent() {
+    PeerEntry *oldest = nullptr;
+    for (uint8_t id = 1; id <= MAX_PANELS; id++) {
+      PeerEntry &e = entries[id];
+      if ((e.flags & PEER_REGISTERED) &&
+          (!oldest || (int32_t)(e.lastTxMs - oldest->lastTxMs) < 0)) {
+        oldest = &e;
+      }
+    }
+    if (oldest) {
+      unregister(*oldest);
+    }
+  }
+};
+
+#endif
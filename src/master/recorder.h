@@ -0,0 +1,327 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "config.h"
+#include "sequences.h"
+#include "show_journal.h"
+#include "spsc_queue.h"
+#include <LittleFS.h>
+#include <atomic>
+
+// ============================================================================
+// SHOW RECORDER
+// ============================================================================
+//
+// capture() sits on the dispatch path (show task): it only delta-encodes the
+// command into a RAM queue. The net task owns the journal file and drains
+// the queue into flash in RECORD_FLUSH_BYTES batches, so flash latency never
+// lands on the show core's dispatch path.
+
+#define JOURNAL_PATH "/show.rec"
+#define RECORD_QUEUE_DEPTH 64
+#define RECORD_FLUSH_BYTES 512
+#define RECORD_FLUSH_INTERVAL_MS 1000
+
+struct EncodedRecord {
+  uint32_t generation; // records from an earlier recording are discarded
+  uint8_t len;
+  uint8_t bytes[JOURNAL_MAX_RECORD];
+};
+
+class ShowRecorder {
+public:
+  // Metrics (written by one task each, read for the heartbeat)
+  volatile uint32_t records = 0;
+  volatile uint32_t bytes = 0;
+  volatile uint32_t overruns = 0;
+  volatile uint32_t captureMaxUs = 0;
+  volatile uint64_t captureSumUs = 0;
+  volatile uint32_t captureSamples = 0;
+  volatile uint32_t flushMaxUs = 0;
+
+  bool recording() const { return active.load(std::memory_order_acquire); }
+
+  // Net task. Truncates the journal and starts capturing.
+  bool start() {
+    stop();
+
+    file = LittleFS.open(JOURNAL_PATH, FILE_WRITE);
+    if (!file) {
+      Serial.println("✗ Recorder: cannot open " JOURNAL_PATH);
+      return false;
+    }
+
+    JournalHeader header = {JOURNAL_MAGIC, JOURNAL_VERSION, 0, MAX_REGIONS};
+    file.write((const uint8_t *)&header, sizeof(header));
+
+    records = 0;
+    bytes = sizeof(header);
+    overruns = 0;
+    bufLen = 0;
+    lastFlush = millis();
+    generation.fetch_add(1, std::memory_order_release);
+    active.store(true, std::memory_order_release);
+
+    Serial.println("● Recording show to " JOURNAL_PATH);
+    return true;
+  }
+
+  // Net task. Flushes everything captured so far and closes the journal.
+  void stop() {
+    if (!recording())
+      return;
+    active.store(false, std::memory_order_release);
+    flush(true);
+    file.close();
+
+    Serial.print("■ Recording stopped: ");
+    Serial.print(records);
+    Serial.print(" records, ");
+    Serial.print(bytes);
+    Serial.println(" bytes");
+  }
+
+  // Show task. Encodes `cmd` against the previously captured command.
+  void capture(const LightCommand &cmd) {
+    if (!recording())
+      return;
+
+    int64_t now = esp_timer_get_time();
+    uint32_t gen = generation.load(std::memory_order_acquire);
+    if (gen != seenGeneration) {
+      seenGeneration = gen;
+      memset(&prev, 0, sizeof(prev));
+      prevUs = now;
+    }
+
+    int64_t dt = now - prevUs;
+    if (dt > 0xFFFFFFFFLL) {
+      dt = 0xFFFFFFFFLL; // gaps over ~71 min are shortened on replay
+    }
+
+    EncodedRecord rec;
+    rec.generation = gen;
+    rec.len = journalEncode(prev, cmd, (uint32_t)dt, rec.bytes);
+
+    // Only advance the delta base when the record made it into the queue,
+    // so a dropped record costs timing accuracy, not journal consistency.
+    if (queue.push(rec)) {
+      prev = cmd;
+      prevUs = now;
+    } else {
+      overruns++;
+    }
+
+    uint32_t took = esp_timer_get_time() - now;
+    captureSumUs += took;
+    captureSamples++;
+    if (took > captureMaxUs) {
+      captureMaxUs = took;
+    }
+  }
+
+  // Net task. Moves queued records to flash once a batch is full, the flush
+  // interval has passed, or `force` is set.
+  void flush(bool force) {
+    EncodedRecord rec;
+    uint32_t gen = generation.load(std::memory_order_acquire);
+    while ((size_t)(bufLen + JOURNAL_MAX_RECORD) <= sizeof(buf) &&
+           queue.pop(rec)) {
+      if (rec.generation != gen)
+        continue;
+      memcpy(buf + bufLen, rec.bytes, rec.len);
+      bufLen += rec.len;
+      records++;
+    }
+
+    if (bufLen == 0)
+      return;
+    if (!force && bufLen < RECORD_FLUSH_BYTES &&
+        millis() - lastFlush < RECORD_FLUSH_INTERVAL_MS)
+      return;
+
+    int64_t start = esp_timer_get_time();
+    file.write(buf, bufLen);
+    file.flush();
+    uint32_t took = esp_timer_get_time() - start;
+    if (took > flushMaxUs) {
+      flushMaxUs = took;
+    }
+
+    bytes += bufLen;
+    bufLen = 0;
+    lastFlush = millis();
+
+    if (force && queue.size() > 0) {
+      flush(true);
+    }
+  }
+
+private:
+  std::atomic<bool> active{false};
+  std::atomic<uint32_t> generation{0};
+
+  // Producer (show task) state
+  uint32_t seenGeneration = 0;
+  LightCommand prev = {};
+  int64_t prevUs = 0;
+
+  SpscQueue<EncodedRecord, RECORD_QUEUE_DEPTH> queue;
+
+  // Consumer (net task) state
+  File file;
+  uint8_t buf[RECORD_FLUSH_BYTES + JOURNAL_MAX_RECORD];
+  uint16_t bufLen = 0;
+  unsigned long lastFlush = 0;
+};
+
+// ============================================================================
+// JOURNAL READER
+// ============================================================================
+
+class JournalReader {
+public:
+  bool open() {
+    file = LittleFS.open(JOURNAL_PATH, FILE_READ);
+    if (!file || !rewind()) {
+      file.close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() { file.close(); }
+
+  // Back to the first record; the command state restarts from zero.
+  bool rewind() {
+    JournalHeader header;
+    file.seek(0);
+    if (file.read((uint8_t *)&header, sizeof(header)) != sizeof(header) ||
+        header.magic != JOURNAL_MAGIC || header.version != JOURNAL_VERSION ||
+        header.maxRegions != MAX_REGIONS) {
+      return false;
+    }
+    state = {};
+    len = pos = 0;
+    return true;
+  }
+
+  // Decode the next record into `cmd`. `dtUs` is its delay after the
+  // previous record.
+  bool next(LightCommand &cmd, uint32_t &dtUs) {
+    for (;;) {
+      uint8_t used = journalDecode(buf + pos, len - pos, state, dtUs);
+      if (used) {
+        pos += used;
+        cmd = state;
+        return true;
+      }
+
+      // Partial record: compact and refill
+      memmove(buf, buf + pos, len - pos);
+      len -= pos;
+      pos = 0;
+      size_t got = file.read(buf + len, sizeof(buf) - len);
+      if (got == 0)
+        return false;
+      len += got;
+    }
+  }
+
+private:
+  File file;
+  uint8_t buf[128];
+  uint16_t len = 0;
+  uint16_t pos = 0;
+  LightCommand state = {};
+};
+
+// ============================================================================
+// SHOW REPLAYER
+// ============================================================================
+//
+// Runs on the show task. Deadlines are absolute (start time plus the running
+// sum of record deltas), so scheduling jitter never accumulates.
+
+class ShowReplayer {
+public:
+  volatile uint32_t records = 0;
+  volatile int32_t lateMaxUs = 0; // worst dispatch lateness this run
+
+  bool active() const { return running; }
+
+  bool start(bool loop) {
+    stop();
+
+    if (!reader.open()) {
+      Serial.println("✗ Replay: no valid journal at " JOURNAL_PATH);
+      return false;
+    }
+
+    looping = loop;
+    records = 0;
+    lateMaxUs = 0;
+    dueUs = esp_timer_get_time();
+    if (!readNext()) {
+      Serial.println("✗ Replay: journal is empty");
+      reader.close();
+      return false;
+    }
+
+    running = true;
+    Serial.println(loop ? "▶ Replaying show (loop)" : "▶ Replaying show");
+    return true;
+  }
+
+  void stop() {
+    if (!running)
+      return;
+    running = false;
+    reader.close();
+    Serial.print("■ Replay stopped after ");
+    Serial.print(records);
+    Serial.println(" records");
+  }
+
+  // Dispatch every record that is due; returns ms until the next one
+  // (SEQ_IDLE when not replaying).
+  uint32_t tick(int64_t nowUs, DispatchFn dispatch) {
+    while (running && nowUs >= dueUs) {
+      int32_t late = nowUs - dueUs;
+      if (late > lateMaxUs) {
+        lateMaxUs = late;
+      }
+
+      LightCommand cmd = pending;
+      dispatch(cmd);
+      records++;
+
+      if (!readNext()) {
+        if (looping && reader.rewind() && readNext())
+          continue;
+        Serial.println("✓ Replay complete");
+        stop();
+      }
+    }
+    if (!running)
+      return SEQ_IDLE;
+    return (uint32_t)((dueUs - nowUs + 999) / 1000);
+  }
+
+private:
+  JournalReader reader;
+  LightCommand pending = {};
+  int64_t dueUs = 0;
+  bool looping = false;
+  bool running = false;
+
+  bool readNext() {
+    uint32_t dt;
+    if (!reader.next(pending, dt))
+      return false;
+    dueUs += dt;
+    return true;
+  }
+};
+
+#endif
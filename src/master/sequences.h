@@ -0,0 +1,275 @@
+#ifndef SEQUENCES_H
+#define SEQUENCES_H
+
+#include "config.h"
+
+// ============================================================================
+// SEQUENCE DEFINITIONS
+// ============================================================================
+//
+// Each sequence is a step function: it mutates the command for `step`, and
+// returns how long to hold it (ms) before the next step, or SEQ_DONE. The
+// player below dispatches the command after every step, so sequences never
+// block and a newer command can interrupt them between steps.
+
+#define SEQ_DONE 0xFFFFFFFFUL
+#define SEQ_IDLE 0xFFFFFFFFUL
+
+typedef uint32_t (*SequenceStepFn)(uint8_t step, LightCommand &cmd);
+typedef void (*DispatchFn)(LightCommand &cmd);
+
+void setAllRegions(bool state, LightCommand &cmd) {
+  cmd.groupInclude = 0;
+  cmd.groupExclude = 0;
+  if (state) {
+    cmd.regions.assignRange(0, STAGE_REGIONS, true);
+  } else {
+    cmd.regions.clearAll();
+  }
+}
+
+void setRegionsByList(const uint8_t *regionList, uint8_t count, bool state,
+                      LightCommand &cmd) {
+  for (uint8_t i = 0; i < count; i++) {
+    cmd.regions.assign(regionList[i], state);
+  }
+}
+
+// Adding groups leaves them for the panels to resolve. Taking some away
+// resolves the command here first, since exclusion would also drop any
+// later additions that share a group.
+void setRegionsByGroup(uint16_t groupMask, bool state, LightCommand &cmd) {
+  if (state && !cmd.groupExclude) {
+    cmd.groupInclude |= groupMask;
+    return;
+  }
+  RegionSet group;
+  RegionGroups::expand(cmd, cmd.regions);
+  cmd.groupInclude = 0;
+  cmd.groupExclude = 0;
+  RegionGroups::getMask(groupMask, group);
+  if (state) {
+    cmd.regions |= group;
+  } else {
+    cmd.regions.subtract(group);
+  }
+}
+
+uint32_t sequence0Step(uint8_t step, LightCommand &cmd) {
+  switch (step) {
+  case 0:
+    Serial.println("\n=== Running Sequence 0: Test Sequence ===");
+    Serial.println("Step 1: All regions full brightness (2s)");
+    setAllRegions(true, cmd);
+    cmd.effect = EFFECT_STATIC;
+    cmd.brightness = 255;
+    cmd.speed = 50;
+    return 2000;
+  case 1:
+    Serial.println("Step 2: Wave effect (5s)");
+    cmd.effect = EFFECT_WAVE;
+    cmd.speed = 60;
+    return 5000;
+  case 2:
+    Serial.println("Step 3: Pulse fast (3s)");
+    cmd.effect = EFFECT_PULSE;
+    cmd.speed = 80;
+    return 3000;
+  case 3:
+    Serial.println("Step 4: Pulse slow (3s)");
+    cmd.speed = 30;
+    return 3000;
+  case 4:
+    Serial.println("Step 5: Fade in (3s)");
+    cmd.effect = EFFECT_FADE_IN;
+    cmd.speed = 50;
+    return 3000;
+  case 5:
+    Serial.println("Step 6: Fade out (3s)");
+    cmd.effect = EFFECT_FADE_OUT;
+    return 3000;
+  case 6:
+    Serial.println("Step 7: All off");
+    cmd.effect = EFFECT_STATIC;
+    cmd.brightness = 0;
+    return 500;
+  default:
+    Serial.println("✓ Sequence 0 complete\n");
+    return SEQ_DONE;
+  }
+}
+
+uint32_t sequence1Step(uint8_t step, LightCommand &cmd) {
+  if (step == 0) {
+    Serial.println("\n=== Running Sequence 1: Vertical Sweep ===");
+    Serial.println("Forward sweep: top to bottom");
+  }
+
+  if (step < STAGE_REGIONS) {
+    cmd.regions.set(step);
+    if (step == STAGE_REGIONS - 1) {
+      Serial.println("Hold all lit (2s)");
+      return 300 + 2000;
+    }
+    return 300;
+  }
+
+  if (step < 2 * STAGE_REGIONS) {
+    if (step == STAGE_REGIONS) {
+      Serial.println("Reverse sweep: bottom to top");
+    }
+    cmd.regions.clear(2 * STAGE_REGIONS - 1 - step);
+    return 300;
+  }
+
+  Serial.println("✓ Sequence 1 complete\n");
+  return SEQ_DONE;
+}
+
+uint32_t sequence2Step(uint8_t step, LightCommand &cmd) {
+  switch (step) {
+  case 0:
+    Serial.println("\n=== Running Sequence 2: Group Narrative ===");
+    Serial.println("Step 1: Light SYMBOL group");
+    setRegionsByGroup(GROUP_SYMBOL, true, cmd);
+    return 4000;
+  case 1:
+    Serial.println("Step 2: Add RAAVANA_HEAD group");
+    setRegionsByGroup(GROUP_RAAVANA_HEAD, true, cmd);
+    return 4000;
+  case 2:
+    Serial.println("Step 3: Expand to full RAAVANA group");
+    setRegionsByGroup(GROUP_RAAVANA, true, cmd);
+    return 5000;
+  case 3:
+    Serial.println("Step 4: Light CONTINENT group");
+    setRegionsByGroup(GROUP_CONTINENT, true, cmd);
+    return 5000;
+  case 4:
+    Serial.println("Step 5: All off");
+    cmd.effect = EFFECT_STATIC;
+    cmd.brightness = 0;
+    return 1000;
+  default:
+    Serial.println("✓ Sequence 2 complete\n");
+    return SEQ_DONE;
+  }
+}
+
+uint32_t sequence3Step(uint8_t step, LightCommand &cmd) {
+  switch (step) {
+  case 0:
+    Serial.println("\n=== Running Sequence 3: Symbol Emergence ===");
+    Serial.println("Step 1: Light SYMBOL regions");
+    setRegionsByGroup(GROUP_SYMBOL, true, cmd);
+    return 3000;
+  case 1:
+    Serial.println("Step 2: Add all other regions");
+    setAllRegions(true, cmd);
+    return 5000;
+  case 2:
+    Serial.println("Step 3: All off");
+    cmd.effect = EFFECT_STATIC;
+    cmd.brightness = 0;
+    return 1000;
+  default:
+    Serial.println("✓ Sequence 3 complete\n");
+    return SEQ_DONE;
+  }
+}
+
+const SequenceStepFn SEQUENCES[] = {sequence0Step, sequence1Step,
+                                    sequence2Step, sequence3Step};
+#define NUM_SEQUENCES (sizeof(SEQUENCES) / sizeof(SEQUENCES[0]))
+
+// ============================================================================
+// SEQUENCE PLAYER
+// ============================================================================
+
+struct SequencePlayer {
+  SequenceStepFn fn;
+  uint8_t id;
+  uint8_t step;
+  uint32_t nextStepAt;
+  LightCommand cmd;
+
+  SequencePlayer() : fn(nullptr), id(0), step(0), nextStepAt(0) {}
+
+  bool running() const { return fn != nullptr; }
+
+  // Arm a sequence using effect/brightness/speed from `params`. The first
+  // step fires at `startAt`. A running sequence is replaced.
+  bool start(const LightCommand &params, uint32_t startAt) {
+    if (params.sequence >= NUM_SEQUENCES) {
+      Serial.print("Unknown sequence ID: ");
+      Serial.println(params.sequence);
+      return false;
+    }
+    if (running()) {
+      Serial.print("Sequence ");
+      Serial.print(id);
+      Serial.println(" interrupted");
+    }
+
+    cmd = params;
+    cmd.panelId = 0;
+    cmd.debugMode = false;
+    setAllRegions(false, cmd);
+
+    fn = SEQUENCES[params.sequence];
+    id = params.sequence;
+    step = 0;
+    nextStepAt = startAt;
+    return true;
+  }
+
+  void stop() { fn = nullptr; }
+
+  // Carry on a sequence another master was playing: `state` is its command
+  // with `nextStep` due at `nextAt`. Steps that are already due run without
+  // being dispatched, so the caller sends the look the sequence has reached
+  // once instead of a burst of stale steps. Returns how many ran.
+  uint8_t resume(uint8_t seqId, uint8_t nextStep, const LightCommand &state,
+                 uint32_t nextAt, uint32_t now) {
+    if (seqId >= NUM_SEQUENCES) {
+      return 0;
+    }
+    fn = SEQUENCES[seqId];
+    id = seqId;
+    step = nextStep;
+    cmd = state;
+    nextStepAt = nextAt;
+
+    uint8_t skipped = 0;
+    while (running() && (int32_t)(now - nextStepAt) >= 0) {
+      uint32_t hold = fn(step, cmd);
+      if (hold == SEQ_DONE) {
+        stop();
+        break;
+      }
+      step++;
+      nextStepAt += hold;
+      skipped++;
+    }
+    return skipped;
+  }
+
+  // Run every step that is due and return the ms until the next one
+  // (SEQ_IDLE when nothing is playing). Deadlines accumulate from the
+  // previous step, so slow dispatches don't stretch the sequence.
+  uint32_t tick(uint32_t now, DispatchFn dispatch) {
+    while (running() && (int32_t)(now - nextStepAt) >= 0) {
+      uint32_t hold = fn(step, cmd);
+      if (hold == SEQ_DONE) {
+        stop();
+        break;
+      }
+      dispatch(cmd);
+      step++;
+      nextStepAt += hold;
+    }
+    return running() ? nextStepAt - now : SEQ_IDLE;
+  }
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef STANDBY_H
+#define STANDBY_H
+
+#include "config.h"
+#include "lease_protocol.h"
+#include "sequences.h"
+#include "show_journal.h"
+
+// ============================================================================
+// SHOW STATE, SENT BY THE ACTIVE MASTER AND KEPT BY THE STANDBY
+// ============================================================================
+//
+// Sequences are deterministic step functions, so a standby that knows which
+// sequence is running, the step due next, when, and the command as it
+// stands can work out every later step itself. It needs no packet per step,
+// only one whenever the scene changes plus the periodic copy that rides
+// along with the beacon. Replays and cue shows are not carried over: the
+// journal and the show live in the active master's flash and RAM. Panels
+// keep playing an uploaded cue list on their own clocks either way.
+
+// Active master, show task. Returns the bytes of `pkt` to send.
+inline size_t showStateEncode(const LightCommand &scene,
+                              const SequencePlayer &player, uint16_t term,
+                              uint32_t now, ShowStatePacket &pkt) {
+  LightCommand empty = {};
+  pkt.type = PKT_SHOW_STATE;
+  pkt.term = term;
+  pkt.sceneLength = journalEncode(empty, scene, 0, pkt.data);
+  if (player.running()) {
+    pkt.sequence = player.id;
+    pkt.step = player.step;
+    pkt.stepDueMs = (int32_t)(player.nextStepAt - now) > 0
+                        ? player.nextStepAt - now
+                        : 0;
+    pkt.playerLength =
+        journalEncode(scene, player.cmd, 0, pkt.data + pkt.sceneLength);
+  } else {
+    pkt.sequence = SHOW_STATE_IDLE;
+    pkt.step = 0;
+    pkt.stepDueMs = 0;
+    pkt.playerLength = 0;
+  }
+  return SHOW_STATE_HEADER + pkt.sceneLength + pkt.playerLength;
+}
+
+// Standby, show task. The latest show state from the lease holder.
+class ShowMirror {
+public:
+  bool valid() const { return have; }
+  const LightCommand &scene() const { return sceneCmd; }
+  uint32_t receivedAt() const { return at; }
+  bool sequenceRunning() const { return sequence != SHOW_STATE_IDLE; }
+
+  // False for a malformed packet; the previous state is kept
+  bool onPacket(const uint8_t *data, int len, uint32_t now) {
+    if (len < (int)SHOW_STATE_HEADER) {
+      return false;
+    }
+    ShowStatePacket pkt;
+    memcpy(&pkt, data, min((size_t)len, sizeof(pkt)));
+    if ((int)SHOW_STATE_HEADER + pkt.sceneLength + pkt.playerLength != len) {
+      return false;
+    }
+
+    LightCommand decodedScene = {};
+    uint32_t dtUs;
+    if (journalDecode(pkt.data, pkt.sceneLength, decodedScene, dtUs) !=
+        pkt.sceneLength) {
+      return false;
+    }
+    LightCommand decodedPlayer = decodedScene;
+    if (pkt.sequence != SHOW_STATE_IDLE &&
+        journalDecode(pkt.data + pkt.sceneLength, pkt.playerLength,
+                      decodedPlayer, dtUs) != pkt.playerLength) {
+      return false;
+    }
+
+    sceneCmd = decodedScene;
+    playerCmd = decodedPlayer;
+    sequence = pkt.sequence;
+    step = pkt.step;
+    stepAt = now + pkt.stepDueMs;
+    at = now;
+    have = true;
+    return true;
+  }
+
+  // Pick the sequence up where the active master left it. Returns the
+  // steps that fell due while nobody was playing it (see
+  // SequencePlayer::resume).
+  uint8_t resume(SequencePlayer &player, uint32_t now) const {
+    if (!have || sequence == SHOW_STATE_IDLE) {
+      return 0;
+    }
+    return player.resume(sequence, step, playerCmd, stepAt, now);
+  }
+
+private:
+  bool have = false;
+  LightCommand sceneCmd = {};
+  LightCommand playerCmd = {};
+  uint8_t sequence = SHOW_STATE_IDLE;
+  uint8_t step = 0;
+  uint32_t stepAt = 0;
+  uint32_t at = 0;
+};
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef PANEL_CUES_H
+#define PANEL_CUES_H
+
+#include "config.h"
+#include "cue_protocol.h"
+#include "identity.h"
+#include <Preferences.h>
+
+// ============================================================================
+// PANEL CUE LIST
+// ============================================================================
+//
+// Packets arrive on the WiFi task and only touch the receive buffer or the
+// pending-GO slot. Verification, the NVS write and cue playback run from
+// loop(), so the receive callback never blocks on flash.
+
+#define CUE_NVS_NAMESPACE "cues"
+#define CUE_MAX_CHUNKS ((MAX_CUES + CUES_PER_CHUNK - 1) / CUES_PER_CHUNK)
+
+static_assert(CUE_MAX_CHUNKS <= 32, "rxChunks is a uint32_t");
+
+class PanelCueList {
+public:
+  uint16_t showId = 0;
+  uint16_t count = 0;
+
+  bool playing() const { return isPlaying; }
+  uint16_t currentCue() const { return current; }
+
+  bool load() {
+    Preferences prefs;
+    if (!prefs.begin(CUE_NVS_NAMESPACE, true))
+      return false;
+    showId = prefs.getUShort("show", 0);
+    count = prefs.getUShort("count", 0);
+    if (count > MAX_CUES ||
+        prefs.getBytes("list", cues, count * sizeof(PanelCue)) !=
+            count * sizeof(PanelCue)) {
+      count = 0;
+    }
+    prefs.end();
+    return count > 0;
+  }
+
+  // --- WiFi task -----------------------------------------------------------
+
+  void onBegin(const CueBeginPacket &pkt) {
+    if (pkt.cueCount > MAX_CUES)
+      return;
+    rxShowId = pkt.showId;
+    rxCount = pkt.cueCount;
+    rxChunks = 0;
+    rxCommitPending = false;
+  }
+
+  void onChunk(const CueChunkPacket &pkt, int len) {
+    if (pkt.showId != rxShowId || pkt.firstCue % CUES_PER_CHUNK != 0 ||
+        pkt.count > CUES_PER_CHUNK || pkt.firstCue + pkt.count > rxCount ||
+        len < (int)(offsetof(CueChunkPacket, cues) +
+                    pkt.count * sizeof(PanelCue)))
+      return;
+    memcpy(rxCues + pkt.firstCue, pkt.cues, pkt.count * sizeof(PanelCue));
+    rxChunks |= 1UL << (pkt.firstCue / CUES_PER_CHUNK);
+  }
+
+  void onCommit(const CueCommitPacket &pkt, const uint8_t *mac) {
+    if (pkt.showId != rxShowId)
+      return;
+    rxCrc = pkt.crc;
+    memcpy(rxFrom, mac, 6);
+    rxCommitPending = true;
+  }
+
+  void onGo(const CueGoPacket &pkt, uint32_t localNow) {
+    // Map the master clock onto ours; airtime (~1 ms) is ignored
+    goCue = pkt.cue;
+    goShowId = pkt.showId;
+    goAt = pkt.atMs + (localNow - pkt.masterMs);
+    goPending = true;
+  }
+
+  // --- loop() --------------------------------------------------------------
+
+  // Verify and persist a committed upload. Returns true and fills `status`
+  // (and the master's MAC) when a reply should be sent.
+  bool pollCommit(CueStatusPacket &status, uint8_t *replyTo) {
+    if (!rxCommitPending)
+      return false;
+    rxCommitPending = false;
+
+    status.type = PKT_CUE_STATUS;
+    status.panelId = panelIdentity().id();
+    status.showId = rxShowId;
+    status.cueCount = rxCount;
+    memcpy(replyTo, rxFrom, 6);
+
+    uint16_t chunks = (rxCount + CUES_PER_CHUNK - 1) / CUES_PER_CHUNK;
+    if (rxChunks != (1UL << chunks) - 1) {
+      status.status = CUE_STATUS_MISSING_CHUNKS;
+      return true;
+    }
+    if (cueListCrc(rxCues, rxCount) != rxCrc) {
+      status.status = CUE_STATUS_BAD_CRC;
+      return true;
+    }
+
+    Preferences prefs;
+    bool ok = prefs.begin(CUE_NVS_NAMESPACE, false) &&
+              prefs.putBytes("list", rxCues, rxCount * sizeof(PanelCue)) ==
+                  rxCount * sizeof(PanelCue) &&
+              prefs.putUShort("count", rxCount) &&
+              prefs.putUShort("show", rxShowId);
+    prefs.end();
+    if (!ok) {
+      status.status = CUE_STATUS_FLASH_ERROR;
+      return true;
+    }
+
+    isPlaying = false;
+    memcpy(cues, rxCues, rxCount * sizeof(PanelCue));
+    count = rxCount;
+    showId = rxShowId;
+    status.status = CUE_STATUS_STORED;
+    return true;
+  }
+
+  // Advance playback. Returns true and fills `cmd` when a new cue starts.
+  bool tick(uint32_t now, LightCommand &cmd) {
+    if (goPending && (int32_t)(now - goAt) >= 0) {
+      goPending = false;
+
+      if (goCue == CUE_GO_STOP) {
+        isPlaying = false;
+        return false;
+      }
+      if (goShowId != showId || goCue >= count)
+        return false;
+
+      if (isPlaying && goCue == current) {
+        // Already there by auto-follow: just resync the cue clock
+        cueStartedAt = goAt;
+        return false;
+      }
+      start(goCue, goAt, cmd);
+      return true;
+    }
+
+    if (!isPlaying)
+      return false;
+
+    uint32_t follow = cues[current].followMs;
+    if (follow == 0 || now - cueStartedAt < follow)
+      return false;
+
+    if (current + 1 >= count) {
+      isPlaying = false;
+      return false;
+    }
+    start(current + 1, cueStartedAt + follow, cmd);
+    return true;
+  }
+
+  void stop() {
+    isPlaying = false;
+    goPending = false;
+  }
+
+private:
+  PanelCue cues[MAX_CUES];
+  uint16_t current = 0;
+  uint32_t cueStartedAt = 0;
+  bool isPlaying = false;
+
+  // Receive buffer (WiFi task writes, loop reads after rxCommitPending)
+  PanelCue rxCues[MAX_CUES];
+  uint16_t rxShowId = 0;
+  uint16_t rxCount = 0;
+  volatile uint32_t rxChunks = 0;
+  uint32_t rxCrc = 0;
+  uint8_t rxFrom[6] = {};
+  volatile bool rxCommitPending = false;
+
+  // Pending GO (WiFi task writes, loop reads)
+  volatile uint16_t goCue = 0;
+  volatile uint16_t goShowId = 0;
+  volatile uint32_t goAt = 0;
+  volatile bool goPending = false;
+
+  void start(uint16_t index, uint32_t at, LightCommand &cmd) {
+    current = index;
+    cueStartedAt = at;
+    isPlaying = true;
+
+    const PanelCue &cue = cues[index];
+    cmd = {};
+    cmd.effect = cue.effect;
+    cmd.brightness = cue.brightness;
+    cmd.speed = cue.speed;
+    cmd.panelId = panelIdentity().id();
+    cmd.transitionMs = DEFAULT_TRANSITION_MS; // cues carry no transition
+    cmd.curve = CURVE_EASE;
+    cmd.regions.deposit(panelIdentity().firstRegion(), cue.regionMask,
+                        panelIdentity().count());
+  }
+};
+
+#endif
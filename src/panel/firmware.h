@@ -0,0 +1,206 @@
+#ifndef PANEL_FIRMWARE_H
+#define PANEL_FIRMWARE_H
+
+#include "config.h"
+#include "firmware_protocol.h"
+
+// ============================================================================
+// PANEL FIRMWARE RECEIVER
+// ============================================================================
+//
+// Takes the master's image (firmware_protocol.h) into the spare OTA slot.
+// Everything runs from loop(): the receive callback only queues packets, so
+// a flash write or erase never holds up the WiFi task.
+//
+// The slot is erased one sector per call to tick() before chunks are taken
+// (FW_STATE_ERASING), because an erase takes tens of ms and chunks arriving
+// meanwhile would overflow the queue. Resuming the same image skips every
+// sector that already holds a chunk, so nothing saved is erased again.
+// Chunks written after the last save are only rewritten with the same bytes.
+//
+// `Store` is where the image and the progress live: the spare OTA slot and
+// NVS on a panel (firmware_store.h), memory in the simulator (src/fwsim).
+// It provides capacity(), erase(offset), write(), read(), loadProgress(),
+// saveProgress(), loadInstalled() and activate().
+
+#define FW_SAVE_EVERY 256       // chunks between progress saves
+#define FW_RESTART_DELAY_MS 1000 // after VERIFIED, so the master hears it
+
+template <class Store> class FirmwareReceiver {
+public:
+  Store store;
+
+  uint8_t state() const { return current; }
+  uint32_t imageId() const { return offer.imageId; }
+  uint16_t held() const { return heldCount; }
+  uint16_t chunks() const { return chunkCount; }
+
+  void begin(uint8_t panel) {
+    panelId = panel;
+    hasInstalled = store.loadInstalled(installed);
+  }
+
+  void onOffer(const FwOfferPacket &pkt) {
+    if (!(pkt.panelMask & (1UL << (panelId - 1))))
+      return;
+    if (pkt.imageId == offer.imageId && current != FW_STATE_IDLE &&
+        current != FW_STATE_BAD_HASH && current != FW_STATE_FLASH_ERROR)
+      return; // a repeat of the offer we are working on
+    offer = pkt;
+    chunkCount = fwChunkCount(pkt.size);
+    if (hasInstalled && memcmp(installed, pkt.sha256, 32) == 0) {
+      current = FW_STATE_CURRENT;
+      return;
+    }
+    if (pkt.size == 0 || chunkCount > FW_MAX_CHUNKS ||
+        pkt.size > store.capacity()) {
+      current = FW_STATE_TOO_LARGE;
+      return;
+    }
+
+    uint32_t savedId, savedSize;
+    memset(bits, 0, sizeof(bits));
+    heldCount = 0;
+    if (store.loadProgress(savedId, savedSize, bits, bitmapBytes()) &&
+        savedId == pkt.imageId && savedSize == pkt.size) {
+      for (uint16_t i = 0; i < chunkCount; i++) {
+        heldCount += fwBit(bits, i);
+      }
+    } else {
+      memset(bits, 0, sizeof(bits));
+      store.saveProgress(pkt.imageId, pkt.size, bits, bitmapBytes());
+    }
+    unsaved = 0;
+    eraseNext = 0;
+    current = FW_STATE_ERASING;
+  }
+
+  void onChunk(const FwChunkPacket &pkt, int len) {
+    if (current != FW_STATE_RECEIVING || pkt.imageId != offer.imageId ||
+        pkt.index >= chunkCount || fwBit(bits, pkt.index))
+      return;
+    uint16_t bytes = fwChunkLength(offer.size, pkt.index);
+    if (len < (int)(offsetof(FwChunkPacket, data) + bytes))
+      return;
+    if (!store.write((uint32_t)pkt.index * FW_CHUNK_BYTES, pkt.data, bytes)) {
+      current = FW_STATE_FLASH_ERROR;
+      return;
+    }
+    fwSetBit(bits, pkt.index);
+    heldCount++;
+    if (heldCount == chunkCount) {
+      current = FW_STATE_COMPLETE;
+    }
+    if (++unsaved >= FW_SAVE_EVERY || current == FW_STATE_COMPLETE) {
+      store.saveProgress(offer.imageId, offer.size, bits, bitmapBytes());
+      unsaved = 0;
+    }
+  }
+
+  // Hashes the whole slot, so it blocks loop() for a moment. Returns true
+  // once the new image is set to boot; restartDue() says when.
+  bool onCommit(const FwCommitPacket &pkt, uint32_t now) {
+    if (pkt.imageId != offer.imageId || current != FW_STATE_COMPLETE ||
+        !(pkt.panelMask & (1UL << (panelId - 1))))
+      return false;
+
+    Sha256 sha;
+    uint8_t buf[256];
+    for (uint32_t at = 0; at < offer.size; at += sizeof(buf)) {
+      uint32_t n = min(offer.size - at, (uint32_t)sizeof(buf));
+      if (!store.read(at, buf, n)) {
+        current = FW_STATE_FLASH_ERROR;
+        return false;
+      }
+      sha.update(buf, n);
+    }
+    uint8_t digest[32];
+    sha.finish(digest);
+    if (memcmp(digest, offer.sha256, 32) != 0) {
+      // Something in the slot is wrong and we cannot tell which chunk
+      memset(bits, 0, sizeof(bits));
+      heldCount = 0;
+      store.saveProgress(offer.imageId, offer.size, bits, bitmapBytes());
+      current = FW_STATE_BAD_HASH;
+      return false;
+    }
+    if (!store.activate(offer.sha256, offer.size)) {
+      current = FW_STATE_FLASH_ERROR;
+      return false;
+    }
+    memcpy(installed, offer.sha256, 32);
+    hasInstalled = true;
+    current = FW_STATE_VERIFIED;
+    restartAt = now + FW_RESTART_DELAY_MS;
+    return true;
+  }
+
+  bool restartDue(uint32_t now) const {
+    return current == FW_STATE_VERIFIED && (int32_t)(now - restartAt) >= 0;
+  }
+
+  // One erase step while preparing the slot. Returns true while erasing.
+  bool tick() {
+    if (current != FW_STATE_ERASING)
+      return false;
+    uint32_t sectors =
+        (offer.size + FW_SECTOR_BYTES - 1) / FW_SECTOR_BYTES;
+    while (eraseNext < sectors && sectorHoldsChunk(eraseNext)) {
+      eraseNext++;
+    }
+    if (eraseNext < sectors) {
+      if (!store.erase(eraseNext * FW_SECTOR_BYTES)) {
+        current = FW_STATE_FLASH_ERROR;
+        return false;
+      }
+      eraseNext++;
+      return true;
+    }
+    current = heldCount == chunkCount ? FW_STATE_COMPLETE : FW_STATE_RECEIVING;
+    return false;
+  }
+
+  void status(uint16_t window, FwStatusPacket &out) const {
+    memset(&out, 0, sizeof(out));
+    out.type = PKT_FW_STATUS;
+    out.panelId = panelId;
+    out.imageId = offer.imageId;
+    out.state = current;
+    out.held = heldCount;
+    out.window = window;
+    for (uint16_t i = 0; i < FW_WINDOW_CHUNKS; i++) {
+      uint32_t chunk = (uint32_t)window + i;
+      if (chunk < chunkCount && !fwBit(bits, chunk)) {
+        fwSetBit(out.missing, i);
+      }
+    }
+  }
+
+private:
+  uint8_t panelId = 0;
+  uint8_t current = FW_STATE_IDLE;
+  FwOfferPacket offer = {};
+  uint16_t chunkCount = 0;
+  uint16_t heldCount = 0;
+  uint16_t unsaved = 0; // chunks written since the last save
+  uint32_t eraseNext = 0;
+  uint32_t restartAt = 0;
+  uint8_t installed[32];
+  bool hasInstalled = false;
+  uint8_t bits[FW_BITMAP_BYTES]; // chunks held
+
+  size_t bitmapBytes() const { return (chunkCount + 7) / 8; }
+
+  // A sector with a held chunk in it was erased for this image already
+  bool sectorHoldsChunk(uint32_t sector) const {
+    uint32_t first = sector * FW_SECTOR_BYTES / FW_CHUNK_BYTES;
+    uint32_t last = ((sector + 1) * FW_SECTOR_BYTES - 1) / FW_CHUNK_BYTES;
+    for (uint32_t i = first; i <= last && i < chunkCount; i++) {
+      if (fwBit(bits, i))
+        return true;
+    }
+    return false;
+  }
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef PANEL_FIRMWARE_STORE_H
+#define PANEL_FIRMWARE_STORE_H
+
+#include "firmware.h"
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+
+// ============================================================================
+// OTA SLOT AND NVS, FOR THE FIRMWARE RECEIVER
+// ============================================================================
+//
+// The image goes into whichever OTA slot we are not running from. Progress
+// (image ID, size, bitmap of chunks held) and the hash of the last image
+// installed are kept in NVS, so a panel that resets mid-rollout resumes and
+// one already running an image says so instead of taking it again.
+//
+// activate() only notes the hash as pending, with the slot it went into.
+// It becomes the installed hash at the next boot if that is the slot
+// running, so an image that never starts (or is rolled back) can be
+// offered again.
+
+#define FW_NVS_NAMESPACE "fw"
+
+class PartitionStore {
+public:
+  uint32_t capacity() {
+    const esp_partition_t *slot = partition();
+    return slot ? slot->size : 0;
+  }
+
+  bool erase(uint32_t offset) {
+    const esp_partition_t *slot = partition();
+    return slot &&
+           esp_partition_erase_range(slot, offset, FW_SECTOR_BYTES) == ESP_OK;
+  }
+
+  bool write(uint32_t offset, const uint8_t *data, size_t len) {
+    const esp_partition_t *slot = partition();
+    return slot && esp_partition_write(slot, offset, data, len) == ESP_OK;
+  }
+
+  bool read(uint32_t offset, uint8_t *data, size_t len) {
+    const esp_partition_t *slot = partition();
+    return slot && esp_partition_read(slot, offset, data, len) == ESP_OK;
+  }
+
+  bool loadProgress(uint32_t &imageId, uint32_t &size, uint8_t *held,
+                    size_t bytes) {
+    Preferences prefs;
+    if (!prefs.begin(FW_NVS_NAMESPACE, true))
+      return false;
+    imageId = prefs.getUInt("image", 0);
+    size = prefs.getUInt("size", 0);
+    bool ok = imageId != 0 && prefs.getBytesLength("held") == bytes &&
+              prefs.getBytes("held", held, bytes) == bytes;
+    prefs.end();
+    return ok;
+  }
+
+  void saveProgress(uint32_t imageId, uint32_t size, const uint8_t *held,
+                    size_t bytes) {
+    Preferences prefs;
+    if (prefs.begin(FW_NVS_NAMESPACE, false)) {
+      prefs.putUInt("image", imageId);
+      prefs.putUInt("size", size);
+      prefs.putBytes("held", held, bytes);
+      prefs.end();
+    }
+  }
+
+  // At boot, before any offer
+  bool loadInstalled(uint8_t *sha256) {
+    Preferences prefs;
+    if (!prefs.begin(FW_NVS_NAMESPACE, false))
+      return false;
+    if (prefs.isKey("pending")) {
+      uint8_t pending[32];
+      const esp_partition_t *running = esp_ota_get_running_partition();
+      if (running && running->address == prefs.getUInt("pendslot", 0) &&
+          prefs.getBytes("pending", pending, 32) == 32) {
+        prefs.putBytes("installed", pending, 32);
+      }
+      prefs.remove("pending");
+      prefs.remove("pendslot");
+    }
+    bool ok = prefs.getBytes("installed", sha256, 32) == 32;
+    prefs.end();
+    return ok;
+  }
+
+  // Checks the image header as well, then boots from the slot next reset
+  bool activate(const uint8_t *sha256, uint32_t size) {
+    const esp_partition_t *slot = partition();
+    if (!slot || size > slot->size ||
+        esp_ota_set_boot_partition(slot) != ESP_OK)
+      return false;
+    Preferences prefs;
+    if (prefs.begin(FW_NVS_NAMESPACE, false)) {
+      prefs.putBytes("pending", sha256, 32);
+      prefs.putUInt("pendslot", slot->address);
+      prefs.remove("held");
+      prefs.end();
+    }
+    return true;
+  }
+
+private:
+  const esp_partition_t *slot = nullptr;
+
+  const esp_partition_t *partition() {
+    if (!slot) {
+      slot = esp_ota_get_next_update_partition(nullptr);
+    }
+    return slot;
+  }
+};
+
+typedef FirmwareReceiver<PartitionStore> PanelFirmware;
+
+#endif
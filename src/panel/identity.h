@@ -0,0 +1,183 @@
+#ifndef PANEL_IDENTITY_H
+#define PANEL_IDENTITY_H
+
+#include "config.h"
+#include "effects.h"
+#include "link_protocol.h"
+#include "provision_protocol.h"
+#include <Preferences.h>
+
+// ============================================================================
+// PANEL IDENTITY
+// ============================================================================
+//
+// One image for every panel: which panel this is and which regions it
+// drives on which pins live in NVS, written by PROVISION from the master
+// (provision_protocol.h) or by "id" / "map" on the panel's console. setup()
+// calls load() before anything else and the region table is built once, in
+// RAM; lookups are array reads with a bounds check, as the PROGMEM tables
+// were. A new identity takes effect on the next boot, since the MAC, the
+// LEDC channels and the compositor are all set up from it.
+//
+// With only an ID stored the panel takes its slice of ALL_REGIONS from
+// STAGE_LAYOUT, which is how every panel of the current stage is set up.
+// A panel with no ID drives nothing and answers nothing but PROVISION; it
+// announces as panel 0 from its factory MAC so the master can name it.
+
+#define IDENTITY_NVS_NAMESPACE "panel"
+
+static_assert(PROVISION_MAX_REGIONS <= MAX_PANEL_REGIONS,
+              "more regions than the effect engine holds");
+
+class PanelIdentity {
+public:
+  // False when no valid identity is stored
+  bool load() {
+    uint8_t id = 0;
+    uint16_t first = 0;
+    uint8_t count = 0;
+    ProvisionRegion map[PROVISION_MAX_REGIONS];
+    Preferences prefs;
+    if (prefs.begin(IDENTITY_NVS_NAMESPACE, true)) {
+      id = prefs.getUChar("id", 0);
+      size_t bytes = prefs.isKey("map") ? prefs.getBytesLength("map") : 0;
+      if (bytes % sizeof(ProvisionRegion) == 0 && bytes <= sizeof(map)) {
+        count = bytes / sizeof(ProvisionRegion);
+        first = prefs.getUShort("first", 0);
+        if (count) {
+          prefs.getBytes("map", map, bytes);
+        }
+      }
+      prefs.end();
+    }
+    if (!valid(id, first, count, map)) {
+      build(0, 0, 0, map);
+      return false;
+    }
+    build(id, first, count, map);
+    return true;
+  }
+
+  // Stores a new identity for the next boot. count 0 = STAGE_LAYOUT.
+  ProvisionStatusCode save(uint8_t id, uint16_t first, uint8_t count,
+                           const ProvisionRegion *map) {
+    if (!valid(id, first, count, map))
+      return PROVISION_INVALID;
+    if (id == storedId && count == storedCount &&
+        (count == 0 || (first == storedFirst &&
+                        memcmp(map, storedMap, count * sizeof(*map)) == 0)))
+      return PROVISION_UNCHANGED;
+
+    Preferences prefs;
+    if (!prefs.begin(IDENTITY_NVS_NAMESPACE, false))
+      return PROVISION_FLASH_ERROR;
+    bool ok = prefs.putUChar("id", id) == 1;
+    if (count) {
+      ok = ok && prefs.putUShort("first", first) == 2 &&
+           prefs.putBytes("map", map, count * sizeof(*map)) ==
+               count * sizeof(*map);
+    } else if (prefs.isKey("map")) {
+      prefs.remove("map");
+    }
+    prefs.end();
+    if (!ok)
+      return PROVISION_FLASH_ERROR;
+    storedId = id;
+    storedFirst = first;
+    storedCount = count;
+    memcpy(storedMap, map, count * sizeof(*map));
+    return PROVISION_STORED;
+  }
+
+  static bool valid(uint8_t id, uint16_t first, uint8_t count,
+                    const ProvisionRegion *map) {
+    if (id < 1 || id > MAX_PANELS)
+      return false;
+    if (count == 0)
+      return id <= STAGE_PANELS;
+    if (count > PROVISION_MAX_REGIONS || first + count > MAX_REGIONS)
+      return false;
+    for (uint8_t r = 0; r < count; r++) {
+      if (!outputPin(map[r].pin))
+        return false;
+    }
+    return true;
+  }
+
+  // GPIO 6-11 are the flash; 34 and up are inputs only
+  static bool outputPin(uint8_t pin) {
+    return pin < 34 && (pin < 6 || pin > 11);
+  }
+
+  uint8_t id() const { return panel; }
+  bool provisioned() const { return panel != 0; }
+  bool customMap() const { return storedCount != 0; }
+  uint8_t count() const { return regionCount; }
+  uint16_t firstRegion() const { return regionCount ? table[0].globalIndex : 0; }
+  const RegionInfo *regions() const { return table; }
+
+  const char *regionName(uint8_t index) const {
+    return index < regionCount ? table[index].name : "INVALID";
+  }
+  uint8_t regionPin(uint8_t index) const {
+    return index < regionCount ? table[index].pin : 0;
+  }
+  uint8_t regionVerticalPos(uint8_t index) const {
+    return index < regionCount ? table[index].verticalPos : 0xFF;
+  }
+  uint16_t regionGroups(uint8_t index) const {
+    return index < regionCount ? table[index].groups : GROUP_NONE;
+  }
+
+private:
+  uint8_t panel = 0;
+  uint8_t regionCount = 0;
+  RegionInfo table[PROVISION_MAX_REGIONS];
+
+  // As in NVS, for save() to tell a repeat from a change
+  uint8_t storedId = 0;
+  uint16_t storedFirst = 0;
+  uint8_t storedCount = 0;
+  ProvisionRegion storedMap[PROVISION_MAX_REGIONS];
+
+  void build(uint8_t id, uint16_t first, uint8_t count,
+             const ProvisionRegion *map) {
+    panel = storedId = id;
+    storedFirst = first;
+    storedCount = count;
+    memcpy(storedMap, map, count * sizeof(*map));
+    regionCount = 0;
+    if (!id)
+      return;
+
+    if (count == 0) {
+      const PanelLayout &layout = STAGE_LAYOUT[id - 1];
+      uint16_t base = pgm_read_word(&layout.firstRegion);
+      regionCount = pgm_read_word(&layout.regionCount);
+      for (uint8_t r = 0; r < regionCount; r++) {
+        const RegionInfo &g = ALL_REGIONS[base + r];
+        table[r] = {pgm_read_word(&g.globalIndex), pgm_read_byte(&g.pin),
+                    (const char *)pgm_read_ptr(&g.name),
+                    pgm_read_byte(&g.verticalPos), pgm_read_word(&g.groups)};
+      }
+      return;
+    }
+
+    regionCount = count;
+    for (uint8_t r = 0; r < count; r++) {
+      uint16_t global = first + r;
+      table[r] = {global, map[r].pin,
+                  global < STAGE_REGIONS
+                      ? (const char *)pgm_read_ptr(&ALL_REGIONS[global].name)
+                      : "REGION",
+                  map[r].verticalPos, map[r].groups};
+    }
+  }
+};
+
+inline PanelIdentity &panelIdentity() {
+  static PanelIdentity identity;
+  return identity;
+}
+
+#endif
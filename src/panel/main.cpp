@@ -1,25 +1,109 @@
+#include "audio_protocol.h"
+#include "compositor.h"
 #include "config.h"
+#include "cue_protocol.h"
+#include "cues.h"
+#include "firmware_store.h"
+#include "identity.h"
+#include "lease_protocol.h"
+#include "light_protocol.h"
+#include "link_protocol.h"
+#include "output.h"
+#include "priority_protocol.h"
+#include "programs.h"
+#include "provision_protocol.h"
+#include "rendezvous.h"
+#include "scene_store.h"
+#include "spsc_queue.h"
+#include "tempo.h"
 #include <WiFi.h>
 #include <esp_now.h>
 #include <esp_wifi.h>
 
-#ifndef PANEL_ID
-#define PANEL_ID 1
-#endif
-
-uint8_t pwmChannels[MAX_REGIONS];
-
-void initPWMChannels() {
-  for (int i = 0; i < MAX_REGIONS; i++) {
-    pwmChannels[i] = i;
-  }
-}
-
-#define PWM_FREQ 5000
-#define PWM_RESOLUTION 8
-
-LightCommand currentState;
-uint8_t lastEffect = EFFECT_STATIC;
+// Who this panel is and which regions it drives; from NVS at boot
+PanelIdentity &identity = panelIdentity();
+uint8_t factoryMac[6];
+
+PanelOutput output;
+Framebuffer framebuffer;
+Compositor compositor;
+
+// Live commands are handed from the receive callback to loop(), which is
+// the only writer of the compositor. A queue rather than one slot, so an
+// overlay sent right after a base command is not overwritten by it. One the
+// master asked us to confirm carries the LIGHT_ACK to send once applied.
+struct PendingCommand {
+  LightCommand cmd;
+  bool ack;
+  uint8_t master[6];
+  LightAckPacket ackPacket;
+};
+SpscQueue<PendingCommand, 4> pendingCommands;
+
+// Master beacons carry the tempo clock; loop() steers ours onto it, since
+// effects read the clock from there.
+struct TempoSync {
+  BeaconPacket beacon;
+  uint32_t receivedAt;
+};
+SpscQueue<TempoSync, 2> tempoSyncs;
+
+PanelCueList cueList;
+PanelPrograms programs;
+
+// Firmware packets go to loop() as they arrived; it owns the flash writes.
+// A chunk dropped on a full queue is sent again in the next round.
+struct FirmwareRx {
+  uint8_t len;
+  uint8_t master[6];
+  uint8_t data[sizeof(FwChunkPacket)];
+};
+SpscQueue<FirmwareRx, 16> firmwarePackets;
+PanelFirmware firmware;
+volatile uint32_t firmwareDrops = 0;
+
+// PROVISION packets, for loop() to check and store. A stored identity
+// takes effect after a restart.
+struct ProvisionRx {
+  uint8_t len;
+  uint8_t master[6];
+  ProvisionPacket pkt;
+};
+SpscQueue<ProvisionRx, 2> provisionRequests;
+#define PROVISION_RESTART_DELAY_MS 500 // so the status reaches the master
+uint32_t provisionRestartAt = 0;
+
+AudioFollower audio;
+LightFrameAssembler lightFrames; // set up for our regions in setup()
+SceneStore scene;
+ChannelRendezvous rendezvous;
+
+// The master we take commands from: whichever holds the lease, so a standby
+// master can take over (lease_protocol.h). Receive callback only.
+MasterLease lease;
+uint32_t reportedLeaseChanges = 0; // loop()
+
+// Blackout/hold latch. Kept in RTC memory as well, so a panel that resets
+// during a blackout comes back dark instead of restoring its scene.
+PriorityLatch priority;
+TaskHandle_t loopTaskHandle = nullptr;
+#define PRIORITY_RTC_MAGIC 0x50524900UL // "PRI" + state
+RTC_NOINIT_ATTR static uint32_t rtcPriority;
+uint32_t priorityChanges = 0;
+uint32_t priorityApplyMaxUs = 0; // packet received to output flushed
+
+// Boot milestones in ms since reset, 0 until reached. The scene goes up
+// before the radio so a panel that browns out mid-show is lit again long
+// before it hears from the master.
+esp_reset_reason_t resetReason;
+uint32_t bootSceneMs = 0;
+uint32_t bootBeaconMs = 0;
+volatile uint32_t bootCommandMs = 0;
+
+// Discovery: announce at boot, as a keep-alive, and whenever the master's
+// beacon does not list us (e.g. after the master rebooted).
+volatile bool announceRequested = true;
+unsigned long lastAnnounce = 0;
 
 unsigned long lastCommandReceived = 0;
 unsigned long lastEffectUpdate = 0;
@@ -28,346 +112,848 @@ unsigned long lastHeartbeat = 0;
 const unsigned long COMMAND_TIMEOUT = 300000;
 const unsigned long HEARTBEAT_INTERVAL = 60000;
 
-void setRegionBrightness(uint8_t region, uint8_t brightness) {
-  if (region < NUM_REGIONS) {
-    ledcWrite(pwmChannels[region], brightness);
+void executeEffect() {
+  lastEffectUpdate = millis();
+  if (priority.current() == PRIORITY_HOLD) {
+    return; // the output keeps the frame it has
+  }
+  compositor.render(lastEffectUpdate, framebuffer);
+  if (priority.current() == PRIORITY_BLACKOUT) {
+    for (uint8_t r = 0; r < identity.count(); r++) {
+      framebuffer.set(r, 0);
+    }
+  }
+
+  // Music scales the finished frame, whatever the layers drew
+  uint8_t gain = audio.gain(lastEffectUpdate);
+  if (gain != 255) {
+    for (uint8_t r = 0; r < identity.count(); r++) {
+      framebuffer.set(r, framebuffer.level[r] * gain / 255);
+    }
   }
-}
 
-void resetEffectStates() {
-  for (int r = 0; r < NUM_REGIONS; r++) {
-    setRegionBrightness(r, 0);
+  if (framebuffer.dirty && output.flush(framebuffer, lastEffectUpdate)) {
+    framebuffer.dirty = false;
   }
 }
 
-void effect_static() {
-  for (int r = 0; r < NUM_REGIONS; r++) {
-    if (currentState.regions[r]) {
-      setRegionBrightness(r, currentState.brightness);
-    } else {
-      setRegionBrightness(r, 0);
+void checkCommandTimeout() {
+  if (lastCommandReceived > 0) {
+    unsigned long timeSinceLastCommand = millis() - lastCommandReceived;
+    if (timeSinceLastCommand > COMMAND_TIMEOUT) {
+      Serial.println("⚠ No commands received for 5 minutes");
+      Serial.println("Master may be offline or communication lost");
+      lastCommandReceived = millis();
     }
   }
 }
 
-void effect_breathing() {
-  static unsigned long lastUpdate = 0;
-  static uint8_t breatheBrightness = 0;
-  static int8_t direction = 1;
+void printHeartbeat() {
+  if (!identity.provisioned()) {
+    Serial.print("⚠ Panel not provisioned (factory MAC ");
+    Serial.print(WiFi.macAddress());
+    Serial.print(") | Uptime: ");
+    Serial.print(millis() / 1000);
+    Serial.println("s | Set an ID with \"id N\" or from the master");
+    return;
+  }
+  Serial.print("✓ Panel ");
+  Serial.print(identity.id());
+  Serial.print(" (");
+  Serial.print(identity.count());
+  Serial.print(" regions) | Uptime: ");
+  Serial.print(millis() / 1000);
+  Serial.print("s | Effect: ");
+  Serial.print(compositor.base().state.effect);
+  Serial.print(" | Brightness: ");
+  Serial.print(compositor.base().state.brightness);
+  Serial.print(" | Speed: ");
+  Serial.print(compositor.base().state.speed);
+  Serial.print(" | Layers: ");
+  Serial.print(compositor.activeLayers());
+  Serial.print(" | Loops: ");
+  Serial.print(loopCounter);
+  Serial.print(" | Heap: ");
+  Serial.print(ESP.getFreeHeap());
 
-  unsigned long currentMillis = millis();
-  uint16_t updateInterval = map(currentState.speed, 0, 100, 50, 5);
+  if (lastCommandReceived > 0) {
+    Serial.print(" | Last cmd: ");
+    Serial.print((millis() - lastCommandReceived) / 1000);
+    Serial.print("s ago");
+  }
 
-  if (currentMillis - lastUpdate >= updateInterval) {
-    lastUpdate = currentMillis;
+  if (cueList.count > 0) {
+    Serial.print(" | Show ");
+    Serial.print(cueList.showId);
+    Serial.print(cueList.playing() ? " cue " : " idle at cue ");
+    Serial.print(cueList.currentCue());
+  }
 
-    breatheBrightness += direction * 5;
+  if (compositor.programFaults() > 0) {
+    Serial.print(" | Program faults: ");
+    Serial.print(compositor.programFaults());
+  }
 
-    if (breatheBrightness >= 255) {
-      breatheBrightness = 255;
-      direction = -1;
-    } else if (breatheBrightness <= 0) {
-      breatheBrightness = 0;
-      direction = 1;
-    }
+  if (audio.active(millis())) {
+    Serial.print(" | Audio");
+  }
 
-    uint8_t scaledBrightness =
-        map(breatheBrightness, 0, 255, 0, currentState.brightness);
+  if (priority.current() != PRIORITY_RELEASE) {
+    Serial.print(" | ");
+    Serial.print(PRIORITY_NAMES[priority.current()]);
+  }
+  if (priorityChanges > 0) {
+    Serial.print(" | Priority max ");
+    Serial.print(priorityApplyMaxUs);
+    Serial.print("us");
+  }
 
-    for (int r = 0; r < NUM_REGIONS; r++) {
-      if (currentState.regions[r]) {
-        setRegionBrightness(r, scaledBrightness);
-      } else {
-        setRegionBrightness(r, 0);
-      }
+  Serial.print(" | Master term ");
+  Serial.print(lease.term());
+  if (lease.changes > 1) {
+    Serial.print(" (");
+    Serial.print(lease.changes - 1);
+    Serial.print(" takeovers)");
+  }
+  if (lease.rejected > 0) {
+    Serial.print(" | Ignored from other masters: ");
+    Serial.print(lease.rejected);
+  }
+
+  if (firmware.state() != FW_STATE_IDLE) {
+    Serial.print(" | Firmware ");
+    Serial.print(FW_STATE_NAMES[firmware.state()]);
+    Serial.print(" ");
+    Serial.print(firmware.held());
+    Serial.print("/");
+    Serial.print(firmware.chunks());
+    if (firmwareDrops > 0) {
+      Serial.print(" (");
+      Serial.print(firmwareDrops);
+      Serial.print(" dropped)");
     }
   }
-}
 
-void effect_wave() {
-  static unsigned long lastUpdate = 0;
-  static uint8_t activeRegion = 0;
+  Serial.print(" | Tempo ");
+  Serial.print(tempoClock().bpmX100() / 100.0f, 2);
 
-  unsigned long currentMillis = millis();
-  uint16_t updateInterval = map(currentState.speed, 0, 100, 1000, 100);
+  Serial.print(" | Ch ");
+  Serial.print(rendezvous.channel());
+  if (rendezvous.scanning()) {
+    Serial.print(" scanning");
+  }
+  if (rendezvous.recoveries > 0) {
+    Serial.print(" (found again ");
+    Serial.print(rendezvous.recoveries);
+    Serial.print("x, last ");
+    Serial.print(rendezvous.lastRecoveryMs);
+    Serial.print("ms, worst ");
+    Serial.print(rendezvous.worstRecoveryMs);
+    Serial.print("ms)");
+  }
 
-  if (currentMillis - lastUpdate >= updateInterval) {
-    lastUpdate = currentMillis;
+  Serial.print(" | Boot: ");
+  Serial.print(resetReasonName(resetReason));
+  Serial.print(", lit ");
+  Serial.print(bootSceneMs);
+  Serial.print("ms, beacon ");
+  if (bootBeaconMs) {
+    Serial.print(bootBeaconMs);
+    Serial.print("ms");
+  } else {
+    Serial.print("-");
+  }
+  Serial.print(", cmd ");
+  if (bootCommandMs) {
+    Serial.print(bootCommandMs);
+    Serial.print("ms");
+  } else {
+    Serial.print("-");
+  }
 
-    for (int r = 0; r < NUM_REGIONS; r++) {
-      setRegionBrightness(r, 0);
-    }
+  Serial.print(" | Active: ");
+  uint8_t activeCount = 0;
+  for (int i = 0; i < identity.count(); i++) {
+    if (compositor.base().regionActive(i))
+      activeCount++;
+  }
+  Serial.print(activeCount);
+  Serial.print("/");
+  Serial.println(identity.count());
 
-    if (currentState.regions[activeRegion]) {
-      setRegionBrightness(activeRegion, currentState.brightness);
-    }
+#if OUTPUT_DRIVER == OUTPUT_PIXEL
+  if (output.busySkips > 0) {
+    Serial.print("⚠ Pixel frames deferred while DMA busy: ");
+    Serial.println(output.busySkips);
+  }
+#elif OUTPUT_DRIVER == OUTPUT_CAPTURE
+  if (output.dropped > 0) {
+    Serial.print("⚠ Captured frames dropped: ");
+    Serial.println(output.dropped);
+  }
+#endif
+}
 
-    do {
-      activeRegion = (activeRegion + 1) % NUM_REGIONS;
-    } while (!currentState.regions[activeRegion] && activeRegion != 0);
+void printRegionConfig() {
+  Serial.print("\n=== Region Configuration (");
+  Serial.print(identity.customMap() ? "own map" : "stage layout");
+  Serial.println(") ===");
+  for (int i = 0; i < identity.count(); i++) {
+    Serial.print(i);
+    Serial.print(": ");
+    Serial.print(identity.regionName(i));
+    Serial.print(" (region ");
+    Serial.print(identity.firstRegion() + i);
+    Serial.print(", GPIO ");
+    Serial.print(identity.regionPin(i));
+    Serial.print(", Pos ");
+    Serial.print(identity.regionVerticalPos(i));
+    Serial.println(")");
   }
+  Serial.println("===========================\n");
 }
 
-void effect_pulse() {
-  static unsigned long lastUpdate = 0;
-  static uint8_t pulseBrightness = 0;
-  static bool increasing = true;
+void applyCommand(const LightCommand &cmd) {
+  if (compositor.apply(cmd, millis())) {
+    Serial.println("Effect type changed, restarting effect clock");
+  }
+  if (cmd.layer == 0 && cmd.blend != BLEND_REMOVE) {
+    scene.save(cmd, millis());
+  }
+}
 
-  unsigned long currentMillis = millis();
-  uint16_t updateInterval = map(currentState.speed, 0, 100, 30, 5);
+void noteFirstCommand() {
+  if (bootCommandMs == 0) {
+    bootCommandMs = millis();
+    Serial.print("✓ First command ");
+    Serial.print(bootCommandMs);
+    Serial.println("ms after reset");
+  }
+}
 
-  if (currentMillis - lastUpdate >= updateInterval) {
-    lastUpdate = currentMillis;
+void onLightCommand(const uint8_t *mac_addr, const uint8_t *data,
+                    int data_len) {
+  if (data_len < LIGHT_FRAME_HEADER || data_len > (int)sizeof(LightCommandFrame)) {
+    Serial.print("⚠ Bad light frame length ");
+    Serial.println(data_len);
+    return;
+  }
 
-    if (increasing) {
-      pulseBrightness += 10;
-      if (pulseBrightness >= 255) {
-        pulseBrightness = 255;
-        increasing = false;
-      }
-    } else {
-      if (pulseBrightness >= 10) {
-        pulseBrightness -= 10;
-      } else {
-        pulseBrightness = 0;
-        increasing = true;
-      }
-    }
+  uint8_t panelId = ((const LightCommandFrame *)data)->panelId;
+  if (panelId != 0 && panelId != identity.id()) {
+    Serial.print("Command ignored (for panel ");
+    Serial.print(panelId);
+    Serial.println(")");
+    return;
+  }
 
-    uint8_t scaledBrightness =
-        map(pulseBrightness, 0, 255, 0, currentState.brightness);
+  PendingCommand pending;
+  LightCommand &receivedCmd = pending.cmd;
+  if (!lightFrames.accept(data, data_len, receivedCmd))
+    return; // waiting for more frames, or a repeat
+  pending.ack = lightFrames.ackRequested();
+  memcpy(pending.master, mac_addr, 6);
+  pending.ackPacket = {PKT_LIGHT_ACK, identity.id(),
+                       lightFrames.lastCommandId()};
+
+  Serial.print("✓ Command accepted - Effect: ");
+  Serial.print(receivedCmd.effect);
+  Serial.print(" Brightness: ");
+  Serial.print(receivedCmd.brightness);
+  if (receivedCmd.layer != 0) {
+    Serial.print(" Layer: ");
+    Serial.print(receivedCmd.layer);
+  }
+  Serial.println();
 
-    for (int r = 0; r < NUM_REGIONS; r++) {
-      if (currentState.regions[r]) {
-        setRegionBrightness(r, scaledBrightness);
-      } else {
-        setRegionBrightness(r, 0);
-      }
-    }
+  if (!pendingCommands.push(pending)) {
+    Serial.println("⚠ Command queue full, dropped"); // and not confirmed
   }
+  lastCommandReceived = millis();
+  noteFirstCommand();
 }
 
-void effect_fade_in() {
-  static unsigned long lastUpdate = 0;
-  static uint8_t fadeBrightness = 0;
+void onDataRecv(const uint8_t *mac_addr, const uint8_t *data, int data_len) {
+  // Ahead of everything else, logging included
+  if (data_len == sizeof(PriorityPacket) && data[0] == PKT_PRIORITY) {
+    if (lease.accept(mac_addr) &&
+        priority.onPacket(*(const PriorityPacket *)data,
+                          esp_timer_get_time()) &&
+        loopTaskHandle) {
+      xTaskNotifyGive(loopTaskHandle);
+    }
+    return;
+  }
+
+  if (data_len < 1)
+    return;
 
-  unsigned long currentMillis = millis();
-  uint16_t updateInterval = map(currentState.speed, 0, 100, 50, 5);
+  // Only the lease holder is listened to. Other panels' announces and the
+  // show state meant for a standby master are not for us either.
+  if (data[0] == PKT_ANNOUNCE || data[0] == PKT_SHOW_STATE) {
+    return;
+  }
+  if (data[0] == PKT_BEACON) {
+    if (data_len != sizeof(BeaconPacket)) {
+      return;
+    }
+    uint32_t changes = lease.changes;
+    if (!lease.onBeacon(mac_addr, ((const BeaconPacket *)data)->term,
+                        millis())) {
+      return;
+    }
+    if (lease.changes != changes) {
+      lightFrames.reset(); // command IDs restart with the new master
+    }
+  } else if (!lease.accept(mac_addr)) {
+    return;
+  }
+  if (!identity.provisioned() && data[0] != PKT_BEACON &&
+      data[0] != PKT_PROVISION) {
+    return; // nothing is for a panel with no ID
+  }
+
+  char macStr[18];
+  snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X", mac_addr[0],
+           mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
 
-  if (currentMillis - lastUpdate >= updateInterval) {
-    lastUpdate = currentMillis;
+  if (data[0] != PKT_BEACON && data[0] != PKT_AUDIO &&
+      data[0] != PKT_FW_CHUNK) {
+    Serial.print("Received from: ");
+    Serial.println(macStr);
+  }
 
-    if (fadeBrightness < currentState.brightness) {
-      fadeBrightness += 5;
-      if (fadeBrightness > currentState.brightness) {
-        fadeBrightness = currentState.brightness;
+  switch (data[0]) {
+  case PKT_LIGHT_COMMAND:
+    onLightCommand(mac_addr, data, data_len);
+    break;
+  case PKT_CUE_BEGIN:
+    if (data_len == sizeof(CueBeginPacket) &&
+        ((const CueBeginPacket *)data)->panelId == identity.id()) {
+      cueList.onBegin(*(const CueBeginPacket *)data);
+    }
+    break;
+  case PKT_CUE_CHUNK:
+    if (data_len >= (int)offsetof(CueChunkPacket, cues) &&
+        ((const CueChunkPacket *)data)->panelId == identity.id()) {
+      CueChunkPacket pkt;
+      memcpy(&pkt, data, min((size_t)data_len, sizeof(pkt)));
+      cueList.onChunk(pkt, data_len);
+    }
+    break;
+  case PKT_CUE_COMMIT:
+    if (data_len == sizeof(CueCommitPacket) &&
+        ((const CueCommitPacket *)data)->panelId == identity.id()) {
+      cueList.onCommit(*(const CueCommitPacket *)data, mac_addr);
+    }
+    break;
+  case PKT_BEACON:
+    if (data_len == sizeof(BeaconPacket)) {
+      TempoSync sync;
+      memcpy(&sync.beacon, data, sizeof(BeaconPacket));
+      sync.receivedAt = millis();
+      tempoSyncs.push(sync); // full: the next beacon comes within a second
+      if (identity.provisioned() &&
+          !(sync.beacon.knownPanels & (1UL << (identity.id() - 1)))) {
+        announceRequested = true;
       }
     }
-
-    for (int r = 0; r < NUM_REGIONS; r++) {
-      if (currentState.regions[r]) {
-        setRegionBrightness(r, fadeBrightness);
-      } else {
-        setRegionBrightness(r, 0);
+    break;
+  case PKT_PROGRAM:
+    if (data_len >= (int)offsetof(ProgramPacket, code) &&
+        (((const ProgramPacket *)data)->panelId == 0 ||
+         ((const ProgramPacket *)data)->panelId == identity.id())) {
+      programs.onPacket(data, data_len, mac_addr);
+    }
+    break;
+  case PKT_AUDIO:
+    if (data_len == sizeof(AudioPacket)) {
+      audio.onPacket(*(const AudioPacket *)data, millis());
+    }
+    break;
+  case PKT_CUE_GO:
+    if (data_len == sizeof(CueGoPacket)) {
+      cueList.onGo(*(const CueGoPacket *)data, millis());
+      lastCommandReceived = millis();
+      noteFirstCommand();
+    }
+    break;
+  case PKT_RATE_PROBE:
+    break; // the master's rate sweep only needs the MAC-level ACK
+  case PKT_FW_OFFER:
+  case PKT_FW_CHUNK:
+  case PKT_FW_POLL:
+  case PKT_FW_COMMIT:
+    if (data_len <= (int)sizeof(FwChunkPacket)) {
+      FirmwareRx rx;
+      rx.len = data_len;
+      memcpy(rx.master, mac_addr, 6);
+      memcpy(rx.data, data, data_len);
+      if (!firmwarePackets.push(rx)) {
+        firmwareDrops++;
       }
     }
+    break;
+  case PKT_PROVISION:
+    if (data_len >= (int)offsetof(ProvisionPacket, regions) &&
+        data_len <= (int)sizeof(ProvisionPacket)) {
+      ProvisionRx rx = {};
+      rx.len = data_len;
+      memcpy(rx.master, mac_addr, 6);
+      memcpy(&rx.pkt, data, data_len);
+      provisionRequests.push(rx); // full: the master repeats it
+    }
+    break;
+  default:
+    Serial.print("⚠ Unknown packet type 0x");
+    Serial.println(data[0], HEX);
   }
 }
 
-void effect_fade_out() {
-  static unsigned long lastUpdate = 0;
-  static uint8_t fadeBrightness = 255;
+void sendToMaster(const uint8_t *mac, const uint8_t *data, size_t len) {
+  if (!esp_now_is_peer_exist(mac)) {
+    esp_now_peer_info_t peerInfo = {};
+    memcpy(peerInfo.peer_addr, mac, 6);
+    peerInfo.channel = 0;
+    peerInfo.encrypt = false;
+    peerInfo.ifidx = WIFI_IF_STA;
+    esp_now_add_peer(&peerInfo);
+  }
+  esp_now_send(mac, data, len);
+}
 
-  unsigned long currentMillis = millis();
-  uint16_t updateInterval = map(currentState.speed, 0, 100, 50, 5);
+void cueTick() {
+  CueStatusPacket status;
+  uint8_t master[6];
+  if (cueList.pollCommit(status, master)) {
+    Serial.print(status.status == CUE_STATUS_STORED ? "✓ Stored show "
+                                                    : "✗ Rejected show ");
+    Serial.print(status.showId);
+    Serial.print(" (");
+    Serial.print(status.cueCount);
+    Serial.print(" cues, status ");
+    Serial.print(status.status);
+    Serial.println(")");
+    sendToMaster(master, (const uint8_t *)&status, sizeof(status));
+  }
 
-  if (currentMillis - lastUpdate >= updateInterval) {
-    lastUpdate = currentMillis;
+  LightCommand cueCmd;
+  if (cueList.tick(millis(), cueCmd)) {
+    Serial.print("▶ Cue ");
+    Serial.println(cueList.currentCue());
+    applyCommand(cueCmd);
+  }
+}
 
-    if (fadeBrightness > 0) {
-      if (fadeBrightness >= 5) {
-        fadeBrightness -= 5;
-      } else {
-        fadeBrightness = 0;
-      }
+void programTick() {
+  ProgramStatusPacket status;
+  uint8_t master[6];
+  if (programs.poll(status, master)) {
+    Serial.print(status.status == PROGRAM_STATUS_STORED ? "✓ Stored program "
+                                                        : "✗ Rejected program ");
+    Serial.print(status.slot);
+    Serial.print(" (status ");
+    Serial.print(status.status);
+    if (status.errorAt >= 0) {
+      Serial.print(", byte ");
+      Serial.print(status.errorAt);
     }
+    Serial.println(")");
+    sendToMaster(master, (const uint8_t *)&status, sizeof(status));
+  }
+}
 
-    for (int r = 0; r < NUM_REGIONS; r++) {
-      if (currentState.regions[r]) {
-        setRegionBrightness(r, fadeBrightness);
-      } else {
-        setRegionBrightness(r, 0);
+void firmwareTick() {
+  uint8_t before = firmware.state();
+  FirmwareRx rx;
+  while (firmwarePackets.pop(rx)) {
+    switch (rx.data[0]) {
+    case PKT_FW_OFFER:
+      if (rx.len == sizeof(FwOfferPacket)) {
+        firmware.onOffer(*(const FwOfferPacket *)rx.data);
       }
+      break;
+    case PKT_FW_CHUNK:
+      firmware.onChunk(*(const FwChunkPacket *)rx.data, rx.len);
+      break;
+    case PKT_FW_POLL:
+      if (rx.len == sizeof(FwPollPacket) &&
+          ((const FwPollPacket *)rx.data)->panelId == identity.id()) {
+        FwStatusPacket status;
+        firmware.status(((const FwPollPacket *)rx.data)->window, status);
+        sendToMaster(rx.master, (const uint8_t *)&status, sizeof(status));
+      }
+      break;
+    case PKT_FW_COMMIT:
+      if (rx.len == sizeof(FwCommitPacket)) {
+        firmware.onCommit(*(const FwCommitPacket *)rx.data, millis());
+      }
+      break;
     }
   }
+  firmware.tick();
+
+  if (firmware.state() != before) {
+    Serial.print(firmware.state() == FW_STATE_VERIFIED ? "✓ Firmware "
+                                                       : "Firmware ");
+    Serial.print(FW_STATE_NAMES[firmware.state()]);
+    Serial.print(" (image ");
+    Serial.print(firmware.imageId(), HEX);
+    Serial.print(", ");
+    Serial.print(firmware.held());
+    Serial.print("/");
+    Serial.print(firmware.chunks());
+    Serial.println(" chunks)");
+  }
+  if (firmware.restartDue(millis())) {
+    Serial.println("⚡ Restarting into the new firmware");
+    Serial.flush();
+    ESP.restart();
+  }
 }
 
-void executeEffect() {
-  lastEffectUpdate = millis();
+// Stores a new identity from PROVISION or the console. Returns the result;
+// on STORED the panel restarts shortly to take it up.
+ProvisionStatusCode provision(uint8_t id, uint16_t first, uint8_t count,
+                              const ProvisionRegion *map) {
+  ProvisionStatusCode result = identity.save(id, first, count, map);
+  Serial.print(result == PROVISION_STORED      ? "✓ Identity "
+               : result == PROVISION_UNCHANGED ? "Identity "
+                                               : "✗ Identity ");
+  Serial.print(PROVISION_STATUS_NAMES[result]);
+  if (result == PROVISION_STORED || result == PROVISION_UNCHANGED) {
+    Serial.print(": panel ");
+    Serial.print(id);
+    if (count) {
+      Serial.print(", regions ");
+      Serial.print(first);
+      Serial.print("-");
+      Serial.print(first + count - 1);
+    } else {
+      Serial.print(", stage layout");
+    }
+  }
+  Serial.println();
+  if (result == PROVISION_STORED) {
+    provisionRestartAt = millis() + PROVISION_RESTART_DELAY_MS;
+  }
+  return result;
+}
 
-  switch (currentState.effect) {
-  case EFFECT_STATIC:
-    effect_static();
-    break;
-  case EFFECT_BREATHING:
-    effect_breathing();
-    break;
-  case EFFECT_WAVE:
-    effect_wave();
-    break;
-  case EFFECT_PULSE:
-    effect_pulse();
-    break;
-  case EFFECT_FADE_IN:
-    effect_fade_in();
-    break;
-  case EFFECT_FADE_OUT:
-    effect_fade_out();
-    break;
-  default:
-    effect_static();
+void provisionTick() {
+  ProvisionRx rx;
+  while (provisionRequests.pop(rx)) {
+    const ProvisionPacket &pkt = rx.pkt;
+    uint8_t current[6];
+    esp_wifi_get_mac(WIFI_IF_STA, current);
+    if (memcmp(pkt.target, factoryMac, 6) != 0 &&
+        memcmp(pkt.target, current, 6) != 0)
+      continue; // for another panel
+    bool fits = rx.len >= (int)(offsetof(ProvisionPacket, regions) +
+                                pkt.regionCount * sizeof(ProvisionRegion));
+    ProvisionStatusPacket status = {PKT_PROVISION_STATUS, identity.id(), {},
+                                    PROVISION_INVALID};
+    memcpy(status.factoryMac, factoryMac, 6);
+    if (fits) {
+      status.status = provision(pkt.panelId, pkt.firstRegion,
+                                pkt.regionCount, pkt.regions);
+    }
+    sendToMaster(rx.master, (const uint8_t *)&status, sizeof(status));
+  }
+  if (provisionRestartAt && (int32_t)(millis() - provisionRestartAt) >= 0) {
+    Serial.println("⚡ Restarting with the new identity");
+    Serial.flush();
+    ESP.restart();
   }
 }
 
-void checkCommandTimeout() {
-  if (lastCommandReceived > 0) {
-    unsigned long timeSinceLastCommand = millis() - lastCommandReceived;
-    if (timeSinceLastCommand > COMMAND_TIMEOUT) {
-      Serial.println("⚠ No commands received for 5 minutes");
-      Serial.println("Master may be offline or communication lost");
-      lastCommandReceived = millis();
+// Line commands on the USB console, for setting a panel up on the bench:
+// "id" shows the identity, "id N" makes this panel N with the stage layout,
+// "map FIRST PIN[:POS[:GROUPS]] ..." gives it its own regions from FIRST
+// on, one PIN per region, and "map default" goes back to the stage layout.
+void pollSerialConsole() {
+  static char line[200];
+  static uint8_t lineLen = 0;
+
+  while (Serial.available()) {
+    char c = Serial.read();
+    if (c != '\n' && c != '\r') {
+      if (lineLen < sizeof(line) - 1) {
+        line[lineLen++] = c;
+      }
+      continue;
+    }
+    if (lineLen == 0)
+      continue;
+    line[lineLen] = '\0';
+    lineLen = 0;
+
+    if (strcmp(line, "id") == 0) {
+      Serial.print("Panel ");
+      Serial.print(identity.id());
+      Serial.print(identity.provisioned() ? "" : " (not provisioned)");
+      Serial.print(", factory MAC ");
+      char macStr[18];
+      snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
+               factoryMac[0], factoryMac[1], factoryMac[2], factoryMac[3],
+               factoryMac[4], factoryMac[5]);
+      Serial.println(macStr);
+      printRegionConfig();
+    } else if (strncmp(line, "id ", 3) == 0) {
+      provision(atoi(line + 3), 0, 0, nullptr);
+    } else if (strcmp(line, "map default") == 0) {
+      provision(identity.id(), 0, 0, nullptr);
+    } else if (strncmp(line, "map ", 4) == 0) {
+      ProvisionRegion map[PROVISION_MAX_REGIONS];
+      char *next = line + 4;
+      uint16_t first = strtoul(next, &next, 10);
+      uint8_t count = 0;
+      bool ok = true;
+      while (*next == ' ' && count < PROVISION_MAX_REGIONS) {
+        ProvisionRegion &r = map[count];
+        r.pin = strtoul(next, &next, 10);
+        r.verticalPos = *next == ':' ? strtoul(next + 1, &next, 10) : count;
+        r.groups = *next == ':' ? strtoul(next + 1, &next, 0) : GROUP_NONE;
+        ok = ok && (*next == ' ' || *next == '\0');
+        count++;
+      }
+      if (!ok || count == 0 || *next != '\0') {
+        Serial.println("✗ Usage: map FIRST PIN[:POS[:GROUPS]] ...");
+      } else {
+        provision(identity.id(), first, count, map);
+      }
+    } else {
+      Serial.print("Unknown command: ");
+      Serial.println(line);
     }
   }
 }
 
-void printHeartbeat() {
-  Serial.print("✓ Panel ");
-  Serial.print(PANEL_ID);
-  Serial.print(" (");
-  Serial.print(NUM_REGIONS);
-  Serial.print(" regions) | Uptime: ");
-  Serial.print(millis() / 1000);
-  Serial.print("s | Effect: ");
-  Serial.print(currentState.effect);
-  Serial.print(" | Brightness: ");
-  Serial.print(currentState.brightness);
-  Serial.print(" | Speed: ");
-  Serial.print(currentState.speed);
-  Serial.print(" | Loops: ");
-  Serial.print(loopCounter);
-  Serial.print(" | Heap: ");
-  Serial.print(ESP.getFreeHeap());
+void tempoTick() {
+  TempoSync sync;
+  while (tempoSyncs.pop(sync)) {
+    if (bootBeaconMs == 0) {
+      bootBeaconMs = sync.receivedAt;
+      Serial.print("✓ Master beacon ");
+      Serial.print(bootBeaconMs);
+      Serial.println("ms after reset");
+    }
+    priority.onBeacon(sync.beacon.priority, sync.receivedAt);
+    if (rendezvous.onBeacon(sync.receivedAt)) {
+      Serial.print("✓ Master found on channel ");
+      Serial.print(rendezvous.channel());
+      Serial.print(" after ");
+      Serial.print(rendezvous.lastRecoveryMs);
+      Serial.println("ms without beacons");
+    }
+    const BeaconPacket &b = sync.beacon;
+    uint64_t target = (uint64_t)b.beat * TEMPO_ONE_BEAT + b.beatFraction;
+    uint16_t before = tempoClock().bpmX100();
+    uint8_t beatsBefore = tempoClock().beatsPerBar();
+    tempoClock().follow(b.bpmX100, b.beatsPerBar, target, sync.receivedAt);
+    if (tempoClock().bpmX100() != before) {
+      Serial.print("Tempo ");
+      Serial.print(tempoClock().bpmX100() / 100.0f, 2);
+      Serial.println(" BPM");
+    }
+    if (tempoClock().bpmX100() != before ||
+        tempoClock().beatsPerBar() != beatsBefore) {
+      scene.saveTempo(millis());
+    }
+  }
 
-  if (lastCommandReceived > 0) {
-    Serial.print(" | Last cmd: ");
-    Serial.print((millis() - lastCommandReceived) / 1000);
-    Serial.print("s ago");
+  if (lease.changes != reportedLeaseChanges) {
+    reportedLeaseChanges = lease.changes;
+    const uint8_t *m = lease.holderMac();
+    char macStr[18];
+    snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X", m[0],
+             m[1], m[2], m[3], m[4], m[5]);
+    Serial.print("✓ Following master ");
+    Serial.print(macStr);
+    Serial.print(" (lease term ");
+    Serial.print(lease.term());
+    Serial.println(")");
   }
+}
 
-  Serial.print(" | Active: ");
-  uint8_t activeCount = 0;
-  for (int i = 0; i < NUM_REGIONS; i++) {
-    if (currentState.regions[i])
-      activeCount++;
+// Runs first in loop() and again right after tempoTick(), which can change
+// the latch from a beacon. A change goes to the output now, not next frame.
+void priorityTick() {
+  uint8_t action;
+  int64_t sinceUs;
+  if (!priority.take(action, sinceUs)) {
+    return;
   }
-  Serial.print(activeCount);
-  Serial.print("/");
-  Serial.println(NUM_REGIONS);
+  rtcPriority = PRIORITY_RTC_MAGIC | action;
+  if (action != PRIORITY_HOLD) {
+    executeEffect();
+  }
+  uint32_t tookUs = esp_timer_get_time() - sinceUs;
+  priorityChanges++;
+  if (tookUs > priorityApplyMaxUs) {
+    priorityApplyMaxUs = tookUs;
+  }
+  Serial.print("⚡ ");
+  Serial.print(PRIORITY_NAMES[action]);
+  Serial.print(" applied in ");
+  Serial.print(tookUs);
+  Serial.println("us");
 }
 
-void printRegionConfig() {
-  Serial.println("\n=== Region Configuration ===");
-  for (int i = 0; i < NUM_REGIONS; i++) {
-    Serial.print(i);
-    Serial.print(": ");
-    Serial.print(getRegionName(i));
-    Serial.print(" (GPIO ");
-    Serial.print(getRegionPin(i));
-    Serial.print(", Pos ");
-    Serial.print(getRegionVerticalPos(i));
-    Serial.println(")");
+void sceneTick() {
+  uint32_t failures = scene.failures;
+  scene.tick(millis());
+  if (scene.failures != failures) {
+    Serial.println("✗ Failed to save scene to flash");
   }
-  Serial.println("===========================\n");
 }
 
-void onDataRecv(const uint8_t *mac_addr, const uint8_t *data, int data_len) {
-  char macStr[18];
-  snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X", mac_addr[0],
-           mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
+void sendAnnounce(unsigned long now) {
+  announceRequested = false;
+  lastAnnounce = now;
 
-  Serial.print("Received from: ");
-  Serial.println(macStr);
+  AnnouncePacket pkt = {PKT_ANNOUNCE, identity.id(), identity.firstRegion(),
+                        identity.count(), (uint16_t)min(now / 1000, 0xFFFFUL)};
+  esp_now_send(broadcast_mac, (const uint8_t *)&pkt, sizeof(pkt));
+}
 
-  if (data_len == sizeof(LightCommand)) {
-    LightCommand receivedCmd;
-    memcpy(&receivedCmd, data, sizeof(LightCommand));
+void announceTick() {
+  unsigned long now = millis();
+  if (!announceRequested && now - lastAnnounce < ANNOUNCE_INTERVAL_MS)
+    return;
 
-    if (receivedCmd.panelId == 0 || receivedCmd.panelId == PANEL_ID) {
-      Serial.print("✓ Command accepted - Effect: ");
-      Serial.print(receivedCmd.effect);
-      Serial.print(" Brightness: ");
-      Serial.println(receivedCmd.brightness);
+  // Jitter so panels rebooting together don't collide
+  if (announceRequested && lastAnnounce != 0 &&
+      now - lastAnnounce < 100 + identity.id() * 20UL)
+    return;
 
-      if (receivedCmd.effect != lastEffect) {
-        Serial.println("Effect type changed, resetting effect states");
-        resetEffectStates();
-        lastEffect = receivedCmd.effect;
-      }
+  sendAnnounce(now);
+}
 
-      currentState = receivedCmd;
-      lastCommandReceived = millis();
-    } else {
-      Serial.print("Command ignored (for panel ");
-      Serial.print(receivedCmd.panelId);
-      Serial.println(")");
-    }
-  } else {
-    Serial.print("⚠ Size mismatch: expected ");
-    Serial.print(sizeof(LightCommand));
-    Serial.print(", got ");
-    Serial.println(data_len);
+void setRadioChannel(uint8_t channel) {
+  esp_wifi_set_promiscuous(true);
+  esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+  esp_wifi_set_promiscuous(false);
+}
+
+// Off the master's channel: hop and probe. The announce on each hop gets an
+// immediate beacon back if the master is there.
+void rendezvousTick() {
+  bool wasScanning = rendezvous.scanning();
+  uint8_t hop = rendezvous.tick(millis());
+  if (hop == 0) {
+    return;
+  }
+  if (!wasScanning) {
+    Serial.println("⚠ Master beacons lost, scanning channels");
   }
+  setRadioChannel(hop);
+  sendAnnounce(millis());
 }
 
 void setup() {
   Serial.begin(115200);
 
-  Serial.print("\n=== PANEL ");
-  Serial.print(PANEL_ID);
-  Serial.println(" ===");
+  // Before anything that depends on which panel this is
+  if (identity.load()) {
+    Serial.print("\n=== PANEL ");
+    Serial.print(identity.id());
+    Serial.println(" ===");
+  } else {
+    Serial.println("\n=== PANEL (not provisioned) ===");
+  }
+
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+  resetReason = esp_reset_reason();
+  Serial.print("Reset: ");
+  Serial.println(resetReasonName(resetReason));
+
+  // Lights first: the last scene is back on the output before WiFi starts
+  Serial.print("Output: ");
+  Serial.println(output.name());
+  if (!output.begin()) {
+    Serial.println("✗ Output driver init failed");
+  }
+
+  compositor.begin(identity.regions(), identity.count());
+  if (identity.count()) {
+    lightFrames.begin(identity.firstRegion(), identity.count());
+  }
+  if ((rtcPriority & ~0xFFUL) == PRIORITY_RTC_MAGIC) {
+    priority.restore(rtcPriority & 0xFF);
+    if (priority.current() != PRIORITY_RELEASE) {
+      Serial.print("⚠ Still in ");
+      Serial.print(PRIORITY_NAMES[priority.current()]);
+      Serial.println(" from before the reset");
+    }
+  }
+  LightCommand boot = {};
+  SceneSource sceneSource = scene.load(boot);
+  if (sceneSource == SCENE_NONE) {
+    boot.effect = EFFECT_STATIC;
+    boot.brightness = 128;
+    boot.speed = 50;
+    boot.regions.assignRange(identity.firstRegion(), identity.count(), true);
+  }
+  boot.transitionMs = 0; // straight up, no fade in from black
+  compositor.apply(boot, millis());
+  executeEffect();
+  bootSceneMs = millis();
+  if (sceneSource != SCENE_NONE) {
+    Serial.print("✓ Restored last scene from ");
+    Serial.print(SCENE_SOURCE_NAMES[sceneSource]);
+    Serial.print(" (effect ");
+    Serial.print(boot.effect);
+    Serial.print(") ");
+  } else {
+    Serial.print("No saved scene, default look ");
+  }
+  Serial.print(bootSceneMs);
+  Serial.println("ms after reset");
 
   WiFi.mode(WIFI_STA);
+  // Long range next to b/g/n, in case the master picks an LR rate
+  esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G |
+                                         WIFI_PROTOCOL_11N | WIFI_PROTOCOL_LR);
 
   Serial.print("Factory MAC: ");
   Serial.println(WiFi.macAddress());
+  esp_read_mac(factoryMac, ESP_MAC_WIFI_STA);
 
-  uint8_t customMAC[6] = {0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0x00};
-  customMAC[5] = PANEL_ID;
+  // Unprovisioned panels keep the factory MAC, so the master can tell them
+  // apart when it provisions them
+  if (identity.provisioned()) {
+    uint8_t customMAC[6] = {0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0x00};
+    customMAC[5] = identity.id();
 
-  esp_err_t err = esp_wifi_set_mac(WIFI_IF_STA, customMAC);
-  if (err == ESP_OK) {
-    Serial.println("✓ Custom MAC address set");
+    esp_err_t err = esp_wifi_set_mac(WIFI_IF_STA, customMAC);
+    if (err == ESP_OK) {
+      Serial.println("✓ Custom MAC address set");
+    } else {
+      Serial.println("✗ Failed to set custom MAC address");
+    }
+
+    Serial.print("Custom MAC: ");
+    Serial.println(WiFi.macAddress());
   } else {
-    Serial.println("✗ Failed to set custom MAC address");
+    Serial.println("⚠ No panel ID in flash; waiting to be provisioned");
   }
 
-  Serial.print("Custom MAC: ");
-  Serial.println(WiFi.macAddress());
-
   WiFi.disconnect();
 
-  esp_wifi_set_promiscuous(true);
-  esp_wifi_set_channel(ESPNOW_WIFI_CHANNEL, WIFI_SECOND_CHAN_NONE);
-  esp_wifi_set_promiscuous(false);
+  // Start where the master was last heard; rendezvousTick() finds it if not
+  uint8_t channel = rendezvous.load();
+  setRadioChannel(channel);
+  rendezvous.begin(channel, millis());
 
   int8_t actual_channel = WiFi.channel();
   Serial.print("WiFi Channel: ");
   Serial.println(actual_channel);
 
-  if (actual_channel != ESPNOW_WIFI_CHANNEL) {
+  if (actual_channel != channel) {
     Serial.println("✗ WiFi channel mismatch!");
     Serial.print("Expected: ");
-    Serial.print(ESPNOW_WIFI_CHANNEL);
+    Serial.print(channel);
     Serial.print(", Got: ");
     Serial.println(actual_channel);
   } else {
@@ -381,30 +967,67 @@ void setup() {
 
   esp_now_register_recv_cb(onDataRecv);
 
-  initPWMChannels();
+  esp_now_peer_info_t broadcastPeer = {};
+  memcpy(broadcastPeer.peer_addr, broadcast_mac, 6);
+  broadcastPeer.channel = 0;
+  broadcastPeer.encrypt = false;
+  broadcastPeer.ifidx = WIFI_IF_STA;
+  if (esp_now_add_peer(&broadcastPeer) != ESP_OK) {
+    Serial.println("✗ Failed to add broadcast peer");
+  }
 
-  for (int i = 0; i < NUM_REGIONS; i++) {
-    uint8_t pin = getRegionPin(i);
-    ledcSetup(pwmChannels[i], PWM_FREQ, PWM_RESOLUTION);
-    ledcAttachPin(pin, pwmChannels[i]);
-    setRegionBrightness(i, 0);
+  printRegionConfig();
+
+  uint8_t storedPrograms = programs.load();
+  if (storedPrograms > 0) {
+    Serial.print("✓ Loaded ");
+    Serial.print(storedPrograms);
+    Serial.println(" effect programs from flash");
   }
 
-  currentState.effect = EFFECT_STATIC;
-  currentState.brightness = 128;
-  currentState.speed = 50;
-  lastEffect = EFFECT_STATIC;
+  firmware.begin(identity.id());
 
-  for (int i = 0; i < MAX_REGIONS; i++) {
-    currentState.regions[i] = (i < NUM_REGIONS);
+  if (cueList.load()) {
+    Serial.print("✓ Loaded show ");
+    Serial.print(cueList.showId);
+    Serial.print(" (");
+    Serial.print(cueList.count);
+    Serial.println(" cues) from flash");
   }
 
-  printRegionConfig();
   Serial.println("✓ Ready to receive commands");
 }
 
 void loop() {
+  priorityTick();
+  PendingCommand pending;
+  while (pendingCommands.pop(pending)) {
+    // A live base command overrides cue playback; overlays play on top
+    const LightCommand &cmd = pending.cmd;
+    if (cmd.layer == 0 && cmd.blend != BLEND_REMOVE) {
+      cueList.stop();
+    }
+    applyCommand(cmd);
+    if (pending.ack) {
+      sendToMaster(pending.master, (const uint8_t *)&pending.ackPacket,
+                   sizeof(pending.ackPacket));
+    }
+  }
+  tempoTick();
+  priorityTick();
+  cueTick();
+  programTick();
+  firmwareTick();
+  provisionTick();
+  pollSerialConsole();
+  rendezvousTick();
+  announceTick();
+  sceneTick();
+
   executeEffect();
+#if OUTPUT_DRIVER == OUTPUT_CAPTURE
+  output.drain(Serial);
+#endif
   loopCounter++;
 
   unsigned long currentMillis = millis();
@@ -416,5 +1039,6 @@ void loop() {
 
   checkCommandTimeout();
 
-  delay(10);
+  // Like delay(10), but a PRIORITY packet ends the wait
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
 }
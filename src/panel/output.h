@@ -0,0 +1,281 @@
+#ifndef PANEL_OUTPUT_H
+#define PANEL_OUTPUT_H
+
+#include "config.h"
+#include "effects.h"
+#include "identity.h"
+
+// ============================================================================
+// OUTPUT DRIVERS
+// ============================================================================
+//
+// Effects render into a Framebuffer (effects.h). Once per loop
+// the panel hands the framebuffer to the output driver if anything changed.
+// The driver is picked at build time with OUTPUT_DRIVER; how many regions
+// it drives, and on which pins, comes from the panel's identity (identity.h):
+//
+//   OUTPUT_LEDC     one PWM channel per region driving a MOSFET (default)
+//   OUTPUT_PIXEL    WS2812-style strip, PIXELS_PER_REGION pixels per region
+//   OUTPUT_CAPTURE  no hardware; records frames and prints them as CSV
+//
+// Every driver has the same shape: name(), begin(), and flush(fb, nowMs),
+// which returns false if the frame could not be taken yet (the framebuffer
+// stays dirty and is offered again on the next loop).
+
+#define OUTPUT_LEDC 0
+#define OUTPUT_PIXEL 1
+#define OUTPUT_CAPTURE 2
+
+#ifndef OUTPUT_DRIVER
+#define OUTPUT_DRIVER OUTPUT_LEDC
+#endif
+
+// ----------------------------------------------------------------------------
+// LEDC: one PWM channel per region (channel = local region index)
+// ----------------------------------------------------------------------------
+
+#if OUTPUT_DRIVER == OUTPUT_LEDC
+
+#define PWM_FREQ 5000
+#define PWM_RESOLUTION 8
+
+class LedcOutput {
+public:
+  const char *name() const { return "LEDC"; }
+
+  bool begin() {
+    const PanelIdentity &identity = panelIdentity();
+    regions = identity.count();
+    for (uint8_t r = 0; r < regions; r++) {
+      ledcSetup(r, PWM_FREQ, PWM_RESOLUTION);
+      ledcAttachPin(identity.regionPin(r), r);
+      ledcWrite(r, 0);
+      written[r] = 0;
+    }
+    return true;
+  }
+
+  bool flush(const Framebuffer &fb, uint32_t nowMs) {
+    for (uint8_t r = 0; r < regions; r++) {
+      if (fb.level[r] != written[r]) {
+        ledcWrite(r, fb.level[r]);
+        written[r] = fb.level[r];
+      }
+    }
+    return true;
+  }
+
+private:
+  uint8_t regions = 0;
+  uint8_t written[MAX_PANEL_REGIONS];
+};
+
+typedef LedcOutput PanelOutput;
+
+// ----------------------------------------------------------------------------
+// PIXEL: WS2812 over SPI with DMA
+// ----------------------------------------------------------------------------
+//
+// The classic ESP32's RMT peripheral has no DMA, so the strip is driven
+// from the SPI MOSI line instead: each data bit becomes four SPI bits at
+// 3.2 MHz (1000 = 0, 1110 = 1). Frames alternate between two DMA buffers:
+// flush() encodes into the idle one and queues it, so the CPU never waits
+// for the ~5 ms a 150-pixel frame spends on the wire.
+//
+// The framebuffer has one level per region, so every pixel of a region
+// shows that level; effects cannot draw within a region.
+
+#elif OUTPUT_DRIVER == OUTPUT_PIXEL
+
+#include <driver/spi_master.h>
+
+#ifndef PIXELS_PER_REGION
+#define PIXELS_PER_REGION 30
+#endif
+#ifndef PIXEL_DATA_PIN
+#define PIXEL_DATA_PIN 23
+#endif
+#ifndef PIXEL_COLOR
+#define PIXEL_COLOR 0xFFB46B // warm white, 0xRRGGBB at full level
+#endif
+
+#define PIXEL_SPI_HOST VSPI_HOST
+#define PIXEL_SPI_HZ 3200000
+#define PIXEL_RESET_BYTES 120 // >= 300 us low latches the frame
+
+class PixelOutput {
+public:
+  uint32_t busySkips = 0; // flushes refused because DMA was still running
+
+  const char *name() const { return "PIXEL"; }
+
+  bool begin() {
+    regions = panelIdentity().count();
+    bufferBytes = regions * PIXELS_PER_REGION * 12 + PIXEL_RESET_BYTES;
+
+    spi_bus_config_t bus = {};
+    bus.mosi_io_num = PIXEL_DATA_PIN;
+    bus.miso_io_num = -1;
+    bus.sclk_io_num = -1;
+    bus.quadwp_io_num = -1;
+    bus.quadhd_io_num = -1;
+    bus.max_transfer_sz = bufferBytes;
+    if (spi_bus_initialize(PIXEL_SPI_HOST, &bus, SPI_DMA_CH_AUTO) != ESP_OK)
+      return false;
+
+    spi_device_interface_config_t dev = {};
+    dev.clock_speed_hz = PIXEL_SPI_HZ;
+    dev.mode = 0;
+    dev.spics_io_num = -1;
+    dev.queue_size = 2;
+    if (spi_bus_add_device(PIXEL_SPI_HOST, &dev, &spi) != ESP_OK)
+      return false;
+
+    for (uint8_t b = 0; b < 2; b++) {
+      buffers[b] = (uint8_t *)heap_caps_malloc(bufferBytes, MALLOC_CAP_DMA);
+      if (!buffers[b])
+        return false;
+      memset(buffers[b], 0, bufferBytes);
+    }
+    return true;
+  }
+
+  bool flush(const Framebuffer &fb, uint32_t nowMs) {
+    if (!spi)
+      return true;
+
+    // Reclaim finished transfers without waiting
+    spi_transaction_t *done;
+    while (inFlight && spi_device_get_trans_result(spi, &done, 0) == ESP_OK) {
+      inFlight--;
+    }
+    if (inFlight == 2) {
+      busySkips++;
+      return false;
+    }
+
+    // At most one transfer is running, and it is not using buffers[back]
+    uint8_t *out = buffers[back];
+    for (uint8_t r = 0; r < regions; r++) {
+      uint8_t red = scale((PIXEL_COLOR >> 16) & 0xFF, fb.level[r]);
+      uint8_t g = scale((PIXEL_COLOR >> 8) & 0xFF, fb.level[r]);
+      uint8_t b = scale(PIXEL_COLOR & 0xFF, fb.level[r]);
+      for (uint16_t p = 0; p < PIXELS_PER_REGION; p++) {
+        out = encodeByte(out, g); // WS2812 wants GRB
+        out = encodeByte(out, red);
+        out = encodeByte(out, b);
+      }
+    }
+    // Reset bytes at the tail stay zero from begin()
+
+    spi_transaction_t &t = transactions[back];
+    t = {};
+    t.length = bufferBytes * 8;
+    t.tx_buffer = buffers[back];
+    if (spi_device_queue_trans(spi, &t, 0) != ESP_OK) {
+      busySkips++;
+      return false;
+    }
+    inFlight++;
+    back ^= 1;
+    return true;
+  }
+
+private:
+  spi_device_handle_t spi = nullptr;
+  spi_transaction_t transactions[2];
+  uint8_t *buffers[2] = {nullptr, nullptr};
+  uint8_t back = 0;
+  uint8_t inFlight = 0;
+  uint8_t regions = 0;
+  size_t bufferBytes = 0;
+
+  static uint8_t scale(uint8_t channel, uint8_t level) {
+    return ((uint16_t)channel * level + 255) >> 8;
+  }
+
+  // Two WS2812 bits per SPI byte
+  static uint8_t *encodeByte(uint8_t *out, uint8_t v) {
+    static const uint8_t pairs[4] = {0x88, 0x8E, 0xE8, 0xEE};
+    out[0] = pairs[(v >> 6) & 3];
+    out[1] = pairs[(v >> 4) & 3];
+    out[2] = pairs[(v >> 2) & 3];
+    out[3] = pairs[v & 3];
+    return out + 4;
+  }
+};
+
+typedef PixelOutput PanelOutput;
+
+// ----------------------------------------------------------------------------
+// CAPTURE: keep the last CAPTURE_FRAMES frames for inspection
+// ----------------------------------------------------------------------------
+
+#elif OUTPUT_DRIVER == OUTPUT_CAPTURE
+
+#define CAPTURE_FRAMES 64
+
+struct CapturedFrame {
+  uint32_t ms;
+  uint8_t level[MAX_PANEL_REGIONS];
+};
+
+class CaptureOutput {
+public:
+  uint32_t captured = 0; // total frames since boot
+  uint32_t dropped = 0;  // overwritten before drain() printed them
+
+  const char *name() const { return "CAPTURE"; }
+
+  bool begin() {
+    regions = panelIdentity().count();
+    return true;
+  }
+
+  bool flush(const Framebuffer &fb, uint32_t nowMs) {
+    CapturedFrame &f = frames[captured % CAPTURE_FRAMES];
+    f.ms = nowMs;
+    memcpy(f.level, fb.level, regions);
+    captured++;
+    if (captured - printed > CAPTURE_FRAMES) {
+      dropped += captured - printed - CAPTURE_FRAMES;
+      printed = captured - CAPTURE_FRAMES;
+    }
+    return true;
+  }
+
+  uint32_t count() const {
+    return captured < CAPTURE_FRAMES ? captured : CAPTURE_FRAMES;
+  }
+
+  // i = 0 is the oldest frame still held
+  const CapturedFrame &frame(uint32_t i) const {
+    return frames[(captured - count() + i) % CAPTURE_FRAMES];
+  }
+
+  // Print frames not printed yet as "ms,level0,level1,..."
+  void drain(Print &out) {
+    for (; printed < captured; printed++) {
+      const CapturedFrame &f = frames[printed % CAPTURE_FRAMES];
+      out.print(f.ms);
+      for (uint8_t r = 0; r < regions; r++) {
+        out.print(',');
+        out.print(f.level[r]);
+      }
+      out.println();
+    }
+  }
+
+private:
+  CapturedFrame frames[CAPTURE_FRAMES];
+  uint32_t printed = 0;
+  uint8_t regions = 0;
+};
+
+typedef CaptureOutput PanelOutput;
+
+#else
+#error "OUTPUT_DRIVER must be OUTPUT_LEDC, OUTPUT_PIXEL or OUTPUT_CAPTURE"
+#endif
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef PANEL_PROGRAMS_H
+#define PANEL_PROGRAMS_H
+
+#include "config.h"
+#include "effect_vm.h"
+#include "identity.h"
+#include "program_protocol.h"
+#include <Preferences.h>
+
+// ============================================================================
+// PANEL EFFECT PROGRAMS
+// ============================================================================
+//
+// The WiFi task only copies an upload into the receive slot. Checking,
+// the NVS write and swapping the slot in run from loop(), which is also
+// where the effect engines read programs, so a slot never changes mid-frame.
+
+#define PROGRAM_NVS_NAMESPACE "programs"
+
+class PanelPrograms {
+public:
+  // Restore every stored slot. Returns how many were loaded.
+  uint8_t load() {
+    Preferences prefs;
+    if (!prefs.begin(PROGRAM_NVS_NAMESPACE, true))
+      return 0;
+    uint8_t loaded = 0;
+    for (uint8_t slot = 0; slot < MAX_PROGRAMS; slot++) {
+      char key[4] = {'p', (char)('0' + slot), 0};
+      EffectProgram &p = effectPrograms()[slot];
+      size_t len = prefs.getBytes(key, p.code, MAX_PROGRAM_BYTES);
+      p.length = vmVerify(p.code, len) < 0 ? len : 0;
+      p.crc = crc32Ieee(p.code, p.length);
+      loaded += p.length > 0;
+    }
+    prefs.end();
+    return loaded;
+  }
+
+  // --- WiFi task -----------------------------------------------------------
+
+  void onPacket(const uint8_t *data, int len, const uint8_t *mac) {
+    if (rxPending || len < (int)offsetof(ProgramPacket, code))
+      return; // previous upload not handled yet; the master will see no reply
+    memcpy(&rx, data, min((size_t)len, sizeof(rx)));
+    if (rx.slot >= MAX_PROGRAMS || rx.length > MAX_PROGRAM_BYTES ||
+        len < (int)offsetof(ProgramPacket, code) + rx.length)
+      return;
+    memcpy(rxFrom, mac, 6);
+    rxPending = true;
+  }
+
+  // --- loop() --------------------------------------------------------------
+
+  // Check, store and install a received program. Returns true and fills
+  // `status` (and the master's MAC) when a reply should be sent.
+  bool poll(ProgramStatusPacket &status, uint8_t *replyTo) {
+    if (!rxPending)
+      return false;
+
+    status.type = PKT_PROGRAM_STATUS;
+    status.panelId = panelIdentity().id();
+    status.slot = rx.slot;
+    status.crc = rx.crc;
+    status.errorAt = -1;
+    memcpy(replyTo, rxFrom, 6);
+
+    if (crc32Ieee(rx.code, rx.length) != rx.crc) {
+      status.status = PROGRAM_STATUS_BAD_CRC;
+    } else if ((status.errorAt = vmVerify(rx.code, rx.length)) >= 0) {
+      status.status = PROGRAM_STATUS_INVALID;
+    } else {
+      char key[4] = {'p', (char)('0' + rx.slot), 0};
+      Preferences prefs;
+      bool ok = prefs.begin(PROGRAM_NVS_NAMESPACE, false) &&
+                prefs.putBytes(key, rx.code, rx.length) == rx.length;
+      prefs.end();
+      if (ok) {
+        EffectProgram &p = effectPrograms()[rx.slot];
+        memcpy(p.code, rx.code, rx.length);
+        p.length = rx.length;
+        p.crc = rx.crc;
+        status.status = PROGRAM_STATUS_STORED;
+      } else {
+        status.status = PROGRAM_STATUS_FLASH_ERROR;
+      }
+    }
+    rxPending = false;
+    return true;
+  }
+
+private:
+  ProgramPacket rx;
+  uint8_t rxFrom[6];
+  volatile bool rxPending = false;
+};
+
+#endif
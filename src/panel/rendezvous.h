@@ -0,0 +1,124 @@
+#ifndef PANEL_RENDEZVOUS_H
+#define PANEL_RENDEZVOUS_H
+
+#include "config.h"
+#include "link_protocol.h"
+#include <Preferences.h>
+
+// ============================================================================
+// CHANNEL RENDEZVOUS
+// ============================================================================
+//
+// The master's ESP-NOW channel is whatever channel its router puts the STA
+// on, so panels find it instead of being built for it. A panel starts on
+// the channel it last heard the master on (ESPNOW_WIFI_CHANNEL the first
+// time) and stays there while beacons keep coming. After
+// RENDEZVOUS_LOST_MS without one it scans: each hop moves to the next
+// channel and sends an ANNOUNCE, which the master answers with a beacon at
+// once, so a channel gets RENDEZVOUS_DWELL_MS before the next hop. The first
+// beacon heard locks the panel onto that channel.
+//
+// Worst case from the last beacon to locked again is RENDEZVOUS_LOST_MS +
+// 13 hops x RENDEZVOUS_DWELL_MS (about 6 s), less one dwell per lap if the
+// master is on the channel the panel tries first.
+//
+// loop() is the only caller; onBeacon() takes beacons as tempoTick() pops
+// them, not from the receive callback.
+
+#define RENDEZVOUS_LOST_MS (3 * BEACON_INTERVAL_MS + 500)
+#define RENDEZVOUS_DWELL_MS 200
+#define RENDEZVOUS_NVS_NAMESPACE "link"
+#define WIFI_CHANNEL_MIN 1
+#define WIFI_CHANNEL_MAX 13
+
+class ChannelRendezvous {
+public:
+  // The channel to start on: the last one the master was heard on
+  uint8_t load() {
+    Preferences prefs;
+    uint8_t ch = ESPNOW_WIFI_CHANNEL;
+    if (prefs.begin(RENDEZVOUS_NVS_NAMESPACE, true)) {
+      ch = prefs.getUChar("channel", ESPNOW_WIFI_CHANNEL);
+      prefs.end();
+    }
+    saved = valid(ch) ? ch : ESPNOW_WIFI_CHANNEL;
+    return saved;
+  }
+
+  void begin(uint8_t ch, uint32_t now) {
+    current = ch;
+    lastBeacon = now; // the master gets one full timeout to show up
+  }
+
+  uint8_t channel() const { return current; }
+  bool scanning() const { return scan; }
+
+  // A beacon arrived on the current channel. Returns true when it ends a
+  // scan. One that was queued before the last hop was heard on the
+  // previous channel and is ignored.
+  bool onBeacon(uint32_t now) {
+    if (scan && (int32_t)(now - hopAt) < 0) {
+      return false;
+    }
+    bool found = scan;
+    if (found) {
+      scan = false;
+      lastRecoveryMs = now - lastBeacon;
+      if (lastRecoveryMs > worstRecoveryMs) {
+        worstRecoveryMs = lastRecoveryMs;
+      }
+      recoveries++;
+    }
+    lastBeacon = now;
+    if (current != saved) {
+      save();
+    }
+    return found;
+  }
+
+  // The channel to move to and probe on now, or 0 to stay put
+  uint8_t tick(uint32_t now) {
+    if (!scan) {
+      if ((int32_t)(now - lastBeacon) < RENDEZVOUS_LOST_MS) {
+        return 0;
+      }
+      scan = true;
+      scans++;
+    } else if (now - hopAt < RENDEZVOUS_DWELL_MS) {
+      return 0;
+    }
+    hopAt = now;
+    current = current >= WIFI_CHANNEL_MAX ? WIFI_CHANNEL_MIN : current + 1;
+    hops++;
+    return current;
+  }
+
+  uint32_t scans = 0;           // times the master was lost
+  uint32_t recoveries = 0;      // times it was found again
+  uint32_t hops = 0;
+  uint32_t lastRecoveryMs = 0;  // last beacon before the loss to first after
+  uint32_t worstRecoveryMs = 0;
+
+private:
+  uint8_t current = ESPNOW_WIFI_CHANNEL;
+  uint8_t saved = ESPNOW_WIFI_CHANNEL;
+  bool scan = false;
+  uint32_t lastBeacon = 0;
+  uint32_t hopAt = 0;
+
+  static bool valid(uint8_t ch) {
+    return ch >= WIFI_CHANNEL_MIN && ch <= WIFI_CHANNEL_MAX;
+  }
+
+  // Only when the channel really moved, so NVS sees one write per move
+  void save() {
+    Preferences prefs;
+    if (prefs.begin(RENDEZVOUS_NVS_NAMESPACE, false)) {
+      prefs.putUChar("channel", current);
+      prefs.end();
+    }
+    saved = current;
+  }
+};
+
+#endif
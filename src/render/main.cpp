@@ -0,0 +1,831 @@
+// Offline show renderer (host build: pio run -e render)
+//
+// Runs the master's sequence code or a recorded journal against one
+// Compositor per panel on a simulated clock and writes every global
+// region's level at a fixed frame rate. No radio is simulated: a command
+// reaches the panels on their next 10 ms loop, as it does on the stage
+// when nothing is lost.
+//
+//   render --sequence 1 [--fps 100] [--out show.csv]
+//   render --journal show.rec --out show.trc
+//   render --sequence 2 --compare golden.trc
+//   render --sequence 1 --program "time 3 shr tri bright scale" --effect 16
+//   render --bench            per-frame compositor and VM cost
+//   render --check-groups     panel-side group resolution against the master
+//   render --check-regions    every global region, up to MAX_REGIONS
+//   render --check-failover   standby takeover in the middle of each sequence
+
+#include "../master/sequences.h"
+#include "../master/standby.h"
+#include "compositor.h"
+#include "config.h"
+#include "light_protocol.h"
+#include "show_journal.h"
+#include "trace.h"
+#include <chrono>
+
+#define PANEL_LOOP_MS 10
+#define DEFAULT_FPS 100
+#define DEFAULT_TAIL_MS 1000
+#define MAX_RENDER_PANELS 8
+
+HostSerial Serial;
+static uint32_t simNow = 0;
+uint32_t millis() { return simNow; }
+
+// ============================================================================
+// SIMULATED PANELS
+// ============================================================================
+//
+// ALL_REGIONS lists each panel's regions in order, and every panel's
+// vertical positions start again at 0, so a reset of verticalPos marks the
+// next panel.
+
+struct SimPanel {
+  uint8_t id;
+  uint16_t firstRegion;
+  uint8_t regionCount;
+  Compositor compositor;
+  Framebuffer framebuffer;
+  std::vector<LightCommand> pending;
+};
+
+SimPanel panels[MAX_RENDER_PANELS];
+uint8_t panelCount = 0;
+
+void buildPanels() {
+  for (uint8_t i = 0; i < STAGE_REGIONS; i++) {
+    bool first = i == 0 || pgm_read_byte(&ALL_REGIONS[i].verticalPos) == 0;
+    if (first && panelCount < MAX_RENDER_PANELS) {
+      SimPanel &p = panels[panelCount++];
+      p.id = panelCount;
+      p.firstRegion = i;
+      p.regionCount = 0;
+    }
+    panels[panelCount - 1].regionCount++;
+  }
+
+  for (uint8_t i = 0; i < panelCount; i++) {
+    // Same boot state as the panel firmware's setup()
+    SimPanel &p = panels[i];
+    p.framebuffer = {};
+    p.pending.clear();
+    p.compositor.begin(&ALL_REGIONS[p.firstRegion], p.regionCount);
+    LightCommand boot = {};
+    boot.effect = EFFECT_STATIC;
+    boot.brightness = 128;
+    boot.speed = 50;
+    boot.regions.assignRange(p.firstRegion, p.regionCount, true);
+    p.compositor.apply(boot, 0);
+  }
+}
+
+uint32_t commandsSent = 0;
+
+void dispatch(LightCommand &cmd) {
+  commandsSent++;
+  for (uint8_t i = 0; i < panelCount; i++) {
+    if (cmd.panelId == 0 || cmd.panelId == panels[i].id) {
+      panels[i].pending.push_back(cmd);
+    }
+  }
+}
+
+void panelLoop(uint32_t now) {
+  for (uint8_t i = 0; i < panelCount; i++) {
+    SimPanel &p = panels[i];
+    for (const LightCommand &cmd : p.pending) {
+      p.compositor.apply(cmd, now);
+    }
+    p.pending.clear();
+    p.compositor.render(now, p.framebuffer);
+  }
+}
+
+void snapshot(Frame &frame) {
+  for (uint8_t i = 0; i < panelCount; i++) {
+    const SimPanel &p = panels[i];
+    for (uint8_t r = 0; r < p.regionCount; r++) {
+      frame[p.firstRegion + r] = p.framebuffer.level[r];
+    }
+  }
+}
+
+// ============================================================================
+// SHOW SOURCES
+// ============================================================================
+
+// Journal records decoded up front, with absolute times
+struct TimedCommand {
+  uint32_t atMs;
+  LightCommand cmd;
+};
+
+bool loadFile(const char *path, std::vector<uint8_t> &out) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    out.insert(out.end(), buf, buf + n);
+  fclose(f);
+  return true;
+}
+
+bool loadJournal(const char *path, std::vector<TimedCommand> &out) {
+  std::vector<uint8_t> bytes;
+  JournalHeader header;
+  if (!loadFile(path, bytes) || bytes.size() < sizeof(header))
+    return false;
+  memcpy(&header, bytes.data(), sizeof(header));
+  if (header.magic != JOURNAL_MAGIC || header.version != JOURNAL_VERSION ||
+      header.maxRegions != MAX_REGIONS)
+    return false;
+
+  LightCommand state = {};
+  uint64_t atUs = 0;
+  size_t pos = sizeof(header);
+  while (pos < bytes.size()) {
+    uint32_t dtUs;
+    uint16_t avail = std::min<size_t>(bytes.size() - pos, 0xFFFF);
+    uint8_t used = journalDecode(bytes.data() + pos, avail, state, dtUs);
+    if (!used)
+      return false;
+    pos += used;
+    atUs += dtUs;
+    TimedCommand tc = {(uint32_t)(atUs / 1000), state};
+    out.push_back(tc);
+  }
+  return true;
+}
+
+// ============================================================================
+// COMPOSITOR BENCHMARK
+// ============================================================================
+//
+// Worst case for one panel: MAX_PANEL_REGIONS regions, every overlay
+// covering all of them with a cyclic effect and a partial mix, so no
+// region or layer is skipped. The last row is the ceiling: a panel cannot
+// stack more layers than that.
+
+int runBench() {
+  RegionInfo layout[MAX_PANEL_REGIONS] = {};
+  for (uint8_t r = 0; r < MAX_PANEL_REGIONS; r++) {
+    layout[r].globalIndex = r;
+    layout[r].verticalPos = r;
+  }
+  const uint32_t frames = 200000;
+
+  printf("layers  ns/frame  ns/region\n");
+  for (uint8_t active = 1; active <= MAX_LAYERS; active++) {
+    Compositor compositor;
+    Framebuffer fb = {};
+    compositor.begin(layout, MAX_PANEL_REGIONS);
+    for (uint8_t l = 0; l < active; l++) {
+      LightCommand cmd = {};
+      cmd.effect = l == 0 ? EFFECT_WAVE : EFFECT_BREATHING;
+      cmd.brightness = 200;
+      cmd.speed = 50;
+      cmd.layer = l;
+      cmd.blend = l % 4; // cycle through max, add, multiply, crossfade
+      cmd.mix = 160;
+      cmd.regions.assignRange(0, MAX_PANEL_REGIONS, true);
+      compositor.apply(cmd, 0);
+    }
+
+    uint32_t sink = 0;
+    auto started = std::chrono::steady_clock::now();
+    for (uint32_t f = 0; f < frames; f++) {
+      compositor.render(f * PANEL_LOOP_MS, fb);
+      sink += fb.level[f % MAX_PANEL_REGIONS];
+    }
+    double ns = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - started)
+                    .count() /
+                frames;
+    printf("%6u  %8.1f  %9.2f%s\n", active, ns, ns / MAX_PANEL_REGIONS,
+           active == MAX_LAYERS ? "  (ceiling)" : "");
+    if (sink == 0xFFFFFFFF)
+      printf("\n"); // keep the frames from being optimised away
+  }
+
+  // Built-in kernels against bytecode doing comparable work
+  struct {
+    const char *name;
+    uint8_t effect;
+    const char *source;
+  } kernels[] = {
+      {"breathing", EFFECT_BREATHING, nullptr},
+      {"  vm", EFFECT_PROGRAM, "time 3 shr row 8 mul sub tri bright scale"},
+      {"wave", EFFECT_WAVE, nullptr},
+      {"  vm", EFFECT_PROGRAM,
+       "time 2 shr region 256 mul stage div sub sin bright scale"},
+      {"  vm loop", EFFECT_PROGRAM,
+       "; sum of 8 sines, row-detuned\n"
+       "0 8 next: dup jz done swap over time mul 6 shr sin add swap 1 sub "
+       "jmp next done: drop 3 shr bright scale"},
+  };
+  printf("\neffect     ns/region\n");
+  for (auto &k : kernels) {
+    if (k.source) {
+      const char *error = "";
+      EffectProgram &p = effectPrograms()[0];
+      int len = vmAssemble(k.source, p.code, &error);
+      if (len < 0 || vmVerify(p.code, len) >= 0) {
+        fprintf(stderr, "✗ Bench program: %s\n", error);
+        return 1;
+      }
+      p.length = len;
+    }
+    EffectEngine engine;
+    Framebuffer fb = {};
+    engine.begin(layout, MAX_PANEL_REGIONS);
+    LightCommand cmd = {};
+    cmd.effect = k.effect;
+    cmd.brightness = 200;
+    cmd.speed = 50;
+    cmd.regions.assignRange(0, MAX_PANEL_REGIONS, true);
+    engine.apply(cmd, 0);
+
+    uint32_t sink = 0;
+    auto started = std::chrono::steady_clock::now();
+    for (uint32_t f = 0; f < frames; f++) {
+      engine.render(f * PANEL_LOOP_MS, fb);
+      sink += fb.level[f % MAX_PANEL_REGIONS];
+    }
+    double ns = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - started)
+                    .count() /
+                frames / MAX_PANEL_REGIONS;
+    printf("%-10s %9.2f%s\n", k.name, ns,
+           engine.programFaults() ? "  (faulted)" : "");
+    if (sink == 0xFFFFFFFF)
+      printf("\n");
+  }
+  return 0;
+}
+
+// ============================================================================
+// GROUP RESOLUTION CHECK
+// ============================================================================
+//
+// Every include/exclude pair of group masks, on top of a few region sets,
+// goes through the journal and the frame encoding to each panel's
+// assembler and effect engine, as in the firmware. The regions the panels
+// light between them must be exactly what RegionGroups::expand() gives on
+// the master.
+
+int runGroupCheck() {
+  buildPanels();
+  std::vector<LightFrameAssembler> assemblers;
+  EffectEngine engines[MAX_RENDER_PANELS];
+  for (uint8_t i = 0; i < panelCount; i++) {
+    assemblers.emplace_back(panels[i].firstRegion, panels[i].regionCount);
+    engines[i].begin(&ALL_REGIONS[panels[i].firstRegion],
+                     panels[i].regionCount);
+  }
+
+  const char *patterns[] = {"none", "every third", "all"};
+  uint32_t cases = 0, mismatches = 0;
+  uint8_t commandId = 0;
+  for (uint8_t pattern = 0; pattern < 3; pattern++) {
+    for (uint16_t include = 0; include < (1 << NUM_GROUPS); include++) {
+      for (uint16_t exclude = 0; exclude < (1 << NUM_GROUPS); exclude++) {
+        LightCommand cmd = {};
+        cmd.effect = EFFECT_STATIC;
+        cmd.brightness = 255;
+        cmd.groupInclude = include;
+        cmd.groupExclude = exclude;
+        for (uint8_t r = 0; r < STAGE_REGIONS; r++) {
+          cmd.regions.assign(r, pattern == 2 || (pattern == 1 && r % 3 == 0));
+        }
+        RegionSet expected;
+        RegionGroups::expand(cmd, expected);
+
+        // Through the recorder's encoding, as a replay would send it
+        uint8_t record[JOURNAL_MAX_RECORD];
+        LightCommand empty = {}, replayed = {};
+        uint32_t dtUs;
+        journalDecode(record, journalEncode(empty, cmd, 0, record), replayed,
+                      dtUs);
+
+        commandId++;
+        RegionSet lit;
+        for (uint8_t f = 0; f < lightFrameCount(replayed); f++) {
+          LightCommandFrame frame;
+          uint8_t len = lightFrameEncode(replayed, commandId, f, frame);
+          for (uint8_t i = 0; i < panelCount; i++) {
+            LightCommand received;
+            if (!assemblers[i].accept((const uint8_t *)&frame, len,
+                                       received))
+              continue;
+            engines[i].apply(received, 0);
+            for (uint8_t r = 0; r < panels[i].regionCount; r++) {
+              lit.assign(panels[i].firstRegion + r, engines[i].regionActive(r));
+            }
+          }
+        }
+
+        cases++;
+        for (uint8_t r = 0; r < STAGE_REGIONS; r++) {
+          if (lit.test(r) == expected.test(r))
+            continue;
+          if (mismatches++ < 10)
+            fprintf(stderr,
+                    "✗ Regions %s, include 0x%03x, exclude 0x%03x: region %u "
+                    "(%s) %s on the panels\n",
+                    patterns[pattern], include, exclude, r,
+                    ALL_REGIONS[r].name, lit.test(r) ? "lit" : "dark");
+          break;
+        }
+      }
+    }
+  }
+
+  if (mismatches) {
+    fprintf(stderr, "✗ %u of %u group commands resolved differently\n",
+            mismatches, cases);
+    return 1;
+  }
+  fprintf(stderr, "✓ %u group commands resolved as on the master\n", cases);
+  return 0;
+}
+
+// ============================================================================
+// REGION RANGE CHECK
+// ============================================================================
+//
+// Panels of MAX_PANEL_REGIONS laid end to end over all MAX_REGIONS global
+// regions, as provisioned panels could be. Each region is lit on its own,
+// through the journal and the frame encoding, and must light on exactly one
+// panel in exactly one place.
+
+int runRegionCheck() {
+  const uint16_t panelsNeeded = MAX_REGIONS / MAX_PANEL_REGIONS;
+  std::vector<RegionInfo> layout(MAX_REGIONS);
+  for (uint16_t g = 0; g < MAX_REGIONS; g++) {
+    layout[g].globalIndex = g;
+    layout[g].verticalPos = g % MAX_PANEL_REGIONS;
+  }
+  std::vector<LightFrameAssembler> assemblers;
+  std::vector<EffectEngine> engines(panelsNeeded);
+  for (uint16_t i = 0; i < panelsNeeded; i++) {
+    assemblers.emplace_back(i * MAX_PANEL_REGIONS, MAX_PANEL_REGIONS);
+    engines[i].begin(&layout[i * MAX_PANEL_REGIONS], MAX_PANEL_REGIONS);
+  }
+
+  uint32_t mismatches = 0;
+  uint8_t commandId = 0;
+  for (uint16_t g = 0; g < MAX_REGIONS; g++) {
+    LightCommand cmd = {};
+    cmd.effect = EFFECT_STATIC;
+    cmd.brightness = 255;
+    cmd.regions.set(g);
+
+    uint8_t record[JOURNAL_MAX_RECORD];
+    LightCommand empty = {}, replayed = {};
+    uint32_t dtUs;
+    journalDecode(record, journalEncode(empty, cmd, 0, record), replayed,
+                  dtUs);
+
+    commandId++;
+    RegionSet lit;
+    uint16_t litCount = 0;
+    for (uint8_t f = 0; f < lightFrameCount(replayed); f++) {
+      LightCommandFrame frame;
+      uint8_t len = lightFrameEncode(replayed, commandId, f, frame);
+      for (uint16_t i = 0; i < panelsNeeded; i++) {
+        LightCommand received;
+        if (!assemblers[i].accept((const uint8_t *)&frame, len, received))
+          continue;
+        engines[i].apply(received, 0);
+        for (uint8_t r = 0; r < MAX_PANEL_REGIONS; r++) {
+          if (engines[i].regionActive(r)) {
+            lit.set(i * MAX_PANEL_REGIONS + r);
+            litCount++;
+          }
+        }
+      }
+    }
+
+    if (litCount != 1 || !lit.test(g)) {
+      if (mismatches++ < 10)
+        fprintf(stderr, "✗ Region %u: %u region(s) lit on the panels\n", g,
+                litCount);
+    }
+  }
+
+  if (mismatches) {
+    fprintf(stderr, "✗ %u of %u regions not driven alone\n", mismatches,
+            MAX_REGIONS);
+    return 1;
+  }
+  fprintf(stderr, "✓ %u regions driven across %u panels\n", MAX_REGIONS,
+          panelsNeeded);
+  return 0;
+}
+
+// ============================================================================
+// FAILOVER CHECK
+// ============================================================================
+//
+// The active master plays each sequence, beaconing and sending show state
+// as the firmware does, and falls silent part way through. The standby
+// takes over once LEASE_TIMEOUT_MS has passed, in takeOver()'s order: a
+// beacon of the new term, then the step the sequence has got to. A panel
+// that follows the lease must be back on the same step as an uninterrupted
+// run from the takeover on, and stay there to the end.
+
+#define FAILOVER_STEP_MS 50       // between the tried failure times
+#define FAILOVER_HORIZON_MS 60000 // a sequence that runs longer is cut off
+
+static const uint8_t MASTER_A_MAC[6] = {0x02, 0, 0, 0, 0, 0xA1};
+static const uint8_t MASTER_B_MAC[6] = {0x02, 0, 0, 0, 0, 0xB2};
+
+struct FailoverPanel {
+  MasterLease lease;
+  LightCommand shown;
+};
+
+static FailoverPanel failoverPanel;
+static const uint8_t *failoverFrom = MASTER_A_MAC;
+static bool failoverStateDue = false;
+static LightCommand failoverReference;
+
+void failoverSend(LightCommand &cmd) {
+  failoverStateDue = true;
+  if (failoverPanel.lease.accept(failoverFrom)) {
+    failoverPanel.shown = cmd;
+  }
+}
+
+void failoverReferenceSend(LightCommand &cmd) { failoverReference = cmd; }
+
+bool sameLook(const LightCommand &a, const LightCommand &b) {
+  LightCommand empty = {};
+  uint8_t ra[JOURNAL_MAX_RECORD], rb[JOURNAL_MAX_RECORD];
+  size_t la = journalEncode(empty, a, 0, ra);
+  size_t lb = journalEncode(empty, b, 0, rb);
+  return la == lb && memcmp(ra, rb, la) == 0;
+}
+
+// One failure at `failAt`. Returns the ms the panel spent on a different
+// look from the takeover on; `caughtUp` is set when steps fell due while
+// nobody played and the standby had to send a catch-up command.
+uint32_t runFailover(const LightCommand &params, uint32_t failAt,
+                     uint32_t endAt, bool &caughtUp) {
+  SequencePlayer active, standby, reference;
+  ShowMirror mirror;
+  active.start(params, 0);
+  reference.start(params, 0);
+  failoverPanel = FailoverPanel();
+  failoverReference = LightCommand();
+  failoverStateDue = false;
+  caughtUp = false;
+
+  uint32_t lastBeacon = 0, lastState = 0, takenAt = 0;
+  bool beaconed = false, taken = false;
+  uint32_t wrongMs = 0;
+  for (uint32_t t = 0; t <= endAt; t += PANEL_LOOP_MS) {
+    simNow = t;
+    reference.tick(t, failoverReferenceSend);
+
+    if (t < failAt) {
+      failoverFrom = MASTER_A_MAC;
+      active.tick(t, failoverSend);
+      bool beacon = !beaconed || t - lastBeacon >= BEACON_INTERVAL_MS;
+      if (beacon) {
+        beaconed = true;
+        lastBeacon = t;
+        failoverPanel.lease.onBeacon(MASTER_A_MAC, 1, t);
+      }
+      if (beacon || (failoverStateDue &&
+                     t - lastState >= SHOW_STATE_MIN_INTERVAL_MS)) {
+        failoverStateDue = false;
+        lastState = t;
+        ShowStatePacket state;
+        size_t len = showStateEncode(params, active, 1, t, state);
+        mirror.onPacket((const uint8_t *)&state, len, t);
+      }
+    } else if (!taken && t - lastBeacon >= LEASE_TIMEOUT_MS) {
+      taken = true;
+      takenAt = t;
+      failoverFrom = MASTER_B_MAC;
+      failoverPanel.lease.onBeacon(MASTER_B_MAC, 2, t);
+      if (mirror.resume(standby, t) > 0) {
+        caughtUp = true;
+        failoverSend(standby.cmd);
+      }
+    } else if (taken) {
+      standby.tick(t, failoverSend);
+    }
+
+    if ((t < failAt || (taken && t >= takenAt)) &&
+        !sameLook(failoverPanel.shown, failoverReference)) {
+      wrongMs += PANEL_LOOP_MS;
+    }
+  }
+  return wrongMs;
+}
+
+int runFailoverCheck() {
+  uint32_t failovers = 0, caughtUp = 0, failures = 0;
+  for (uint8_t s = 0; s < NUM_SEQUENCES; s++) {
+    LightCommand params = {};
+    params.effect = EFFECT_STATIC;
+    params.brightness = DEFAULT_BRIGHTNESS;
+    params.speed = DEFAULT_SPEED;
+    params.sequence = s;
+
+    // How long the sequence runs when nothing fails
+    SequencePlayer timing;
+    timing.start(params, 0);
+    uint32_t length = 0;
+    while (timing.running() && length < FAILOVER_HORIZON_MS) {
+      uint32_t untilNext = timing.tick(length, failoverReferenceSend);
+      if (untilNext == SEQ_IDLE)
+        break;
+      length += untilNext;
+    }
+    uint32_t endAt = length + LEASE_TIMEOUT_MS + BEACON_INTERVAL_MS;
+
+    // From the first show state on: a standby that never heard one restores
+    // its own scene instead
+    for (uint32_t failAt = FAILOVER_STEP_MS; failAt < length;
+         failAt += FAILOVER_STEP_MS) {
+      bool stepsMissed;
+      uint32_t wrongMs = runFailover(params, failAt, endAt, stepsMissed);
+      failovers++;
+      caughtUp += stepsMissed;
+      if (wrongMs) {
+        if (failures++ < 10)
+          fprintf(stderr,
+                  "✗ Sequence %u, master lost at %u ms: panel off the "
+                  "sequence for %u ms after the takeover\n",
+                  s, failAt, wrongMs);
+      }
+    }
+  }
+
+  if (failures) {
+    fprintf(stderr, "✗ %u of %u failovers left the panels behind\n", failures,
+            failovers);
+    return 1;
+  }
+  fprintf(stderr,
+          "✓ %u failovers over %u sequences, %u with a catch-up command, "
+          "panels in step after each\n",
+          failovers, (unsigned)NUM_SEQUENCES, caughtUp);
+  return 0;
+}
+
+// ============================================================================
+// MAIN
+// ============================================================================
+
+void usage() {
+  fprintf(stderr,
+          "usage: render (--sequence N | --journal FILE) [options]\n"
+          "  --fps N         frames per second (default %d)\n"
+          "  --out FILE      .trc = binary, anything else = CSV (default "
+          "stdout CSV)\n"
+          "  --binary        binary trace on stdout\n"
+          "  --effect N --brightness N --speed N   sequence parameters\n"
+          "  --transition MS crossfade on effect changes (default %d)\n"
+          "  --bpm N         tempo clock (default %d)\n"
+          "  --beats N       cycle length in beats, on the tempo clock\n"
+          "  --program TEXT  assemble into effect slot 0 (effect 16)\n"
+          "  --tail MS       keep rendering after the show ends (default %d)\n"
+          "  --duration MS   stop after this long regardless\n"
+          "  --compare FILE  render, then compare with a trace; exit 1 on "
+          "mismatch\n"
+          "  --verbose       print the firmware's serial output to stderr\n"
+          "  --bench         time the compositor per layer count and exit\n"
+          "  --check-groups  check panel-side group resolution and exit\n"
+          "  --check-regions drive every global region on its own and exit\n"
+          "  --check-failover  fail the master mid-sequence and check the "
+          "standby\n",
+          DEFAULT_FPS, DEFAULT_TRANSITION_MS, TEMPO_DEFAULT_BPM_X100 / 100,
+          DEFAULT_TAIL_MS);
+}
+
+bool endsWith(const char *s, const char *suffix) {
+  size_t a = strlen(s), b = strlen(suffix);
+  return a >= b && strcmp(s + a - b, suffix) == 0;
+}
+
+int compareTraces(const std::vector<uint8_t> &rendered, const char *path) {
+  std::vector<uint8_t> golden;
+  std::vector<Frame> a, b;
+  if (!loadFile(path, golden) || !readTrace(golden, b)) {
+    fprintf(stderr, "✗ Cannot read trace %s\n", path);
+    return 2;
+  }
+  readTrace(rendered, a);
+
+  size_t frames = std::min(a.size(), b.size());
+  for (size_t f = 0; f < frames; f++) {
+    if (a[f] == b[f])
+      continue;
+    for (size_t r = 0; r < a[f].size() && r < b[f].size(); r++) {
+      if (a[f][r] != b[f][r]) {
+        fprintf(stderr, "✗ Frame %zu region %zu (%s): rendered %u, golden %u\n",
+                f, r, r < STAGE_REGIONS ? ALL_REGIONS[r].name : "?",
+                a[f][r], b[f][r]);
+        return 1;
+      }
+    }
+    fprintf(stderr, "✗ Frame %zu: region count differs\n", f);
+    return 1;
+  }
+  if (a.size() != b.size()) {
+    fprintf(stderr, "✗ Rendered %zu frames, golden has %zu\n", a.size(),
+            b.size());
+    return 1;
+  }
+  fprintf(stderr, "✓ Matches %s (%zu frames)\n", path, frames);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int sequence = -1;
+  const char *journalPath = nullptr;
+  const char *outPath = nullptr;
+  const char *comparePath = nullptr;
+  bool binary = false;
+  uint32_t fps = DEFAULT_FPS;
+  uint32_t tailMs = DEFAULT_TAIL_MS;
+  uint32_t durationMs = 0;
+  LightCommand params = {};
+  params.effect = EFFECT_STATIC;
+  params.brightness = DEFAULT_BRIGHTNESS;
+  params.speed = DEFAULT_SPEED;
+  params.transitionMs = DEFAULT_TRANSITION_MS;
+  params.curve = CURVE_EASE;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!strcmp(arg, "--verbose")) {
+      Serial.enabled = true;
+      continue;
+    }
+    if (!strcmp(arg, "--bench")) {
+      return runBench();
+    }
+    if (!strcmp(arg, "--check-groups")) {
+      return runGroupCheck();
+    }
+    if (!strcmp(arg, "--check-regions")) {
+      return runRegionCheck();
+    }
+    if (!strcmp(arg, "--check-failover")) {
+      return runFailoverCheck();
+    }
+    if (!strcmp(arg, "--binary")) {
+      binary = true;
+      continue;
+    }
+    if (!val) {
+      usage();
+      return 2;
+    }
+    i++;
+    if (!strcmp(arg, "--sequence"))
+      sequence = atoi(val);
+    else if (!strcmp(arg, "--journal"))
+      journalPath = val;
+    else if (!strcmp(arg, "--out"))
+      outPath = val;
+    else if (!strcmp(arg, "--compare"))
+      comparePath = val;
+    else if (!strcmp(arg, "--fps"))
+      fps = atoi(val);
+    else if (!strcmp(arg, "--tail"))
+      tailMs = atoi(val);
+    else if (!strcmp(arg, "--duration"))
+      durationMs = atoi(val);
+    else if (!strcmp(arg, "--effect"))
+      params.effect = atoi(val);
+    else if (!strcmp(arg, "--brightness"))
+      params.brightness = atoi(val);
+    else if (!strcmp(arg, "--speed"))
+      params.speed = atoi(val);
+    else if (!strcmp(arg, "--transition"))
+      params.transitionMs = atoi(val);
+    else if (!strcmp(arg, "--bpm"))
+      tempoClock().setBpm(atof(val) * 100 + 0.5, 0);
+    else if (!strcmp(arg, "--beats"))
+      params.beatLength = atof(val) * 4 + 0.5;
+    else if (!strcmp(arg, "--program")) {
+      const char *error = "";
+      EffectProgram &p = effectPrograms()[0];
+      int len = vmAssemble(val, p.code, &error);
+      if (len < 0) {
+        fprintf(stderr, "✗ Program: %s\n", error);
+        return 2;
+      }
+      p.length = len;
+    }
+    else {
+      usage();
+      return 2;
+    }
+  }
+
+  if ((sequence < 0) == (journalPath == nullptr) || fps == 0 || fps > 255) {
+    usage();
+    return 2;
+  }
+  if (comparePath) {
+    binary = endsWith(comparePath, ".trc");
+  } else if (outPath) {
+    binary = endsWith(outPath, ".trc");
+  }
+
+  buildPanels();
+
+  SequencePlayer player;
+  std::vector<TimedCommand> journal;
+  size_t nextRecord = 0;
+  if (journalPath) {
+    if (!loadJournal(journalPath, journal)) {
+      fprintf(stderr, "✗ Cannot read journal %s\n", journalPath);
+      return 2;
+    }
+  } else {
+    params.sequence = sequence;
+    if (!player.start(params, 0)) {
+      fprintf(stderr, "✗ No sequence %d\n", sequence);
+      return 2;
+    }
+  }
+
+  const char *names[STAGE_REGIONS];
+  for (uint8_t r = 0; r < STAGE_REGIONS; r++) {
+    names[r] = (const char *)pgm_read_ptr(&ALL_REGIONS[r].name);
+  }
+  TraceWriter trace;
+  trace.begin(!binary, fps, STAGE_REGIONS, names);
+  Frame frame(STAGE_REGIONS, 0);
+
+  auto started = std::chrono::steady_clock::now();
+  uint32_t frameIndex = 0;
+  uint32_t showEnd = 0;
+  for (simNow = 0;; simNow++) {
+    // Master side
+    if (journalPath) {
+      while (nextRecord < journal.size() &&
+             journal[nextRecord].atMs <= simNow) {
+        dispatch(journal[nextRecord++].cmd);
+      }
+    } else {
+      player.tick(simNow, dispatch);
+    }
+    bool showDone = journalPath ? nextRecord >= journal.size()
+                                : !player.running();
+    if (showDone && showEnd == 0) {
+      showEnd = simNow;
+    }
+
+    // Panel side
+    if (simNow % PANEL_LOOP_MS == 0) {
+      panelLoop(simNow);
+    }
+
+    // Frames land on the first millisecond at or after k / fps
+    while ((uint64_t)frameIndex * 1000 / fps == simNow) {
+      snapshot(frame);
+      trace.frame(frame);
+      frameIndex++;
+    }
+
+    if (durationMs ? simNow >= durationMs : showDone && simNow >= showEnd + tailMs)
+      break;
+  }
+  trace.end();
+
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - started)
+                       .count();
+  fprintf(stderr,
+          "Rendered %.1f s of show (%u frames, %u commands, %zu bytes) in "
+          "%.3f s, %.0fx real time\n",
+          simNow / 1000.0, frameIndex, commandsSent, trace.bytes.size(),
+          elapsed, elapsed > 0 ? simNow / 1000.0 / elapsed : 0.0);
+
+  if (comparePath) {
+    return compareTraces(trace.bytes, comparePath);
+  }
+
+  FILE *out = outPath ? fopen(outPath, "wb") : stdout;
+  if (!out) {
+    fprintf(stderr, "✗ Cannot write %s\n", outPath);
+    return 2;
+  }
+  fwrite(trace.bytes.data(), 1, trace.bytes.size(), out);
+  if (outPath)
+    fclose(out);
+  return 0;
+}
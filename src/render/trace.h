@@ -0,0 +1,192 @@
+#ifndef RENDER_TRACE_H
+#define RENDER_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// ============================================================================
+// REGION TRACE FORMATS
+// ============================================================================
+//
+// A trace is one row of global region levels per frame at a fixed rate.
+//
+// CSV: a header "ms,<region name>,..." then "ms,level,..." per frame.
+//
+// Binary (.trc): an 8-byte header, then one record per frame in which any
+// region changed:
+//
+//   varint  frames since the previous record (first: the frame index)
+//   varint  number of changed regions
+//   ...     varint region, uint8 level, per changed region
+//
+// A final record with zero changes marks the last frame. A 30-minute show
+// at 100 fps with a few changes per frame stays well under a megabyte.
+
+#define TRACE_MAGIC 0x44524E54UL // "TNRD"
+#define TRACE_VERSION 1
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t fps;
+  uint16_t regions;
+} TraceHeader;
+
+typedef std::vector<uint8_t> Frame;
+
+class TraceWriter {
+public:
+  std::vector<uint8_t> bytes;
+
+  void begin(bool csv, uint8_t fps, uint16_t regions,
+             const char *const *names) {
+    binary = !csv;
+    frameMs = 1000.0 / fps;
+    last.assign(regions, 0);
+    if (binary) {
+      TraceHeader h = {TRACE_MAGIC, TRACE_VERSION, fps, regions};
+      append(&h, sizeof(h));
+    } else {
+      text("ms");
+      for (uint16_t r = 0; r < regions; r++) {
+        text(",");
+        text(names[r]);
+      }
+      text("\n");
+    }
+  }
+
+  void frame(const Frame &levels) {
+    if (binary) {
+      uint16_t changed = 0;
+      for (size_t r = 0; r < levels.size(); r++)
+        changed += levels[r] != last[r];
+      if (changed) {
+        varint(frames - lastRecord);
+        varint(changed);
+        for (size_t r = 0; r < levels.size(); r++) {
+          if (levels[r] != last[r]) {
+            varint(r);
+            bytes.push_back(levels[r]);
+          }
+        }
+        lastRecord = frames;
+        recorded = true;
+      }
+    } else {
+      char buf[16];
+      snprintf(buf, sizeof(buf), "%lu", (unsigned long)(frames * frameMs));
+      text(buf);
+      for (size_t r = 0; r < levels.size(); r++) {
+        snprintf(buf, sizeof(buf), ",%u", levels[r]);
+        text(buf);
+      }
+      text("\n");
+    }
+    last = levels;
+    frames++;
+  }
+
+  void end() {
+    if (binary && frames > 0 && (!recorded || lastRecord != frames - 1)) {
+      varint(frames - 1 - lastRecord);
+      varint(0);
+    }
+  }
+
+private:
+  bool binary = false;
+  double frameMs = 10;
+  uint32_t frames = 0;
+  uint32_t lastRecord = 0;
+  bool recorded = false;
+  Frame last;
+
+  void append(const void *p, size_t n) {
+    bytes.insert(bytes.end(), (const uint8_t *)p, (const uint8_t *)p + n);
+  }
+  void text(const char *s) { append(s, strlen(s)); }
+  void varint(uint32_t v) {
+    do {
+      uint8_t b = v & 0x7F;
+      v >>= 7;
+      bytes.push_back(v ? (b | 0x80) : b);
+    } while (v);
+  }
+};
+
+// Decode either format back into frames. Returns false on a malformed
+// trace.
+inline bool readTrace(const std::vector<uint8_t> &in, std::vector<Frame> &out) {
+  out.clear();
+  TraceHeader h;
+  if (in.size() >= sizeof(h) && memcmp(in.data(), "TNRD", 4) == 0) {
+    memcpy(&h, in.data(), sizeof(h));
+    if (h.version != TRACE_VERSION)
+      return false;
+    size_t pos = sizeof(h);
+    Frame current(h.regions, 0);
+    auto varint = [&](uint32_t &v) {
+      v = 0;
+      for (uint8_t shift = 0; pos < in.size() && shift < 35; shift += 7) {
+        uint8_t b = in[pos++];
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+          return true;
+      }
+      return false;
+    };
+    bool first = true;
+    while (pos < in.size()) {
+      uint32_t skip, changed;
+      if (!varint(skip) || !varint(changed))
+        return false;
+      // Frames between records repeat the previous levels
+      for (uint32_t i = first ? 0 : 1; i < skip; i++)
+        out.push_back(current);
+      for (uint32_t c = 0; c < changed; c++) {
+        uint32_t region;
+        if (!varint(region) || region >= h.regions || pos >= in.size())
+          return false;
+        current[region] = in[pos++];
+      }
+      out.push_back(current);
+      first = false;
+    }
+    return true;
+  }
+
+  // CSV: skip the header line, then one frame per line, ms column dropped
+  size_t pos = 0;
+  while (pos < in.size() && in[pos] != '\n')
+    pos++;
+  pos++;
+  while (pos < in.size()) {
+    Frame f;
+    bool firstColumn = true;
+    uint32_t v = 0;
+    for (; pos < in.size(); pos++) {
+      char c = in[pos];
+      if (c >= '0' && c <= '9') {
+        v = v * 10 + (c - '0');
+      } else if (c == ',' || c == '\n') {
+        if (!firstColumn)
+          f.push_back(v);
+        firstColumn = false;
+        v = 0;
+        if (c == '\n') {
+          pos++;
+          break;
+        }
+      } else if (c != '\r') {
+        return false;
+      }
+    }
+    out.push_back(f);
+  }
+  return true;
+}
+
+#endif